@@ -19,6 +19,8 @@
 #define __ASM__ARCH_MSM_RPCROUTER_H
 
 #include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/stddef.h>
 #include <linux/list.h>
 #include <linux/platform_device.h>
 
@@ -192,6 +194,102 @@ int xdr_recv_int32(struct msm_rpc_xdr *xdr, int32_t *value);
 int xdr_recv_uint32(struct msm_rpc_xdr *xdr, uint32_t *value);
 int xdr_recv_bytes(struct msm_rpc_xdr *xdr, void **data, uint32_t *size);
 
+/* Table-driven marshalling.  A descriptor lists the members of an
+ * argument or result structure in the order they go on the wire, and is
+ * built at compile time with MSM_RPC_XDR_DESC() from the structure
+ * layout, e.g.
+ *
+ *	struct foo_args { uint32_t id; int8_t level; };
+ *	MSM_RPC_XDR_DESC(foo_args_desc,
+ *		MSM_RPC_XDR_UINT_FIELD(struct foo_args, id),
+ *		MSM_RPC_XDR_INT_FIELD(struct foo_args, level));
+ *
+ * Integers of 8, 16 or 32 bits each take one XDR word, signed ones
+ * sign extended.  OPAQUE is a fixed size array, padded to a word.
+ * BYTES is a pointer member and a uint32_t length member sent as
+ * counted bytes; on receive the length is the room at the pointer on
+ * entry and the size received on return.
+ */
+enum {
+	MSM_RPC_XDR_UINT,
+	MSM_RPC_XDR_INT,
+	MSM_RPC_XDR_OPAQUE,
+	MSM_RPC_XDR_BYTES,
+};
+
+struct msm_rpc_xdr_field {
+	uint16_t type;
+	uint16_t offset;
+	uint16_t size;	/* BYTES: offset of the length member */
+};
+
+struct msm_rpc_xdr_desc {
+	const struct msm_rpc_xdr_field *fields;
+	unsigned nr_fields;
+};
+
+#define MSM_RPC_XDR_SIZEOF(type, member) sizeof(((type *)0)->member)
+
+#define MSM_RPC_XDR_UINT_FIELD(type, member) \
+	{ MSM_RPC_XDR_UINT, offsetof(type, member), \
+	  MSM_RPC_XDR_SIZEOF(type, member) + \
+	  BUILD_BUG_ON_ZERO(MSM_RPC_XDR_SIZEOF(type, member) > 4) }
+
+#define MSM_RPC_XDR_INT_FIELD(type, member) \
+	{ MSM_RPC_XDR_INT, offsetof(type, member), \
+	  MSM_RPC_XDR_SIZEOF(type, member) + \
+	  BUILD_BUG_ON_ZERO(MSM_RPC_XDR_SIZEOF(type, member) > 4) }
+
+#define MSM_RPC_XDR_OPAQUE_FIELD(type, member) \
+	{ MSM_RPC_XDR_OPAQUE, offsetof(type, member), \
+	  MSM_RPC_XDR_SIZEOF(type, member) }
+
+#define MSM_RPC_XDR_BYTES_FIELD(type, member, len_member) \
+	{ MSM_RPC_XDR_BYTES, offsetof(type, member), \
+	  offsetof(type, len_member) + \
+	  BUILD_BUG_ON_ZERO(MSM_RPC_XDR_SIZEOF(type, len_member) != 4) }
+
+#define MSM_RPC_XDR_DESC(name, ...) \
+	static const struct msm_rpc_xdr_field name##_fields[] = { \
+		__VA_ARGS__ \
+	}; \
+	static const struct msm_rpc_xdr_desc name = { \
+		.fields = name##_fields, \
+		.nr_fields = ARRAY_SIZE(name##_fields), \
+	}
+
+int xdr_send_desc(struct msm_rpc_xdr *xdr,
+		  const struct msm_rpc_xdr_desc *desc, const void *data);
+int xdr_recv_desc(struct msm_rpc_xdr *xdr,
+		  const struct msm_rpc_xdr_desc *desc, void *data);
+
+/* One call of msm_rpc_call_batch().  Either descriptor may be NULL for
+ * a call without arguments or results; rc is the call's own result.
+ */
+struct msm_rpc_call {
+	uint32_t proc;
+	const struct msm_rpc_xdr_desc *args_desc;
+	const void *args;
+	const struct msm_rpc_xdr_desc *ret_desc;
+	void *ret;
+	int rc;
+};
+
+#define MSM_RPC_MAX_BATCH 8
+
+/* Marshal with descriptors into the endpoint's own send buffer and
+ * wait for the reply.  msm_rpc_call_batch() sends all of its calls
+ * before waiting for any reply, returns 0 once each call has its rc,
+ * or an error if none could be attempted.
+ */
+int msm_rpc_call_desc(struct msm_rpc_endpoint *ept, uint32_t proc,
+		      const struct msm_rpc_xdr_desc *args_desc,
+		      const void *args,
+		      const struct msm_rpc_xdr_desc *ret_desc, void *ret,
+		      long timeout);
+int msm_rpc_call_batch(struct msm_rpc_endpoint *ept,
+		       struct msm_rpc_call *calls, int n, long timeout);
+
 struct msm_rpc_server
 {
 	struct list_head list;
@@ -19,6 +19,7 @@
 #define __ASM_ARCH_MSM_SMD_H
 
 typedef struct smd_channel smd_channel_t;
+struct kvec;
 
 /* warning: notify() may be called before open returns */
 int smd_open(const char *name, smd_channel_t **ch, void *priv,
@@ -44,6 +45,32 @@ int smd_write(smd_channel_t *ch, const void *data, int len);
 int smd_write_avail(smd_channel_t *ch);
 int smd_read_avail(smd_channel_t *ch);
 
+/* Gathers the segments into one write. On a packet channel they form a
+** single packet, which is written as a whole or not at all.
+*/
+int smd_writev(smd_channel_t *ch, const struct kvec *iov, int count);
+
+/* Zero-copy access to the FIFO.
+** smd_write_reserve() returns the length of the contiguous free space at
+** *data, 0 if there is none. Fill as much of it as wanted and pass the
+** length to smd_write_commit(). On a packet channel that is one packet.
+** smd_read_buffer() returns the length of the contiguous data at *data,
+** limited to the current packet on a packet channel, and
+** smd_read_done() consumes it. Use smd_read_done_from_cb() from the
+** notify callback.
+*/
+int smd_write_reserve(smd_channel_t *ch, void **data);
+int smd_write_commit(smd_channel_t *ch, int len);
+int smd_read_buffer(smd_channel_t *ch, void **data);
+int smd_read_done(smd_channel_t *ch, int len);
+int smd_read_done_from_cb(smd_channel_t *ch, int len);
+
+/* Reads and writes between these raise a single interrupt on the other
+** side, when the outermost batch ends.
+*/
+void smd_notify_batch_begin(smd_channel_t *ch);
+void smd_notify_batch_end(smd_channel_t *ch);
+
 /* Returns the total size of the current packet being read.
 ** Returns 0 if no packets available or a stream channel.
 */
@@ -16,6 +16,9 @@
 #ifndef _ARCH_ARM_MACH_MSM_MSM_PROC_COMM_H_
 #define _ARCH_ARM_MACH_MSM_MSM_PROC_COMM_H_
 
+#include <linux/list.h>
+#include <linux/completion.h>
+
 enum {
 	PCOM_CMD_IDLE = 0x0,
 	PCOM_CMD_DONE,
@@ -138,6 +141,7 @@ enum {
 	PCOM_CLKCTL_RPC_SRC_REQUEST,
 	PCOM_NPA_INIT,
 	PCOM_NPA_ISSUE_REQUIRED_REQUEST,
+	PCOM_NUM_CMDS,
 };
 
 enum {
@@ -171,4 +175,29 @@ enum {
 void msm_proc_comm_reset_modem_now(void);
 int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2);
 
+/* One command of a batch; data1 and data2 are replaced by the results */
+struct msm_proc_comm_req {
+	unsigned cmd;
+	unsigned data1;
+	unsigned data2;
+	int status;
+};
+
+struct msm_proc_comm_batch {
+	struct msm_proc_comm_req *reqs;
+	int nr;
+	/* called from the proc_comm thread, instead of waking the waiter */
+	void (*done)(struct msm_proc_comm_batch *batch);
+	void *priv;
+
+	/* private to proc_comm.c */
+	struct list_head list;
+	struct completion complete;
+	int status;
+};
+
+int msm_proc_comm_batch(struct msm_proc_comm_req *reqs, int nr);
+int msm_proc_comm_submit(struct msm_proc_comm_batch *batch);
+int msm_proc_comm_wait(struct msm_proc_comm_batch *batch);
+
 #endif
@@ -29,6 +29,7 @@
 
 #include <linux/mtd/nand.h>
 #include <linux/mtd/partitions.h>
+#include <linux/mtd/ubi.h>
 
 #include <mach/msm_iomap.h>
 
@@ -54,6 +55,31 @@ static char msm_nand_names[MSM_MAX_PARTITIONS * 16];
 
 extern struct flash_platform_data msm_nand_data;
 
+#ifdef CONFIG_MSM_NAND_UBI_PARTITIONS
+/* Hand the partitions named in CONFIG_MSM_NAND_UBI_PARTITIONS to UBI */
+static void __init msm_nand_attach_ubi(void)
+{
+	char list[] = CONFIG_MSM_NAND_UBI_PARTITIONS;
+	char *p = list, *want;
+	int n;
+
+	while ((want = strsep(&p, ",")) != NULL) {
+		if (!*want)
+			continue;
+		for (n = 0; n < msm_nand_data.nr_parts; n++) {
+			if (strcmp(msm_nand_partitions[n].name, want))
+				continue;
+			if (ubi_attach_at_boot(want, 0))
+				printk(KERN_WARNING "%s: can't attach %s to "
+				       "UBI\n", __func__, want);
+			break;
+		}
+	}
+}
+#else
+static inline void msm_nand_attach_ubi(void) { }
+#endif
+
 static int __init parse_tag_msm_partition(const struct tag *tag)
 {
 	struct mtd_partition *ptn = msm_nand_partitions;
@@ -86,6 +112,7 @@ static int __init parse_tag_msm_partition(const struct tag *tag)
 
 	msm_nand_data.nr_parts = count;
 	msm_nand_data.parts = msm_nand_partitions;
+	msm_nand_attach_ubi();
 
 	return 0;
 }
@@ -115,7 +142,7 @@ struct flash_partition_table {
 	struct flash_partition_entry part_entry[16];
 };
 
-static int get_nand_partitions(void)
+static int __init get_nand_partitions(void)
 {
 	struct flash_partition_table *partition_table;
 	struct flash_partition_entry *part_entry;
@@ -171,6 +198,7 @@ static int get_nand_partitions(void)
 
 			msm_nand_data.nr_parts = 1;
 			msm_nand_data.parts = msm_nand_partitions;
+			msm_nand_attach_ubi();
 
 			printk(KERN_INFO "Partition(from smem) %s "
 					"-- Offset:%llx Size:%llx\n",
@@ -20,6 +20,11 @@
 #include <linux/io.h>
 #include <linux/spinlock.h>
 #include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <mach/msm_iomap.h>
 #include <mach/system.h>
 
@@ -51,6 +56,87 @@ static inline void notify_other_proc_comm(void)
 
 static DEFINE_SPINLOCK(proc_comm_lock);
 
+#if defined(CONFIG_DEBUG_FS)
+/* Counts and latencies of each command, shown in proc_comm_stats.  A
+ * latency runs from taking the interface to the modem marking the command
+ * done, by power of two microseconds; the last bucket is open.
+ */
+#define PCOM_STATS_LAT_BUCKETS	16
+
+struct pcom_cmd_stats {
+	unsigned long calls;
+	unsigned long fails;
+	unsigned long restarts;
+	u64 total_us;
+	u64 max_us;
+	unsigned long lat[PCOM_STATS_LAT_BUCKETS];
+};
+
+/* one entry per command; the OEM commands share the last one */
+static struct pcom_cmd_stats pcom_stats[PCOM_NUM_CMDS + 1];
+static unsigned long pcom_batches;
+static unsigned long pcom_batch_cmds;
+
+/*
+ * Called with proc_comm_lock held.  Commands are timed with sched_clock(),
+ * since the acpuclock power collapse path issues them after timekeeping
+ * has been suspended.
+ */
+static void proc_comm_account(unsigned cmd, int ret, int restarts,
+			      unsigned long long start)
+{
+	struct pcom_cmd_stats *st;
+	unsigned long long now = sched_clock();
+	u64 us;
+	int b;
+
+	us = now > start ? now - start : 0;
+	do_div(us, NSEC_PER_USEC);
+	b = us > 0 ? fls64(us) : 0;
+	if (b >= PCOM_STATS_LAT_BUCKETS)
+		b = PCOM_STATS_LAT_BUCKETS - 1;
+
+	st = &pcom_stats[cmd < PCOM_NUM_CMDS ? cmd : PCOM_NUM_CMDS];
+	st->calls++;
+	if (ret)
+		st->fails++;
+	st->restarts += restarts;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = us;
+	st->lat[b]++;
+}
+
+static void proc_comm_account_batch(int nr)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&proc_comm_lock, flags);
+	pcom_batches++;
+	pcom_batch_cmds += nr;
+	spin_unlock_irqrestore(&proc_comm_lock, flags);
+}
+
+static inline unsigned long long proc_comm_start(void)
+{
+	return sched_clock();
+}
+#else
+static inline void proc_comm_account(unsigned cmd, int ret, int restarts,
+				     unsigned long long start)
+{
+}
+
+static inline void proc_comm_account_batch(int nr)
+{
+}
+
+static inline unsigned long long proc_comm_start(void)
+{
+	return 0;
+}
+#endif
+
 /* Poll for a state change, checking for possible
  * modem crashes along the way (so we don't wait
  * forever while the ARM9 is blowing up.
@@ -95,15 +181,16 @@ again:
 }
 EXPORT_SYMBOL(msm_proc_comm_reset_modem_now);
 
-int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+/* Run one command; called with proc_comm_lock held */
+static int __msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
 {
 	unsigned base = (unsigned)MSM_SHARED_RAM_BASE;
-	unsigned long flags;
+	unsigned long long start = proc_comm_start();
+	int restarts = -1;
 	int ret;
 
-	spin_lock_irqsave(&proc_comm_lock, flags);
-
 again:
+	restarts++;
 	if (proc_comm_wait_for(base + MDM_STATUS, PCOM_READY))
 		goto again;
 
@@ -128,7 +215,221 @@ again:
 
 	writel(PCOM_CMD_IDLE, base + APP_COMMAND);
 
+	proc_comm_account(cmd, ret, restarts, start);
+	return ret;
+}
+
+int msm_proc_comm(unsigned cmd, unsigned *data1, unsigned *data2)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&proc_comm_lock, flags);
+	ret = __msm_proc_comm(cmd, data1, data2);
 	spin_unlock_irqrestore(&proc_comm_lock, flags);
 	return ret;
 }
 EXPORT_SYMBOL(msm_proc_comm);
+
+/* The interface is taken for one command at a time, so that a long batch
+ * keeps interrupts off no longer than a single msm_proc_comm() would, and
+ * other callers can get in between its commands.
+ */
+static int proc_comm_run(struct msm_proc_comm_req *reqs, int nr,
+			 int can_sleep)
+{
+	unsigned long flags;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (ret) {
+			reqs[i].status = -ECANCELED;
+			continue;
+		}
+		spin_lock_irqsave(&proc_comm_lock, flags);
+		reqs[i].status = __msm_proc_comm(reqs[i].cmd, &reqs[i].data1,
+						 &reqs[i].data2);
+		spin_unlock_irqrestore(&proc_comm_lock, flags);
+		ret = reqs[i].status;
+		if (can_sleep)
+			cond_resched();
+	}
+	proc_comm_account_batch(nr);
+	return ret;
+}
+
+/* Run a batch in the caller's context, which may be atomic.  The commands
+ * are issued in order and the first failure cancels the rest; each
+ * request gets its own status and results, and the first error is
+ * returned.
+ */
+int msm_proc_comm_batch(struct msm_proc_comm_req *reqs, int nr)
+{
+	return proc_comm_run(reqs, nr, 0);
+}
+EXPORT_SYMBOL(msm_proc_comm_batch);
+
+static struct workqueue_struct *proc_comm_wq;
+static LIST_HEAD(proc_comm_queue);
+static DEFINE_SPINLOCK(proc_comm_queue_lock);
+
+static void proc_comm_complete(struct msm_proc_comm_batch *batch)
+{
+	batch->status = proc_comm_run(batch->reqs, batch->nr, 1);
+	/* the callback may free the batch, so it can't be waited on too */
+	if (batch->done)
+		batch->done(batch);
+	else
+		complete(&batch->complete);
+}
+
+static void proc_comm_work(struct work_struct *work)
+{
+	struct msm_proc_comm_batch *batch;
+	unsigned long flags;
+
+	spin_lock_irqsave(&proc_comm_queue_lock, flags);
+	while (!list_empty(&proc_comm_queue)) {
+		batch = list_first_entry(&proc_comm_queue,
+					 struct msm_proc_comm_batch, list);
+		list_del(&batch->list);
+		spin_unlock_irqrestore(&proc_comm_queue_lock, flags);
+
+		proc_comm_complete(batch);
+
+		spin_lock_irqsave(&proc_comm_queue_lock, flags);
+	}
+	spin_unlock_irqrestore(&proc_comm_queue_lock, flags);
+}
+
+static DECLARE_WORK(proc_comm_queue_work, proc_comm_work);
+
+/* Queue a batch to be run by the proc_comm thread and return at once, so
+ * that, say, a resume handler can go on with its own work while the
+ * modem switches on its regulators and clocks.  When the batch has run,
+ * batch->done is called from the thread if it is set; otherwise the
+ * submitter collects the result with msm_proc_comm_wait().  Batches are
+ * run in the order they are submitted.  Before the thread is up, the
+ * batch is run here instead, so the caller must be able to sleep.
+ */
+int msm_proc_comm_submit(struct msm_proc_comm_batch *batch)
+{
+	unsigned long flags;
+
+	if (!batch->reqs || batch->nr <= 0)
+		return -EINVAL;
+
+	init_completion(&batch->complete);
+	batch->status = -EINPROGRESS;
+
+	if (!proc_comm_wq) {
+		proc_comm_complete(batch);
+		return 0;
+	}
+
+	spin_lock_irqsave(&proc_comm_queue_lock, flags);
+	list_add_tail(&batch->list, &proc_comm_queue);
+	spin_unlock_irqrestore(&proc_comm_queue_lock, flags);
+	queue_work(proc_comm_wq, &proc_comm_queue_work);
+	return 0;
+}
+EXPORT_SYMBOL(msm_proc_comm_submit);
+
+int msm_proc_comm_wait(struct msm_proc_comm_batch *batch)
+{
+	wait_for_completion(&batch->complete);
+	return batch->status;
+}
+EXPORT_SYMBOL(msm_proc_comm_wait);
+
+static int __init proc_comm_queue_init(void)
+{
+	proc_comm_wq = create_singlethread_workqueue("proc_comm");
+	return proc_comm_wq ? 0 : -ENOMEM;
+}
+core_initcall(proc_comm_queue_init);
+
+#if defined(CONFIG_DEBUG_FS)
+static int proc_comm_stats_show(struct seq_file *m, void *unused)
+{
+	struct pcom_cmd_stats *st, *copy;
+	unsigned long batches, batch_cmds;
+	unsigned long flags;
+	int i, b;
+
+	/* don't hold the interface, and interrupts, off while printing */
+	copy = kmalloc(sizeof(pcom_stats), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	spin_lock_irqsave(&proc_comm_lock, flags);
+	memcpy(copy, pcom_stats, sizeof(pcom_stats));
+	batches = pcom_batches;
+	batch_cmds = pcom_batch_cmds;
+	spin_unlock_irqrestore(&proc_comm_lock, flags);
+
+	seq_printf(m, "%-6s %8s %8s %8s %12s %10s\n", "cmd", "calls",
+		   "fails", "restarts", "total_us", "max_us");
+	for (i = 0; i <= PCOM_NUM_CMDS; i++) {
+		st = &copy[i];
+		if (!st->calls)
+			continue;
+		if (i < PCOM_NUM_CMDS)
+			seq_printf(m, "0x%04x", i);
+		else
+			seq_printf(m, "%-6s", "oem");
+		seq_printf(m, " %8lu %8lu %8lu %12llu %10llu\n", st->calls,
+			   st->fails, st->restarts, st->total_us, st->max_us);
+		seq_printf(m, "    us:");
+		for (b = 0; b < PCOM_STATS_LAT_BUCKETS; b++)
+			if (st->lat[b])
+				seq_printf(m, " %s%llu:%lu",
+					   b == PCOM_STATS_LAT_BUCKETS - 1 ?
+					   ">=" : "<",
+					   b == PCOM_STATS_LAT_BUCKETS - 1 ?
+					   1ULL << (b - 1) : 1ULL << b,
+					   st->lat[b]);
+		seq_printf(m, "\n");
+	}
+	seq_printf(m, "%lu batches, %lu commands\n", batches, batch_cmds);
+
+	kfree(copy);
+	return 0;
+}
+
+static int proc_comm_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, proc_comm_stats_show, NULL);
+}
+
+/* Any write clears the counters, e.g. just before a suspend */
+static ssize_t proc_comm_stats_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&proc_comm_lock, flags);
+	memset(pcom_stats, 0, sizeof(pcom_stats));
+	pcom_batches = 0;
+	pcom_batch_cmds = 0;
+	spin_unlock_irqrestore(&proc_comm_lock, flags);
+	return count;
+}
+
+static const struct file_operations proc_comm_stats_ops = {
+	.open = proc_comm_stats_open,
+	.read = seq_read,
+	.write = proc_comm_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init proc_comm_debugfs_init(void)
+{
+	debugfs_create_file("proc_comm_stats", 0644, NULL, NULL,
+			    &proc_comm_stats_ops);
+	return 0;
+}
+late_initcall(proc_comm_debugfs_init);
+#endif
@@ -18,16 +18,60 @@
 
 /*
  * PROC COMM TEST Driver source file
+ *
+ * Writing "reverse_test" to /sys/kernel/debug/proc_comm checks that the
+ * modem swaps the two data words of PCOM_OEM_TEST_CMD.  Writing "bench"
+ * times bench_cmds test commands issued each way: one msm_proc_comm()
+ * call at a time, msm_proc_comm_batch() of bench_batch commands, and
+ * batches queued with msm_proc_comm_submit(), two in flight.  Reading the
+ * file gives the result of the last test and the last benchmark.
  */
 
 #include <linux/types.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
 #include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
 #include "proc_comm.h"
 
+static int bench_cmds = 1024;
+module_param(bench_cmds, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bench_cmds, "commands each way of issuing runs");
+
+static int bench_batch = 8;
+module_param(bench_batch, int, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bench_batch, "commands per batch");
+
+/* Latencies by power of two microseconds; the last bucket is open */
+#define BENCH_LAT_BUCKETS	16
+#define BENCH_MAX_BATCH		64
+
+enum {
+	BENCH_SINGLE,
+	BENCH_BATCH,
+	BENCH_ASYNC,
+	BENCH_NR_MODES,
+};
+
+static const char * const bench_modes[] = {
+	"single", "batch", "async",
+};
+
+struct proc_comm_bench {
+	unsigned long lat[BENCH_LAT_BUCKETS];
+	unsigned long rounds;
+	unsigned long cmds;
+	s64 max_us;
+	/* time the caller spent issuing, as opposed to waiting */
+	s64 blocked_us;
+};
+
 static struct dentry *dent;
 static int proc_comm_test_res;
+static char bench_result[512];
+static int bench_result_len;
 
 static int proc_comm_reverse_test(void)
 {
@@ -47,14 +91,231 @@ static int proc_comm_reverse_test(void)
 	return 0;
 }
 
+static void bench_fill(struct msm_proc_comm_req *reqs, int nr, unsigned seq)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		reqs[i].cmd = PCOM_OEM_TEST_CMD;
+		reqs[i].data1 = seq + i;
+		reqs[i].data2 = ~(seq + i);
+	}
+}
+
+static int bench_check(struct msm_proc_comm_req *reqs, int nr, unsigned seq)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (reqs[i].status)
+			return reqs[i].status;
+		if (reqs[i].data1 != ~(seq + i) || reqs[i].data2 != seq + i)
+			return -1;
+	}
+	return 0;
+}
+
+static void bench_account(struct proc_comm_bench *b, int nr, s64 us)
+{
+	int n;
+
+	n = us > 0 ? fls64(us) : 0;
+	if (n >= BENCH_LAT_BUCKETS)
+		n = BENCH_LAT_BUCKETS - 1;
+	b->lat[n]++;
+	if (us > b->max_us)
+		b->max_us = us;
+	b->rounds++;
+	b->cmds += nr;
+}
+
+/* Upper bound in microseconds of permille/1000 of the rounds */
+static s64 bench_percentile(struct proc_comm_bench *b, int permille)
+{
+	unsigned long want = b->rounds - div64_u64((u64)b->rounds *
+						   (1000 - permille), 1000);
+	unsigned long seen = 0;
+	int n;
+
+	for (n = 0; n < BENCH_LAT_BUCKETS - 1; n++) {
+		seen += b->lat[n];
+		if (seen >= want)
+			break;
+	}
+	return 1LL << n;
+}
+
+static int bench_single(struct proc_comm_bench *b)
+{
+	unsigned data1, data2, seq;
+	ktime_t start;
+	s64 us;
+	int rc;
+
+	for (seq = 0; seq < bench_cmds; seq++) {
+		data1 = seq;
+		data2 = ~seq;
+		start = ktime_get();
+		rc = msm_proc_comm(PCOM_OEM_TEST_CMD, &data1, &data2);
+		us = ktime_us_delta(ktime_get(), start);
+		if (rc)
+			return rc;
+		if (data1 != ~seq || data2 != seq)
+			return -1;
+		bench_account(b, 1, us);
+		b->blocked_us += us;
+		cond_resched();
+	}
+	return 0;
+}
+
+static int bench_batched(struct proc_comm_bench *b,
+			 struct msm_proc_comm_req *reqs)
+{
+	unsigned seq;
+	ktime_t start;
+	s64 us;
+	int rc, nr;
+
+	for (seq = 0; seq < bench_cmds; seq += nr) {
+		nr = min_t(int, bench_batch, bench_cmds - seq);
+		bench_fill(reqs, nr, seq);
+		start = ktime_get();
+		rc = msm_proc_comm_batch(reqs, nr);
+		us = ktime_us_delta(ktime_get(), start);
+		if (rc)
+			return rc;
+		rc = bench_check(reqs, nr, seq);
+		if (rc)
+			return rc;
+		bench_account(b, nr, us);
+		b->blocked_us += us;
+		cond_resched();
+	}
+	return 0;
+}
+
+/* Keeps two batches queued, so one is being filled and checked while
+ * the other runs; the latency is from submitting to the result being
+ * collected.
+ */
+static int bench_async(struct proc_comm_bench *b,
+		       struct msm_proc_comm_req *reqs)
+{
+	struct msm_proc_comm_batch batch[2];
+	unsigned seq[2];
+	ktime_t start[2];
+	unsigned next = 0;
+	int rc = 0, ret = 0;
+	int i, cur;
+
+	for (i = 0; i < 2; i++) {
+		batch[i].reqs = reqs + i * BENCH_MAX_BATCH;
+		batch[i].nr = 0;
+		batch[i].done = NULL;
+	}
+
+	for (i = 0; ; i++) {
+		cur = i & 1;
+		if (batch[cur].nr) {
+			rc = msm_proc_comm_wait(&batch[cur]);
+			if (!rc)
+				rc = bench_check(batch[cur].reqs, batch[cur].nr,
+						 seq[cur]);
+			if (rc && !ret)
+				ret = rc;
+			bench_account(b, batch[cur].nr,
+				      ktime_us_delta(ktime_get(), start[cur]));
+			batch[cur].nr = 0;
+		}
+		if (ret || next >= bench_cmds) {
+			/* collect the other one before returning */
+			if (!batch[cur ^ 1].nr)
+				break;
+			continue;
+		}
+
+		batch[cur].nr = min_t(int, bench_batch, bench_cmds - next);
+		seq[cur] = next;
+		next += batch[cur].nr;
+		bench_fill(batch[cur].reqs, batch[cur].nr, seq[cur]);
+		start[cur] = ktime_get();
+		rc = msm_proc_comm_submit(&batch[cur]);
+		b->blocked_us += ktime_us_delta(ktime_get(), start[cur]);
+		if (rc) {
+			batch[cur].nr = 0;
+			ret = rc;
+		}
+	}
+	return ret;
+}
+
+static int proc_comm_bench(void)
+{
+	struct msm_proc_comm_req *reqs;
+	struct proc_comm_bench *b;
+	s64 elapsed_us;
+	ktime_t start;
+	int mode, rc = 0;
+	int len = 0;
+
+	if (bench_cmds <= 0 || bench_batch <= 0 ||
+	    bench_batch > BENCH_MAX_BATCH)
+		return -EINVAL;
+
+	reqs = kmalloc(2 * BENCH_MAX_BATCH * sizeof(*reqs), GFP_KERNEL);
+	b = kmalloc(sizeof(*b), GFP_KERNEL);
+	if (!reqs || !b) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (mode = 0; mode < BENCH_NR_MODES && !rc; mode++) {
+		memset(b, 0, sizeof(*b));
+		start = ktime_get();
+		if (mode == BENCH_SINGLE)
+			rc = bench_single(b);
+		else if (mode == BENCH_BATCH)
+			rc = bench_batched(b, reqs);
+		else
+			rc = bench_async(b, reqs);
+		elapsed_us = ktime_us_delta(ktime_get(), start);
+		if (elapsed_us <= 0)
+			elapsed_us = 1;
+		if (!b->cmds)
+			continue;
+
+		len += scnprintf(bench_result + len, sizeof(bench_result) - len,
+				 "%s: %lu cmds, %llu cmds/s, blocked %llu "
+				 "ns/cmd, %lu rounds p50 < %lld us p99 < %lld "
+				 "us max %lld us\n", bench_modes[mode], b->cmds,
+				 div64_u64((u64)b->cmds * USEC_PER_SEC,
+					   elapsed_us),
+				 div64_u64((u64)b->blocked_us * NSEC_PER_USEC,
+					   b->cmds),
+				 b->rounds, bench_percentile(b, 500),
+				 bench_percentile(b, 990), b->max_us);
+	}
+	bench_result_len = len;
+	if (len)
+		pr_info("proc comm bench:\n%s", bench_result);
+out:
+	kfree(b);
+	kfree(reqs);
+	return rc;
+}
+
 static ssize_t debug_read(struct file *fp, char __user *buf,
 			  size_t count, loff_t *pos)
 {
-	char _buf[16];
+	char _buf[16 + sizeof(bench_result)];
+	int len;
 
-	snprintf(_buf, sizeof(_buf), "%i\n", proc_comm_test_res);
+	len = snprintf(_buf, 16, "%i\n", proc_comm_test_res);
+	memcpy(_buf + len, bench_result, bench_result_len);
+	len += bench_result_len;
 
-	return simple_read_from_buffer(buf, count, pos, _buf, strlen(_buf));
+	return simple_read_from_buffer(buf, count, pos, _buf, len);
 }
 
 static ssize_t debug_write(struct file *fp, const char __user *buf,
@@ -81,6 +342,8 @@ static ssize_t debug_write(struct file *fp, const char __user *buf,
 
 	if (!strncmp(cmd, "reverse_test", 64))
 		proc_comm_test_res = proc_comm_reverse_test();
+	else if (!strncmp(cmd, "bench", 64))
+		proc_comm_test_res = proc_comm_bench();
 	else
 		proc_comm_test_res = -EINVAL;
 
@@ -53,6 +53,14 @@ struct msm_hsusb_rpc_ids {
 static struct msm_hsusb_rpc_ids usb_rpc_ids;
 static struct msm_chg_rpc_ids chg_rpc_ids;
 
+/* argument or result of the calls that take or return one word */
+struct hsusb_rpc_word {
+	uint32_t value;
+};
+
+MSM_RPC_XDR_DESC(hsusb_rpc_word_desc,
+	MSM_RPC_XDR_UINT_FIELD(struct hsusb_rpc_word, value));
+
 static int msm_hsusb_init_rpc_ids(unsigned long vers)
 {
 	if (vers == 0x00010001) {
@@ -273,10 +281,7 @@ EXPORT_SYMBOL(msm_hsusb_vbus_shutdown);
 int msm_hsusb_send_productID(uint32_t product_id)
 {
 	int rc = 0;
-	struct hsusb_phy_start_req {
-		struct rpc_request_hdr hdr;
-		uint32_t product_id;
-	} req;
+	struct hsusb_rpc_word arg = { .value = product_id };
 
 	if (!usb_ep || IS_ERR(usb_ep)) {
 		pr_err("%s: rpc connect failed: rc = %ld\n",
@@ -284,10 +289,8 @@ int msm_hsusb_send_productID(uint32_t product_id)
 		return -EAGAIN;
 	}
 
-	req.product_id = cpu_to_be32(product_id);
-	rc = msm_rpc_call(usb_ep, usb_rpc_ids.update_product_id,
-				&req, sizeof(req),
-				5 * HZ);
+	rc = msm_rpc_call_desc(usb_ep, usb_rpc_ids.update_product_id,
+			       &hsusb_rpc_word_desc, &arg, NULL, NULL, 5 * HZ);
 	if (rc < 0)
 		pr_err("%s: rpc call failed! error: %d\n",
 			__func__, rc);
@@ -332,10 +335,7 @@ EXPORT_SYMBOL(msm_hsusb_send_serial_number);
 int msm_hsusb_is_serial_num_null(uint32_t val)
 {
 	int rc = 0;
-	struct hsusb_phy_start_req {
-			struct rpc_request_hdr hdr;
-			uint32_t value;
-	} req;
+	struct hsusb_rpc_word arg = { .value = val };
 
 	if (!usb_ep || IS_ERR(usb_ep)) {
 		pr_err("%s: rpc connect failed: rc = %ld\n",
@@ -347,10 +347,8 @@ int msm_hsusb_is_serial_num_null(uint32_t val)
 		return -ENODATA;
 	}
 
-	req.value = cpu_to_be32(val);
-	rc = msm_rpc_call(usb_ep, usb_rpc_ids.update_is_serial_num_null,
-				&req, sizeof(req),
-				5 * HZ);
+	rc = msm_rpc_call_desc(usb_ep, usb_rpc_ids.update_is_serial_num_null,
+			       &hsusb_rpc_word_desc, &arg, NULL, NULL, 5 * HZ);
 	if (rc < 0)
 		pr_err("%s: rpc call failed! error: %d\n" ,
 			__func__, rc);
@@ -364,16 +362,13 @@ EXPORT_SYMBOL(msm_hsusb_is_serial_num_null);
 int msm_chg_usb_charger_connected(uint32_t device)
 {
 	int rc = 0;
-	struct hsusb_start_req {
-		struct rpc_request_hdr hdr;
-		uint32_t otg_dev;
-	} req;
+	struct hsusb_rpc_word arg = { .value = device };
 
 	if (!chg_ep || IS_ERR(chg_ep))
 		return -EAGAIN;
-	req.otg_dev = cpu_to_be32(device);
-	rc = msm_rpc_call(chg_ep, chg_rpc_ids.chg_usb_charger_connected_proc,
-			&req, sizeof(req), 5 * HZ);
+	rc = msm_rpc_call_desc(chg_ep,
+			       chg_rpc_ids.chg_usb_charger_connected_proc,
+			       &hsusb_rpc_word_desc, &arg, NULL, NULL, 5 * HZ);
 
 	if (rc < 0) {
 		pr_err("%s: charger_connected failed! rc = %d\n",
@@ -388,16 +383,12 @@ EXPORT_SYMBOL(msm_chg_usb_charger_connected);
 int msm_chg_usb_i_is_available(uint32_t sample)
 {
 	int rc = 0;
-	struct hsusb_start_req {
-		struct rpc_request_hdr hdr;
-		uint32_t i_ma;
-	} req;
+	struct hsusb_rpc_word arg = { .value = sample };
 
 	if (!chg_ep || IS_ERR(chg_ep))
 		return -EAGAIN;
-	req.i_ma = cpu_to_be32(sample);
-	rc = msm_rpc_call(chg_ep, chg_rpc_ids.chg_usb_i_is_available_proc,
-			&req, sizeof(req), 5 * HZ);
+	rc = msm_rpc_call_desc(chg_ep, chg_rpc_ids.chg_usb_i_is_available_proc,
+			       &hsusb_rpc_word_desc, &arg, NULL, NULL, 5 * HZ);
 
 	if (rc < 0) {
 		pr_err("%s: charger_i_available failed! rc = %d\n",
@@ -506,15 +497,7 @@ EXPORT_SYMBOL(msm_chg_rpc_close);
 int msm_hsusb_reset_rework_installed(void)
 {
 	int rc = 0;
-	struct hsusb_start_req {
-		struct rpc_request_hdr hdr;
-	} req;
-	struct hsusb_rpc_rep {
-		struct rpc_reply_hdr hdr;
-		uint32_t rework;
-	} rep;
-
-	memset(&rep, 0, sizeof(rep));
+	struct hsusb_rpc_word rep = { .value = 0 };
 
 	if (!usb_ep || IS_ERR(usb_ep)) {
 		pr_err("%s: hsusb rpc connection not initialized, rc = %ld\n",
@@ -522,9 +505,8 @@ int msm_hsusb_reset_rework_installed(void)
 		return -EAGAIN;
 	}
 
-	rc = msm_rpc_call_reply(usb_ep, usb_rpc_ids.reset_rework_installed,
-				&req, sizeof(req),
-				&rep, sizeof(rep), 5 * HZ);
+	rc = msm_rpc_call_desc(usb_ep, usb_rpc_ids.reset_rework_installed,
+			       NULL, NULL, &hsusb_rpc_word_desc, &rep, 5 * HZ);
 
 	if (rc < 0) {
 		pr_err("%s: rpc call failed! error: (%d)"
@@ -534,8 +516,8 @@ int msm_hsusb_reset_rework_installed(void)
 		return rc;
 	}
 
-	pr_info("%s: rework: (%d)\n", __func__, rep.rework);
-	return be32_to_cpu(rep.rework);
+	pr_info("%s: rework: (%d)\n", __func__, rep.value);
+	return rep.value;
 }
 EXPORT_SYMBOL(msm_hsusb_reset_rework_installed);
 
@@ -0,0 +1,469 @@
+/* arch/arm/mach-msm/rpcrouter_loopback_bench.c
+ *
+ * Round trip latency benchmark for the RPC router receive path, run over
+ * the local loopback transport.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * One endpoint registers two echo programs and serves them from a single
+ * thread, the way krpcserversd serves every apps server. A client calls
+ * the first program with small messages and then with messages big enough
+ * to be fragmented, checking each reply, while load threads keep the
+ * server busy with big calls to the second program. Adding the first
+ * program to smd_rpcrouter.priority_progs shows what queueing its calls
+ * ahead of the others does to their latency.
+ *
+ * Before the load starts, descriptor marshalled calls are made one at a
+ * time with msm_rpc_call_desc() and then batch at a time with
+ * msm_rpc_call_batch(), decoding each echoed reply and comparing it with
+ * the arguments. The descriptor encoder is also checked against the same
+ * arguments encoded by hand.
+ */
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/jiffies.h>
+#include <mach/msm_rpcrouter.h>
+
+#define RR_BENCH_PROG		0x3000fff0
+#define RR_BENCH_LOAD_PROG	0x3000fff1
+#define RR_BENCH_VERS		0x00010001
+#define RR_BENCH_PROC_ECHO	1
+
+static int small = 32;
+module_param(small, int, S_IRUGO);
+MODULE_PARM_DESC(small, "payload bytes of the small calls");
+
+static int large = 1536;
+module_param(large, int, S_IRUGO);
+MODULE_PARM_DESC(large, "payload bytes of the fragmented calls");
+
+static int load = 2;
+module_param(load, int, S_IRUGO);
+MODULE_PARM_DESC(load, "threads making fragmented calls in the background");
+
+static int batch = 4;
+module_param(batch, int, S_IRUGO);
+MODULE_PARM_DESC(batch, "calls per msm_rpc_call_batch()");
+
+static int run_time = 2;
+module_param(run_time, int, S_IRUGO);
+MODULE_PARM_DESC(run_time, "seconds each size or way of calling runs");
+
+/* Round trip times by power of two microseconds; the last bucket is open */
+#define RR_BENCH_LAT_BUCKETS	24
+
+struct rr_bench_msg {
+	union {
+		struct rpc_request_hdr req;
+		struct rpc_reply_hdr reply;
+	} hdr;
+	unsigned char data[0];
+};
+
+struct rr_bench_args {
+	uint32_t seq;
+	int16_t level;
+	int8_t delta;
+	unsigned char tag[6];
+	void *name;
+	uint32_t name_len;
+};
+
+MSM_RPC_XDR_DESC(rr_bench_args_desc,
+	MSM_RPC_XDR_UINT_FIELD(struct rr_bench_args, seq),
+	MSM_RPC_XDR_INT_FIELD(struct rr_bench_args, level),
+	MSM_RPC_XDR_INT_FIELD(struct rr_bench_args, delta),
+	MSM_RPC_XDR_OPAQUE_FIELD(struct rr_bench_args, tag),
+	MSM_RPC_XDR_BYTES_FIELD(struct rr_bench_args, name, name_len));
+
+static char rr_bench_name[] = "rpcrouter_loopback_bench";
+
+static struct msm_rpc_endpoint *server_ept;
+static struct task_struct *server_task;
+static struct task_struct **load_tasks;
+static unsigned long load_calls;
+
+static int rr_bench_server(void *unused)
+{
+	struct rr_bench_msg *out;
+	struct rpc_request_hdr *req;
+	int rc, n;
+
+	out = kmalloc(sizeof(*out) + MSM_RPC_MSGSIZE_MAX, GFP_KERNEL);
+	if (!out)
+		return -ENOMEM;
+
+	while (!kthread_should_stop()) {
+		rc = msm_rpc_read(server_ept, (void **)&req, -1, HZ / 10);
+		if (rc == -ETIMEDOUT)
+			continue;
+		if (rc < 0)
+			break;
+		n = rc - sizeof(*req);
+		if (n < 0 || n > MSM_RPC_MSGSIZE_MAX || req->type != 0) {
+			kfree(req);
+			continue;
+		}
+
+		memset(&out->hdr.reply, 0, sizeof(out->hdr.reply));
+		out->hdr.reply.xid = req->xid;
+		out->hdr.reply.type = cpu_to_be32(1);
+		out->hdr.reply.reply_stat = cpu_to_be32(RPCMSG_REPLYSTAT_ACCEPTED);
+		out->hdr.reply.data.acc_hdr.accept_stat =
+			cpu_to_be32(RPC_ACCEPTSTAT_SUCCESS);
+		memcpy(out->data, req + 1, n);
+		kfree(req);
+
+		msm_rpc_write(server_ept, out, sizeof(out->hdr.reply) + n);
+	}
+
+	kfree(out);
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ / 10);
+	return 0;
+}
+
+static int rr_bench_call(struct msm_rpc_endpoint *ept, struct rr_bench_msg *in,
+			 struct rr_bench_msg *out, int len)
+{
+	int i, rc;
+
+	for (i = 0; i < len; i++)
+		in->data[i] = (unsigned char)(i + jiffies);
+
+	rc = msm_rpc_call_reply(ept, RR_BENCH_PROC_ECHO,
+				in, sizeof(in->hdr.req) + len,
+				out, sizeof(out->hdr.reply) + len, 5 * HZ);
+	if (rc < 0)
+		return rc;
+	if (rc != sizeof(out->hdr.reply) + len ||
+	    memcmp(in->data, out->data, len))
+		return -EIO;
+	return 0;
+}
+
+static int rr_bench_load(void *unused)
+{
+	struct msm_rpc_endpoint *ept;
+	struct rr_bench_msg *in, *out;
+
+	in = kmalloc(sizeof(*in) + large, GFP_KERNEL);
+	out = kmalloc(sizeof(*out) + large, GFP_KERNEL);
+	ept = msm_rpc_connect(RR_BENCH_LOAD_PROG, RR_BENCH_VERS, 0);
+	if (in && out && !IS_ERR(ept)) {
+		while (!kthread_should_stop()) {
+			if (rr_bench_call(ept, in, out, large))
+				break;
+			load_calls++;
+			cond_resched();
+		}
+	}
+	if (!IS_ERR(ept))
+		msm_rpc_close(ept);
+	kfree(out);
+	kfree(in);
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ / 10);
+	return 0;
+}
+
+static int rr_bench_encode_by_hand(const struct rr_bench_args *a, void *buf)
+{
+	uint32_t *p = buf;
+
+	*p++ = cpu_to_be32(a->seq);
+	*p++ = cpu_to_be32((int32_t)a->level);
+	*p++ = cpu_to_be32((int32_t)a->delta);
+	memset(p, 0, 8);
+	memcpy(p, a->tag, sizeof(a->tag));
+	p += 2;
+	*p++ = cpu_to_be32(a->name_len);
+	memset(p, 0, ALIGN(a->name_len, 4));
+	memcpy(p, a->name, a->name_len);
+	return (void *)p + ALIGN(a->name_len, 4) - buf;
+}
+
+static int rr_bench_check_encoder(void)
+{
+	struct rr_bench_args a = {
+		.seq = 0x12345678,
+		.level = -2,
+		.delta = -128,
+		.tag = { 1, 2, 3, 4, 5, 6 },
+		.name = rr_bench_name,
+		.name_len = sizeof(rr_bench_name),
+	};
+	unsigned char by_hand[64], by_desc[64];
+	struct msm_rpc_xdr xdr;
+	int len;
+
+	len = rr_bench_encode_by_hand(&a, by_hand);
+	xdr.out_buf = by_desc;
+	xdr.out_size = sizeof(by_desc);
+	xdr.out_index = 0;
+	if (xdr_send_desc(&xdr, &rr_bench_args_desc, &a) ||
+	    xdr.out_index != len || memcmp(by_hand, by_desc, len)) {
+		printk(KERN_ERR "rpcrouter_loopback_bench: descriptor encoding "
+		       "differs from the hand-written one\n");
+		return -EIO;
+	}
+	return 0;
+}
+
+static void rr_bench_fill_args(struct rr_bench_args *a, uint32_t seq)
+{
+	a->seq = seq;
+	a->level = -(int16_t)seq;
+	a->delta = (int8_t)seq;
+	memset(a->tag, seq, sizeof(a->tag));
+	a->name = rr_bench_name;
+	a->name_len = 1 + seq % sizeof(rr_bench_name);
+}
+
+static int rr_bench_check_ret(const struct rr_bench_args *a,
+			      const struct rr_bench_args *r)
+{
+	if (a->seq != r->seq || a->level != r->level ||
+	    a->delta != r->delta || memcmp(a->tag, r->tag, sizeof(a->tag)) ||
+	    a->name_len != r->name_len ||
+	    memcmp(a->name, r->name, a->name_len))
+		return -EIO;
+	return 0;
+}
+
+enum {
+	RR_BENCH_ONE_AT_A_TIME,
+	RR_BENCH_BATCHED,
+};
+
+static int rr_bench_run_batch(struct msm_rpc_endpoint *ept, int batched)
+{
+	struct rr_bench_args args[MSM_RPC_MAX_BATCH], ret[MSM_RPC_MAX_BATCH];
+	char names[MSM_RPC_MAX_BATCH][sizeof(rr_bench_name)];
+	struct msm_rpc_call calls[MSM_RPC_MAX_BATCH];
+	unsigned long end = jiffies + run_time * HZ;
+	unsigned long calls_done = 0;
+	uint32_t seq = 0;
+	s64 elapsed_us;
+	ktime_t start;
+	int ret_val = 0;
+	int i;
+
+	start = ktime_get();
+	while (time_before(jiffies, end) && !ret_val) {
+		for (i = 0; i < batch; i++) {
+			rr_bench_fill_args(&args[i], seq++);
+			ret[i].name = names[i];
+			ret[i].name_len = sizeof(names[i]);
+			calls[i].proc = RR_BENCH_PROC_ECHO;
+			calls[i].args_desc = &rr_bench_args_desc;
+			calls[i].args = &args[i];
+			calls[i].ret_desc = &rr_bench_args_desc;
+			calls[i].ret = &ret[i];
+		}
+
+		if (batched) {
+			ret_val = msm_rpc_call_batch(ept, calls, batch,
+						     5 * HZ);
+		} else {
+			for (i = 0; i < batch; i++)
+				calls[i].rc = msm_rpc_call_desc(ept,
+					RR_BENCH_PROC_ECHO, &rr_bench_args_desc,
+					&args[i], &rr_bench_args_desc, &ret[i],
+					5 * HZ);
+		}
+
+		for (i = 0; i < batch && !ret_val; i++) {
+			ret_val = calls[i].rc;
+			if (!ret_val)
+				ret_val = rr_bench_check_ret(&args[i], &ret[i]);
+			if (!ret_val)
+				calls_done++;
+		}
+		cond_resched();
+	}
+	elapsed_us = ktime_us_delta(ktime_get(), start);
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+
+	printk(KERN_INFO "rpcrouter_loopback_bench: %s: %lu calls, %llu "
+	       "calls/s\n", batched ? "msm_rpc_call_batch" :
+	       "msm_rpc_call_desc", calls_done,
+	       div64_u64((u64)calls_done * USEC_PER_SEC, elapsed_us));
+	if (ret_val)
+		printk(KERN_ERR "rpcrouter_loopback_bench: %s calls failed, "
+		       "%d\n", batched ? "batched" : "descriptor", ret_val);
+	return ret_val;
+}
+
+/* Upper bound in microseconds of the round trip of permille/1000 calls */
+static s64 rr_bench_percentile(unsigned long *lat, unsigned long calls,
+			       int permille)
+{
+	unsigned long want = calls - div64_u64((u64)calls *
+					       (1000 - permille), 1000);
+	unsigned long seen = 0;
+	int b;
+
+	for (b = 0; b < RR_BENCH_LAT_BUCKETS - 1; b++) {
+		seen += lat[b];
+		if (seen >= want)
+			break;
+	}
+	return 1LL << b;
+}
+
+static int rr_bench_run(struct msm_rpc_endpoint *ept, int len)
+{
+	unsigned long lat[RR_BENCH_LAT_BUCKETS] = { 0 };
+	unsigned long end = jiffies + run_time * HZ;
+	unsigned long calls = 0, load_start = load_calls;
+	struct rr_bench_msg *in, *out;
+	s64 us, max_us = 0;
+	ktime_t start;
+	int ret = 0;
+	int b;
+
+	in = kmalloc(sizeof(*in) + len, GFP_KERNEL);
+	out = kmalloc(sizeof(*out) + len, GFP_KERNEL);
+	if (!in || !out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	while (time_before(jiffies, end)) {
+		start = ktime_get();
+		ret = rr_bench_call(ept, in, out, len);
+		us = ktime_us_delta(ktime_get(), start);
+		if (ret)
+			break;
+
+		b = us > 0 ? fls64(us) : 0;
+		if (b >= RR_BENCH_LAT_BUCKETS)
+			b = RR_BENCH_LAT_BUCKETS - 1;
+		lat[b]++;
+		if (us > max_us)
+			max_us = us;
+		calls++;
+		cond_resched();
+	}
+
+	if (calls)
+		printk(KERN_INFO "rpcrouter_loopback_bench: %d byte calls: %lu "
+		       "calls, p50 < %lld us, p99 < %lld us, p99.9 < %lld us, "
+		       "max %lld us, %lu background calls\n",
+		       len, calls,
+		       rr_bench_percentile(lat, calls, 500),
+		       rr_bench_percentile(lat, calls, 990),
+		       rr_bench_percentile(lat, calls, 999), max_us,
+		       load_calls - load_start);
+	if (ret)
+		printk(KERN_ERR "rpcrouter_loopback_bench: %d byte calls failed "
+		       "after %lu calls, %d\n", len, calls, ret);
+out:
+	kfree(out);
+	kfree(in);
+	return ret;
+}
+
+static int __init rpcrouter_loopback_bench_init(void)
+{
+	struct msm_rpc_endpoint *ept = ERR_PTR(-ENODEV);
+	int ret, i;
+
+	if (small <= 0 || large <= 0 || load < 0 || run_time <= 0 ||
+	    batch <= 0 || batch > MSM_RPC_MAX_BATCH ||
+	    sizeof(struct rpc_request_hdr) + max(small, large) >
+	    MSM_RPC_MSGSIZE_MAX)
+		return -EINVAL;
+
+	ret = rr_bench_check_encoder();
+	if (ret)
+		return ret;
+
+	load_tasks = kcalloc(load, sizeof(*load_tasks), GFP_KERNEL);
+	if (load && !load_tasks)
+		return -ENOMEM;
+
+	server_ept = msm_rpc_open();
+	if (IS_ERR(server_ept)) {
+		ret = PTR_ERR(server_ept);
+		goto out_free;
+	}
+	ret = msm_rpc_register_server(server_ept, RR_BENCH_PROG,
+				      RR_BENCH_VERS);
+	if (!ret)
+		ret = msm_rpc_register_server(server_ept, RR_BENCH_LOAD_PROG,
+					      RR_BENCH_VERS);
+	if (ret)
+		goto out_unregister;
+
+	server_task = kthread_run(rr_bench_server, NULL, "rr_bench_server");
+	if (IS_ERR(server_task)) {
+		ret = PTR_ERR(server_task);
+		goto out_unregister;
+	}
+
+	ept = msm_rpc_connect(RR_BENCH_PROG, RR_BENCH_VERS, 0);
+	if (IS_ERR(ept)) {
+		ret = PTR_ERR(ept);
+		printk(KERN_ERR "rpcrouter_loopback_bench: can't connect, is "
+		       "the loopback transport up? %d\n", ret);
+		goto out_stop;
+	}
+
+	ret = rr_bench_run_batch(ept, RR_BENCH_ONE_AT_A_TIME);
+	if (!ret)
+		ret = rr_bench_run_batch(ept, RR_BENCH_BATCHED);
+	if (ret)
+		goto out_stop;
+
+	for (i = 0; i < load; i++) {
+		load_tasks[i] = kthread_run(rr_bench_load, NULL,
+					    "rr_bench_load%d", i);
+		if (IS_ERR(load_tasks[i])) {
+			ret = PTR_ERR(load_tasks[i]);
+			load_tasks[i] = NULL;
+			goto out_stop;
+		}
+	}
+
+	ret = rr_bench_run(ept, small);
+	if (!ret)
+		ret = rr_bench_run(ept, large);
+
+out_stop:
+	for (i = 0; i < load; i++)
+		if (load_tasks[i])
+			kthread_stop(load_tasks[i]);
+	if (!IS_ERR(ept))
+		msm_rpc_close(ept);
+	kthread_stop(server_task);
+out_unregister:
+	msm_rpc_unregister_server(server_ept, RR_BENCH_LOAD_PROG,
+				  RR_BENCH_VERS);
+	msm_rpc_unregister_server(server_ept, RR_BENCH_PROG, RR_BENCH_VERS);
+	msm_rpc_close(server_ept);
+out_free:
+	kfree(load_tasks);
+	return ret;
+}
+
+static void __exit rpcrouter_loopback_bench_exit(void)
+{
+}
+
+module_init(rpcrouter_loopback_bench_init);
+module_exit(rpcrouter_loopback_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RPC router loopback round trip benchmark");
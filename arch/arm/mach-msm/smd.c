@@ -29,6 +29,7 @@
 #include <linux/io.h>
 #include <linux/termios.h>
 #include <linux/ctype.h>
+#include <linux/uio.h>
 #include <mach/msm_smd.h>
 #include <mach/msm_iomap.h>
 #include <mach/system.h>
@@ -258,11 +259,17 @@ struct smd_channel {
 	int (*read_avail)(smd_channel_t *ch);
 	int (*write_avail)(smd_channel_t *ch);
 	int (*read_from_cb)(smd_channel_t *ch, void *data, int len);
+	int (*writev)(smd_channel_t *ch, const struct kvec *iov, int count);
 
 	void (*update_state)(smd_channel_t *ch);
 	unsigned last_state;
 	void (*notify_other_cpu)(void);
 
+	/* interrupts held back between smd_notify_batch_{begin,end}() */
+	atomic_t notify_batch;
+	unsigned long notify_pending;
+	int is_pkt_ch;
+
 	char name[20];
 	struct platform_device pdev;
 	unsigned type;
@@ -422,10 +429,10 @@ static void update_packet_state(struct smd_channel *ch)
 	}
 }
 
-/* provide a pointer and length to next free space in the fifo */
-static unsigned ch_write_buffer(struct smd_channel *ch, void **ptr)
+/* provide a pointer and length to free space in the fifo from head on */
+static unsigned ch_write_buffer_at(struct smd_channel *ch, unsigned head,
+				   void **ptr)
 {
-	unsigned head = ch->send->head;
 	unsigned tail = ch->send->tail;
 	*ptr = (void *) (ch->send_data + head);
 
@@ -439,6 +446,12 @@ static unsigned ch_write_buffer(struct smd_channel *ch, void **ptr)
 	}
 }
 
+/* provide a pointer and length to next free space in the fifo */
+static unsigned ch_write_buffer(struct smd_channel *ch, void **ptr)
+{
+	return ch_write_buffer_at(ch, ch->send->head, ptr);
+}
+
 /* advace the fifo write pointer after freespace
  * from ch_write_buffer is filled
  */
@@ -449,6 +462,44 @@ static void ch_write_done(struct smd_channel *ch, unsigned count)
 	ch->send->fHEAD = 1;
 }
 
+/* basic write interface to ch_write_{buffer,done}, leaves notifying the
+ * other side to the caller
+ */
+static int ch_write(struct smd_channel *ch, const void *_data, int len)
+{
+	void *ptr;
+	const unsigned char *buf = _data;
+	unsigned xfer;
+	int orig_len = len;
+
+	while (len > 0 && (xfer = ch_write_buffer(ch, &ptr)) != 0) {
+		if (!ch_is_open(ch))
+			break;
+		if (xfer > len)
+			xfer = len;
+		memcpy(ptr, buf, xfer);
+		ch_write_done(ch, xfer);
+		len -= xfer;
+		buf += xfer;
+	}
+
+	return orig_len - len;
+}
+
+/* interrupt the other side about a read or write, unless it is batched */
+static void ch_notify(struct smd_channel *ch)
+{
+	if (atomic_read(&ch->notify_batch)) {
+		set_bit(0, &ch->notify_pending);
+		smp_mb();
+		/* the batch may have ended while the bit was being set */
+		if (atomic_read(&ch->notify_batch) ||
+		    !test_and_clear_bit(0, &ch->notify_pending))
+			return;
+	}
+	ch->notify_other_cpu();
+}
+
 static void ch_set_state(struct smd_channel *ch, unsigned n)
 {
 	if (n == SMD_SS_OPENED) {
@@ -631,10 +682,7 @@ static int smd_is_packet(struct smd_alloc_elm *alloc_elm)
 
 static int smd_stream_write(smd_channel_t *ch, const void *_data, int len)
 {
-	void *ptr;
-	const unsigned char *buf = _data;
-	unsigned xfer;
-	int orig_len = len;
+	int r;
 
 	SMD_DBG("smd_stream_write() %d -> ch%d\n", len, ch->n);
 	if (len < 0)
@@ -642,23 +690,11 @@ static int smd_stream_write(smd_channel_t *ch, const void *_data, int len)
 	else if (len == 0)
 		return 0;
 
-	while ((xfer = ch_write_buffer(ch, &ptr)) != 0) {
-		if (!ch_is_open(ch))
-			break;
-		if (xfer > len)
-			xfer = len;
-		memcpy(ptr, buf, xfer);
-		ch_write_done(ch, xfer);
-		len -= xfer;
-		buf += xfer;
-		if (len == 0)
-			break;
-	}
-
-	if (orig_len - len)
-		ch->notify_other_cpu();
+	r = ch_write(ch, _data, len);
+	if (r)
+		ch_notify(ch);
 
-	return orig_len - len;
+	return r;
 }
 
 static int smd_packet_write(smd_channel_t *ch, const void *_data, int len)
@@ -679,16 +715,19 @@ static int smd_packet_write(smd_channel_t *ch, const void *_data, int len)
 	hdr[1] = hdr[2] = hdr[3] = hdr[4] = 0;
 
 
-	ret = smd_stream_write(ch, hdr, sizeof(hdr));
-	if (ret < 0 || ret != sizeof(hdr)) {
+	/* header and data go out under one interrupt */
+	ret = ch_write(ch, hdr, sizeof(hdr));
+	if (ret != sizeof(hdr)) {
 		SMD_DBG("%s failed to write pkt header: "
 			"%d returned\n", __func__, ret);
+		if (ret)
+			ch_notify(ch);
 		return -1;
 	}
 
-
-	ret = smd_stream_write(ch, _data, len);
-	if (ret < 0 || ret != len) {
+	ret = ch_write(ch, _data, len);
+	ch_notify(ch);
+	if (ret != len) {
 		SMD_DBG("%s failed to write pkt data: "
 			"%d returned\n", __func__, ret);
 		return ret;
@@ -697,6 +736,69 @@ static int smd_packet_write(smd_channel_t *ch, const void *_data, int len)
 	return len;
 }
 
+static int smd_stream_writev(smd_channel_t *ch, const struct kvec *iov,
+			     int count)
+{
+	int i, r, total = 0;
+
+	if (count < 0)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if ((int)iov[i].iov_len < 0)
+			return total ? total : -EINVAL;
+		r = ch_write(ch, iov[i].iov_base, iov[i].iov_len);
+		total += r;
+		if (r != iov[i].iov_len)
+			break;
+	}
+
+	if (total)
+		ch_notify(ch);
+
+	return total;
+}
+
+/* the segments make up one packet, written as a whole or not at all */
+static int smd_packet_writev(smd_channel_t *ch, const struct kvec *iov,
+			     int count)
+{
+	unsigned hdr[5];
+	int i, r, len = 0;
+
+	if (count < 0)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (iov[i].iov_len > INT_MAX - len)
+			return -EINVAL;
+		len += iov[i].iov_len;
+	}
+	if (len == 0)
+		return 0;
+
+	if (smd_stream_write_avail(ch) < (len + SMD_HEADER_SIZE))
+		return -ENOMEM;
+
+	hdr[0] = len;
+	hdr[1] = hdr[2] = hdr[3] = hdr[4] = 0;
+
+	r = ch_write(ch, hdr, sizeof(hdr));
+	for (i = 0; r == sizeof(hdr) && i < count; i++) {
+		if (ch_write(ch, iov[i].iov_base, iov[i].iov_len) !=
+		    iov[i].iov_len)
+			break;
+	}
+	if (r)
+		ch_notify(ch);
+	if (r != sizeof(hdr) || i != count) {
+		SMD_DBG("%s failed to write pkt\n", __func__);
+		return -EIO;
+	}
+
+	return len;
+}
+
 static int smd_stream_read(smd_channel_t *ch, void *data, int len)
 {
 	int r;
@@ -706,7 +808,7 @@ static int smd_stream_read(smd_channel_t *ch, void *data, int len)
 
 	r = ch_read(ch, data, len);
 	if (r > 0)
-		ch->notify_other_cpu();
+		ch_notify(ch);
 
 	return r;
 }
@@ -724,7 +826,7 @@ static int smd_packet_read(smd_channel_t *ch, void *data, int len)
 
 	r = ch_read(ch, data, len);
 	if (r > 0)
-		ch->notify_other_cpu();
+		ch_notify(ch);
 
 	spin_lock_irqsave(&smd_lock, flags);
 	ch->current_packet -= r;
@@ -746,7 +848,7 @@ static int smd_packet_read_from_cb(smd_channel_t *ch, void *data, int len)
 
 	r = ch_read(ch, data, len);
 	if (r > 0)
-		ch->notify_other_cpu();
+		ch_notify(ch);
 
 	ch->current_packet -= r;
 	update_packet_state(ch);
@@ -831,6 +933,8 @@ static int smd_alloc_channel(struct smd_alloc_elm *alloc_elm)
 		ch->write_avail = smd_packet_write_avail;
 		ch->update_state = update_packet_state;
 		ch->read_from_cb = smd_packet_read_from_cb;
+		ch->writev = smd_packet_writev;
+		ch->is_pkt_ch = 1;
 	} else {
 		ch->read = smd_stream_read;
 		ch->write = smd_stream_write;
@@ -838,6 +942,7 @@ static int smd_alloc_channel(struct smd_alloc_elm *alloc_elm)
 		ch->write_avail = smd_stream_write_avail;
 		ch->update_state = update_stream_state;
 		ch->read_from_cb = smd_stream_read;
+		ch->writev = smd_stream_writev;
 	}
 
 	memcpy(ch->name, alloc_elm->name, 20);
@@ -898,6 +1003,7 @@ static int smd_alloc_loopback_channel(void)
 	ch->write_avail = smd_stream_write_avail;
 	ch->update_state = update_stream_state;
 	ch->read_from_cb = smd_stream_read;
+	ch->writev = smd_stream_writev;
 
 	memset(ch->name, 0, 20);
 	memcpy(ch->name, "local_loopback", 14);
@@ -1050,6 +1156,122 @@ int smd_write(smd_channel_t *ch, const void *data, int len)
 }
 EXPORT_SYMBOL(smd_write);
 
+int smd_writev(smd_channel_t *ch, const struct kvec *iov, int count)
+{
+	return ch->writev(ch, iov, count);
+}
+EXPORT_SYMBOL(smd_writev);
+
+/* contiguous free space for a write, after room for the header on packet
+ * channels
+ */
+static unsigned ch_reserve(struct smd_channel *ch, void **ptr)
+{
+	unsigned avail, n;
+
+	if (!ch_is_open(ch))
+		return 0;
+	if (!ch->is_pkt_ch)
+		return ch_write_buffer(ch, ptr);
+
+	avail = smd_stream_write_avail(ch);
+	if (avail <= SMD_HEADER_SIZE)
+		return 0;
+	n = ch_write_buffer_at(ch, (ch->send->head + SMD_HEADER_SIZE) &
+			       ch->fifo_mask, ptr);
+	return min(n, avail - SMD_HEADER_SIZE);
+}
+
+int smd_write_reserve(smd_channel_t *ch, void **data)
+{
+	return ch_reserve(ch, data);
+}
+EXPORT_SYMBOL(smd_write_reserve);
+
+int smd_write_commit(smd_channel_t *ch, int len)
+{
+	unsigned hdr[5];
+	void *ptr;
+
+	if (len < 0 || len > ch_reserve(ch, &ptr))
+		return -EINVAL;
+	if (len == 0)
+		return 0;
+
+	if (ch->is_pkt_ch) {
+		hdr[0] = len;
+		hdr[1] = hdr[2] = hdr[3] = hdr[4] = 0;
+		if (ch_write(ch, hdr, sizeof(hdr)) != sizeof(hdr))
+			return -EIO;
+	}
+	ch_write_done(ch, len);
+	ch_notify(ch);
+
+	return len;
+}
+EXPORT_SYMBOL(smd_write_commit);
+
+int smd_read_buffer(smd_channel_t *ch, void **data)
+{
+	unsigned n = ch_read_buffer(ch, data);
+
+	if (ch->is_pkt_ch && n > ch->current_packet)
+		n = ch->current_packet;
+	return n;
+}
+EXPORT_SYMBOL(smd_read_buffer);
+
+static int ch_read_consume(struct smd_channel *ch, int len, int from_cb)
+{
+	unsigned long flags;
+	void *ptr;
+
+	if (len < 0 || len > smd_read_buffer(ch, &ptr))
+		return -EINVAL;
+	if (len == 0)
+		return 0;
+
+	ch_read_done(ch, len);
+	ch_notify(ch);
+
+	if (ch->is_pkt_ch) {
+		if (!from_cb)
+			spin_lock_irqsave(&smd_lock, flags);
+		ch->current_packet -= len;
+		update_packet_state(ch);
+		if (!from_cb)
+			spin_unlock_irqrestore(&smd_lock, flags);
+	}
+
+	return len;
+}
+
+int smd_read_done(smd_channel_t *ch, int len)
+{
+	return ch_read_consume(ch, len, 0);
+}
+EXPORT_SYMBOL(smd_read_done);
+
+int smd_read_done_from_cb(smd_channel_t *ch, int len)
+{
+	return ch_read_consume(ch, len, 1);
+}
+EXPORT_SYMBOL(smd_read_done_from_cb);
+
+void smd_notify_batch_begin(smd_channel_t *ch)
+{
+	atomic_inc(&ch->notify_batch);
+}
+EXPORT_SYMBOL(smd_notify_batch_begin);
+
+void smd_notify_batch_end(smd_channel_t *ch)
+{
+	if (atomic_dec_and_test(&ch->notify_batch) &&
+	    test_and_clear_bit(0, &ch->notify_pending))
+		ch->notify_other_cpu();
+}
+EXPORT_SYMBOL(smd_notify_batch_end);
+
 int smd_read_avail(smd_channel_t *ch)
 {
 	return ch->read_avail(ch);
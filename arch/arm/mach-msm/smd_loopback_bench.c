@@ -0,0 +1,240 @@
+/* arch/arm/mach-msm/smd_loopback_bench.c
+ *
+ * Throughput and interrupt count benchmark for the SMD write paths,
+ * run over the local loopback channel.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Each round writes batch chunks of chunk bytes into the loopback FIFO and
+ * reads them back, checking the data. The rounds are repeated for run_time
+ * seconds with each way of writing in turn: smd_write() per chunk,
+ * smd_writev() of all the chunks, smd_write_reserve()/smd_write_commit()
+ * filling the FIFO in place and read back with smd_read_buffer(), and
+ * smd_write() per chunk inside smd_notify_batch_{begin,end}(). The loopback
+ * channel calls its notify callback wherever the modem would have been
+ * interrupted, so counting the callbacks counts the interrupts.
+ */
+
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/hrtimer.h>
+#include <linux/jiffies.h>
+#include <mach/msm_smd.h>
+
+#include "smd_private.h"
+
+static int chunk = 512;
+module_param(chunk, int, S_IRUGO);
+MODULE_PARM_DESC(chunk, "bytes per write");
+
+static int batch = 8;
+module_param(batch, int, S_IRUGO);
+MODULE_PARM_DESC(batch, "writes per round");
+
+static int run_time = 2;
+module_param(run_time, int, S_IRUGO);
+MODULE_PARM_DESC(run_time, "seconds each way of writing runs");
+
+enum {
+	SMD_BENCH_COPY,
+	SMD_BENCH_WRITEV,
+	SMD_BENCH_ZEROCOPY,
+	SMD_BENCH_BATCHED,
+	SMD_BENCH_NR_MODES,
+};
+
+static const char * const smd_bench_modes[] = {
+	"write", "writev", "zero-copy", "batched write",
+};
+
+static smd_channel_t *ch;
+static atomic_t notifies;
+static unsigned char *wbuf, *rbuf;
+static struct kvec *iov;
+static unsigned roff;
+static unsigned long bad_bytes;
+
+static void smd_bench_notify(void *priv, unsigned event)
+{
+	if (event == SMD_EVENT_DATA)
+		atomic_inc(&notifies);
+}
+
+/* every byte in the stream is its offset, modulo 256 */
+static void smd_bench_check(const unsigned char *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++, roff++)
+		if (data[i] != (unsigned char)roff)
+			bad_bytes++;
+}
+
+static int smd_bench_write_zerocopy(unsigned woff)
+{
+	int left = chunk;
+
+	while (left > 0) {
+		unsigned char *p;
+		int i, n;
+
+		n = smd_write_reserve(ch, (void **)&p);
+		if (n <= 0)
+			return -ENOSPC;
+		if (n > left)
+			n = left;
+		for (i = 0; i < n; i++)
+			p[i] = (unsigned char)(woff + i);
+		if (smd_write_commit(ch, n) != n)
+			return -EIO;
+		woff += n;
+		left -= n;
+	}
+	return 0;
+}
+
+static int smd_bench_round(int mode)
+{
+	int total = chunk * batch;
+	int i, n;
+
+	switch (mode) {
+	case SMD_BENCH_WRITEV:
+		if (smd_writev(ch, iov, batch) != total)
+			return -EIO;
+		break;
+	case SMD_BENCH_ZEROCOPY:
+		for (i = 0; i < batch; i++)
+			if (smd_bench_write_zerocopy(roff + i * chunk))
+				return -EIO;
+		break;
+	case SMD_BENCH_BATCHED:
+		smd_notify_batch_begin(ch);
+		/* fall through */
+	case SMD_BENCH_COPY:
+		for (i = 0; i < batch; i++)
+			if (smd_write(ch, wbuf + i * chunk, chunk) != chunk)
+				break;
+		if (mode == SMD_BENCH_BATCHED)
+			smd_notify_batch_end(ch);
+		if (i != batch)
+			return -EIO;
+		break;
+	}
+
+	if (mode == SMD_BENCH_ZEROCOPY) {
+		void *p;
+
+		while (total > 0 && (n = smd_read_buffer(ch, &p)) > 0) {
+			smd_bench_check(p, n);
+			smd_read_done(ch, n);
+			total -= n;
+		}
+	} else if (smd_read(ch, rbuf, total) == total) {
+		smd_bench_check(rbuf, total);
+		total = 0;
+	}
+	return total ? -EIO : 0;
+}
+
+static int smd_bench_run(int mode)
+{
+	unsigned long end = jiffies + run_time * HZ;
+	unsigned long rounds = 0;
+	unsigned long long bytes;
+	s64 elapsed_us;
+	ktime_t start;
+	int ret = 0;
+	int irqs;
+
+	atomic_set(&notifies, 0);
+	roff = 0;
+	bad_bytes = 0;
+
+	start = ktime_get();
+	while (time_before(jiffies, end)) {
+		ret = smd_bench_round(mode);
+		if (ret)
+			break;
+		rounds++;
+		cond_resched();
+	}
+	elapsed_us = ktime_us_delta(ktime_get(), start);
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+
+	bytes = (unsigned long long)rounds * chunk * batch;
+	irqs = atomic_read(&notifies);
+	printk(KERN_INFO "smd_loopback_bench: %s: %llu bytes in %lld us, "
+	       "%llu KiB/s, %d interrupts, %llu per MiB\n",
+	       smd_bench_modes[mode], bytes, elapsed_us,
+	       div64_u64(bytes * USEC_PER_SEC, elapsed_us) >> 10, irqs,
+	       bytes ? div64_u64((u64)irqs << 20, bytes) : 0);
+	if (bad_bytes)
+		printk(KERN_ERR "smd_loopback_bench: %s: %lu bytes read back "
+		       "wrong\n", smd_bench_modes[mode], bad_bytes);
+	if (ret)
+		printk(KERN_ERR "smd_loopback_bench: %s failed after %lu "
+		       "rounds\n", smd_bench_modes[mode], rounds);
+	return ret;
+}
+
+static int __init smd_loopback_bench_init(void)
+{
+	int ret, mode, i;
+
+	/* each round has to fit in the FIFO, and the pattern must line up */
+	if (chunk <= 0 || batch <= 0 || run_time <= 0 ||
+	    chunk * batch >= SMD_BUF_SIZE || (chunk * batch) % 256)
+		return -EINVAL;
+
+	wbuf = kmalloc(chunk * batch, GFP_KERNEL);
+	rbuf = kmalloc(chunk * batch, GFP_KERNEL);
+	iov = kmalloc(batch * sizeof(*iov), GFP_KERNEL);
+	if (!wbuf || !rbuf || !iov) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < chunk * batch; i++)
+		wbuf[i] = (unsigned char)i;
+	for (i = 0; i < batch; i++) {
+		iov[i].iov_base = wbuf + i * chunk;
+		iov[i].iov_len = chunk;
+	}
+
+	ret = smd_named_open_on_edge("local_loopback", SMD_LOOPBACK_TYPE, &ch,
+				     NULL, smd_bench_notify);
+	if (ret) {
+		printk(KERN_ERR "smd_loopback_bench: can't open the loopback "
+		       "channel, %d\n", ret);
+		goto out;
+	}
+
+	for (mode = 0; mode < SMD_BENCH_NR_MODES && !ret; mode++)
+		ret = smd_bench_run(mode);
+
+	smd_close(ch);
+out:
+	kfree(iov);
+	kfree(rbuf);
+	kfree(wbuf);
+	return ret;
+}
+
+static void __exit smd_loopback_bench_exit(void)
+{
+}
+
+module_init(smd_loopback_bench_init);
+module_exit(smd_loopback_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SMD loopback write path benchmark");
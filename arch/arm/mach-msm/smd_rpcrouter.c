@@ -39,6 +39,10 @@
 #include <linux/platform_device.h>
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
+#include <linux/mempool.h>
+#include <linux/seq_file.h>
+#include <linux/hash.h>
+#include <linux/hrtimer.h>
 
 #include <asm/byteorder.h>
 
@@ -70,6 +74,19 @@ static int smd_rpcrouter_debug_mask = SMEM_LOG;
 module_param_named(debug_mask, smd_rpcrouter_debug_mask,
 		   int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/* Calls to these programs, and to their callback programs, are queued
+ * ahead of other calls on an endpoint that several servers share, so
+ * that audio is not held up behind slower services.
+ */
+#define RR_MAX_PRIORITY_PROGS	8
+static uint32_t rr_priority_progs[RR_MAX_PRIORITY_PROGS] = {
+	0x30000002,	/* SND */
+	0x30000013,	/* AUDMGR */
+};
+static int rr_num_priority_progs = 2;
+module_param_array_named(priority_progs, rr_priority_progs, uint,
+			 &rr_num_priority_progs, S_IRUGO | S_IWUSR | S_IWGRP);
+
 #define DIAG(x...) printk(KERN_ERR "[RR] ERROR " x)
 
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
@@ -150,6 +167,16 @@ static DEFINE_SPINLOCK(rpc_board_dev_list_lock);
 
 static struct workqueue_struct *rpcrouter_workqueue;
 
+/* Fragments and packets are taken from pools so that the read path
+ * always has memory to receive into.  Fragments never leave the router:
+ * msm_rpc_read() copies them out and returns them to the pool.
+ */
+#define RR_FRAG_POOL_MIN	16
+#define RR_PKT_POOL_MIN		16
+
+static mempool_t *rr_frag_pool;
+static mempool_t *rr_pkt_pool;
+
 static atomic_t next_xid = ATOMIC_INIT(1);
 static atomic_t pm_mid = ATOMIC_INIT(1);
 
@@ -275,12 +302,52 @@ static int rpcrouter_send_control_msg(struct rpcrouter_xprt_info *xprt_info,
 	return 0;
 }
 
+static struct rr_fragment *rr_alloc_fragment(void)
+{
+	struct rr_fragment *frag;
+
+	frag = mempool_alloc(rr_frag_pool, GFP_KERNEL);
+	frag->length = 0;
+	frag->next = NULL;
+	return frag;
+}
+
+void msm_rpcrouter_free_fragments(struct rr_fragment *frag)
+{
+	struct rr_fragment *next;
+
+	while (frag != NULL) {
+		next = frag->next;
+		mempool_free(frag, rr_frag_pool);
+		frag = next;
+	}
+}
+
+static struct rr_packet *rr_alloc_packet(struct rr_header *hdr, uint32_t mid)
+{
+	struct rr_packet *pkt;
+
+	pkt = mempool_alloc(rr_pkt_pool, GFP_KERNEL);
+	pkt->first = rr_alloc_fragment();
+	pkt->last = pkt->first;
+	memcpy(&pkt->hdr, hdr, sizeof(*hdr));
+	pkt->mid = mid;
+	pkt->length = 0;
+	pkt->priority = 0;
+	return pkt;
+}
+
+static void rr_free_packet(struct rr_packet *pkt)
+{
+	msm_rpcrouter_free_fragments(pkt->first);
+	mempool_free(pkt, rr_pkt_pool);
+}
+
 static void modem_reset_start_cleanup(void)
 {
 	struct msm_rpc_endpoint *ept;
 	struct rr_remote_endpoint *r_ept;
 	struct rr_packet *pkt, *tmp_pkt;
-	struct rr_fragment *frag, *next;
 	struct msm_rpc_reply *reply, *reply_tmp;
 	unsigned long flags;
 
@@ -307,13 +374,7 @@ static void modem_reset_start_cleanup(void)
 			list_for_each_entry_safe(pkt, tmp_pkt,
 						 &ept->incomplete, list) {
 				list_del(&pkt->list);
-				frag = pkt->first;
-				while (frag != NULL) {
-					next = frag->next;
-					kfree(frag);
-					frag = next;
-				}
-			kfree(pkt);
+				rr_free_packet(pkt);
 			}
 			spin_unlock(&ept->incomplete_lock);
 			/* remove all completed packets waiting to be read*/
@@ -321,13 +382,7 @@ static void modem_reset_start_cleanup(void)
 			list_for_each_entry_safe(pkt, tmp_pkt, &ept->read_q,
 						 list) {
 				list_del(&pkt->list);
-				frag = pkt->first;
-				while (frag != NULL) {
-					next = frag->next;
-					kfree(frag);
-					frag = next;
-				}
-				kfree(pkt);
+				rr_free_packet(pkt);
 			}
 			spin_unlock(&ept->read_q_lock);
 			/* Set restart state for local ep */
@@ -531,6 +586,7 @@ struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev)
 	wake_lock_init(&ept->reply_q_wake_lock, WAKE_LOCK_SUSPEND, "rpc_reply");
 	INIT_LIST_HEAD(&ept->incomplete);
 	spin_lock_init(&ept->incomplete_lock);
+	mutex_init(&ept->call_lock);
 
 	spin_lock_irqsave(&local_endpoints_lock, flags);
 	list_add_tail(&ept->list, &local_endpoints);
@@ -578,6 +634,7 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 	spin_lock_irqsave(&local_endpoints_lock, flags);
 	list_del(&ept->list);
 	spin_unlock_irqrestore(&local_endpoints_lock, flags);
+	kfree(ept->call_buf);
 	kfree(ept);
 	return 0;
 }
@@ -929,11 +986,105 @@ static char *type_to_str(int i)
 
 static uint32_t r2r_buf[RPCROUTER_MSGSIZE_MAX];
 
-static void do_read_data(struct work_struct *work)
+/*
+ * Read a fragment's payload straight onto the end of the packet it
+ * belongs to, filling what is left of the last buffer before starting
+ * another one.  A message that fits in one buffer so ends up in one,
+ * however the remote side fragmented it, and msm_rpc_read() can hand
+ * it over without copying.
+ */
+static int rr_read_fragment(struct rpcrouter_xprt_info *xprt_info,
+			    struct rr_packet *pkt, uint32_t len)
+{
+	struct rr_fragment *frag = pkt->last;
+	uint32_t n;
+
+	while (len) {
+		if (frag->length == sizeof(frag->data)) {
+			frag = rr_alloc_fragment();
+			pkt->last->next = frag;
+			pkt->last = frag;
+		}
+		n = min(len, (uint32_t)sizeof(frag->data) - frag->length);
+		if (rr_read(xprt_info, frag->data + frag->length, n))
+			return -EIO;
+		frag->length += n;
+		pkt->length += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Take the partial packet with this mid, if any, off the endpoint's
+ * incomplete list while the next fragment is read into it.
+ */
+static struct rr_packet *rr_get_incomplete(struct msm_rpc_endpoint *ept,
+					   uint32_t mid)
+{
+	struct rr_packet *pkt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ept->incomplete_lock, flags);
+	list_for_each_entry(pkt, &ept->incomplete, list) {
+		if (pkt->mid == mid) {
+			list_del(&pkt->list);
+			spin_unlock_irqrestore(&ept->incomplete_lock, flags);
+			return pkt;
+		}
+	}
+	spin_unlock_irqrestore(&ept->incomplete_lock, flags);
+	return NULL;
+}
+
+static uint32_t rr_packet_priority(struct rr_packet *pkt)
+{
+	struct rpc_request_hdr *rq = (void *) pkt->first->data;
+	uint32_t prog;
+	int i;
+
+	if (pkt->first->length < 4 * sizeof(uint32_t) || rq->type != 0)
+		return 0;
+
+	/* callback programs differ from their program in bit 24 */
+	prog = be32_to_cpu(rq->prog) & ~0x01000000;
+	for (i = 0; i < rr_num_priority_progs; i++)
+		if (prog == rr_priority_progs[i])
+			return 1;
+	return 0;
+}
+
+/* Queue a complete packet for its endpoint.  Priority packets go after
+ * the priority packets already queued but ahead of everything else.
+ */
+static void rr_queue_packet(struct msm_rpc_endpoint *ept,
+			    struct rr_packet *pkt)
+{
+	struct list_head *pos = &ept->read_q;
+	struct rr_packet *p;
+	unsigned long flags;
+
+	pkt->priority = rr_packet_priority(pkt);
+
+	spin_lock_irqsave(&ept->read_q_lock, flags);
+	D("%s: take read lock on ept %p\n", __func__, ept);
+	wake_lock(&ept->read_q_wake_lock);
+	if (pkt->priority) {
+		list_for_each_entry(p, &ept->read_q, list) {
+			if (!p->priority) {
+				pos = &p->list;
+				break;
+			}
+		}
+	}
+	list_add_tail(&pkt->list, pos);
+	wake_up(&ept->wait_q);
+	spin_unlock_irqrestore(&ept->read_q_lock, flags);
+}
+
+static int rr_read_packet(struct rpcrouter_xprt_info *xprt_info)
 {
 	struct rr_header hdr;
 	struct rr_packet *pkt;
-	struct rr_fragment *frag;
 	struct msm_rpc_endpoint *ept;
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
 	struct rpc_request_hdr *rq;
@@ -941,13 +1092,8 @@ static void do_read_data(struct work_struct *work)
 	uint32_t pm, mid;
 	unsigned long flags;
 
-	struct rpcrouter_xprt_info *xprt_info =
-		container_of(work,
-			     struct rpcrouter_xprt_info,
-			     read_data);
-
 	if (rr_read(xprt_info, &hdr, sizeof(hdr)))
-		goto fail_io;
+		return -EIO;
 
 	RR("- ver=%d type=%d src=%d:%08x crx=%d siz=%d dst=%d:%08x\n",
 	   hdr.version, hdr.type, hdr.src_pid, hdr.src_cid,
@@ -960,11 +1106,11 @@ static void do_read_data(struct work_struct *work)
 
 	if (hdr.version != RPCROUTER_VERSION) {
 		DIAG("version %d != %d\n", hdr.version, RPCROUTER_VERSION);
-		goto fail_data;
+		return -EINVAL;
 	}
 	if (hdr.size > RPCROUTER_MSGSIZE_MAX) {
 		DIAG("msg size %d > max %d\n", hdr.size, RPCROUTER_MSGSIZE_MAX);
-		goto fail_data;
+		return -EINVAL;
 	}
 
 	if (hdr.dst_cid == RPCROUTER_ROUTER_ADDRESS) {
@@ -972,34 +1118,51 @@ static void do_read_data(struct work_struct *work)
 			xprt_info->remote_pid = hdr.src_pid;
 
 		if (rr_read(xprt_info, r2r_buf, hdr.size))
-			goto fail_io;
+			return -EIO;
 		process_control_msg(xprt_info, (void *) r2r_buf, hdr.size);
 		goto done;
 	}
 
 	if (hdr.size < sizeof(pm)) {
 		DIAG("runt packet (no pacmark)\n");
-		goto fail_data;
+		return -EINVAL;
 	}
 	if (rr_read(xprt_info, &pm, sizeof(pm)))
-		goto fail_io;
+		return -EIO;
 
 	hdr.size -= sizeof(pm);
+	mid = PACMARK_MID(pm);
 
-	frag = rr_malloc(hdr.size + sizeof(*frag));
-	frag->next = NULL;
-	frag->length = hdr.size;
-	if (rr_read(xprt_info, frag->data, hdr.size))
-		goto fail_io;
+	ept = rpcrouter_lookup_local_endpoint(hdr.dst_cid);
+	if (!ept) {
+		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
+		pkt = rr_alloc_packet(&hdr, mid);
+		if (rr_read_fragment(xprt_info, pkt, hdr.size)) {
+			rr_free_packet(pkt);
+			return -EIO;
+		}
+		rr_free_packet(pkt);
+		goto done;
+	}
+
+	/* Append this fragment to the partial packet with our mid, or
+	 * start a new packet if the mid is new.
+	 */
+	pkt = rr_get_incomplete(ept, mid);
+	if (!pkt)
+		pkt = rr_alloc_packet(&hdr, mid);
+	if (rr_read_fragment(xprt_info, pkt, hdr.size)) {
+		rr_free_packet(pkt);
+		return -EIO;
+	}
 
 #if defined(CONFIG_MSM_ONCRPCROUTER_DEBUG)
+	rq = (struct rpc_request_hdr *) pkt->first->data;
 	if ((smd_rpcrouter_debug_mask & RAW_PMR) &&
 	    ((pm >> 30 & 0x1) || (pm >> 31 & 0x1))) {
 		uint32_t xid = 0;
-		if (pm >> 30 & 0x1) {
-			rq = (struct rpc_request_hdr *) frag->data;
+		if (pm >> 30 & 0x1)
 			xid = ntohl(rq->xid);
-		}
 		if ((pm >> 31 & 0x1) || (pm >> 30 & 0x1))
 			RAW_PMR_NOMASK("xid:0x%03x first=%i,last=%i,mid=%3i,"
 				       "len=%3i,dst_cid=%08x\n",
@@ -1011,7 +1174,6 @@ static void do_read_data(struct work_struct *work)
 	}
 
 	if (smd_rpcrouter_debug_mask & SMEM_LOG) {
-		rq = (struct rpc_request_hdr *) frag->data;
 		if (rq->xid == 0)
 			smem_log_event(SMEM_LOG_PROC_ID_APPS |
 				       RPC_ROUTER_LOG_EVENT_MID_READ,
@@ -1027,56 +1189,13 @@ static void do_read_data(struct work_struct *work)
 	}
 #endif
 
-	ept = rpcrouter_lookup_local_endpoint(hdr.dst_cid);
-	if (!ept) {
-		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
-		kfree(frag);
-		goto done;
-	}
-
-	/* See if there is already a partial packet that matches our mid
-	 * and if so, append this fragment to that packet.
-	 */
-	mid = PACMARK_MID(pm);
-	spin_lock_irqsave(&ept->incomplete_lock, flags);
-	list_for_each_entry(pkt, &ept->incomplete, list) {
-		if (pkt->mid == mid) {
-			pkt->last->next = frag;
-			pkt->last = frag;
-			pkt->length += frag->length;
-			if (PACMARK_LAST(pm)) {
-				list_del(&pkt->list);
-				spin_unlock_irqrestore(&ept->incomplete_lock,
-						       flags);
-				goto packet_complete;
-			}
-			spin_unlock_irqrestore(&ept->incomplete_lock, flags);
-			goto done;
-		}
-	}
-	spin_unlock_irqrestore(&ept->incomplete_lock, flags);
-	/* This mid is new -- create a packet for it, and put it on
-	 * the incomplete list if this fragment is not a last fragment,
-	 * otherwise put it on the read queue.
-	 */
-	pkt = rr_malloc(sizeof(struct rr_packet));
-	pkt->first = frag;
-	pkt->last = frag;
-	memcpy(&pkt->hdr, &hdr, sizeof(hdr));
-	pkt->mid = mid;
-	pkt->length = frag->length;
-	if (!PACMARK_LAST(pm)) {
+	if (PACMARK_LAST(pm)) {
+		rr_queue_packet(ept, pkt);
+	} else {
+		spin_lock_irqsave(&ept->incomplete_lock, flags);
 		list_add_tail(&pkt->list, &ept->incomplete);
-		goto done;
+		spin_unlock_irqrestore(&ept->incomplete_lock, flags);
 	}
-
-packet_complete:
-	spin_lock_irqsave(&ept->read_q_lock, flags);
-	D("%s: take read lock on ept %p\n", __func__, ept);
-	wake_lock(&ept->read_q_wake_lock);
-	list_add_tail(&pkt->list, &ept->read_q);
-	wake_up(&ept->wait_q);
-	spin_unlock_irqrestore(&ept->read_q_lock, flags);
 done:
 
 	if (hdr.confirm_rx) {
@@ -1099,12 +1218,22 @@ done:
 #endif
 
 	}
+	return 0;
+}
 
-	queue_work(xprt_info->workqueue, &xprt_info->read_data);
-	return;
+/* Each transport has its own reader, which stays in here for as long as
+ * the transport is up rather than being requeued for every packet.
+ */
+static void do_read_data(struct work_struct *work)
+{
+	struct rpcrouter_xprt_info *xprt_info =
+		container_of(work,
+			     struct rpcrouter_xprt_info,
+			     read_data);
+
+	while (!rr_read_packet(xprt_info))
+		cond_resched();
 
-fail_io:
-fail_data:
 	printk(KERN_ERR "rpc_router has died\n");
 }
 
@@ -1130,6 +1259,7 @@ struct msm_rpc_endpoint *msm_rpc_open(void)
 
 	return ept;
 }
+EXPORT_SYMBOL(msm_rpc_open);
 
 int msm_rpc_close(struct msm_rpc_endpoint *ept)
 {
@@ -1546,35 +1676,26 @@ EXPORT_SYMBOL(msm_rpc_write);
 int msm_rpc_read(struct msm_rpc_endpoint *ept, void **buffer,
 		 unsigned user_len, long timeout)
 {
-	struct rr_fragment *frag, *next;
+	struct rr_fragment *frag, *first;
 	char *buf;
 	int rc;
 
-	rc = __msm_rpc_read(ept, &frag, user_len, timeout);
+	rc = __msm_rpc_read(ept, &first, user_len, timeout);
 	if (rc <= 0)
 		return rc;
 
-	/* single-fragment messages conveniently can be
-	 * returned as-is (the buffer is at the front)
-	 */
-	if (frag->next == 0) {
-		*buffer = (void*) frag;
-		return rc;
-	}
-
-	/* multi-fragment messages, we have to do it the
-	 * hard way, which is rather disgusting right now
+	/* callers kfree() the buffer, so even single-fragment
+	 * messages are copied out rather than handing over a
+	 * fragment that belongs to rr_frag_pool
 	 */
 	buf = rr_malloc(rc);
 	*buffer = buf;
 
-	while (frag != NULL) {
+	for (frag = first; frag != NULL; frag = frag->next) {
 		memcpy(buf, frag->data, frag->length);
-		next = frag->next;
 		buf += frag->length;
-		kfree(frag);
-		frag = next;
 	}
+	msm_rpcrouter_free_fragments(first);
 
 	return rc;
 }
@@ -1597,6 +1718,8 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 {
 	struct rpc_request_hdr *req = _request;
 	struct rpc_reply_hdr *reply;
+	int reply_len = -EIO;
+	ktime_t start;
 	int rc;
 
 	if (request_size < sizeof(*req))
@@ -1612,14 +1735,15 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 	req->vers = ept->dst_vers;
 	req->procedure = cpu_to_be32(proc);
 
+	start = ktime_get();
 	rc = msm_rpc_write(ept, req, request_size);
 	if (rc < 0)
-		return rc;
+		goto out;
 
 	for (;;) {
 		rc = msm_rpc_read(ept, (void*) &reply, -1, timeout);
 		if (rc < 0)
-			return rc;
+			goto out;
 		if (rc < (3 * sizeof(uint32_t))) {
 			rc = -EIO;
 			break;
@@ -1637,6 +1761,7 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 			kfree(reply);
 			continue;
 		}
+		reply_len = rc;
 		if (reply->reply_stat != 0) {
 			rc = -EPERM;
 			break;
@@ -1657,10 +1782,173 @@ int msm_rpc_call_reply(struct msm_rpc_endpoint *ept, uint32_t proc,
 		break;
 	}
 	kfree(reply);
+out:
+	msm_rpcrouter_stats_call(be32_to_cpu(ept->dst_prog), proc, request_size,
+				 reply_len >= 0 ? reply_len : rc, start);
 	return rc;
 }
 EXPORT_SYMBOL(msm_rpc_call_reply);
 
+/* Room in an endpoint's send buffer for one msm_rpc_call_desc() request */
+#define RR_CALL_BUF_SIZE	1024
+
+static int rr_call_decode_reply(struct rpc_reply_hdr *reply, int len,
+				const struct msm_rpc_xdr_desc *ret_desc,
+				void *ret)
+{
+	struct msm_rpc_xdr xdr;
+
+	if (len < 3 * sizeof(uint32_t))
+		return -EIO;
+	if (reply->reply_stat != 0)
+		return -EPERM;
+	if (len < sizeof(*reply))
+		return -EIO;
+	if (reply->data.acc_hdr.accept_stat != 0)
+		return -EINVAL;
+	if (!ret_desc)
+		return 0;
+
+	xdr.in_buf = reply;
+	xdr.in_size = len;
+	xdr.in_index = sizeof(*reply);
+	return xdr_recv_desc(&xdr, ret_desc, ret) ? -EIO : 0;
+}
+
+/*
+ * ONC RPC has no message carrying several calls, so a batch is
+ * pipelined instead: every request is written before the first reply is
+ * waited for, and the calls cost one round trip between them rather than
+ * one each.  The server still runs them one at a time, in order.
+ */
+int msm_rpc_call_batch(struct msm_rpc_endpoint *ept,
+		       struct msm_rpc_call *calls, int n, long timeout)
+{
+	uint32_t xid[MSM_RPC_MAX_BATCH], len[MSM_RPC_MAX_BATCH];
+	unsigned long deadline = jiffies + timeout;
+	struct rpc_request_hdr *req;
+	struct rpc_reply_hdr *reply;
+	struct msm_rpc_xdr xdr;
+	int i, rc, pending = 0;
+	ktime_t start;
+
+	if (n <= 0 || n > MSM_RPC_MAX_BATCH)
+		return -EINVAL;
+
+	if (ept->dst_pid == 0xffffffff)
+		return -ENOTCONN;
+
+	mutex_lock(&ept->call_lock);
+	if (!ept->call_buf) {
+		ept->call_buf = kmalloc(RR_CALL_BUF_SIZE, GFP_KERNEL);
+		if (!ept->call_buf) {
+			mutex_unlock(&ept->call_lock);
+			return -ENOMEM;
+		}
+	}
+	req = ept->call_buf;
+
+	start = ktime_get();
+	for (i = 0; i < n; i++) {
+		memset(req, 0, sizeof(*req));
+		req->xid = cpu_to_be32(atomic_add_return(1, &next_xid));
+		req->rpc_vers = cpu_to_be32(2);
+		req->prog = ept->dst_prog;
+		req->vers = ept->dst_vers;
+		req->procedure = cpu_to_be32(calls[i].proc);
+		xid[i] = req->xid;
+
+		xdr.out_buf = req;
+		xdr.out_size = RR_CALL_BUF_SIZE;
+		xdr.out_index = sizeof(*req);
+		if (calls[i].args_desc &&
+		    xdr_send_desc(&xdr, calls[i].args_desc, calls[i].args)) {
+			calls[i].rc = -EINVAL;
+			continue;
+		}
+		len[i] = xdr.out_index;
+
+		rc = msm_rpc_write(ept, req, len[i]);
+		if (rc < 0) {
+			calls[i].rc = rc;
+			msm_rpcrouter_stats_call(be32_to_cpu(ept->dst_prog),
+						 calls[i].proc, len[i], rc,
+						 start);
+			continue;
+		}
+		calls[i].rc = -EINPROGRESS;
+		pending++;
+	}
+
+	rc = 0;
+	while (pending) {
+		long left = -1;
+
+		if (timeout >= 0) {
+			left = (long)(deadline - jiffies);
+			if (left <= 0)
+				left = 1;
+		}
+		rc = msm_rpc_read(ept, (void **)&reply, -1, left);
+		if (rc < 0)
+			break;
+
+		/* drop CALLs, and replies to calls that timed out earlier */
+		i = n;
+		if (rc >= 3 * sizeof(uint32_t) && reply->type != 0)
+			for (i = 0; i < n; i++)
+				if (calls[i].rc == -EINPROGRESS &&
+				    reply->xid == xid[i])
+					break;
+		if (i == n) {
+			kfree(reply);
+			continue;
+		}
+
+		calls[i].rc = rr_call_decode_reply(reply, rc,
+						   calls[i].ret_desc,
+						   calls[i].ret);
+		msm_rpcrouter_stats_call(be32_to_cpu(ept->dst_prog),
+					 calls[i].proc, len[i],
+					 calls[i].rc < 0 ? calls[i].rc : rc,
+					 start);
+		kfree(reply);
+		pending--;
+	}
+
+	for (i = 0; pending && i < n; i++) {
+		if (calls[i].rc != -EINPROGRESS)
+			continue;
+		calls[i].rc = rc;
+		msm_rpcrouter_stats_call(be32_to_cpu(ept->dst_prog),
+					 calls[i].proc, len[i], rc, start);
+		pending--;
+	}
+	mutex_unlock(&ept->call_lock);
+	return 0;
+}
+EXPORT_SYMBOL(msm_rpc_call_batch);
+
+int msm_rpc_call_desc(struct msm_rpc_endpoint *ept, uint32_t proc,
+		      const struct msm_rpc_xdr_desc *args_desc,
+		      const void *args,
+		      const struct msm_rpc_xdr_desc *ret_desc, void *ret,
+		      long timeout)
+{
+	struct msm_rpc_call call = {
+		.proc = proc,
+		.args_desc = args_desc,
+		.args = args,
+		.ret_desc = ret_desc,
+		.ret = ret,
+	};
+	int rc;
+
+	rc = msm_rpc_call_batch(ept, &call, 1, timeout);
+	return rc ? rc : call.rc;
+}
+EXPORT_SYMBOL(msm_rpc_call_desc);
+
 
 static inline int ept_packet_available(struct msm_rpc_endpoint *ept)
 {
@@ -1760,7 +2048,7 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		set_pend_reply(ept, reply);
 	}
 
-	kfree(pkt);
+	mempool_free(pkt, rr_pkt_pool);
 
 	IO("READ on ept %p (%d bytes)\n", ept, rc);
 
@@ -1945,6 +2233,7 @@ int msm_rpc_register_server(struct msm_rpc_endpoint *ept,
 	spin_unlock_irqrestore(&xprt_info_list_lock, flags);
 	return 0;
 }
+EXPORT_SYMBOL(msm_rpc_register_server);
 
 int msm_rpc_clear_netreset(struct msm_rpc_endpoint *ept)
 {
@@ -1971,6 +2260,7 @@ int msm_rpc_unregister_server(struct msm_rpc_endpoint *ept,
 	rpcrouter_destroy_server(server);
 	return 0;
 }
+EXPORT_SYMBOL(msm_rpc_unregister_server);
 
 int msm_rpc_get_curr_pkt_size(struct msm_rpc_endpoint *ept)
 {
@@ -2136,6 +2426,163 @@ static int dump_msm_rpc_endpoint(char *buf, int max)
 	return i;
 }
 
+/* Per (prog, proc) accounting of the calls made by apps clients, so
+ * that the modem RPCs which hold up boot or resume can be found.
+ */
+#define RR_STATS_ENTRIES	128
+/* Round trip times by power of two microseconds; the last bucket is open */
+#define RR_STATS_LAT_BUCKETS	24
+
+struct rr_call_stats {
+	uint32_t prog;
+	uint32_t proc;
+	unsigned long calls;
+	unsigned long replies;
+	unsigned long timeouts;
+	unsigned long long bytes;
+	u64 total_us;
+	u64 max_us;
+	unsigned long lat[RR_STATS_LAT_BUCKETS];
+};
+
+static struct rr_call_stats rr_call_stats[RR_STATS_ENTRIES];
+static unsigned long rr_call_stats_dropped;
+static DEFINE_SPINLOCK(rr_call_stats_lock);
+
+static struct rr_call_stats *rr_find_call_stats(uint32_t prog, uint32_t proc)
+{
+	struct rr_call_stats *st;
+	unsigned i, n;
+
+	i = hash_32(prog ^ (proc << 16), ilog2(RR_STATS_ENTRIES));
+	for (n = 0; n < RR_STATS_ENTRIES; n++) {
+		st = &rr_call_stats[(i + n) % RR_STATS_ENTRIES];
+		if (st->calls && st->prog == prog && st->proc == proc)
+			return st;
+		if (!st->calls) {
+			st->prog = prog;
+			st->proc = proc;
+			return st;
+		}
+	}
+	return NULL;
+}
+
+void msm_rpcrouter_stats_call(uint32_t prog, uint32_t proc,
+			      uint32_t req_len, int reply_len, ktime_t start)
+{
+	struct rr_call_stats *st;
+	unsigned long flags;
+	s64 us;
+	int b;
+
+	us = ktime_us_delta(ktime_get(), start);
+	if (us < 0)
+		us = 0;
+	b = us > 0 ? fls64(us) : 0;
+	if (b >= RR_STATS_LAT_BUCKETS)
+		b = RR_STATS_LAT_BUCKETS - 1;
+
+	spin_lock_irqsave(&rr_call_stats_lock, flags);
+	st = rr_find_call_stats(prog, proc);
+	if (!st) {
+		rr_call_stats_dropped++;
+		spin_unlock_irqrestore(&rr_call_stats_lock, flags);
+		return;
+	}
+	st->calls++;
+	st->bytes += req_len;
+	if (reply_len >= 0) {
+		st->replies++;
+		st->bytes += reply_len;
+		st->total_us += us;
+		if (us > st->max_us)
+			st->max_us = us;
+		st->lat[b]++;
+	} else if (reply_len == -ETIMEDOUT) {
+		st->timeouts++;
+		st->total_us += us;
+	}
+	spin_unlock_irqrestore(&rr_call_stats_lock, flags);
+}
+
+static int dump_call_stats_show(struct seq_file *m, void *unused)
+{
+	struct rr_call_stats *st, *copy;
+	unsigned long dropped;
+	unsigned long flags;
+	const char *sym;
+	int i, b;
+
+	/* don't hold the callers, and interrupts, off while printing */
+	copy = kmalloc(sizeof(rr_call_stats), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+	spin_lock_irqsave(&rr_call_stats_lock, flags);
+	memcpy(copy, rr_call_stats, sizeof(rr_call_stats));
+	dropped = rr_call_stats_dropped;
+	spin_unlock_irqrestore(&rr_call_stats_lock, flags);
+
+	seq_printf(m, "%-10s %-4s %-24s %8s %8s %8s %10s %12s %10s\n",
+		   "prog", "proc", "name", "calls", "replies", "timeouts",
+		   "bytes", "total_us", "max_us");
+
+	for (i = 0; i < RR_STATS_ENTRIES; i++) {
+		st = &copy[i];
+		if (!st->calls)
+			continue;
+		sym = smd_rpc_get_sym(st->prog);
+		seq_printf(m, "0x%08x %4u %-24s %8lu %8lu %8lu %10llu %12llu "
+			   "%10llu\n", st->prog, st->proc, sym ? sym : "-",
+			   st->calls, st->replies, st->timeouts, st->bytes,
+			   st->total_us, st->max_us);
+		if (!st->replies)
+			continue;
+		seq_printf(m, "    us:");
+		for (b = 0; b < RR_STATS_LAT_BUCKETS; b++)
+			if (st->lat[b])
+				seq_printf(m, " %s%llu:%lu",
+					   b == RR_STATS_LAT_BUCKETS - 1 ?
+					   ">=" : "<",
+					   b == RR_STATS_LAT_BUCKETS - 1 ?
+					   1ULL << (b - 1) : 1ULL << b,
+					   st->lat[b]);
+		seq_printf(m, "\n");
+	}
+	if (dropped)
+		seq_printf(m, "%lu calls not counted, table full\n", dropped);
+
+	kfree(copy);
+	return 0;
+}
+
+static int dump_call_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dump_call_stats_show, NULL);
+}
+
+/* Any write clears the counters, e.g. just before a suspend */
+static ssize_t dump_call_stats_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rr_call_stats_lock, flags);
+	memset(rr_call_stats, 0, sizeof(rr_call_stats));
+	rr_call_stats_dropped = 0;
+	spin_unlock_irqrestore(&rr_call_stats_lock, flags);
+	return count;
+}
+
+static const struct file_operations dump_call_stats_ops = {
+	.open = dump_call_stats_open,
+	.read = seq_read,
+	.write = dump_call_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -2179,6 +2626,8 @@ static void debugfs_init(void)
 		     dump_remote_endpoints);
 	debug_create("dump_servers", 0444, dent,
 		     dump_servers);
+	debugfs_create_file("dump_call_stats", 0644, dent, NULL,
+			    &dump_call_stats_ops);
 
 }
 
@@ -2265,6 +2714,18 @@ static int __init rpcrouter_init(void)
 
 	msm_rpc_connect_timeout_ms = 0;
 	smd_rpcrouter_debug_mask |= SMEM_LOG;
+
+	rr_frag_pool = mempool_create_kmalloc_pool(RR_FRAG_POOL_MIN,
+						   sizeof(struct rr_fragment));
+	if (!rr_frag_pool)
+		return -ENOMEM;
+	rr_pkt_pool = mempool_create_kmalloc_pool(RR_PKT_POOL_MIN,
+						  sizeof(struct rr_packet));
+	if (!rr_pkt_pool) {
+		mempool_destroy(rr_frag_pool);
+		return -ENOMEM;
+	}
+
 	debugfs_init();
 
 	/* Initialize what we need to start processing */
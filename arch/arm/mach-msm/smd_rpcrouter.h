@@ -24,6 +24,8 @@
 #include <linux/platform_device.h>
 #include <linux/msm_rpcrouter.h>
 #include <linux/wakelock.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
 
 #include <mach/msm_smd.h>
 #include <mach/msm_rpcrouter.h>
@@ -101,6 +103,7 @@ struct rr_packet {
 	struct rr_header hdr;
 	uint32_t mid;
 	uint32_t length;
+	uint32_t priority;
 };
 
 #define PACMARK_LAST(n) ((n) & 0x80000000)
@@ -193,6 +196,10 @@ struct msm_rpc_endpoint {
 
 	/* device node if this endpoint is accessed via userspace */
 	dev_t dev;
+
+	/* send buffer of msm_rpc_call_desc(), allocated on first use */
+	struct mutex call_lock;
+	void *call_buf;
 };
 
 enum write_data_type {
@@ -217,6 +224,19 @@ void msm_rpcrouter_xprt_notify(struct rpcrouter_xprt *xprt, unsigned event);
 int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		   struct rr_fragment **frag,
 		   unsigned len, long timeout);
+void msm_rpcrouter_free_fragments(struct rr_fragment *frag);
+
+/* Account for a call made at start; reply_len is the size of the reply,
+ * or the error when there was none (-ETIMEDOUT counts as a timeout).
+ */
+#if defined(CONFIG_DEBUG_FS)
+void msm_rpcrouter_stats_call(uint32_t prog, uint32_t proc,
+			      uint32_t req_len, int reply_len, ktime_t start);
+#else
+static inline void msm_rpcrouter_stats_call(uint32_t prog, uint32_t proc,
+					    uint32_t req_len, int reply_len,
+					    ktime_t start) {}
+#endif
 
 int msm_rpcrouter_close(void);
 struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev);
@@ -449,6 +449,9 @@ int msm_rpc_client_req(struct msm_rpc_client *client, uint32_t proc,
 	struct rpc_reply_hdr *rpc_rsp;
 	int rc = 0;
 	uint32_t req_xid;
+	uint32_t req_len;
+	int reply_len = -EIO;
+	ktime_t start;
 
 	mutex_lock(&client->req_lock);
 
@@ -467,11 +470,13 @@ int msm_rpc_client_req(struct msm_rpc_client *client, uint32_t proc,
 			client->xdr.out_index += rc;
 	}
 
+	req_len = client->xdr.out_index;
+	start = ktime_get();
 	rc = msm_rpc_write(client->ept, client->xdr.out_buf,
 			   client->xdr.out_index);
 	if (rc < 0) {
 		pr_err("%s: couldn't send RPC request:%d\n", __func__, rc);
-		goto release_locks;
+		goto account;
 	} else
 		rc = 0;
 
@@ -484,7 +489,7 @@ int msm_rpc_client_req(struct msm_rpc_client *client, uint32_t proc,
 		if (rc == 0) {
 			pr_err("%s: request timeout\n", __func__);
 			rc = -ETIMEDOUT;
-			goto release_locks;
+			goto account;
 		}
 
 		rpc_rsp = (struct rpc_reply_hdr *)client->xdr.in_buf;
@@ -497,6 +502,7 @@ int msm_rpc_client_req(struct msm_rpc_client *client, uint32_t proc,
 		} else
 			rc = 0;
 	} while (rc);
+	reply_len = client->xdr.in_size;
 
 	if (be32_to_cpu(rpc_rsp->reply_stat) != RPCMSG_REPLYSTAT_ACCEPTED) {
 		pr_err("%s: RPC call was denied! %d\n", __func__,
@@ -519,6 +525,9 @@ int msm_rpc_client_req(struct msm_rpc_client *client, uint32_t proc,
  free_and_release:
 	xdr_clean_input(&client->xdr);
 	client->xdr.out_index = 0;
+ account:
+	msm_rpcrouter_stats_call(client->prog, proc, req_len,
+				 reply_len >= 0 ? reply_len : rc, start);
  release_locks:
 	mutex_unlock(&client->req_lock);
 	return rc;
@@ -563,6 +572,9 @@ int msm_rpc_client_req2(struct msm_rpc_client *client, uint32_t proc,
 	struct rpc_reply_hdr rpc_rsp;
 	int rc = 0;
 	uint32_t req_xid;
+	uint32_t req_len;
+	int reply_len = -EIO;
+	ktime_t start;
 
 	mutex_lock(&client->req_lock);
 
@@ -576,10 +588,12 @@ int msm_rpc_client_req2(struct msm_rpc_client *client, uint32_t proc,
 		}
 	}
 
+	req_len = client->xdr.out_index;
+	start = ktime_get();
 	rc = xdr_send_msg(&client->xdr);
 	if (rc < 0) {
 		pr_err("%s: couldn't send RPC request:%d\n", __func__, rc);
-		goto release_locks;
+		goto account;
 	} else
 		rc = 0;
 
@@ -592,7 +606,7 @@ int msm_rpc_client_req2(struct msm_rpc_client *client, uint32_t proc,
 		if (rc == 0) {
 			pr_err("%s: request timeout\n", __func__);
 			rc = -ETIMEDOUT;
-			goto release_locks;
+			goto account;
 		}
 
 		xdr_recv_reply(&client->xdr, &rpc_rsp);
@@ -605,6 +619,7 @@ int msm_rpc_client_req2(struct msm_rpc_client *client, uint32_t proc,
 		} else
 			rc = 0;
 	} while (rc);
+	reply_len = client->xdr.in_size;
 
 	if (rpc_rsp.reply_stat != RPCMSG_REPLYSTAT_ACCEPTED) {
 		pr_err("%s: RPC call was denied! %d\n",
@@ -627,6 +642,9 @@ int msm_rpc_client_req2(struct msm_rpc_client *client, uint32_t proc,
 	xdr_clean_input(&client->xdr);
 	/* TODO: put it in xdr_reset_output */
 	client->xdr.out_index = 0;
+ account:
+	msm_rpcrouter_stats_call(client->prog, proc, req_len,
+				 reply_len >= 0 ? reply_len : rc, start);
  release_locks:
 	mutex_unlock(&client->req_lock);
 	return rc;
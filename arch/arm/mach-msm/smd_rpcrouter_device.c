@@ -87,28 +87,26 @@ static ssize_t rpcrouter_read(struct file *filp, char __user *buf,
 			      size_t count, loff_t *ppos)
 {
 	struct msm_rpc_endpoint *ept;
-	struct rr_fragment *frag, *next;
+	struct rr_fragment *frag, *first;
 	int rc;
 
 	ept = (struct msm_rpc_endpoint *) filp->private_data;
 
-	rc = __msm_rpc_read(ept, &frag, count, -1);
+	rc = __msm_rpc_read(ept, &first, count, -1);
 	if (rc < 0)
 		return rc;
 
 	count = rc;
 
-	while (frag != NULL) {		
+	for (frag = first; frag != NULL; frag = frag->next) {
 		if (copy_to_user(buf, frag->data, frag->length)) {
 			printk(KERN_ERR
 			       "rpcrouter: could not copy all read data to user!\n");
 			rc = -EFAULT;
 		}
 		buf += frag->length;
-		next = frag->next;
-		kfree(frag);
-		frag = next;
 	}
+	msm_rpcrouter_free_fragments(first);
 
 	return rc;
 }
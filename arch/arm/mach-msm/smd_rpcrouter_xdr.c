@@ -25,6 +25,7 @@
 #include <linux/kernel.h>
 #include <linux/delay.h>
 #include <linux/sched.h>
+#include <linux/module.h>
 
 #include <mach/msm_rpcrouter.h>
 
@@ -173,6 +174,149 @@ int xdr_recv_bytes(struct msm_rpc_xdr *xdr, void **data,
 	return 0;
 }
 
+static uint32_t xdr_desc_load(const void *p, unsigned size, int is_signed)
+{
+	switch (size) {
+	case 1:
+		return is_signed ? *(const int8_t *)p : *(const uint8_t *)p;
+	case 2:
+		return is_signed ? *(const int16_t *)p : *(const uint16_t *)p;
+	default:
+		return *(const uint32_t *)p;
+	}
+}
+
+static void xdr_desc_store(void *p, unsigned size, uint32_t value)
+{
+	switch (size) {
+	case 1:
+		*(uint8_t *)p = value;
+		break;
+	case 2:
+		*(uint16_t *)p = value;
+		break;
+	default:
+		*(uint32_t *)p = value;
+		break;
+	}
+}
+
+static int xdr_send_opaque(struct msm_rpc_xdr *xdr, const void *data,
+			   uint32_t size)
+{
+	uint32_t padded = ALIGN(size, sizeof(uint32_t));
+
+	if ((xdr->out_index + padded) > xdr->out_size) {
+		pr_err("%s: xdr out buffer full\n", __func__);
+		return -1;
+	}
+
+	memcpy(xdr->out_buf + xdr->out_index, data, size);
+	memset(xdr->out_buf + xdr->out_index + size, 0, padded - size);
+	xdr->out_index += padded;
+	return 0;
+}
+
+static int xdr_recv_opaque(struct msm_rpc_xdr *xdr, void *data, uint32_t size)
+{
+	uint32_t padded = ALIGN(size, sizeof(uint32_t));
+
+	if ((xdr->in_index + padded) > xdr->in_size) {
+		pr_err("%s: xdr in buffer full\n", __func__);
+		return -1;
+	}
+
+	memcpy(data, xdr->in_buf + xdr->in_index, size);
+	xdr->in_index += padded;
+	return 0;
+}
+
+int xdr_send_desc(struct msm_rpc_xdr *xdr,
+		  const struct msm_rpc_xdr_desc *desc, const void *data)
+{
+	const struct msm_rpc_xdr_field *f;
+	const void *bytes;
+	uint32_t value;
+	int rc;
+
+	for (f = desc->fields; f < desc->fields + desc->nr_fields; f++) {
+		const void *p = data + f->offset;
+
+		switch (f->type) {
+		case MSM_RPC_XDR_UINT:
+		case MSM_RPC_XDR_INT:
+			value = xdr_desc_load(p, f->size,
+					      f->type == MSM_RPC_XDR_INT);
+			rc = xdr_send_uint32(xdr, &value);
+			break;
+		case MSM_RPC_XDR_OPAQUE:
+			rc = xdr_send_opaque(xdr, p, f->size);
+			break;
+		case MSM_RPC_XDR_BYTES:
+			bytes = *(const void **)p;
+			value = *(const uint32_t *)(data + f->size);
+			if (value)
+				rc = xdr_send_bytes(xdr, &bytes, &value);
+			else
+				rc = xdr_send_uint32(xdr, &value);
+			break;
+		default:
+			rc = -1;
+			break;
+		}
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(xdr_send_desc);
+
+int xdr_recv_desc(struct msm_rpc_xdr *xdr,
+		  const struct msm_rpc_xdr_desc *desc, void *data)
+{
+	const struct msm_rpc_xdr_field *f;
+	uint32_t value, *room;
+	int rc;
+
+	for (f = desc->fields; f < desc->fields + desc->nr_fields; f++) {
+		void *p = data + f->offset;
+
+		switch (f->type) {
+		case MSM_RPC_XDR_UINT:
+		case MSM_RPC_XDR_INT:
+			rc = xdr_recv_uint32(xdr, &value);
+			if (!rc)
+				xdr_desc_store(p, f->size, value);
+			break;
+		case MSM_RPC_XDR_OPAQUE:
+			rc = xdr_recv_opaque(xdr, p, f->size);
+			break;
+		case MSM_RPC_XDR_BYTES:
+			room = data + f->size;
+			rc = xdr_recv_uint32(xdr, &value);
+			if (rc)
+				break;
+			if (value > *room) {
+				pr_err("%s: %u bytes for %u of room\n",
+				       __func__, value, *room);
+				rc = -1;
+				break;
+			}
+			rc = xdr_recv_opaque(xdr, *(void **)p, value);
+			if (!rc)
+				*room = value;
+			break;
+		default:
+			rc = -1;
+			break;
+		}
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(xdr_recv_desc);
+
 int xdr_send_pointer(struct msm_rpc_xdr *xdr, void **obj,
 		     uint32_t obj_size, void *xdr_op)
 {
@@ -39,6 +39,8 @@
 	(PMEM_MAX_USER_SPACE_DEVICES + PMEM_MAX_KERNEL_SPACE_DEVICES)
 
 #define PMEM_MAX_ORDER (128)
+/* orders the buddy allocator keeps free lists for */
+#define PMEM_BUDDY_MAX_ORDER BITS_PER_LONG
 #define PMEM_MIN_ALLOC PAGE_SIZE
 
 #define PMEM_INITIAL_NUM_BITMAP_ALLOCATIONS (64)
@@ -100,6 +102,7 @@ struct pmem_data {
 struct pmem_bits {
 	unsigned allocated:1;		/* 1 if allocated, 0 if free */
 	unsigned order:7;		/* size of the region in pmem space */
+	struct list_head free;		/* entry in the free list of order */
 };
 
 struct pmem_region_node {
@@ -191,6 +194,20 @@ struct pmem_info {
 			 */
 
 			struct pmem_bits *buddy_bitmap;
+
+			/* free blocks of each order, with a mask of the
+			 * orders that have any, so that allocation and free
+			 * never need to walk the bitmap */
+			struct list_head free_area[PMEM_BUDDY_MAX_ORDER];
+			unsigned long nr_free[PMEM_BUDDY_MAX_ORDER];
+			unsigned long free_orders;
+			unsigned long free_quanta;
+
+			/* allocation attempts and failures, and the failures
+			 * that there were enough free quanta for */
+			unsigned long allocs;
+			unsigned long failures;
+			unsigned long frag_failures;
 		} buddy_bestfit;
 
 		struct {
@@ -460,6 +477,55 @@ static ssize_t show_pmem_buddy_bitmap_dump(int id, char *buf)
 }
 RO_PMEM_ATTR(buddy_bitmap_dump);
 
+static ssize_t show_pmem_buddy_free_blocks(int id, char *buf)
+{
+	int ret, order;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "order\tlength\tfree\n");
+
+	for (order = 0; order < PMEM_BUDDY_MAX_ORDER; order++)
+		if (pmem[id].allocator.buddy_bestfit.nr_free[order])
+			ret += scnprintf(buf + ret, PAGE_SIZE - ret,
+				"%d\t%lu\t%lu\n", order,
+				(1UL << order) * pmem[id].quantum,
+				pmem[id].allocator.buddy_bestfit.nr_free[order]);
+
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(buddy_free_blocks);
+
+/*
+ * unusable_index is the part of the free space, in percent, that lies
+ * outside the largest free block and so can't back a maximal allocation.
+ */
+static ssize_t show_pmem_fragmentation(int id, char *buf)
+{
+	unsigned long free, largest = 0;
+	unsigned int unusable = 0;
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	free = pmem[id].allocator.buddy_bestfit.free_quanta;
+	if (pmem[id].allocator.buddy_bestfit.free_orders)
+		largest = 1UL << __fls(pmem[id].allocator.buddy_bestfit.
+				       free_orders);
+	if (free)
+		unusable = (free - largest) * 100 / free;
+
+	ret = scnprintf(buf, PAGE_SIZE,
+		"free %lu\nlargest %lu\nunusable_index %u\n"
+		"allocs %lu\nfailures %lu\nfragmented_failures %lu\n",
+		free * pmem[id].quantum, largest * pmem[id].quantum, unusable,
+		pmem[id].allocator.buddy_bestfit.allocs,
+		pmem[id].allocator.buddy_bestfit.failures,
+		pmem[id].allocator.buddy_bestfit.frag_failures);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(fragmentation);
+
 #define PMEM_BITMAP_BUDDY_BESTFIT_COMMON_SYSFS_ATTRS \
 	&pmem_attr_quantum_size.attr, \
 	&pmem_attr_total_entries.attr
@@ -470,6 +536,8 @@ static struct attribute *pmem_buddy_bestfit_attrs[] = {
 	PMEM_BITMAP_BUDDY_BESTFIT_COMMON_SYSFS_ATTRS,
 
 	&pmem_attr_buddy_bitmap_dump.attr,
+	&pmem_attr_buddy_free_blocks.attr,
+	&pmem_attr_fragmentation.attr,
 
 	NULL
 };
@@ -604,25 +672,52 @@ static int pmem_free_space_all_or_nothing(int id,
 }
 
 
+static void pmem_buddy_add_free(int id, int index)
+{
+	/* caller should hold the lock on arena_mutex! */
+	int order = PMEM_BUDDY_ORDER(id, index);
+
+	pmem[id].allocator.buddy_bestfit.buddy_bitmap[index].allocated = 0;
+	list_add(&pmem[id].allocator.buddy_bestfit.buddy_bitmap[index].free,
+		 &pmem[id].allocator.buddy_bestfit.free_area[order]);
+	pmem[id].allocator.buddy_bestfit.nr_free[order]++;
+	pmem[id].allocator.buddy_bestfit.free_orders |= 1UL << order;
+	pmem[id].allocator.buddy_bestfit.free_quanta += 1UL << order;
+}
+
+static void pmem_buddy_del_free(int id, int index)
+{
+	/* caller should hold the lock on arena_mutex! */
+	int order = PMEM_BUDDY_ORDER(id, index);
+
+	list_del_init(&pmem[id].allocator.buddy_bestfit.buddy_bitmap[index].
+		      free);
+	if (!--pmem[id].allocator.buddy_bestfit.nr_free[order])
+		pmem[id].allocator.buddy_bestfit.free_orders &= ~(1UL << order);
+	pmem[id].allocator.buddy_bestfit.free_quanta -= 1UL << order;
+}
+
 static int pmem_free_buddy_bestfit(int id, int index)
 {
 	/* caller should hold the lock on arena_mutex! */
 	int curr = index;
 	DLOG("index %d\n", index);
 
+	if (PMEM_IS_FREE_BUDDY(id, curr))
+		return -1;
 
-	/* clean up the bitmap, merging any buddies */
-	pmem[id].allocator.buddy_bestfit.buddy_bitmap[curr].allocated = 0;
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
 	 * if the buddy is also free merge them
 	 * repeat until the buddy is not free or end of the bitmap is reached
 	 */
+	pmem[id].allocator.buddy_bestfit.buddy_bitmap[curr].allocated = 0;
 	do {
 		int buddy = PMEM_BUDDY_INDEX(id, curr);
 		if (buddy < pmem[id].num_entries &&
 		    PMEM_IS_FREE_BUDDY(id, buddy) &&
 		    PMEM_BUDDY_ORDER(id, buddy) ==
 				PMEM_BUDDY_ORDER(id, curr)) {
+			pmem_buddy_del_free(id, buddy);
 			PMEM_BUDDY_ORDER(id, buddy)++;
 			PMEM_BUDDY_ORDER(id, curr)++;
 			curr = min(buddy, curr);
@@ -631,6 +726,7 @@ static int pmem_free_buddy_bestfit(int id, int index)
 		}
 	} while (curr < pmem[id].num_entries);
 
+	pmem_buddy_add_free(id, curr);
 	return 0;
 }
 
@@ -639,20 +735,13 @@ static int pmem_free_space_buddy_bestfit(int id,
 		struct pmem_freespace *fs)
 {
 	/* caller should hold the lock on arena_mutex! */
-	int curr;
-	unsigned long size;
-	fs->total = 0;
-	fs->largest = 0;
+	unsigned long free_orders =
+		pmem[id].allocator.buddy_bestfit.free_orders;
 
-	for (curr = 0; curr < pmem[id].num_entries;
-	     curr = PMEM_BUDDY_NEXT_INDEX(id, curr)) {
-		if (PMEM_IS_FREE_BUDDY(id, curr)) {
-			size = PMEM_BUDDY_LEN(id, curr);
-			if (size > fs->largest)
-				fs->largest = size;
-			fs->total += size;
-		}
-	}
+	fs->total = pmem[id].allocator.buddy_bestfit.free_quanta *
+		pmem[id].quantum;
+	fs->largest = free_orders ?
+		(1UL << __fls(free_orders)) * pmem[id].quantum : 0;
 	return 0;
 }
 
@@ -922,48 +1011,40 @@ static int pmem_allocator_buddy_bestfit(const int id,
 		unsigned int align)
 {
 	/* caller should hold the lock on arena_mutex! */
-	int curr;
 	int best_fit = -1;
-	unsigned long order;
+	unsigned long order, orders;
+	struct pmem_bits *bits;
 
 	DLOG("buddy bestfit\n");
+	pmem[id].allocator.buddy_bestfit.allocs++;
 	order = pmem_order(len, id);
-	if (order > PMEM_MAX_ORDER)
-		goto out;
+	if (order >= PMEM_BUDDY_MAX_ORDER)
+		goto fail;
 
 	DLOG("order %lx\n", order);
 
-	/* Look through the bitmap.
-	 * 	If a free slot of the correct order is found, use it.
-	 * 	Otherwise, use the best fit (smallest with size > order) slot.
+	/* The best fit is the first free block of the smallest order that
+	 * is at least as large as the request.
 	 */
-	for (curr = 0;
-	     curr < pmem[id].num_entries;
-	     curr = PMEM_BUDDY_NEXT_INDEX(id, curr))
-		if (PMEM_IS_FREE_BUDDY(id, curr)) {
-			if (PMEM_BUDDY_ORDER(id, curr) ==
-					(unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_BUDDY_ORDER(id, curr) >
-					(unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_BUDDY_ORDER(id, curr) <
-					PMEM_BUDDY_ORDER(id, best_fit)))
-				best_fit = curr;
-		}
-
-	/* if best_fit < 0, there are no suitable slots; return an error */
-	if (best_fit < 0) {
+	orders = pmem[id].allocator.buddy_bestfit.free_orders &
+		~((1UL << order) - 1);
+	if (!orders) {
 #if PMEM_DEBUG
 		printk(KERN_ALERT "pmem: %s: no space left to allocate!\n",
 			__func__);
 #endif
-		goto out;
+		if (pmem[id].allocator.buddy_bestfit.free_quanta >=
+				1UL << order)
+			pmem[id].allocator.buddy_bestfit.frag_failures++;
+		goto fail;
 	}
 
+	bits = list_first_entry(
+		&pmem[id].allocator.buddy_bestfit.free_area[__ffs(orders)],
+		struct pmem_bits, free);
+	best_fit = bits - pmem[id].allocator.buddy_bestfit.buddy_bitmap;
+	pmem_buddy_del_free(id, best_fit);
+
 	/* now partition the best fit:
 	 * 	split the slot into 2 buddies of order - 1
 	 * 	repeat until the slot is of the correct order
@@ -973,10 +1054,14 @@ static int pmem_allocator_buddy_bestfit(const int id,
 		PMEM_BUDDY_ORDER(id, best_fit) -= 1;
 		buddy = PMEM_BUDDY_INDEX(id, best_fit);
 		PMEM_BUDDY_ORDER(id, buddy) = PMEM_BUDDY_ORDER(id, best_fit);
+		pmem_buddy_add_free(id, buddy);
 	}
 	pmem[id].allocator.buddy_bestfit.buddy_bitmap[best_fit].allocated = 1;
-out:
 	return best_fit;
+
+fail:
+	pmem[id].allocator.buddy_bestfit.failures++;
+	return -1;
 }
 
 
@@ -2767,10 +2852,17 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 
 		memset(pmem[id].allocator.buddy_bestfit.buddy_bitmap, 0,
 			sizeof(struct pmem_bits) * pmem[id].num_entries);
+		for (i = 0; i < pmem[id].num_entries; i++)
+			INIT_LIST_HEAD(&pmem[id].allocator.buddy_bestfit.
+				       buddy_bitmap[i].free);
+		for (i = 0; i < PMEM_BUDDY_MAX_ORDER; i++)
+			INIT_LIST_HEAD(&pmem[id].allocator.buddy_bestfit.
+				       free_area[i]);
 
 		for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--)
 			if ((pmem[id].num_entries) &  1<<i) {
 				PMEM_BUDDY_ORDER(id, index) = i;
+				pmem_buddy_add_free(id, index);
 				index = PMEM_BUDDY_NEXT_INDEX(id, index);
 			}
 		pmem[id].allocate = pmem_allocator_buddy_bestfit;
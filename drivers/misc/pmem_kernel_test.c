@@ -20,6 +20,10 @@
 #include <linux/android_pmem.h>
 #include <linux/io.h>
 #include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/uaccess.h>
 
 #define MODULE_NAME "pmem_kernel_test"
 
@@ -55,6 +59,9 @@ module_param_named(run_tests_on_init,
 
 #define NUM_DYN_ALLOCED_BUFFERS 512
 
+#define TRACE_MAX_OPS 4096
+#define TRACE_DEFAULT_OPS 2048
+
 static int read_write_test(void *kernel_addr, unsigned long size)
 {
 	int j, *p;
@@ -539,6 +546,155 @@ done:
 	return ret;
 }
 
+/*
+ * Allocation traces are arrays of struct pmem_kernel_test_trace_op written
+ * to the device; a write at offset zero starts a new trace. Without one,
+ * trace_replay_test() replays a synthetic camera/video/display mix.
+ */
+static struct pmem_kernel_test_trace_op *trace;
+static size_t trace_ops;
+static DEFINE_MUTEX(trace_mutex);
+
+static const unsigned int trace_default_sizes[] = {
+	PAGE_SIZE,		/* small kernel buffers */
+	0x10000,		/* video bitstream */
+	0x4b000,		/* QVGA preview, 16bpp */
+	0x12c000,		/* VGA preview, 32bpp */
+	0x200000,		/* camera snapshot */
+};
+
+static void trace_make_default(void)
+{
+	unsigned long seed = 1;
+	int busy[PMEM_KERNEL_TEST_TRACE_SLOTS] = { 0 };
+	int i;
+
+	for (i = 0; i < TRACE_DEFAULT_OPS; i++) {
+		struct pmem_kernel_test_trace_op *op = &trace[i];
+
+		seed = seed * 1103515245 + 12345;
+		op->slot = (seed >> 16) % PMEM_KERNEL_TEST_TRACE_SLOTS;
+		op->flags = PMEM_MEMTYPE_EBI1 | PMEM_ALIGNMENT_4K;
+		if (busy[op->slot]) {
+			op->op = PMEM_KERNEL_TEST_TRACE_FREE;
+			op->size = 0;
+		} else {
+			op->op = PMEM_KERNEL_TEST_TRACE_ALLOC;
+			op->size = trace_default_sizes[(seed >> 8) %
+				ARRAY_SIZE(trace_default_sizes)];
+		}
+		busy[op->slot] = !busy[op->slot];
+	}
+	trace_ops = TRACE_DEFAULT_OPS;
+}
+
+static ssize_t pmem_kernel_test_write(struct file *file,
+		const char __user *buf, size_t count, loff_t *ppos)
+{
+	size_t first = *ppos / sizeof(*trace);
+	size_t nr = count / sizeof(*trace);
+
+	if (*ppos % sizeof(*trace) || !nr)
+		return -EINVAL;
+	if (first + nr > TRACE_MAX_OPS)
+		return -ENOSPC;
+
+	mutex_lock(&trace_mutex);
+	if (copy_from_user(&trace[first], buf, nr * sizeof(*trace))) {
+		mutex_unlock(&trace_mutex);
+		return -EFAULT;
+	}
+	trace_ops = first + nr;
+	mutex_unlock(&trace_mutex);
+
+	*ppos += nr * sizeof(*trace);
+	return nr * sizeof(*trace);
+}
+
+static int trace_replay_test(void)
+{
+	int32_t addr[PMEM_KERNEL_TEST_TRACE_SLOTS] = { 0 };
+	unsigned long allocs = 0, failures = 0, frees = 0, bad_ops = 0;
+	u64 alloc_ns = 0, alloc_max_ns = 0, free_ns = 0, free_max_ns = 0;
+	int ret = 0;
+	size_t i;
+
+	printk(KERN_INFO MODULE_NAME "%s entry\n", __func__);
+
+	mutex_lock(&trace_mutex);
+	if (!trace_ops)
+		trace_make_default();
+
+	for (i = 0; i < trace_ops; i++) {
+		struct pmem_kernel_test_trace_op *op = &trace[i];
+		ktime_t start;
+		u64 ns;
+
+		if (op->slot >= PMEM_KERNEL_TEST_TRACE_SLOTS) {
+			bad_ops++;
+			continue;
+		}
+
+		switch (op->op) {
+		case PMEM_KERNEL_TEST_TRACE_ALLOC:
+			if (addr[op->slot] > 0) {
+				bad_ops++;
+				break;
+			}
+			start = ktime_get();
+			addr[op->slot] = pmem_kalloc(op->size, op->flags);
+			ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+			allocs++;
+			alloc_ns += ns;
+			alloc_max_ns = max(alloc_max_ns, ns);
+			if (addr[op->slot] <= 0)
+				failures++;
+			break;
+		case PMEM_KERNEL_TEST_TRACE_FREE:
+			/* frees of failed allocations are expected */
+			if (addr[op->slot] <= 0)
+				break;
+			start = ktime_get();
+			if (pmem_kfree(addr[op->slot]) < 0) {
+				printk(KERN_INFO MODULE_NAME
+					": %s free of %#x, op %zu FAILS\n",
+					__func__, addr[op->slot], i);
+				ret = -EFAULT;
+			}
+			ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+			addr[op->slot] = 0;
+
+			frees++;
+			free_ns += ns;
+			free_max_ns = max(free_max_ns, ns);
+			break;
+		default:
+			bad_ops++;
+			break;
+		}
+	}
+	mutex_unlock(&trace_mutex);
+
+	/* release whatever the trace left allocated */
+	for (i = 0; i < PMEM_KERNEL_TEST_TRACE_SLOTS; i++)
+		if (addr[i] > 0)
+			pmem_kfree(addr[i]);
+
+	printk(KERN_INFO MODULE_NAME ": %s %lu allocs, %lu failed "
+		"(%lu.%lu%%), alloc avg %llu ns max %llu ns\n", __func__,
+		allocs, failures,
+		allocs ? failures * 100 / allocs : 0,
+		allocs ? failures * 1000 / allocs % 10 : 0,
+		allocs ? div64_u64(alloc_ns, allocs) : 0, alloc_max_ns);
+	printk(KERN_INFO MODULE_NAME ": %s %lu frees, free avg %llu ns "
+		"max %llu ns, %lu invalid trace ops\n", __func__, frees,
+		frees ? div64_u64(free_ns, frees) : 0, free_max_ns, bad_ops);
+
+	OUTPUT_FINAL_FUNCTION_STATUS(ret);
+	return ret;
+}
+
 static long pmem_kernel_test_ioctl(struct file *ignored1,
 		unsigned int cmd, unsigned long ignored2)
 {
@@ -553,6 +709,8 @@ static long pmem_kernel_test_ioctl(struct file *ignored1,
 		return free_of_unallocated_test();
 	case PMEM_KERNEL_TEST_LARGE_REGION_NUMBER_TEST_IOCTL:
 		return large_number_of_regions_test();
+	case PMEM_KERNEL_TEST_TRACE_REPLAY_TEST_IOCTL:
+		return trace_replay_test();
 	default:
 		printk(KERN_ERR MODULE_NAME
 			": %s, invalid command %#x\n",
@@ -562,6 +720,7 @@ static long pmem_kernel_test_ioctl(struct file *ignored1,
 }
 
 static const struct file_operations pmem_kernel_test_fops = {
+	.write = pmem_kernel_test_write,
 	.unlocked_ioctl = pmem_kernel_test_ioctl,
 };
 
@@ -574,10 +733,17 @@ static struct miscdevice pmem_kernel_test_miscdevice = {
 
 static int __init pmem_kernel_test_init(void)
 {
-	int ret = misc_register(&pmem_kernel_test_miscdevice);
+	int ret;
+
+	trace = vmalloc(TRACE_MAX_OPS * sizeof(*trace));
+	if (!trace)
+		return -ENOMEM;
+
+	ret = misc_register(&pmem_kernel_test_miscdevice);
 	if (ret) {
 		printk(KERN_ERR MODULE_NAME ": failed to register misc "
 		       "device, err: %d!\n", ret);
+		vfree(trace);
 		goto out;
 	}
 
@@ -612,6 +778,10 @@ static int __init pmem_kernel_test_init(void)
 	if (ret)
 		goto done;
 
+	ret = trace_replay_test();
+	if (ret)
+		goto done;
+
 done:
 	if (!ret)
 		printk(KERN_INFO MODULE_NAME ": All PMEM kernel API tests "
@@ -624,6 +794,7 @@ out:
 static void __exit pmem_kernel_test_exit(void)
 {
 	misc_deregister(&pmem_kernel_test_miscdevice);
+	vfree(trace);
 }
 
 device_initcall(pmem_kernel_test_init);
@@ -30,9 +30,18 @@
 #include <mach/dma.h>
 
 #include <linux/proc_fs.h>
+#include <linux/scatterlist.h>
+#include <linux/highmem.h>
 #include <linux/zte_memlog.h>
 #include "msm_nand.h"
 
+#ifdef CONFIG_MTD_MSM_NAND_DMSIM
+/* every command list goes to the software data mover instead */
+#include "msm_nand_dmsim.h"
+#define msm_dmov_exec_cmd	msm_nand_dmsim_exec_cmd
+#define msm_dmov_enqueue_cmd	msm_nand_dmsim_enqueue_cmd
+#endif
+
 unsigned long msm_nand_phys;
 unsigned long msm_nandc01_phys;
 unsigned long msm_nandc10_phys;
@@ -748,6 +757,472 @@ uint32_t flash_onfi_probe(struct msm_nand_chip *chip)
 	return err;
 }
 
+/*
+ * Pipelined multi-page transfers.
+ *
+ * The single page loops below build one command list per page and sleep
+ * in msm_dmov_exec_cmd() until it has finished, so the data mover sits
+ * idle while the CPU checks the status words and builds the next list.
+ * For multi-page ECC reads and writes we instead keep up to
+ * msm_nand_pipeline_depth per-page command lists queued on the channel
+ * with msm_dmov_enqueue_cmd().  The data mover runs them back to back:
+ * the command and address cycles and tR of page N+1 start as soon as
+ * page N has been drained from the controller buffer, while page N's
+ * status is checked from its completion.
+ */
+#define MSM_NAND_PIPELINE_MAX 4
+
+static unsigned msm_nand_pipeline_depth = MSM_NAND_PIPELINE_MAX;
+module_param_named(pipeline_depth, msm_nand_pipeline_depth, uint, 0644);
+MODULE_PARM_DESC(pipeline_depth, "pages kept queued on the data mover "
+		 "for multi-page transfers, 1 disables pipelining");
+
+struct msm_nand_pipe_slot {
+	struct msm_dmov_cmd dmov_cmd;
+	struct completion done;
+	unsigned int result;
+	void *dma_buffer;
+	unsigned index;		/* page within the request */
+	dma_addr_t data_dma_addr;
+	struct page *data_page;	/* where the page's data lands */
+	unsigned data_offs;
+	uint32_t oob_offs;	/* oobbuf bytes this page transfers */
+	uint32_t oob_len;
+};
+
+/* walks a mapped scatterlist one flash page at a time */
+struct msm_nand_sg_iter {
+	struct scatterlist *sg;
+	unsigned offs;
+};
+
+static void msm_nand_sg_next_page(struct mtd_info *mtd,
+				  struct msm_nand_sg_iter *iter,
+				  struct msm_nand_pipe_slot *slot)
+{
+	unsigned offs = iter->sg->offset + iter->offs;
+
+	slot->data_dma_addr = sg_dma_address(iter->sg) + iter->offs;
+	slot->data_page = nth_page(sg_page(iter->sg), offs >> PAGE_SHIFT);
+	slot->data_offs = offs & ~PAGE_MASK;
+
+	iter->offs += mtd->writesize;
+	if (iter->offs >= iter->sg->length) {
+		iter->sg = sg_next(iter->sg);
+		iter->offs = 0;
+	}
+}
+
+struct msm_nand_read_cmdlist {
+	dmov_s cmd[8 * 5 + 2];
+	unsigned cmdptr;
+	struct {
+		uint32_t cmd;
+		uint32_t addr0;
+		uint32_t addr1;
+		uint32_t chipsel;
+		uint32_t cfg0;
+		uint32_t cfg1;
+		uint32_t exec;
+		uint32_t ecccfg;
+		struct {
+			uint32_t flash_status;
+			uint32_t buffer_status;
+		} result[8];
+	} data;
+};
+
+struct msm_nand_write_cmdlist {
+	dmov_s cmd[8 * 7 + 2];
+	unsigned cmdptr;
+	struct {
+		uint32_t cmd;
+		uint32_t addr0;
+		uint32_t addr1;
+		uint32_t chipsel;
+		uint32_t cfg0;
+		uint32_t cfg1;
+		uint32_t exec;
+		uint32_t ecccfg;
+		uint32_t clrfstatus;
+		uint32_t clrrstatus;
+		uint32_t flash_status[8];
+	} data;
+};
+
+static void msm_nand_pipe_complete(struct msm_dmov_cmd *cmd,
+				   unsigned int result,
+				   struct msm_dmov_errdata *err)
+{
+	struct msm_nand_pipe_slot *slot =
+		container_of(cmd, struct msm_nand_pipe_slot, dmov_cmd);
+
+	slot->result = result;
+	complete(&slot->done);
+}
+
+/*
+ * Only the first command buffer is waited for; the others are taken if
+ * the pool has room, so two pipelined requests can never deadlock each
+ * other and a busy pool just shortens the pipeline.
+ */
+static unsigned msm_nand_pipe_get_buffers(struct msm_nand_chip *chip,
+					  struct msm_nand_pipe_slot *slots,
+					  size_t size)
+{
+	unsigned depth = min_t(unsigned, msm_nand_pipeline_depth,
+			       MSM_NAND_PIPELINE_MAX);
+	unsigned n;
+
+	wait_event(chip->wait_queue,
+		   (slots[0].dma_buffer = msm_nand_get_dma_buffer(chip, size)));
+	for (n = 1; n < depth; n++) {
+		slots[n].dma_buffer = msm_nand_get_dma_buffer(chip, size);
+		if (!slots[n].dma_buffer)
+			break;
+	}
+	return n;
+}
+
+static void msm_nand_pipe_put_buffers(struct msm_nand_chip *chip,
+				      struct msm_nand_pipe_slot *slots,
+				      unsigned nslots, size_t size)
+{
+	while (nslots-- > 0)
+		msm_nand_release_dma_buffer(chip, slots[nslots].dma_buffer,
+					    size);
+}
+
+static void msm_nand_pipe_submit(struct msm_nand_chip *chip,
+				 struct msm_nand_pipe_slot *slot,
+				 unsigned *cmdptr)
+{
+	slot->dmov_cmd.cmdptr = DMOV_CMD_PTR_LIST |
+		DMOV_CMD_ADDR(msm_virt_to_dma(chip, cmdptr));
+	slot->dmov_cmd.crci_mask = crci_mask;
+	slot->dmov_cmd.complete_func = msm_nand_pipe_complete;
+	slot->dmov_cmd.exec_func = NULL;
+	slot->result = 0;
+	init_completion(&slot->done);
+
+	dsb();
+	msm_dmov_enqueue_cmd(chip->dma_channel, &slot->dmov_cmd);
+}
+
+static int msm_nand_pipe_wait(struct msm_nand_pipe_slot *slot)
+{
+	wait_for_completion(&slot->done);
+	dsb();
+
+	if (slot->result != 0x80000002) {
+		pr_err("msm_nand: data mover error, result %x\n",
+		       slot->result);
+		return -EIO;
+	}
+	return 0;
+}
+
+/* returns the number of oob bytes the page transfers */
+static uint32_t msm_nand_pipe_build_read(struct msm_nand_chip *chip,
+				     struct mtd_info *mtd,
+				     struct mtd_oob_ops *ops,
+				     struct msm_nand_read_cmdlist *dma_buffer,
+				     unsigned page, dma_addr_t data_dma_addr,
+				     dma_addr_t oob_dma_addr, uint32_t oob_len)
+{
+	unsigned cwperpage = mtd->writesize >> 9;
+	uint32_t sectordatasize;
+	uint32_t sectoroobsize;
+	uint32_t oob_used = 0;
+	dmov_s *cmd = dma_buffer->cmd;
+	unsigned n;
+
+	dma_buffer->data.cmd = MSM_NAND_CMD_PAGE_READ_ECC;
+	dma_buffer->data.cfg0 = (chip->CFG0 & ~(7U << 6)) |
+		((cwperpage - 1) << 6);
+	dma_buffer->data.cfg1 = chip->CFG1;
+	dma_buffer->data.addr0 = page << 16;
+	dma_buffer->data.addr1 = (page >> 16) & 0xff;
+	/* flash0 + undoc bit */
+	dma_buffer->data.chipsel = 0 | 4;
+	/* GO bit for the EXEC register */
+	dma_buffer->data.exec = 1;
+	dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
+
+	for (n = 0; n < cwperpage; n++) {
+		dma_buffer->data.result[n].flash_status = 0xeeeeeeee;
+		dma_buffer->data.result[n].buffer_status = 0xeeeeeeee;
+
+		/* block on cmd ready, then write CMD / ADDR0 / ADDR1 /
+		 * CHIPSEL regs in a burst
+		 */
+		cmd->cmd = DST_CRCI_NAND_CMD;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.cmd);
+		cmd->dst = MSM_NAND_FLASH_CMD;
+		cmd->len = (n == 0) ? 16 : 4;
+		cmd++;
+
+		if (n == 0) {
+			cmd->cmd = 0;
+			cmd->src = msm_virt_to_dma(chip,
+						   &dma_buffer->data.cfg0);
+			cmd->dst = MSM_NAND_DEV0_CFG0;
+			cmd->len = 8;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = msm_virt_to_dma(chip,
+						   &dma_buffer->data.ecccfg);
+			cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+			cmd->len = 4;
+			cmd++;
+		}
+
+		/* kick the execute register */
+		cmd->cmd = 0;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.exec);
+		cmd->dst = MSM_NAND_EXEC_CMD;
+		cmd->len = 4;
+		cmd++;
+
+		/* block on data ready, then read the status registers */
+		cmd->cmd = SRC_CRCI_NAND_DATA;
+		cmd->src = MSM_NAND_FLASH_STATUS;
+		cmd->dst = msm_virt_to_dma(chip, &dma_buffer->data.result[n]);
+		cmd->len = 8;
+		cmd++;
+
+		/* read data block (only valid if status says success) */
+		sectordatasize = (n < (cwperpage - 1)) ?
+			516 : (512 - ((cwperpage - 1) << 2));
+		cmd->cmd = 0;
+		cmd->src = MSM_NAND_FLASH_BUFFER;
+		cmd->dst = data_dma_addr;
+		data_dma_addr += sectordatasize;
+		cmd->len = sectordatasize;
+		cmd++;
+
+		if (ops->oobbuf && (n == (cwperpage - 1) ||
+				    ops->mode != MTD_OOB_AUTO)) {
+			cmd->cmd = 0;
+			if (n == (cwperpage - 1)) {
+				cmd->src = MSM_NAND_FLASH_BUFFER +
+					(512 - ((cwperpage - 1) << 2));
+				sectoroobsize = (cwperpage << 2);
+				if (ops->mode != MTD_OOB_AUTO)
+					sectoroobsize += 10;
+			} else {
+				cmd->src = MSM_NAND_FLASH_BUFFER + 516;
+				sectoroobsize = 10;
+			}
+			cmd->dst = oob_dma_addr;
+			cmd->len = min(sectoroobsize, oob_len);
+			oob_dma_addr += cmd->len;
+			oob_len -= cmd->len;
+			oob_used += cmd->len;
+			if (cmd->len > 0)
+				cmd++;
+		}
+	}
+
+	BUILD_BUG_ON(8 * 5 + 2 != ARRAY_SIZE(dma_buffer->cmd));
+	BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
+	dma_buffer->cmd[0].cmd |= CMD_OCB;
+	cmd[-1].cmd |= CMD_OCU | CMD_LC;
+
+	dma_buffer->cmdptr =
+		(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) | CMD_PTR_LP;
+
+	return oob_used;
+}
+
+/* returns the same page error codes as the msm_nand_read_oob() loop */
+static int msm_nand_pipe_check_read(struct msm_nand_chip *chip,
+				    struct mtd_info *mtd,
+				    struct mtd_oob_ops *ops,
+				    struct msm_nand_pipe_slot *slot,
+				    uint32_t *total_ecc_errors)
+{
+	struct msm_nand_read_cmdlist *dma_buffer = slot->dma_buffer;
+	unsigned cwperpage = mtd->writesize >> 9;
+	uint32_t ecc_errors;
+	int pageerr = 0, rawerr = 0;
+	unsigned n;
+
+	/* if any of the reads failed (0x10), or there was a
+	 * protection violation (0x100), we lose
+	 */
+	for (n = 0; n < cwperpage; n++) {
+		if (dma_buffer->data.result[n].flash_status & 0x110) {
+			rawerr = -EIO;
+			break;
+		}
+	}
+	if (rawerr) {
+		uint8_t *oobbuf = ops->oobbuf + slot->oob_offs;
+		uint8_t *kaddr, *datbuf;
+
+		/* the other pages may still be in flight, so only this
+		 * page's cache lines are handed back and forth
+		 */
+		dma_sync_single_for_cpu(chip->dev, slot->data_dma_addr,
+					mtd->writesize, DMA_BIDIRECTIONAL);
+		kaddr = kmap_atomic(slot->data_page, KM_USER0);
+		datbuf = kaddr + slot->data_offs;
+		for (n = 0; n < mtd->writesize; n++) {
+			/* empty blocks read 0x54 at these offsets */
+			if (n % 516 == 3 && datbuf[n] == 0x54)
+				datbuf[n] = 0xff;
+			if (datbuf[n] != 0xff) {
+				pageerr = rawerr;
+				break;
+			}
+		}
+		kunmap_atomic(kaddr, KM_USER0);
+		dma_sync_single_for_device(chip->dev, slot->data_dma_addr,
+					   mtd->writesize, DMA_BIDIRECTIONAL);
+
+		for (n = 0; ops->oobbuf && n < slot->oob_len; n++) {
+			if (oobbuf[n] != 0xff) {
+				pageerr = rawerr;
+				break;
+			}
+		}
+	}
+	if (pageerr) {
+		for (n = 0; n < cwperpage; n++) {
+			if (dma_buffer->data.result[n].buffer_status & 0x8) {
+				/* not thread safe */
+				mtd->ecc_stats.failed++;
+				mtd_stats_ecc(mtd, 0, 1);
+				pageerr = -EBADMSG;
+				break;
+			}
+		}
+	}
+	if (!rawerr) { /* check for correctable errors */
+		for (n = 0; n < cwperpage; n++) {
+			ecc_errors =
+				dma_buffer->data.result[n].buffer_status & 0x7;
+			if (ecc_errors) {
+				*total_ecc_errors += ecc_errors;
+				/* not thread safe */
+				mtd->ecc_stats.corrected += ecc_errors;
+				mtd_stats_ecc(mtd, ecc_errors, 0);
+				if (ecc_errors > 1)
+					pageerr = -EUCLEAN;
+			}
+		}
+	}
+	return pageerr;
+}
+
+/*
+ * The page data goes straight to the scatterlist's pages; ops supplies
+ * the oob buffer and mode and gets retlen/oobretlen back.
+ */
+static int msm_nand_read_pages(struct mtd_info *mtd, loff_t from,
+			       struct mtd_oob_ops *ops,
+			       struct scatterlist *sg, unsigned nents,
+			       unsigned page, unsigned page_count)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+	struct msm_nand_pipe_slot slots[MSM_NAND_PIPELINE_MAX];
+	struct msm_nand_pipe_slot *slot;
+	unsigned nslots, submitted = 0, completed = 0;
+	unsigned pages_read = 0;
+	uint32_t oob_len = ops->ooblen;
+	uint32_t oobretlen = 0;
+	uint32_t total_ecc_errors = 0;
+	struct msm_nand_sg_iter iter;
+	dma_addr_t oob_dma_addr = 0;
+	int err = 0, pageerr, stop = 0;
+
+	if (!dma_map_sg(chip->dev, sg, nents, DMA_BIDIRECTIONAL)) {
+		pr_err("msm_nand_read_oob: failed to map %u sg entries\n",
+		       nents);
+		return -EIO;
+	}
+	if (ops->oobbuf) {
+		memset(ops->oobbuf, 0xff, ops->ooblen);
+		oob_dma_addr = msm_nand_dma_map(chip->dev, ops->oobbuf,
+						ops->ooblen, DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(chip->dev, oob_dma_addr)) {
+			pr_err("msm_nand_read_oob: failed to get dma addr "
+			       "for %p\n", ops->oobbuf);
+			err = -EIO;
+			goto err_dma_map_oobbuf_failed;
+		}
+	}
+
+	nslots = msm_nand_pipe_get_buffers(chip, slots,
+				sizeof(struct msm_nand_read_cmdlist));
+	iter.sg = sg;
+	iter.offs = 0;
+
+	while (completed < submitted || (!stop && submitted < page_count)) {
+		/* keep the data mover fed */
+		while (!stop && submitted < page_count &&
+		       submitted - completed < nslots) {
+			uint32_t oob_offs = ops->ooblen - oob_len;
+
+			slot = &slots[submitted % nslots];
+			slot->index = submitted;
+			slot->oob_offs = oob_offs;
+			msm_nand_sg_next_page(mtd, &iter, slot);
+			slot->oob_len = msm_nand_pipe_build_read(chip, mtd,
+				ops, slot->dma_buffer, page + submitted,
+				slot->data_dma_addr,
+				oob_dma_addr + oob_offs, oob_len);
+			oob_len -= slot->oob_len;
+			msm_nand_pipe_submit(chip, slot,
+				&((struct msm_nand_read_cmdlist *)
+				  slot->dma_buffer)->cmdptr);
+			submitted++;
+		}
+
+		slot = &slots[completed % nslots];
+		completed++;
+		if (msm_nand_pipe_wait(slot)) {
+			if (!stop)
+				err = -EIO;
+			stop = 1;
+			continue;
+		}
+		if (stop)
+			continue;
+
+		pageerr = msm_nand_pipe_check_read(chip, mtd, ops, slot,
+						   &total_ecc_errors);
+		if (pageerr && (pageerr != -EUCLEAN || err == 0))
+			err = pageerr;
+		oobretlen = slot->oob_offs + slot->oob_len;
+		if (err && err != -EUCLEAN && err != -EBADMSG) {
+			/* drain what is still queued, count none of it */
+			stop = 1;
+			continue;
+		}
+		pages_read++;
+	}
+
+	msm_nand_pipe_put_buffers(chip, slots, nslots,
+				  sizeof(struct msm_nand_read_cmdlist));
+
+	if (ops->oobbuf)
+		dma_unmap_page(chip->dev, oob_dma_addr, ops->ooblen,
+			       DMA_BIDIRECTIONAL);
+err_dma_map_oobbuf_failed:
+	dma_unmap_sg(chip->dev, sg, nents, DMA_BIDIRECTIONAL);
+
+	ops->retlen = mtd->writesize * pages_read;
+	ops->oobretlen = oobretlen;
+	if (err)
+		pr_err("msm_nand_read_oob %llx %x %x failed %d, corrected %d\n",
+		       from, page_count * mtd->writesize, ops->ooblen, err,
+		       total_ecc_errors);
+	return err;
+}
+
 static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 			     struct mtd_oob_ops *ops)
 {
@@ -839,6 +1314,20 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 	else
 		page_count = ops->len / (mtd->writesize + mtd->oobsize);
 
+	/* the erased page check touches each page's data while the rest is
+	 * still in flight, so pages must not share cache lines
+	 */
+	if (msm_nand_pipeline_depth > 1 && page_count > 1 &&
+	    ops->mode != MTD_OOB_RAW && ops->datbuf &&
+	    virt_addr_valid(ops->datbuf) &&
+	    IS_ALIGNED((unsigned long)ops->datbuf, L1_CACHE_BYTES)) {
+		struct scatterlist sg;
+
+		sg_init_one(&sg, ops->datbuf, ops->len);
+		return msm_nand_read_pages(mtd, from, ops, &sg, 1,
+					   page, page_count);
+	}
+
 #if 0 /* yaffs reads more oob data than it needs */
 	if (ops->ooblen >= sectoroobsize * 4) {
 		pr_err("%s: unsupported ops->ooblen, %d\n",
@@ -1079,6 +1568,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 						& 0x8) {
 					/* not thread safe */
 					mtd->ecc_stats.failed++;
+					mtd_stats_ecc(mtd, 0, 1);
 					pageerr = -EBADMSG;
 					break;
 				}
@@ -1092,6 +1582,7 @@ static int msm_nand_read_oob(struct mtd_info *mtd, loff_t from,
 					total_ecc_errors += ecc_errors;
 					/* not thread safe */
 					mtd->ecc_stats.corrected += ecc_errors;
+					mtd_stats_ecc(mtd, ecc_errors, 0);
 					if (ecc_errors > 1)
 						pageerr = -EUCLEAN;
 				}
@@ -1883,6 +2374,7 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 						& 0x8) {
 					/* not thread safe */
 					mtd->ecc_stats.failed++;
+					mtd_stats_ecc(mtd, 0, 1);
 					pageerr = -EBADMSG;
 					break;
 				}
@@ -1896,6 +2388,7 @@ static int msm_nand_read_oob_dualnandc(struct mtd_info *mtd, loff_t from,
 					total_ecc_errors += ecc_errors;
 					/* not thread safe */
 					mtd->ecc_stats.corrected += ecc_errors;
+					mtd_stats_ecc(mtd, ecc_errors, 0);
 					if (ecc_errors > 1)
 						pageerr = -EUCLEAN;
 				}
@@ -2002,8 +2495,8 @@ err_dma_map_oobbuf_failed:
 }
 
 static int
-msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
-	      size_t *retlen, u_char *buf)
+msm_nand_read_linear(struct mtd_info *mtd, loff_t from, size_t len,
+		     size_t *retlen, u_char *buf)
 {
 	int ret;
 	struct mtd_oob_ops ops;
@@ -2024,6 +2517,302 @@ msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	return ret;
 }
 
+/*
+ * The controller only moves whole pages, and only to buffers it can map
+ * in one piece.  UBI and UBIFS read headers and nodes at any offset and
+ * length, often into vmalloc()ed buffers, so those reads go through a
+ * bounce buffer of up to MSM_NAND_BOUNCE_PAGES pages.
+ */
+#define MSM_NAND_BOUNCE_PAGES 4
+
+static int msm_nand_read_bounce(struct mtd_info *mtd, loff_t from, size_t len,
+				size_t *retlen, u_char *buf)
+{
+	size_t bounce_len = min_t(size_t, MSM_NAND_BOUNCE_PAGES * mtd->writesize,
+				  ALIGN(len + (from & (mtd->writesize - 1)),
+					mtd->writesize));
+	uint8_t *bounce;
+	int err = 0, ret;
+
+	*retlen = 0;
+	bounce = kmalloc(bounce_len, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	while (len > 0) {
+		loff_t start = from & ~((loff_t)mtd->writesize - 1);
+		size_t offs = from - start;
+		size_t n = min_t(size_t, len, bounce_len - offs);
+		size_t got;
+
+		ret = msm_nand_read_linear(mtd, start,
+					   ALIGN(offs + n, mtd->writesize),
+					   &got, bounce);
+		if (ret && ret != -EUCLEAN && ret != -EBADMSG) {
+			err = ret;
+			break;
+		}
+		/* keep going past ECC trouble, report the worst */
+		if (ret == -EBADMSG || !err)
+			err = ret;
+		memcpy(buf, bounce + offs, n);
+		*retlen += n;
+		buf += n;
+		from += n;
+		len -= n;
+	}
+
+	kfree(bounce);
+	return err;
+}
+
+static int
+msm_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
+	      size_t *retlen, u_char *buf)
+{
+	if ((from & (mtd->writesize - 1)) || (len & (mtd->writesize - 1)) ||
+	    (!virt_addr_valid(buf) &&
+	     offset_in_page(buf) + len > PAGE_SIZE))
+		return msm_nand_read_bounce(mtd, from, len, retlen, buf);
+	return msm_nand_read_linear(mtd, from, len, retlen, buf);
+}
+
+/* returns the number of oob bytes the page transfers */
+static uint32_t msm_nand_pipe_build_write(struct msm_nand_chip *chip,
+				struct mtd_info *mtd, struct mtd_oob_ops *ops,
+				struct msm_nand_write_cmdlist *dma_buffer,
+				unsigned page, dma_addr_t data_dma_addr,
+				dma_addr_t oob_dma_addr, uint32_t oob_len)
+{
+	unsigned cwperpage = mtd->writesize >> 9;
+	uint32_t sectordatawritesize;
+	uint32_t oob_used = 0;
+	dmov_s *cmd = dma_buffer->cmd;
+	unsigned n;
+
+	dma_buffer->data.cmd = MSM_NAND_CMD_PRG_PAGE;
+	dma_buffer->data.cfg0 = chip->CFG0;
+	dma_buffer->data.cfg1 = chip->CFG1;
+	dma_buffer->data.addr0 = page << 16;
+	dma_buffer->data.addr1 = (page >> 16) & 0xff;
+	dma_buffer->data.chipsel = 0 | 4; /* flash0 + undoc bit */
+	/* GO bit for the EXEC register */
+	dma_buffer->data.exec = 1;
+	dma_buffer->data.ecccfg = chip->ecc_buf_cfg;
+	dma_buffer->data.clrfstatus = 0x00000020;
+	dma_buffer->data.clrrstatus = 0x000000C0;
+
+	for (n = 0; n < cwperpage; n++) {
+		dma_buffer->data.flash_status[n] = 0xeeeeeeee;
+
+		/* block on cmd ready, then write CMD / ADDR0 / ADDR1 /
+		 * CHIPSEL regs in a burst
+		 */
+		cmd->cmd = DST_CRCI_NAND_CMD;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.cmd);
+		cmd->dst = MSM_NAND_FLASH_CMD;
+		cmd->len = (n == 0) ? 16 : 4;
+		cmd++;
+
+		if (n == 0) {
+			cmd->cmd = 0;
+			cmd->src = msm_virt_to_dma(chip,
+						   &dma_buffer->data.cfg0);
+			cmd->dst = MSM_NAND_DEV0_CFG0;
+			cmd->len = 8;
+			cmd++;
+
+			cmd->cmd = 0;
+			cmd->src = msm_virt_to_dma(chip,
+						   &dma_buffer->data.ecccfg);
+			cmd->dst = MSM_NAND_EBI2_ECC_BUF_CFG;
+			cmd->len = 4;
+			cmd++;
+		}
+
+		/* write data block */
+		sectordatawritesize = (n < (cwperpage - 1)) ?
+			516 : (512 - ((cwperpage - 1) << 2));
+		cmd->cmd = 0;
+		cmd->src = data_dma_addr;
+		data_dma_addr += sectordatawritesize;
+		cmd->dst = MSM_NAND_FLASH_BUFFER;
+		cmd->len = sectordatawritesize;
+		cmd++;
+
+		if (ops->oobbuf && ops->mode == MTD_OOB_AUTO &&
+		    n == (cwperpage - 1)) {
+			cmd->cmd = 0;
+			cmd->src = oob_dma_addr;
+			cmd->dst = MSM_NAND_FLASH_BUFFER +
+				(512 - ((cwperpage - 1) << 2));
+			cmd->len = min_t(uint32_t, cwperpage << 2, oob_len);
+			oob_used = cmd->len;
+			if (cmd->len > 0)
+				cmd++;
+		}
+
+		/* kick the execute register */
+		cmd->cmd = 0;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.exec);
+		cmd->dst = MSM_NAND_EXEC_CMD;
+		cmd->len = 4;
+		cmd++;
+
+		/* block on data ready, then read the status register */
+		cmd->cmd = SRC_CRCI_NAND_DATA;
+		cmd->src = MSM_NAND_FLASH_STATUS;
+		cmd->dst = msm_virt_to_dma(chip,
+					   &dma_buffer->data.flash_status[n]);
+		cmd->len = 4;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.clrfstatus);
+		cmd->dst = MSM_NAND_FLASH_STATUS;
+		cmd->len = 4;
+		cmd++;
+
+		cmd->cmd = 0;
+		cmd->src = msm_virt_to_dma(chip, &dma_buffer->data.clrrstatus);
+		cmd->dst = MSM_NAND_READ_STATUS;
+		cmd->len = 4;
+		cmd++;
+	}
+
+	BUILD_BUG_ON(8 * 7 + 2 != ARRAY_SIZE(dma_buffer->cmd));
+	BUG_ON(cmd - dma_buffer->cmd > ARRAY_SIZE(dma_buffer->cmd));
+	dma_buffer->cmd[0].cmd |= CMD_OCB;
+	cmd[-1].cmd |= CMD_OCU | CMD_LC;
+
+	dma_buffer->cmdptr =
+		(msm_virt_to_dma(chip, dma_buffer->cmd) >> 3) | CMD_PTR_LP;
+
+	return oob_used;
+}
+
+/*
+ * A page that fails to program ends the request, but the pages queued
+ * behind it have already been handed to the controller.  The pipeline is
+ * drained before the first page of each erase block is queued, so those
+ * pages can only land in the same (now failing) block, which the caller
+ * retires anyway; only retlen has to stop at the first bad page.  A
+ * healthy next block is never programmed past what retlen reports.
+ */
+static int msm_nand_write_pages(struct mtd_info *mtd, loff_t to,
+				struct mtd_oob_ops *ops,
+				struct scatterlist *sg, unsigned nents,
+				unsigned page, unsigned page_count)
+{
+	struct msm_nand_chip *chip = mtd->priv;
+	struct msm_nand_pipe_slot slots[MSM_NAND_PIPELINE_MAX];
+	struct msm_nand_pipe_slot *slot;
+	struct msm_nand_write_cmdlist *dma_buffer;
+	unsigned nslots, submitted = 0, completed = 0;
+	unsigned cwperpage = mtd->writesize >> 9;
+	unsigned pages_per_block = mtd->erasesize / mtd->writesize;
+	unsigned pages_written = 0;
+	uint32_t oob_len = ops->ooblen;
+	uint32_t oobretlen = 0;
+	struct msm_nand_sg_iter iter;
+	dma_addr_t oob_dma_addr = 0;
+	int err = 0, stop = 0;
+	unsigned n;
+
+	if (!dma_map_sg(chip->dev, sg, nents, DMA_TO_DEVICE)) {
+		pr_err("msm_nand_write_oob: failed to map %u sg entries\n",
+		       nents);
+		return -EIO;
+	}
+	if (ops->oobbuf) {
+		oob_dma_addr = msm_nand_dma_map(chip->dev, ops->oobbuf,
+						ops->ooblen, DMA_TO_DEVICE);
+		if (dma_mapping_error(chip->dev, oob_dma_addr)) {
+			pr_err("msm_nand_write_oob: failed to get dma addr "
+			       "for %p\n", ops->oobbuf);
+			err = -EIO;
+			goto err_dma_map_oobbuf_failed;
+		}
+	}
+
+	nslots = msm_nand_pipe_get_buffers(chip, slots,
+				sizeof(struct msm_nand_write_cmdlist));
+	iter.sg = sg;
+	iter.offs = 0;
+
+	while (completed < submitted || (!stop && submitted < page_count)) {
+		while (!stop && submitted < page_count &&
+		       submitted - completed < nslots) {
+			uint32_t oob_offs = ops->ooblen - oob_len;
+
+			/* drain before starting on the next erase block */
+			if (submitted > completed &&
+			    (page + submitted) % pages_per_block == 0)
+				break;
+
+			slot = &slots[submitted % nslots];
+			slot->index = submitted;
+			slot->oob_offs = oob_offs;
+			msm_nand_sg_next_page(mtd, &iter, slot);
+			slot->oob_len = msm_nand_pipe_build_write(chip, mtd,
+				ops, slot->dma_buffer, page + submitted,
+				slot->data_dma_addr,
+				oob_dma_addr + oob_offs, oob_len);
+			oob_len -= slot->oob_len;
+			msm_nand_pipe_submit(chip, slot,
+				&((struct msm_nand_write_cmdlist *)
+				  slot->dma_buffer)->cmdptr);
+			submitted++;
+		}
+
+		slot = &slots[completed % nslots];
+		completed++;
+		if (msm_nand_pipe_wait(slot)) {
+			if (!stop)
+				err = -EIO;
+			stop = 1;
+			continue;
+		}
+		if (stop)
+			continue;
+
+		/* if any of the writes failed (0x10), or there was a
+		 * protection violation (0x100), or the program success
+		 * bit (0x80) is unset, we lose
+		 */
+		dma_buffer = slot->dma_buffer;
+		for (n = 0; n < cwperpage; n++) {
+			if ((dma_buffer->data.flash_status[n] & 0x110) ||
+			    !(dma_buffer->data.flash_status[n] & 0x80)) {
+				err = -EIO;
+				break;
+			}
+		}
+		oobretlen = slot->oob_offs + slot->oob_len;
+		if (err) {
+			stop = 1;
+			continue;
+		}
+		pages_written++;
+	}
+
+	msm_nand_pipe_put_buffers(chip, slots, nslots,
+				  sizeof(struct msm_nand_write_cmdlist));
+
+	if (ops->oobbuf)
+		dma_unmap_page(chip->dev, oob_dma_addr, ops->ooblen,
+			       DMA_TO_DEVICE);
+err_dma_map_oobbuf_failed:
+	dma_unmap_sg(chip->dev, sg, nents, DMA_TO_DEVICE);
+
+	ops->retlen = mtd->writesize * pages_written;
+	ops->oobretlen = oobretlen;
+	if (err)
+		pr_err("msm_nand_write_oob %llx %x %x failed %d\n",
+		       to, page_count * mtd->writesize, ops->ooblen, err);
+	return err;
+}
+
 static int
 msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 {
@@ -2110,6 +2899,15 @@ msm_nand_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 		return -EINVAL;
 	}
 
+	if (msm_nand_pipeline_depth > 1 && ops->mode != MTD_OOB_RAW &&
+	    ops->len / mtd->writesize > 1 && virt_addr_valid(ops->datbuf)) {
+		struct scatterlist sg;
+
+		sg_init_one(&sg, ops->datbuf, ops->len);
+		return msm_nand_write_pages(mtd, to, ops, &sg, 1, page,
+					    ops->len / mtd->writesize);
+	}
+
 	if (ops->datbuf) {
 		data_dma_addr_curr = data_dma_addr =
 			msm_nand_dma_map(chip->dev, ops->datbuf,
@@ -2944,8 +3742,8 @@ err_dma_map_oobbuf_failed:
 	return err;
 }
 
-static int msm_nand_write(struct mtd_info *mtd, loff_t to, size_t len,
-			  size_t *retlen, const u_char *buf)
+static int msm_nand_write_linear(struct mtd_info *mtd, loff_t to, size_t len,
+				 size_t *retlen, const u_char *buf)
 {
 	int ret;
 	struct mtd_oob_ops ops;
@@ -2964,6 +3762,123 @@ static int msm_nand_write(struct mtd_info *mtd, loff_t to, size_t len,
 	return ret;
 }
 
+/* page aligned writes from buffers the controller can't map in one piece */
+static int msm_nand_write_bounce(struct mtd_info *mtd, loff_t to, size_t len,
+				 size_t *retlen, const u_char *buf)
+{
+	size_t bounce_len = min_t(size_t, len,
+				  MSM_NAND_BOUNCE_PAGES * mtd->writesize);
+	uint8_t *bounce;
+	int ret = 0;
+
+	*retlen = 0;
+	bounce = kmalloc(bounce_len, GFP_KERNEL);
+	if (!bounce)
+		return -ENOMEM;
+
+	while (len > 0) {
+		size_t n = min(len, bounce_len);
+		size_t done;
+
+		memcpy(bounce, buf, n);
+		ret = msm_nand_write_linear(mtd, to, n, &done, bounce);
+		*retlen += done;
+		if (ret)
+			break;
+		buf += n;
+		to += n;
+		len -= n;
+	}
+
+	kfree(bounce);
+	return ret;
+}
+
+static int msm_nand_write(struct mtd_info *mtd, loff_t to, size_t len,
+			  size_t *retlen, const u_char *buf)
+{
+	if (!virt_addr_valid(buf) && offset_in_page(buf) + len > PAGE_SIZE &&
+	    !(to & (mtd->writesize - 1)) && !(len & (mtd->writesize - 1)))
+		return msm_nand_write_bounce(mtd, to, len, retlen, buf);
+	return msm_nand_write_linear(mtd, to, len, retlen, buf);
+}
+
+/* every entry has to cover whole pages for the per-page walk */
+static int msm_nand_sg_len(struct mtd_info *mtd, loff_t ofs,
+			   struct scatterlist *sg, unsigned int nents,
+			   size_t *len)
+{
+	struct scatterlist *s;
+	unsigned int i;
+
+	*len = 0;
+	if (!nents || (ofs & (mtd->writesize - 1)))
+		return -EINVAL;
+	for_each_sg(sg, s, nents, i) {
+		if (!s->length || (s->offset & (mtd->writesize - 1)) ||
+		    (s->length & (mtd->writesize - 1)))
+			return -EINVAL;
+		*len += s->length;
+	}
+	if (ofs + *len > mtd->size)
+		return -EINVAL;
+	return 0;
+}
+
+static int msm_nand_read_sg(struct mtd_info *mtd, loff_t from,
+			    struct scatterlist *sg, unsigned int nents,
+			    size_t *retlen)
+{
+	struct mtd_oob_ops ops;
+	size_t len;
+	int ret;
+
+	*retlen = 0;
+	ret = msm_nand_sg_len(mtd, from, sg, nents, &len);
+	if (ret)
+		return ret;
+
+	ops.mode = MTD_OOB_PLACE;
+	ops.len = len;
+	ops.retlen = 0;
+	ops.ooblen = 0;
+	ops.oobretlen = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = NULL;
+	ret = msm_nand_read_pages(mtd, from, &ops, sg, nents,
+				  from >> __ffs(mtd->writesize),
+				  len >> __ffs(mtd->writesize));
+	*retlen = ops.retlen;
+	return ret;
+}
+
+static int msm_nand_write_sg(struct mtd_info *mtd, loff_t to,
+			     struct scatterlist *sg, unsigned int nents,
+			     size_t *retlen)
+{
+	struct mtd_oob_ops ops;
+	size_t len;
+	int ret;
+
+	*retlen = 0;
+	ret = msm_nand_sg_len(mtd, to, sg, nents, &len);
+	if (ret)
+		return ret;
+
+	ops.mode = MTD_OOB_PLACE;
+	ops.len = len;
+	ops.retlen = 0;
+	ops.ooblen = 0;
+	ops.oobretlen = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = NULL;
+	ret = msm_nand_write_pages(mtd, to, &ops, sg, nents,
+				   to >> __ffs(mtd->writesize),
+				   len >> __ffs(mtd->writesize));
+	*retlen = ops.retlen;
+	return ret;
+}
+
 static int
 msm_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 {
@@ -6707,6 +7622,11 @@ int msm_nand_scan(struct mtd_info *mtd, int maxchips)
 	mtd->write = msm_nand_write;
 	mtd->read_oob  = msm_nand_read_oob;
 	mtd->write_oob = msm_nand_write_oob;
+	/* the page-by-page walk only knows the single controller path */
+	if (!dual_nand_ctlr_present && mtd->writesize <= 4096) {
+		mtd->read_sg = msm_nand_read_sg;
+		mtd->write_sg = msm_nand_write_sg;
+	}
 	if (dual_nand_ctlr_present) {
 		mtd->read_oob = msm_nand_read_oob_dualnandc;
 		mtd->write_oob = msm_nand_write_oob_dualnandc;
@@ -6976,6 +7896,16 @@ no_dual_nand_ctlr_support:
 	pr_info("%s: allocated dma buffer at %p, dma_addr %x\n",
 		__func__, info->msm_nand.dma_buffer, info->msm_nand.dma_addr);
 
+#ifdef CONFIG_MTD_MSM_NAND_DMSIM
+	err = msm_nand_dmsim_attach(&pdev->dev, info->msm_nand.dma_buffer,
+				    info->msm_nand.dma_addr,
+				    MSM_NAND_DMA_BUFFER_SIZE);
+	if (err) {
+		pr_err("%s: software data mover failed, %d\n", __func__, err);
+		goto out_free_dma_buffer;
+	}
+#endif
+
 	crci_mask = msm_dmov_build_crci_mask(2,
 			DMOV_NAND_CRCI_DATA, DMOV_NAND_CRCI_CMD);
 
@@ -6990,7 +7920,7 @@ no_dual_nand_ctlr_support:
 		if (msm_onenand_scan(&info->mtd, 1)) {
 			pr_err("%s: No nand device found\n", __func__);
 			err = -ENXIO;
-			goto out_free_dma_buffer;
+			goto out_detach_dmsim;
 		}
 
 	setup_mtd_device(pdev, info);
@@ -6999,7 +7929,11 @@ no_dual_nand_ctlr_support:
 
 	return 0;
 
+out_detach_dmsim:
+#ifdef CONFIG_MTD_MSM_NAND_DMSIM
+	msm_nand_dmsim_detach();
 out_free_dma_buffer:
+#endif
 	dma_free_coherent(NULL, MSM_NAND_DMA_BUFFER_SIZE,
 			info->msm_nand.dma_buffer,
 			info->msm_nand.dma_addr);
@@ -7024,6 +7958,9 @@ static int __devexit msm_nand_remove(struct platform_device *pdev)
 			del_mtd_device(&info->mtd);
 
 		msm_nand_release(&info->mtd);
+#ifdef CONFIG_MTD_MSM_NAND_DMSIM
+		msm_nand_dmsim_detach();
+#endif
 		dma_free_coherent(NULL, MSM_NAND_DMA_BUFFER_SIZE,
 				  info->msm_nand.dma_buffer,
 				  info->msm_nand.dma_addr);
@@ -0,0 +1,505 @@
+/* drivers/mtd/devices/msm_nand_dmsim.c
+ *
+ * Software data mover stand-in for the MSM NAND controller
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * msm_nand talks to the controller only through data mover command
+ * lists.  With CONFIG_MTD_MSM_NAND_DMSIM those lists are handed to this
+ * file instead of the ADM: each list is walked in software against a
+ * model of the controller's register window and page buffer, backed by a
+ * vmalloc'd flash array, and completed from a workqueue in submission
+ * order.  That is enough to run the driver, including its pipelined
+ * multi-page paths, with no NAND part attached, and /proc/msm_nand_dmsim
+ * shows how the lists were sequenced.
+ *
+ * Only the single controller register window is modelled; boards with a
+ * second NAND controller are not supported.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/delay.h>
+#include <linux/proc_fs.h>
+#include <linux/dma-mapping.h>
+
+#include <mach/dma.h>
+
+#include "msm_nand.h"
+#include "msm_nand_dmsim.h"
+
+static unsigned dmsim_flash_id = 0x1500aaec;
+module_param_named(flash_id, dmsim_flash_id, uint, S_IRUGO);
+MODULE_PARM_DESC(flash_id, "id returned for FETCH_ID");
+
+static unsigned dmsim_size_mb = 32;
+module_param_named(size_mb, dmsim_size_mb, uint, S_IRUGO);
+MODULE_PARM_DESC(size_mb, "backed flash size, pages beyond read erased "
+		 "and fail to program");
+
+static unsigned dmsim_page_size = 2048;
+module_param_named(page_size, dmsim_page_size, uint, S_IRUGO);
+
+static unsigned dmsim_pages_per_block = 64;
+module_param_named(pages_per_block, dmsim_pages_per_block, uint, S_IRUGO);
+
+static unsigned dmsim_tr_us = 25;
+module_param_named(tr_us, dmsim_tr_us, uint, 0644);
+MODULE_PARM_DESC(tr_us, "simulated array read time per page");
+
+static unsigned dmsim_tprog_us = 200;
+module_param_named(tprog_us, dmsim_tprog_us, uint, 0644);
+MODULE_PARM_DESC(tprog_us, "simulated program time per page");
+
+static unsigned dmsim_tbers_us = 1500;
+module_param_named(tbers_us, dmsim_tbers_us, uint, 0644);
+MODULE_PARM_DESC(tbers_us, "simulated block erase time");
+
+#define DMSIM_CW_SIZE		528
+#define DMSIM_CTRL_SIZE		(0x100 + DMSIM_CW_SIZE)
+#define DMSIM_REG(r)		((r) - msm_nand_phys)
+#define DMSIM_MAX_PTRS		16
+#define DMSIM_MAX_CMDS		256
+#define DMSIM_WIDE_FLASH	(1U << 1)
+
+#define DMSIM_RESULT_OK		(DMOV_RSLT_VALID | DMOV_RSLT_DONE)
+#define DMSIM_RESULT_ERROR	(DMOV_RSLT_VALID | DMOV_RSLT_ERROR)
+
+struct msm_nand_dmsim {
+	struct device *dev;
+	uint8_t *dma_buffer;
+	dma_addr_t dma_addr;
+	size_t dma_size;
+
+	spinlock_t lock;
+	struct list_head queue;
+	unsigned queued;
+	int busy;
+	struct workqueue_struct *wq;
+	struct work_struct work;
+
+	/* register window and page buffer as the data mover sees them */
+	uint32_t ctrl[DMSIM_CTRL_SIZE / 4];
+	int new_op;
+	unsigned page;
+	unsigned cw;
+	unsigned op_cws;
+
+	uint8_t *array;
+	unsigned cwperpage;
+	unsigned pages;
+
+	unsigned long lists;
+	unsigned long queued_behind;
+	unsigned max_queued;
+	unsigned long pages_read;
+	unsigned long pages_programmed;
+	unsigned long blocks_erased;
+	unsigned long bad_lists;
+	unsigned long unlocked_lists;
+};
+
+static struct msm_nand_dmsim dmsim;
+static struct msm_dmov_errdata dmsim_errdata;
+
+static uint32_t dmsim_reg(unsigned long reg)
+{
+	return dmsim.ctrl[DMSIM_REG(reg) / 4];
+}
+
+static void dmsim_set_reg(unsigned long reg, uint32_t val)
+{
+	dmsim.ctrl[DMSIM_REG(reg) / 4] = val;
+}
+
+/*
+ * Map a data mover address to something we can memcpy: the controller
+ * window, the driver's coherent command buffer, or a streaming mapping
+ * of lowmem pages.
+ */
+static uint8_t *dmsim_addr(uint32_t addr, uint32_t len, int *ctrl)
+{
+	struct page *page;
+
+	*ctrl = 0;
+	if (addr >= msm_nand_phys &&
+	    addr - msm_nand_phys + len <= DMSIM_CTRL_SIZE) {
+		*ctrl = 1;
+		return (uint8_t *)dmsim.ctrl + (addr - msm_nand_phys);
+	}
+	if (addr >= dmsim.dma_addr &&
+	    addr - dmsim.dma_addr + len <= dmsim.dma_size)
+		return dmsim.dma_buffer + (addr - dmsim.dma_addr);
+
+	if (!len || !pfn_valid(addr >> PAGE_SHIFT) ||
+	    !pfn_valid((addr + len - 1) >> PAGE_SHIFT))
+		return NULL;
+	page = pfn_to_page(addr >> PAGE_SHIFT);
+	if (PageHighMem(page) ||
+	    PageHighMem(pfn_to_page((addr + len - 1) >> PAGE_SHIFT)))
+		return NULL;
+	return (uint8_t *)page_address(page) + (addr & ~PAGE_MASK);
+}
+
+static uint8_t *dmsim_codeword(unsigned page, unsigned cw)
+{
+	if (page >= dmsim.pages || cw >= dmsim.cwperpage)
+		return NULL;
+	return dmsim.array +
+		((size_t)page * dmsim.cwperpage + cw) * DMSIM_CW_SIZE;
+}
+
+/* the controller runs whatever FLASH_CMD holds when EXEC_CMD is written */
+static void dmsim_exec(void)
+{
+	uint32_t cmd = dmsim_reg(MSM_NAND_FLASH_CMD);
+	uint32_t addr0 = dmsim_reg(MSM_NAND_ADDR0);
+	uint32_t cfg0 = dmsim_reg(MSM_NAND_DEV0_CFG0);
+	uint8_t *buf = (uint8_t *)dmsim.ctrl +
+		DMSIM_REG(MSM_NAND_FLASH_BUFFER);
+	unsigned ud = (cfg0 >> 9) & 0x3ff;
+	unsigned cwperop = ((cfg0 >> 6) & 7) + 1;
+	unsigned block, ppb = dmsim_pages_per_block;
+	uint32_t status = 0x20;
+	uint8_t *cw;
+	unsigned n;
+
+	if (!ud || ud > DMSIM_CW_SIZE)
+		ud = DMSIM_CW_SIZE;
+
+	if (dmsim.new_op) {
+		unsigned col = addr0 & 0xffff;
+
+		if (dmsim_reg(MSM_NAND_DEV0_CFG1) & DMSIM_WIDE_FLASH)
+			col <<= 1;
+		dmsim.page = (addr0 >> 16) |
+			((dmsim_reg(MSM_NAND_ADDR1) & 0xff) << 16);
+		dmsim.cw = col / DMSIM_CW_SIZE;
+		dmsim.op_cws = 0;
+	}
+
+	switch (cmd) {
+	case MSM_NAND_CMD_PAGE_READ:
+	case MSM_NAND_CMD_PAGE_READ_ECC:
+	case MSM_NAND_CMD_PAGE_READ_ALL:
+		if (dmsim.new_op) {
+			if (dmsim_tr_us)
+				udelay(dmsim_tr_us);
+			dmsim.pages_read++;
+		}
+		cw = dmsim_codeword(dmsim.page, dmsim.cw);
+		if (cw)
+			memcpy(buf, cw, DMSIM_CW_SIZE);
+		else
+			memset(buf, 0xff, DMSIM_CW_SIZE);
+		if (cmd == MSM_NAND_CMD_PAGE_READ_ECC) {
+			/* ECC fails on erased codewords, as on the part */
+			for (n = 0; n < ud && buf[n] == 0xff; n++)
+				;
+			if (n == ud)
+				status |= 0x10;
+		}
+		dmsim.cw++;
+		break;
+
+	case MSM_NAND_CMD_PRG_PAGE:
+	case MSM_NAND_CMD_PRG_PAGE_ECC:
+	case MSM_NAND_CMD_PRG_PAGE_ALL:
+		cw = dmsim_codeword(dmsim.page, dmsim.cw);
+		if (cw) {
+			/* programming can only clear bits */
+			for (n = 0; n < ud; n++)
+				cw[n] &= buf[n];
+			status |= 0x80;
+		} else
+			status |= 0x100;
+		dmsim.cw++;
+		if (++dmsim.op_cws == cwperop) {
+			if (dmsim_tprog_us)
+				udelay(dmsim_tprog_us);
+			dmsim.pages_programmed++;
+		}
+		break;
+
+	case MSM_NAND_CMD_BLOCK_ERASE:
+		/* erase takes a row address only */
+		block = addr0 / ppb;
+		if (block < dmsim.pages / ppb) {
+			memset(dmsim_codeword(block * ppb, 0), 0xff,
+			       (size_t)ppb * dmsim.cwperpage * DMSIM_CW_SIZE);
+			if (dmsim_tbers_us)
+				mdelay(DIV_ROUND_UP(dmsim_tbers_us, 1000));
+			dmsim.blocks_erased++;
+			status |= 0x80;
+		} else
+			status |= 0x100;
+		break;
+
+	case MSM_NAND_CMD_FETCH_ID:
+		dmsim_set_reg(MSM_NAND_READ_ID, dmsim_flash_id);
+		break;
+
+	default:
+		break;
+	}
+
+	dmsim.new_op = 0;
+	dmsim_set_reg(MSM_NAND_FLASH_STATUS, status);
+	dmsim_set_reg(MSM_NAND_BUFFER_STATUS, 0);
+}
+
+static int dmsim_xfer(dmov_s *c)
+{
+	unsigned long off;
+	uint8_t *src, *dst;
+	int src_ctrl, dst_ctrl;
+
+	src = dmsim_addr(c->src, c->len, &src_ctrl);
+	dst = dmsim_addr(c->dst, c->len, &dst_ctrl);
+	if (!src || !dst)
+		return -EFAULT;
+
+	memmove(dst, src, c->len);
+
+	if (!dst_ctrl) {
+		/* land in memory, not just in our cached view of it */
+		if (dst < dmsim.dma_buffer ||
+		    dst >= dmsim.dma_buffer + dmsim.dma_size)
+			dma_cache_maint(dst, c->len, DMA_TO_DEVICE);
+		return 0;
+	}
+
+	off = c->dst - msm_nand_phys;
+	if (off <= DMSIM_REG(MSM_NAND_ADDR0) &&
+	    off + c->len > DMSIM_REG(MSM_NAND_ADDR0))
+		dmsim.new_op = 1;
+	if (off <= DMSIM_REG(MSM_NAND_EXEC_CMD) &&
+	    off + c->len > DMSIM_REG(MSM_NAND_EXEC_CMD))
+		dmsim_exec();
+	return 0;
+}
+
+static int dmsim_run(unsigned int cmdptr)
+{
+	uint32_t ptr_addr = (cmdptr & 0x1fffffff) << 3;
+	unsigned first_cmd = 0, last_cmd = 0;
+	unsigned nptr, ncmd;
+	int ctrl, ret;
+
+	for (nptr = 0; nptr < DMSIM_MAX_PTRS; nptr++, ptr_addr += 4) {
+		uint32_t *ptr = (uint32_t *)dmsim_addr(ptr_addr, 4, &ctrl);
+		uint32_t cmd_addr;
+
+		if (!ptr || ctrl)
+			return -EFAULT;
+		cmd_addr = (*ptr & 0x1fffffff) << 3;
+
+		for (ncmd = 0; ncmd < DMSIM_MAX_CMDS; ncmd++) {
+			dmov_s *c = (dmov_s *)dmsim_addr(cmd_addr,
+							 sizeof(*c), &ctrl);
+
+			if (!c || ctrl)
+				return -EFAULT;
+			if ((c->cmd & 3) != CMD_MODE_SINGLE)
+				return -EINVAL;
+			if (nptr == 0 && ncmd == 0)
+				first_cmd = c->cmd;
+			last_cmd = c->cmd;
+
+			ret = dmsim_xfer(c);
+			if (ret)
+				return ret;
+			if (c->cmd & CMD_LC)
+				break;
+			cmd_addr += sizeof(*c);
+		}
+		if (ncmd == DMSIM_MAX_CMDS)
+			return -E2BIG;
+		if (*ptr & CMD_PTR_LP)
+			break;
+	}
+	if (nptr == DMSIM_MAX_PTRS)
+		return -E2BIG;
+
+	/* a list that does not hold the other channels off for its whole
+	 * length could be interleaved with another master's on real hardware
+	 */
+	if (!(first_cmd & CMD_OCB) || !(last_cmd & CMD_OCU))
+		dmsim.unlocked_lists++;
+	return 0;
+}
+
+static void dmsim_work(struct work_struct *work)
+{
+	struct msm_dmov_cmd *cmd;
+	unsigned long flags;
+	unsigned int result;
+
+	for (;;) {
+		spin_lock_irqsave(&dmsim.lock, flags);
+		if (list_empty(&dmsim.queue)) {
+			dmsim.busy = 0;
+			spin_unlock_irqrestore(&dmsim.lock, flags);
+			break;
+		}
+		cmd = list_first_entry(&dmsim.queue, struct msm_dmov_cmd,
+				       list);
+		list_del(&cmd->list);
+		dmsim.queued--;
+		spin_unlock_irqrestore(&dmsim.lock, flags);
+
+		dmsim.lists++;
+		if (dmsim_run(cmd->cmdptr)) {
+			dmsim.bad_lists++;
+			pr_err("msm_nand_dmsim: bad command list %x\n",
+			       cmd->cmdptr);
+			result = DMSIM_RESULT_ERROR;
+		} else
+			result = DMSIM_RESULT_OK;
+
+		if (cmd->complete_func)
+			cmd->complete_func(cmd, result,
+				result == DMSIM_RESULT_OK ?
+				NULL : &dmsim_errdata);
+	}
+}
+
+void msm_nand_dmsim_enqueue_cmd(unsigned id, struct msm_dmov_cmd *cmd)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dmsim.lock, flags);
+	/* on the ADM this list would sit in the channel's pointer FIFO
+	 * behind the one running, which is what pipelining is after
+	 */
+	if (dmsim.busy)
+		dmsim.queued_behind++;
+	dmsim.busy = 1;
+	list_add_tail(&cmd->list, &dmsim.queue);
+	if (++dmsim.queued > dmsim.max_queued)
+		dmsim.max_queued = dmsim.queued;
+	spin_unlock_irqrestore(&dmsim.lock, flags);
+
+	queue_work(dmsim.wq, &dmsim.work);
+}
+
+struct dmsim_exec_cmd {
+	struct msm_dmov_cmd dmov_cmd;
+	struct completion complete;
+	unsigned int result;
+};
+
+static void dmsim_exec_complete(struct msm_dmov_cmd *cmd,
+				unsigned int result,
+				struct msm_dmov_errdata *err)
+{
+	struct dmsim_exec_cmd *ecmd =
+		container_of(cmd, struct dmsim_exec_cmd, dmov_cmd);
+
+	ecmd->result = result;
+	complete(&ecmd->complete);
+}
+
+int msm_nand_dmsim_exec_cmd(unsigned id, unsigned int crci_mask,
+			    unsigned int cmdptr)
+{
+	struct dmsim_exec_cmd cmd;
+
+	cmd.dmov_cmd.cmdptr = cmdptr;
+	cmd.dmov_cmd.crci_mask = crci_mask;
+	cmd.dmov_cmd.complete_func = dmsim_exec_complete;
+	cmd.dmov_cmd.exec_func = NULL;
+	init_completion(&cmd.complete);
+
+	msm_nand_dmsim_enqueue_cmd(id, &cmd.dmov_cmd);
+	wait_for_completion(&cmd.complete);
+
+	return cmd.result == DMSIM_RESULT_OK ? 0 : -EIO;
+}
+
+static int dmsim_read_proc(char *page, char **start, off_t off,
+			   int count, int *eof, void *data)
+{
+	int len;
+
+	len = sprintf(page,
+		"lists %lu\n"
+		"queued behind running list %lu\n"
+		"max queued %u\n"
+		"pages read %lu\n"
+		"pages programmed %lu\n"
+		"blocks erased %lu\n"
+		"bad lists %lu\n"
+		"lists without OCB/OCU %lu\n",
+		dmsim.lists, dmsim.queued_behind, dmsim.max_queued,
+		dmsim.pages_read, dmsim.pages_programmed,
+		dmsim.blocks_erased, dmsim.bad_lists,
+		dmsim.unlocked_lists);
+	*eof = 1;
+	return len;
+}
+
+int msm_nand_dmsim_attach(struct device *dev, void *dma_buffer,
+			  dma_addr_t dma_addr, size_t size)
+{
+	size_t array_size;
+
+	if (dmsim_page_size < 512 || dmsim_page_size > 4096 ||
+	    !dmsim_pages_per_block)
+		return -EINVAL;
+
+	memset(&dmsim, 0, sizeof(dmsim));
+	dmsim.dev = dev;
+	dmsim.dma_buffer = dma_buffer;
+	dmsim.dma_addr = dma_addr;
+	dmsim.dma_size = size;
+	spin_lock_init(&dmsim.lock);
+	INIT_LIST_HEAD(&dmsim.queue);
+	INIT_WORK(&dmsim.work, dmsim_work);
+
+	dmsim.cwperpage = dmsim_page_size >> 9;
+	dmsim.pages = ((dmsim_size_mb << 20) / dmsim_page_size) /
+		dmsim_pages_per_block * dmsim_pages_per_block;
+	array_size = (size_t)dmsim.pages * dmsim.cwperpage * DMSIM_CW_SIZE;
+	dmsim.array = vmalloc(array_size);
+	if (!dmsim.array)
+		return -ENOMEM;
+	memset(dmsim.array, 0xff, array_size);
+
+	dmsim.wq = create_singlethread_workqueue("msm_nand_dmsim");
+	if (!dmsim.wq) {
+		vfree(dmsim.array);
+		return -ENOMEM;
+	}
+
+	create_proc_read_entry("msm_nand_dmsim", 0, NULL,
+			       dmsim_read_proc, NULL);
+
+	pr_info("msm_nand_dmsim: %u pages of %u bytes, id 0x%x\n",
+		dmsim.pages, dmsim_page_size, dmsim_flash_id);
+	return 0;
+}
+
+void msm_nand_dmsim_detach(void)
+{
+	remove_proc_entry("msm_nand_dmsim", NULL);
+	destroy_workqueue(dmsim.wq);
+	vfree(dmsim.array);
+	dmsim.array = NULL;
+}
@@ -0,0 +1,32 @@
+/* drivers/mtd/devices/msm_nand_dmsim.h
+ *
+ * Software data mover stand-in for the MSM NAND controller
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __DRIVERS_MTD_DEVICES_MSM_NAND_DMSIM_H
+#define __DRIVERS_MTD_DEVICES_MSM_NAND_DMSIM_H
+
+#include <linux/types.h>
+
+struct device;
+struct msm_dmov_cmd;
+
+int msm_nand_dmsim_attach(struct device *dev, void *dma_buffer,
+			  dma_addr_t dma_addr, size_t size);
+void msm_nand_dmsim_detach(void);
+
+void msm_nand_dmsim_enqueue_cmd(unsigned id, struct msm_dmov_cmd *cmd);
+int msm_nand_dmsim_exec_cmd(unsigned id, unsigned int crci_mask,
+			    unsigned int cmdptr);
+
+#endif
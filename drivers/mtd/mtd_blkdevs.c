@@ -20,18 +20,49 @@
 #include <linux/init.h>
 #include <linux/mutex.h>
 #include <linux/kthread.h>
+#include <linux/scatterlist.h>
 #include <asm/uaccess.h>
 
 #include "mtdcore.h"
 
 static LIST_HEAD(blktrans_majors);
 
+/* segments of one request handed to ->readsg() */
+#define MTD_BLKTRANS_SG_MAX	32
+
 struct mtd_blkcore_priv {
 	struct task_struct *thread;
 	struct request_queue *rq;
 	spinlock_t queue_lock;
+	struct scatterlist sg[MTD_BLKTRANS_SG_MAX];
 };
 
+/*
+ * Reads are offered to ->readsg() as a whole first, so the translation
+ * layer can move the data straight into the request's pages instead of
+ * going through readsect() one blksize at a time.
+ */
+static int do_blktrans_sg_request(struct mtd_blktrans_ops *tr,
+				  struct mtd_blktrans_dev *dev,
+				  struct request *req)
+{
+	struct scatterlist *sg = tr->blkcore_priv->sg;
+	int nents;
+
+	if (!tr->readsg || !blk_fs_request(req) || blk_discard_rq(req) ||
+	    rq_data_dir(req) != READ)
+		return -EOPNOTSUPP;
+
+	if (blk_rq_pos(req) + blk_rq_sectors(req) >
+	    get_capacity(req->rq_disk))
+		return -EIO;
+
+	sg_init_table(sg, MTD_BLKTRANS_SG_MAX);
+	nents = blk_rq_map_sg(req->q, req, sg);
+	return tr->readsg(dev, blk_rq_pos(req) << 9 >> tr->blkshift,
+			  blk_rq_bytes(req), sg, nents);
+}
+
 static int do_blktrans_request(struct mtd_blktrans_ops *tr,
 			       struct mtd_blktrans_dev *dev,
 			       struct request *req)
@@ -44,6 +75,10 @@ static int do_blktrans_request(struct mtd_blktrans_ops *tr,
 
 	buf = req->buffer;
 
+	if (req->cmd_type == REQ_TYPE_LINUX_BLOCK &&
+	    req->cmd[0] == REQ_LB_OP_FLUSH)
+		return tr->flush ? tr->flush(dev) : 0;
+
 	if (!blk_fs_request(req))
 		return -EIO;
 
@@ -105,6 +140,14 @@ static int mtd_blktrans_thread(void *arg)
 		spin_unlock_irq(rq->queue_lock);
 
 		mutex_lock(&dev->lock);
+		res = do_blktrans_sg_request(tr, dev, req);
+		if (res != -EOPNOTSUPP) {
+			mutex_unlock(&dev->lock);
+			spin_lock_irq(rq->queue_lock);
+			__blk_end_request_all(req, res);
+			req = NULL;
+			continue;
+		}
 		res = do_blktrans_request(tr, dev, req);
 		mutex_unlock(&dev->lock);
 
@@ -122,6 +165,17 @@ static int mtd_blktrans_thread(void *arg)
 	return 0;
 }
 
+/*
+ * Barriers drain the queue and are followed by a flush request, which
+ * reaches the translation layer's flush() like BLKFLSBUF does.
+ */
+static void mtd_blktrans_prepare_flush(struct request_queue *rq,
+				       struct request *req)
+{
+	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
+	req->cmd[0] = REQ_LB_OP_FLUSH;
+}
+
 static void mtd_blktrans_request(struct request_queue *rq)
 {
 	struct mtd_blktrans_ops *tr = rq->queuedata;
@@ -373,6 +427,16 @@ int register_mtd_blktrans(struct mtd_blktrans_ops *tr)
 	if (tr->discard)
 		queue_flag_set_unlocked(QUEUE_FLAG_DISCARD,
 					tr->blkcore_priv->rq);
+	if (tr->flush)
+		blk_queue_ordered(tr->blkcore_priv->rq,
+				  QUEUE_ORDERED_DRAIN_FLUSH,
+				  mtd_blktrans_prepare_flush);
+	if (tr->readsg) {
+		blk_queue_max_phys_segments(tr->blkcore_priv->rq,
+					    MTD_BLKTRANS_SG_MAX);
+		blk_queue_max_hw_segments(tr->blkcore_priv->rq,
+					  MTD_BLKTRANS_SG_MAX);
+	}
 
 	tr->blkshift = ffs(tr->blksize) - 1;
 
@@ -8,6 +8,8 @@
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <linux/module.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
@@ -19,14 +21,32 @@
 #include <linux/mutex.h>
 
 
+static int cache_blocks = 4;
+module_param(cache_blocks, int, S_IRUGO);
+MODULE_PARM_DESC(cache_blocks, "erase blocks each device caches for writing");
+
+static int writeback_ms = 3000;
+module_param(writeback_ms, int, S_IRUGO);
+MODULE_PARM_DESC(writeback_ms, "ms a cached erase block may stay dirty, "
+			       "0 to keep it until it is evicted or flushed");
+
+struct mtdblk_cache {
+	struct list_head lru;
+	unsigned char *data;
+	unsigned long offset;
+	unsigned long dirtied;
+	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } state;
+};
+
 static struct mtdblk_dev {
 	struct mtd_info *mtd;
 	int count;
 	struct mutex cache_mutex;
-	unsigned char *cache_data;
-	unsigned long cache_offset;
+	struct mtdblk_cache *cache;
+	int cache_entries;
+	struct list_head cache_lru;	/* most recently used first */
 	unsigned int cache_size;
-	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } cache_state;
+	struct task_struct *flush_thread;
 } *mtdblks[MAX_MTD_DEVICES];
 
 static struct mutex mtdblks_lock;
@@ -37,8 +57,11 @@ static struct mutex mtdblks_lock;
  * Since typical flash erasable sectors are much larger than what Linux's
  * buffer cache can handle, we must implement read-modify-write on flash
  * sectors for each block write requests.  To avoid over-erasing flash sectors
- * and to speed things up, we locally cache a whole flash sector while it is
- * being written to until a different sector is required.
+ * and to speed things up, we locally cache up to cache_blocks flash sectors
+ * while they are being written to, and only write one back when its slot is
+ * needed for another sector, when it has been dirty for writeback_ms, or on a
+ * flush.  Contiguous dirty sectors are written back together, with a single
+ * erase covering all of them.
  */
 
 static void erase_callback(struct erase_info *done)
@@ -47,19 +70,13 @@ static void erase_callback(struct erase_info *done)
 	wake_up(wait_q);
 }
 
-static int erase_write (struct mtd_info *mtd, unsigned long pos,
-			int len, const char *buf)
+static int erase_region (struct mtd_info *mtd, unsigned long pos, int len)
 {
 	struct erase_info erase;
 	DECLARE_WAITQUEUE(wait, current);
 	wait_queue_head_t wait_q;
-	size_t retlen;
 	int ret;
 
-	/*
-	 * First, let's erase the flash block.
-	 */
-
 	init_waitqueue_head(&wait_q);
 	erase.mtd = mtd;
 	erase.callback = erase_callback;
@@ -82,6 +99,22 @@ static int erase_write (struct mtd_info *mtd, unsigned long pos,
 
 	schedule();  /* Wait for erase to finish. */
 	remove_wait_queue(&wait_q, &wait);
+	return 0;
+}
+
+static int erase_write (struct mtd_info *mtd, unsigned long pos,
+			int len, const char *buf)
+{
+	size_t retlen;
+	int ret;
+
+	/*
+	 * First, let's erase the flash block.
+	 */
+
+	ret = erase_region(mtd, pos, len);
+	if (ret)
+		return ret;
 
 	/*
 	 * Next, write the data to flash.
@@ -96,40 +129,188 @@ static int erase_write (struct mtd_info *mtd, unsigned long pos,
 }
 
 
-static int write_cached_data (struct mtdblk_dev *mtdblk)
+static struct mtdblk_cache *find_cached (struct mtdblk_dev *mtdblk,
+					 unsigned long sect_start)
+{
+	struct mtdblk_cache *c;
+
+	list_for_each_entry(c, &mtdblk->cache_lru, lru)
+		if (c->state != STATE_EMPTY && c->offset == sect_start)
+			return c;
+	return NULL;
+}
+
+static struct mtdblk_cache *find_dirty (struct mtdblk_dev *mtdblk,
+					unsigned long sect_start)
+{
+	struct mtdblk_cache *c = find_cached(mtdblk, sect_start);
+
+	return c && c->state == STATE_DIRTY ? c : NULL;
+}
+
+/* Empty entries go to the tail, so they are the first to be reused */
+static void drop_cached (struct mtdblk_dev *mtdblk, struct mtdblk_cache *c)
+{
+	c->state = STATE_EMPTY;
+	list_move_tail(&c->lru, &mtdblk->cache_lru);
+}
+
+/*
+ * Write back the run of contiguous dirty sectors that @dirty is part of,
+ * erasing the whole run at once.
+ */
+static int write_cached_run (struct mtdblk_dev *mtdblk,
+			     struct mtdblk_cache *dirty)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
+	unsigned int sect_size = mtdblk->cache_size;
+	unsigned long start = dirty->offset, end = dirty->offset + sect_size;
+	struct mtdblk_cache *c;
+	size_t retlen;
 	int ret;
 
-	if (mtdblk->cache_state != STATE_DIRTY)
-		return 0;
+	while (start >= sect_size && find_dirty(mtdblk, start - sect_size))
+		start -= sect_size;
+	while (find_dirty(mtdblk, end))
+		end += sect_size;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "mtdblock: writing cached data for \"%s\" "
-			"at 0x%lx, size 0x%x\n", mtd->name,
-			mtdblk->cache_offset, mtdblk->cache_size);
+			"at 0x%lx, size 0x%lx\n", mtd->name,
+			start, end - start);
 
-	ret = erase_write (mtd, mtdblk->cache_offset,
-			   mtdblk->cache_size, mtdblk->cache_data);
+	ret = erase_region(mtd, start, end - start);
 	if (ret)
 		return ret;
 
-	/*
-	 * Here we could argubly set the cache state to STATE_CLEAN.
-	 * However this could lead to inconsistency since we will not
-	 * be notified if this content is altered on the flash by other
-	 * means.  Let's declare it empty and leave buffering tasks to
-	 * the buffer cache instead.
-	 */
-	mtdblk->cache_state = STATE_EMPTY;
+	for (; start < end; start += sect_size) {
+		c = find_dirty(mtdblk, start);
+		ret = mtd->write(mtd, start, sect_size, &retlen, c->data);
+		if (!ret && retlen != sect_size)
+			ret = -EIO;
+		if (ret)
+			return ret;
+
+		/*
+		 * Here we could argubly set the cache state to STATE_CLEAN.
+		 * However this could lead to inconsistency since we will not
+		 * be notified if this content is altered on the flash by other
+		 * means.  Let's declare it empty and leave buffering tasks to
+		 * the buffer cache instead.
+		 */
+		drop_cached(mtdblk, c);
+	}
 	return 0;
 }
 
+/* Write back every dirty sector, in address order */
+static int write_cached_data (struct mtdblk_dev *mtdblk)
+{
+	struct mtdblk_cache *c, *first;
+	int ret;
+
+	for (;;) {
+		first = NULL;
+		list_for_each_entry(c, &mtdblk->cache_lru, lru)
+			if (c->state == STATE_DIRTY &&
+			    (!first || c->offset < first->offset))
+				first = c;
+		if (!first)
+			return 0;
+
+		ret = write_cached_run(mtdblk, first);
+		if (ret)
+			return ret;
+	}
+}
+
+/* Write back everything once any sector has been dirty for writeback_ms */
+static int write_expired_data (struct mtdblk_dev *mtdblk)
+{
+	unsigned long expire = msecs_to_jiffies(writeback_ms);
+	struct mtdblk_cache *c;
+
+	list_for_each_entry(c, &mtdblk->cache_lru, lru)
+		if (c->state == STATE_DIRTY &&
+		    time_after_eq(jiffies, c->dirtied + expire))
+			return write_cached_data(mtdblk);
+	return 0;
+}
+
+/* Jiffies until the oldest dirty sector expires, or MAX_SCHEDULE_TIMEOUT */
+static long next_expiry (struct mtdblk_dev *mtdblk)
+{
+	unsigned long expire = msecs_to_jiffies(writeback_ms);
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+	struct mtdblk_cache *c;
+	long left;
+
+	list_for_each_entry(c, &mtdblk->cache_lru, lru) {
+		if (c->state != STATE_DIRTY)
+			continue;
+		left = (long)(c->dirtied + expire - jiffies);
+		if (left < timeout)
+			timeout = left > 0 ? left : 1;
+	}
+	return timeout;
+}
+
+/*
+ * Find the cache entry for a sector, or bring the sector in, writing back
+ * the least recently used entry if there is no free one.
+ */
+static struct mtdblk_cache *get_cached (struct mtdblk_dev *mtdblk,
+					unsigned long sect_start)
+{
+	struct mtd_info *mtd = mtdblk->mtd;
+	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
+	size_t retlen;
+	int ret;
+
+	c = find_cached(mtdblk, sect_start);
+	if (c) {
+		list_move(&c->lru, &mtdblk->cache_lru);
+		return c;
+	}
+
+	c = list_entry(mtdblk->cache_lru.prev, struct mtdblk_cache, lru);
+	if (c->state == STATE_DIRTY) {
+		ret = write_cached_run(mtdblk, c);
+		if (ret)
+			return ERR_PTR(ret);
+	}
+	c->state = STATE_EMPTY;
+
+	if (unlikely(!c->data)) {
+		c->data = vmalloc(sect_size);
+		if (!c->data)
+			return ERR_PTR(-EINTR);
+		/* -EINTR is not really correct, but it is the best match
+		 * documented in man 2 write for all cases.  We could also
+		 * return -EAGAIN sometimes, but why bother?
+		 */
+	}
+
+	/* fill the cache with the current sector */
+	ret = mtd->read(mtd, sect_start, sect_size, &retlen, c->data);
+	if (ret)
+		return ERR_PTR(ret);
+	if (retlen != sect_size)
+		return ERR_PTR(-EIO);
+
+	c->offset = sect_start;
+	c->state = STATE_CLEAN;
+	list_move(&c->lru, &mtdblk->cache_lru);
+	return c;
+}
+
 
 static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			    int len, const char *buf)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
 	int ret;
 
@@ -150,40 +331,30 @@ static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			/*
 			 * We are covering a whole sector.  Thus there is no
 			 * need to bother with the cache while it may still be
-			 * useful for other partial writes.
+			 * useful for other partial writes.  Whatever it held
+			 * for this sector is now out of date.
 			 */
+			c = find_cached(mtdblk, sect_start);
+			if (c)
+				drop_cached(mtdblk, c);
 			ret = erase_write (mtd, pos, size, buf);
 			if (ret)
 				return ret;
 		} else {
 			/* Partial sector: need to use the cache */
-
-			if (mtdblk->cache_state == STATE_DIRTY &&
-			    mtdblk->cache_offset != sect_start) {
-				ret = write_cached_data(mtdblk);
-				if (ret)
-					return ret;
-			}
-
-			if (mtdblk->cache_state == STATE_EMPTY ||
-			    mtdblk->cache_offset != sect_start) {
-				/* fill the cache with the current sector */
-				mtdblk->cache_state = STATE_EMPTY;
-				ret = mtd->read(mtd, sect_start, sect_size,
-						&retlen, mtdblk->cache_data);
-				if (ret)
-					return ret;
-				if (retlen != sect_size)
-					return -EIO;
-
-				mtdblk->cache_offset = sect_start;
-				mtdblk->cache_size = sect_size;
-				mtdblk->cache_state = STATE_CLEAN;
-			}
+			c = get_cached(mtdblk, sect_start);
+			if (IS_ERR(c))
+				return PTR_ERR(c);
 
 			/* write data to our local cache */
-			memcpy (mtdblk->cache_data + offset, buf, size);
-			mtdblk->cache_state = STATE_DIRTY;
+			memcpy (c->data + offset, buf, size);
+			if (c->state != STATE_DIRTY) {
+				c->dirtied = jiffies;
+				/* the flush thread sleeps while all is clean */
+				if (mtdblk->flush_thread)
+					wake_up_process(mtdblk->flush_thread);
+			}
+			c->state = STATE_DIRTY;
 		}
 
 		buf += size;
@@ -200,6 +371,7 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
 	int ret;
 
@@ -222,9 +394,9 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 		 * contains what we want, otherwise we read the data directly
 		 * from flash.
 		 */
-		if (mtdblk->cache_state != STATE_EMPTY &&
-		    mtdblk->cache_offset == sect_start) {
-			memcpy (buf, mtdblk->cache_data + offset, size);
+		c = find_cached(mtdblk, sect_start);
+		if (c) {
+			memcpy (buf, c->data + offset, size);
 		} else {
 			ret = mtd->read(mtd, pos, size, &retlen, buf);
 			if (ret)
@@ -241,27 +413,102 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 	return 0;
 }
 
+/*
+ * Writes back sectors that have been dirty too long, so that a crash
+ * loses at most writeback_ms worth of partial sector writes.  While the
+ * cache is clean it sleeps until do_cached_write() dirties a sector.
+ */
+static int mtdblock_flush_thread(void *arg)
+{
+	struct mtdblk_dev *mtdblk = arg;
+	long timeout;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		mutex_lock(&mtdblk->cache_mutex);
+		if (write_expired_data(mtdblk)) {
+			if (printk_ratelimit())
+				printk(KERN_WARNING "mtdblock: writeback on "
+				       "\"%s\" failed\n", mtdblk->mtd->name);
+			/* still dirty; try again a full period later */
+			timeout = msecs_to_jiffies(writeback_ms) ? : 1;
+		} else {
+			timeout = next_expiry(mtdblk);
+		}
+		/* set under the mutex, so a write dirtying the cache now
+		 * still wakes us */
+		set_current_state(TASK_INTERRUPTIBLE);
+		mutex_unlock(&mtdblk->cache_mutex);
+
+		if (!kthread_should_stop())
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+	return 0;
+}
+
 static int mtdblock_readsect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	return do_cached_read(mtdblk, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_read(mtdblk, block<<9, 512, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
+}
+
+/*
+ * A whole read request in one go, straight into the request's pages.
+ * Anything the erase block cache may hold newer data for, and anything
+ * the driver can't map, goes through readsect() instead.
+ */
+static int mtdblock_readsg(struct mtd_blktrans_dev *dev, unsigned long block,
+			   size_t len, struct scatterlist *sg, int nents)
+{
+	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
+	struct mtd_info *mtd = mtdblk->mtd;
+	unsigned long pos = block << 9;
+	struct mtdblk_cache *c;
+	size_t retlen;
+	int ret;
+
+	if (!mtd->read_sg)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	list_for_each_entry(c, &mtdblk->cache_lru, lru) {
+		if (c->state != STATE_EMPTY &&
+		    pos < c->offset + mtdblk->cache_size &&
+		    pos + len > c->offset) {
+			mutex_unlock(&mtdblk->cache_mutex);
+			return -EOPNOTSUPP;
+		}
+	}
+	ret = mtd->read_sg(mtd, pos, sg, nents, &retlen);
+	mutex_unlock(&mtdblk->cache_mutex);
+
+	if (ret == -EINVAL)
+		return -EOPNOTSUPP;
+	if (ret && ret != -EUCLEAN)
+		return ret;
+	if (retlen != len)
+		return -EIO;
+	return 0;
 }
 
 static int mtdblock_writesect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	if (unlikely(!mtdblk->cache_data && mtdblk->cache_size)) {
-		mtdblk->cache_data = vmalloc(mtdblk->mtd->erasesize);
-		if (!mtdblk->cache_data)
-			return -EINTR;
-		/* -EINTR is not really correct, but it is the best match
-		 * documented in man 2 write for all cases.  We could also
-		 * return -EAGAIN sometimes, but why bother?
-		 */
-	}
-	return do_cached_write(mtdblk, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_write(mtdblk, block<<9, 512, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
 }
 
 static int mtdblock_open(struct mtd_blktrans_dev *mbd)
@@ -290,10 +537,33 @@ static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 	mtdblk->mtd = mtd;
 
 	mutex_init(&mtdblk->cache_mutex);
-	mtdblk->cache_state = STATE_EMPTY;
+	INIT_LIST_HEAD(&mtdblk->cache_lru);
 	if ( !(mtdblk->mtd->flags & MTD_NO_ERASE) && mtdblk->mtd->erasesize) {
+		int i, n = max(cache_blocks, 1);
+
+		/* the sector buffers themselves are allocated on first use */
+		mtdblk->cache = kcalloc(n, sizeof(*mtdblk->cache), GFP_KERNEL);
+		if (!mtdblk->cache) {
+			kfree(mtdblk);
+			mutex_unlock(&mtdblks_lock);
+			return -ENOMEM;
+		}
+		for (i = 0; i < n; i++)
+			list_add_tail(&mtdblk->cache[i].lru,
+				      &mtdblk->cache_lru);
+		mtdblk->cache_entries = n;
 		mtdblk->cache_size = mtdblk->mtd->erasesize;
-		mtdblk->cache_data = NULL;
+
+		if (writeback_ms > 0 && (mtd->flags & MTD_WRITEABLE)) {
+			mtdblk->flush_thread = kthread_run(
+					mtdblock_flush_thread, mtdblk,
+					"mtdblockd%d", dev);
+			if (IS_ERR(mtdblk->flush_thread)) {
+				printk(KERN_WARNING "mtdblock: no writeback "
+				       "thread for \"%s\"\n", mtd->name);
+				mtdblk->flush_thread = NULL;
+			}
+		}
 	}
 
 	mtdblks[dev] = mtdblk;
@@ -313,16 +583,23 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 
 	mutex_lock(&mtdblks_lock);
 
+	if (!--mtdblk->count && mtdblk->flush_thread)
+		kthread_stop(mtdblk->flush_thread);
+
 	mutex_lock(&mtdblk->cache_mutex);
 	write_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
-	if (!--mtdblk->count) {
+	if (!mtdblk->count) {
+		int i;
+
 		/* It was the last usage. Free the device */
 		mtdblks[dev] = NULL;
 		if (mtdblk->mtd->sync)
 			mtdblk->mtd->sync(mtdblk->mtd);
-		vfree(mtdblk->cache_data);
+		for (i = 0; i < mtdblk->cache_entries; i++)
+			vfree(mtdblk->cache[i].data);
+		kfree(mtdblk->cache);
 		kfree(mtdblk);
 	}
 
@@ -336,14 +613,16 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
 static int mtdblock_flush(struct mtd_blktrans_dev *dev)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
+	int ret;
 
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	ret = write_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
+	/* ->sync can't fail; a failed writeback must fail the barrier */
 	if (mtdblk->mtd->sync)
 		mtdblk->mtd->sync(mtdblk->mtd);
-	return 0;
+	return ret;
 }
 
 static void mtdblock_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
@@ -380,6 +659,7 @@ static struct mtd_blktrans_ops mtdblock_tr = {
 	.flush		= mtdblock_flush,
 	.release	= mtdblock_release,
 	.readsect	= mtdblock_readsect,
+	.readsg		= mtdblock_readsg,
 	.writesect	= mtdblock_writesect,
 	.add_mtd	= mtdblock_add_mtd,
 	.remove_dev	= mtdblock_remove_dev,
@@ -17,6 +17,7 @@
 #include <linux/init.h>
 #include <linux/mtd/compatmac.h>
 #include <linux/proc_fs.h>
+#include <linux/spinlock.h>
 
 #include <linux/mtd/mtd.h>
 #include "internal.h"
@@ -200,6 +201,209 @@ static ssize_t mtd_name_show(struct device *dev,
 }
 static DEVICE_ATTR(name, S_IRUGO, mtd_name_show, NULL);
 
+/*
+ * I/O statistics.  They are accounted by whoever sees the operation
+ * complete: mtdpart for everything that goes through a partition (to the
+ * partition and to its master), the driver for the ECC results of the
+ * master.  One lock for all devices is plenty next to flash latencies.
+ */
+static DEFINE_SPINLOCK(mtd_stats_lock);
+
+static const char *mtd_stats_names[MTD_STATS_NR_OPS] = {
+	[MTD_STATS_READ]	= "read",
+	[MTD_STATS_WRITE]	= "write",
+	[MTD_STATS_ERASE]	= "erase",
+};
+
+/**
+ *	mtd_stats_account - account one completed operation
+ *	@mtd: MTD device the operation was issued to
+ *	@op: MTD_STATS_READ, MTD_STATS_WRITE or MTD_STATS_ERASE
+ *	@bytes: bytes transferred or erased
+ *	@err: result of the operation, -EUCLEAN counts as success
+ *	@us: how long it took in microseconds
+ */
+void mtd_stats_account(struct mtd_info *mtd, enum mtd_stats_op op,
+		       size_t bytes, int err, s64 us)
+{
+	struct mtd_op_stats *st = &mtd->stats.op[op];
+	unsigned long flags;
+	int bucket = 0;
+
+	if (us < 0)
+		us = 0;
+	if (us > UINT_MAX)
+		us = UINT_MAX;
+	if (us)
+		bucket = min(fls((u32)us) - 1, MTD_STATS_BUCKETS - 1);
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	st->ops++;
+	st->bytes += bytes;
+	if (err && err != -EUCLEAN)
+		st->errors++;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = us;
+	st->hist[bucket]++;
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+}
+
+/**
+ *	mtd_stats_ecc - account ECC results
+ *	@mtd: MTD device the data was read from
+ *	@corrected: number of bitflips corrected
+ *	@failed: number of uncorrectable reads
+ */
+void mtd_stats_ecc(struct mtd_info *mtd, unsigned int corrected,
+		   unsigned int failed)
+{
+	unsigned long flags;
+
+	if (!corrected && !failed)
+		return;
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	mtd->stats.ecc_corrected += corrected;
+	mtd->stats.ecc_failed += failed;
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+}
+
+/**
+ *	mtd_stats_erase - count an erase against each eraseblock it covers
+ *	@mtd: MTD device that was erased
+ *	@addr: start of the erased range
+ *	@len: length of the erased range
+ */
+void mtd_stats_erase(struct mtd_info *mtd, uint64_t addr, uint64_t len)
+{
+	uint32_t eb, last;
+	unsigned long flags;
+
+	if (!len || addr + len > mtd->size)
+		return;
+	eb = mtd_div_by_eb(addr, mtd);
+	last = mtd_div_by_eb(addr + len - 1, mtd);
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	if (mtd->erase_count)
+		for (; eb <= last; eb++)
+			mtd->erase_count[eb]++;
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+}
+
+static void mtd_stats_snapshot(struct mtd_info *mtd, struct mtd_stats *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	*stats = mtd->stats;
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+}
+
+static ssize_t mtd_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct mtd_info *mtd = dev_to_mtd(dev);
+	struct mtd_stats stats;
+	ssize_t len = 0;
+	int i;
+
+	mtd_stats_snapshot(mtd, &stats);
+
+	for (i = 0; i < MTD_STATS_NR_OPS; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len,
+				"%s: ops %llu bytes %llu errors %llu "
+				"total_us %llu max_us %u\n",
+				mtd_stats_names[i],
+				(unsigned long long)stats.op[i].ops,
+				(unsigned long long)stats.op[i].bytes,
+				(unsigned long long)stats.op[i].errors,
+				(unsigned long long)stats.op[i].total_us,
+				stats.op[i].max_us);
+	len += snprintf(buf + len, PAGE_SIZE - len,
+			"ecc: corrected %llu failed %llu\n",
+			(unsigned long long)stats.ecc_corrected,
+			(unsigned long long)stats.ecc_failed);
+	return len;
+}
+
+/* writing anything clears the statistics */
+static ssize_t mtd_stats_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct mtd_info *mtd = dev_to_mtd(dev);
+	unsigned long flags;
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	memset(&mtd->stats, 0, sizeof(mtd->stats));
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+	return count;
+}
+static DEVICE_ATTR(stats, S_IRUGO | S_IWUSR, mtd_stats_show, mtd_stats_store);
+
+/* one row per operation, one column per log2(us) bucket */
+static ssize_t mtd_latency_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct mtd_info *mtd = dev_to_mtd(dev);
+	struct mtd_stats stats;
+	ssize_t len = 0;
+	int i, n;
+
+	mtd_stats_snapshot(mtd, &stats);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "us:");
+	for (n = 0; n < MTD_STATS_BUCKETS; n++)
+		len += snprintf(buf + len, PAGE_SIZE - len, " %u", 1u << n);
+	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+
+	for (i = 0; i < MTD_STATS_NR_OPS; i++) {
+		len += snprintf(buf + len, PAGE_SIZE - len, "%s:",
+				mtd_stats_names[i]);
+		for (n = 0; n < MTD_STATS_BUCKETS; n++)
+			len += snprintf(buf + len, PAGE_SIZE - len, " %u",
+					stats.op[i].hist[n]);
+		len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	return len;
+}
+static DEVICE_ATTR(latency, S_IRUGO, mtd_latency_show, NULL);
+
+/* spread of erases over the eraseblocks, for judging wear leveling */
+static ssize_t mtd_wear_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct mtd_info *mtd = dev_to_mtd(dev);
+	uint32_t blocks = mtd_div_by_eb(mtd->size, mtd);
+	uint32_t min = UINT_MAX, max = 0, unused = 0;
+	unsigned long long total = 0;
+	unsigned long flags;
+	uint32_t eb;
+
+	if (!mtd->erase_count || !blocks)
+		return -ENODEV;
+
+	spin_lock_irqsave(&mtd_stats_lock, flags);
+	for (eb = 0; eb < blocks; eb++) {
+		uint32_t n = mtd->erase_count[eb];
+
+		total += n;
+		if (n < min)
+			min = n;
+		if (n > max)
+			max = n;
+		if (!n)
+			unused++;
+	}
+	spin_unlock_irqrestore(&mtd_stats_lock, flags);
+
+	return snprintf(buf, PAGE_SIZE, "blocks %u erases %llu min %u avg %llu "
+			"max %u unerased %u\n", blocks, total, min,
+			div_u64(total, blocks), max, unused);
+}
+static DEVICE_ATTR(wear, S_IRUGO, mtd_wear_show, NULL);
+
 static struct attribute *mtd_attrs[] = {
 	&dev_attr_type.attr,
 	&dev_attr_flags.attr,
@@ -210,6 +414,9 @@ static struct attribute *mtd_attrs[] = {
 	&dev_attr_oobsize.attr,
 	&dev_attr_numeraseregions.attr,
 	&dev_attr_name.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_latency.attr,
+	&dev_attr_wear.attr,
 	NULL,
 };
 
@@ -281,6 +488,13 @@ int add_mtd_device(struct mtd_info *mtd)
 			mtd->erasesize_mask = (1 << mtd->erasesize_shift) - 1;
 			mtd->writesize_mask = (1 << mtd->writesize_shift) - 1;
 
+			/* wear tracking is best effort */
+			if (mtd->erasesize)
+				mtd->erase_count = kcalloc(
+					mtd_div_by_eb(mtd->size, mtd),
+					sizeof(uint32_t),
+					GFP_KERNEL | __GFP_NOWARN);
+
 			/* Some chips always power up locked. Unlock them now */
 			if ((mtd->flags & MTD_WRITEABLE)
 			    && (mtd->flags & MTD_POWERUP_LOCK) && mtd->unlock) {
@@ -301,6 +515,8 @@ int add_mtd_device(struct mtd_info *mtd)
 			dev_set_drvdata(&mtd->dev, mtd);
 			if (device_register(&mtd->dev) != 0) {
 				mtd_table[i] = NULL;
+				kfree(mtd->erase_count);
+				mtd->erase_count = NULL;
 				break;
 			}
 
@@ -362,6 +578,11 @@ int del_mtd_device (struct mtd_info *mtd)
 
 		mtd_table[mtd->index] = NULL;
 
+		spin_lock_irq(&mtd_stats_lock);
+		kfree(mtd->erase_count);
+		mtd->erase_count = NULL;
+		spin_unlock_irq(&mtd_stats_lock);
+
 		module_put(THIS_MODULE);
 		ret = 0;
 	}
@@ -573,6 +794,9 @@ EXPORT_SYMBOL_GPL(put_mtd_device);
 EXPORT_SYMBOL_GPL(register_mtd_user);
 EXPORT_SYMBOL_GPL(unregister_mtd_user);
 EXPORT_SYMBOL_GPL(default_mtd_writev);
+EXPORT_SYMBOL_GPL(mtd_stats_account);
+EXPORT_SYMBOL_GPL(mtd_stats_ecc);
+EXPORT_SYMBOL_GPL(mtd_stats_erase);
 
 #ifdef CONFIG_PROC_FS
 
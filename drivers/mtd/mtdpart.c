@@ -15,6 +15,8 @@
 #include <linux/slab.h>
 #include <linux/list.h>
 #include <linux/kmod.h>
+#include <linux/scatterlist.h>
+#include <linux/hrtimer.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/compatmac.h>
@@ -36,6 +38,27 @@ struct mtd_part {
  */
 #define PART(x)  ((struct mtd_part *)(x))
 
+/*
+ * I/O through a partition is accounted to it and to its master.  The
+ * partition's share of the ECC results is what the master's ecc_stats
+ * moved by during the call.
+ */
+static void part_account(struct mtd_part *part, enum mtd_stats_op op,
+			 size_t bytes, int err, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	mtd_stats_account(&part->mtd, op, bytes, err, us);
+	mtd_stats_account(part->master, op, bytes, err, us);
+}
+
+static void part_account_ecc(struct mtd_part *part,
+			     struct mtd_ecc_stats *before)
+{
+	mtd_stats_ecc(&part->mtd,
+		      part->master->ecc_stats.corrected - before->corrected,
+		      part->master->ecc_stats.failed - before->failed);
+}
 
 /*
  * MTD methods which simply translate the effective address and pass through
@@ -47,6 +70,7 @@ static int part_read(struct mtd_info *mtd, loff_t from, size_t len,
 {
 	struct mtd_part *part = PART(mtd);
 	struct mtd_ecc_stats stats;
+	ktime_t start = ktime_get();
 	int res;
 
 	stats = part->master->ecc_stats;
@@ -57,6 +81,44 @@ static int part_read(struct mtd_info *mtd, loff_t from, size_t len,
 		len = mtd->size - from;
 	res = part->master->read(part->master, from + part->offset,
 				   len, retlen, buf);
+	part_account(part, MTD_STATS_READ, *retlen, res, start);
+	part_account_ecc(part, &stats);
+	if (unlikely(res)) {
+		if (res == -EUCLEAN)
+			mtd->ecc_stats.corrected += part->master->ecc_stats.corrected - stats.corrected;
+		if (res == -EBADMSG)
+			mtd->ecc_stats.failed += part->master->ecc_stats.failed - stats.failed;
+	}
+	return res;
+}
+
+static size_t part_sg_len(struct scatterlist *sg, unsigned int nents)
+{
+	struct scatterlist *s;
+	unsigned int i;
+	size_t len = 0;
+
+	for_each_sg(sg, s, nents, i)
+		len += s->length;
+	return len;
+}
+
+static int part_read_sg(struct mtd_info *mtd, loff_t from,
+		struct scatterlist *sg, unsigned int nents, size_t *retlen)
+{
+	struct mtd_part *part = PART(mtd);
+	struct mtd_ecc_stats stats;
+	ktime_t start = ktime_get();
+	int res;
+
+	stats = part->master->ecc_stats;
+
+	if (from + part_sg_len(sg, nents) > mtd->size)
+		return -EINVAL;
+	res = part->master->read_sg(part->master, from + part->offset,
+				    sg, nents, retlen);
+	part_account(part, MTD_STATS_READ, *retlen, res, start);
+	part_account_ecc(part, &stats);
 	if (unlikely(res)) {
 		if (res == -EUCLEAN)
 			mtd->ecc_stats.corrected += part->master->ecc_stats.corrected - stats.corrected;
@@ -101,13 +163,20 @@ static int part_read_oob(struct mtd_info *mtd, loff_t from,
 		struct mtd_oob_ops *ops)
 {
 	struct mtd_part *part = PART(mtd);
+	struct mtd_ecc_stats stats;
+	ktime_t start = ktime_get();
 	int res;
 
+	stats = part->master->ecc_stats;
+
 	if (from >= mtd->size)
 		return -EINVAL;
 	if (ops->datbuf && from + ops->len > mtd->size)
 		return -EINVAL;
 	res = part->master->read_oob(part->master, from + part->offset, ops);
+	part_account(part, MTD_STATS_READ, ops->retlen + ops->oobretlen,
+		     res, start);
+	part_account_ecc(part, &stats);
 
 	if (unlikely(res)) {
 		if (res == -EUCLEAN)
@@ -152,14 +221,36 @@ static int part_write(struct mtd_info *mtd, loff_t to, size_t len,
 		size_t *retlen, const u_char *buf)
 {
 	struct mtd_part *part = PART(mtd);
+	ktime_t start = ktime_get();
+	int res;
+
 	if (!(mtd->flags & MTD_WRITEABLE))
 		return -EROFS;
 	if (to >= mtd->size)
 		len = 0;
 	else if (to + len > mtd->size)
 		len = mtd->size - to;
-	return part->master->write(part->master, to + part->offset,
-				    len, retlen, buf);
+	res = part->master->write(part->master, to + part->offset,
+				  len, retlen, buf);
+	part_account(part, MTD_STATS_WRITE, *retlen, res, start);
+	return res;
+}
+
+static int part_write_sg(struct mtd_info *mtd, loff_t to,
+		struct scatterlist *sg, unsigned int nents, size_t *retlen)
+{
+	struct mtd_part *part = PART(mtd);
+	ktime_t start = ktime_get();
+	int res;
+
+	if (!(mtd->flags & MTD_WRITEABLE))
+		return -EROFS;
+	if (to + part_sg_len(sg, nents) > mtd->size)
+		return -EINVAL;
+	res = part->master->write_sg(part->master, to + part->offset,
+				     sg, nents, retlen);
+	part_account(part, MTD_STATS_WRITE, *retlen, res, start);
+	return res;
 }
 
 static int part_panic_write(struct mtd_info *mtd, loff_t to, size_t len,
@@ -180,6 +271,8 @@ static int part_write_oob(struct mtd_info *mtd, loff_t to,
 		struct mtd_oob_ops *ops)
 {
 	struct mtd_part *part = PART(mtd);
+	ktime_t start = ktime_get();
+	int res;
 
 	if (!(mtd->flags & MTD_WRITEABLE))
 		return -EROFS;
@@ -188,7 +281,10 @@ static int part_write_oob(struct mtd_info *mtd, loff_t to,
 		return -EINVAL;
 	if (ops->datbuf && to + ops->len > mtd->size)
 		return -EINVAL;
-	return part->master->write_oob(part->master, to + part->offset, ops);
+	res = part->master->write_oob(part->master, to + part->offset, ops);
+	part_account(part, MTD_STATS_WRITE, ops->retlen + ops->oobretlen,
+		     res, start);
+	return res;
 }
 
 static int part_write_user_prot_reg(struct mtd_info *mtd, loff_t from,
@@ -219,6 +315,8 @@ static int part_writev(struct mtd_info *mtd, const struct kvec *vecs,
 static int part_erase(struct mtd_info *mtd, struct erase_info *instr)
 {
 	struct mtd_part *part = PART(mtd);
+	ktime_t start = ktime_get();
+	uint64_t addr = instr->addr;
 	int ret;
 	if (!(mtd->flags & MTD_WRITEABLE))
 		return -EROFS;
@@ -226,6 +324,9 @@ static int part_erase(struct mtd_info *mtd, struct erase_info *instr)
 		return -EINVAL;
 	instr->addr += part->offset;
 	ret = part->master->erase(part->master, instr);
+	/* only a synchronous erase is timed in full */
+	part_account(part, MTD_STATS_ERASE, instr->len, ret, start);
+	mtd_stats_erase(mtd, addr, instr->len);
 	if (ret) {
 		if (instr->fail_addr != MTD_FAIL_ADDR_UNKNOWN)
 			instr->fail_addr -= part->offset;
@@ -389,6 +490,10 @@ static struct mtd_part *add_one_partition(struct mtd_info *master,
 
 	if (master->get_unmapped_area)
 		slave->mtd.get_unmapped_area = part_get_unmapped_area;
+	if (master->read_sg)
+		slave->mtd.read_sg = part_read_sg;
+	if (master->write_sg)
+		slave->mtd.write_sg = part_write_sg;
 	if (master->read_oob)
 		slave->mtd.read_oob = part_read_oob;
 	if (master->write_oob)
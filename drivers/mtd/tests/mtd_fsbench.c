@@ -0,0 +1,399 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * Compare flash file systems on the same MTD device: mount time, random 4KiB
+ * write latency, fsync cost and how evenly the erases land.
+ *
+ * Run it once per file system on a freshly formatted nandsim, e.g.
+ *
+ *   modprobe nandsim first_id_byte=0xec second_id_byte=0xa1 \
+ *	third_id_byte=0x00 fourth_id_byte=0x15
+ *
+ * For YAFFS2, load mtdblock and use mount_dev=/dev/mtdblock0
+ * mount_fs=yaffs2. For UBIFS, ubiattach -m 0, ubimkvol /dev/ubi0 -N data -m
+ * and use mount_dev=ubi0:data mount_fs=ubifs. In both cases dev=0 names the
+ * MTD device whose per-eraseblock erase counts, as kept by the MTD core, are
+ * compared before and after the writes. Nothing may have the file system
+ * mounted while the module loads. The results are printed when it loads.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/mtd/mtd.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/random.h>
+#include <linux/hrtimer.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+
+#define PRINT_PREF KERN_INFO "mtd_fsbench: "
+
+static char *mount_dev;
+module_param(mount_dev, charp, S_IRUGO);
+MODULE_PARM_DESC(mount_dev, "device to mount, e.g. /dev/mtdblock0 or "
+			    "ubi0:data");
+
+static char *mount_fs = "yaffs2";
+module_param(mount_fs, charp, S_IRUGO);
+MODULE_PARM_DESC(mount_fs, "file system type to mount mount_dev as");
+
+static int dev = -1;
+module_param(dev, int, S_IRUGO);
+MODULE_PARM_DESC(dev, "MTD device under mount_dev, for erase counts");
+
+static int mount_runs = 5;
+module_param(mount_runs, int, S_IRUGO);
+MODULE_PARM_DESC(mount_runs, "mounts to time");
+
+static int file_kb = 4096;
+module_param(file_kb, int, S_IRUGO);
+MODULE_PARM_DESC(file_kb, "size of the file written to in KiB");
+
+static int nr_writes = 4096;
+module_param(nr_writes, int, S_IRUGO);
+MODULE_PARM_DESC(nr_writes, "random 4KiB writes to time");
+
+static int sync_every = 16;
+module_param(sync_every, int, S_IRUGO);
+MODULE_PARM_DESC(sync_every, "writes between timed fsyncs, 0 for none");
+
+#define FSBENCH_IO_SIZE		4096
+#define FSBENCH_NAME		"mtd_fsbench"
+
+/* Latencies by power of two microseconds; the last bucket is open */
+#define FSBENCH_LAT_BUCKETS	24
+
+struct fsbench_lat {
+	unsigned long	count;
+	s64		total_us;
+	s64		max_us;
+	unsigned long	hist[FSBENCH_LAT_BUCKETS];
+};
+
+static struct mtd_info *mtd;
+static unsigned char *iobuf;
+
+static void fsbench_lat_add(struct fsbench_lat *lat, s64 us)
+{
+	int b = us > 0 ? fls64(us) : 0;
+
+	if (b >= FSBENCH_LAT_BUCKETS)
+		b = FSBENCH_LAT_BUCKETS - 1;
+	lat->hist[b]++;
+	lat->count++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+}
+
+/* Upper bound in microseconds of the latency of permille/1000 of the ops */
+static s64 fsbench_percentile(struct fsbench_lat *lat, int permille)
+{
+	unsigned long want = lat->count - div64_u64((u64)lat->count *
+						    (1000 - permille), 1000);
+	unsigned long seen = 0;
+	int b;
+
+	for (b = 0; b < FSBENCH_LAT_BUCKETS - 1; b++) {
+		seen += lat->hist[b];
+		if (seen >= want)
+			break;
+	}
+	return 1LL << b;
+}
+
+static void fsbench_mount_time(void)
+{
+	struct fsbench_lat lat;
+	int run;
+
+	memset(&lat, 0, sizeof(lat));
+	for (run = 0; run < mount_runs; run++) {
+		struct vfsmount *mnt;
+		ktime_t start;
+
+		start = ktime_get();
+		mnt = do_kern_mount(mount_fs, 0, mount_dev, NULL);
+		if (IS_ERR(mnt)) {
+			printk(PRINT_PREF "can't mount %s, %ld\n", mount_dev,
+			       PTR_ERR(mnt));
+			return;
+		}
+		fsbench_lat_add(&lat, ktime_us_delta(ktime_get(), start));
+		mntput(mnt);
+	}
+
+	printk(PRINT_PREF "%s mount: %lu mounts, avg %lld us, max %lld us\n",
+	       mount_fs, lat.count, div64_u64(lat.total_us, lat.count),
+	       lat.max_us);
+}
+
+/* Open, creating if need be, the benchmark file in the root of @mnt */
+static struct file *fsbench_open(struct vfsmount *mnt)
+{
+	struct inode *dir = mnt->mnt_root->d_inode;
+	struct dentry *dentry;
+	int err;
+
+	err = mnt_want_write(mnt);
+	if (err)
+		return ERR_PTR(err);
+
+	mutex_lock_nested(&dir->i_mutex, I_MUTEX_PARENT);
+	dentry = lookup_one_len(FSBENCH_NAME, mnt->mnt_root,
+				strlen(FSBENCH_NAME));
+	if (!IS_ERR(dentry) && !dentry->d_inode) {
+		err = vfs_create(dir, dentry, S_IFREG | 0600, NULL);
+		if (err) {
+			dput(dentry);
+			dentry = ERR_PTR(err);
+		}
+	}
+	mutex_unlock(&dir->i_mutex);
+	mnt_drop_write(mnt);
+	if (IS_ERR(dentry))
+		return ERR_CAST(dentry);
+
+	/* dentry_open() takes over both references, even on failure */
+	return dentry_open(dentry, mntget(mnt), O_RDWR | O_LARGEFILE,
+			   current_cred());
+}
+
+static void fsbench_unlink(struct vfsmount *mnt, struct dentry *dentry)
+{
+	struct inode *dir = mnt->mnt_root->d_inode;
+
+	if (mnt_want_write(mnt))
+		return;
+	mutex_lock_nested(&dir->i_mutex, I_MUTEX_PARENT);
+	vfs_unlink(dir, dentry);
+	mutex_unlock(&dir->i_mutex);
+	mnt_drop_write(mnt);
+}
+
+/* Copy of the erase counts, or NULL if the MTD device does not keep them */
+static uint32_t *fsbench_erase_counts(void)
+{
+	uint32_t blocks = mtd_div_by_eb(mtd->size, mtd);
+	uint32_t *counts;
+
+	if (!mtd->erase_count)
+		return NULL;
+	counts = vmalloc(blocks * sizeof(uint32_t));
+	if (counts)
+		memcpy(counts, mtd->erase_count, blocks * sizeof(uint32_t));
+	return counts;
+}
+
+static void fsbench_report_wear(uint32_t *before)
+{
+	uint32_t blocks = mtd_div_by_eb(mtd->size, mtd);
+	uint32_t min = UINT_MAX, max = 0, touched = 0;
+	uint32_t worst = 0, eb;
+	unsigned long long total = 0;
+
+	for (eb = 0; eb < blocks; eb++) {
+		uint32_t n = mtd->erase_count[eb] - before[eb];
+
+		total += n;
+		if (n < min)
+			min = n;
+		if (n > max)
+			max = n;
+		if (n)
+			touched++;
+		if (mtd->erase_count[eb] > worst)
+			worst = mtd->erase_count[eb];
+	}
+
+	printk(PRINT_PREF "%s wear: %llu erases over %u of %u blocks, per "
+	       "block min %u avg %llu max %u, most worn block %u erases\n",
+	       mount_fs, total, touched, blocks, min, div_u64(total, blocks),
+	       max, worst);
+}
+
+/*
+ * Overwrite random 4KiB pieces of a prefilled file, timing each write and
+ * an fsync every sync_every writes. The caller runs with KERNEL_DS.
+ */
+static int fsbench_random_writes(struct file *filp)
+{
+	struct dentry *dentry = filp->f_path.dentry;
+	unsigned int pieces = ((unsigned int)file_kb << 10) / FSBENCH_IO_SIZE;
+	struct fsbench_lat wr, sync;
+	uint32_t *before = NULL;
+	ktime_t start, begin;
+	s64 elapsed_us;
+	loff_t pos = 0;
+	int i, err;
+
+	/* the file is laid down and synced before anything is timed */
+	memset(iobuf, 0x5a, FSBENCH_IO_SIZE);
+	for (i = 0; i < pieces; i++) {
+		ssize_t n = vfs_write(filp, (const char __user *)iobuf,
+				      FSBENCH_IO_SIZE, &pos);
+		if (n != FSBENCH_IO_SIZE)
+			return n < 0 ? n : -ENOSPC;
+	}
+	err = vfs_fsync(filp, dentry, 0);
+	if (err)
+		return err;
+
+	if (mtd)
+		before = fsbench_erase_counts();
+
+	memset(&wr, 0, sizeof(wr));
+	memset(&sync, 0, sizeof(sync));
+	memset(iobuf, 0xa5, FSBENCH_IO_SIZE);
+	begin = ktime_get();
+	for (i = 0; i < nr_writes; i++) {
+		ssize_t n;
+
+		pos = (loff_t)(random32() % pieces) * FSBENCH_IO_SIZE;
+		start = ktime_get();
+		n = vfs_write(filp, (const char __user *)iobuf,
+			      FSBENCH_IO_SIZE, &pos);
+		fsbench_lat_add(&wr, ktime_us_delta(ktime_get(), start));
+		if (n != FSBENCH_IO_SIZE) {
+			err = n < 0 ? n : -ENOSPC;
+			goto out;
+		}
+
+		if (sync_every && (i + 1) % sync_every == 0) {
+			start = ktime_get();
+			err = vfs_fsync(filp, dentry, 0);
+			fsbench_lat_add(&sync,
+					ktime_us_delta(ktime_get(), start));
+			if (err)
+				goto out;
+		}
+		cond_resched();
+	}
+	err = vfs_fsync(filp, dentry, 0);
+	if (err)
+		goto out;
+	elapsed_us = ktime_us_delta(ktime_get(), begin);
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+
+	printk(PRINT_PREF "%s writes: %lu in %lld us, %llu KiB/s, "
+	       "p50 < %lld us, p99 < %lld us, p99.9 < %lld us, max %lld us\n",
+	       mount_fs, wr.count, elapsed_us,
+	       div64_u64((u64)wr.count * FSBENCH_IO_SIZE * USEC_PER_SEC,
+			 elapsed_us) >> 10,
+	       fsbench_percentile(&wr, 500), fsbench_percentile(&wr, 990),
+	       fsbench_percentile(&wr, 999), wr.max_us);
+	if (sync.count)
+		printk(PRINT_PREF "%s fsync: %lu syncs, avg %lld us, "
+		       "p99 < %lld us, max %lld us\n", mount_fs, sync.count,
+		       div64_u64(sync.total_us, sync.count),
+		       fsbench_percentile(&sync, 990), sync.max_us);
+	if (before)
+		fsbench_report_wear(before);
+	else if (mtd)
+		printk(PRINT_PREF "mtd%d keeps no erase counts\n", dev);
+
+out:
+	vfree(before);
+	return err;
+}
+
+static int fsbench_writes(void)
+{
+	struct vfsmount *mnt;
+	struct file *filp;
+	mm_segment_t fs;
+	int err;
+
+	mnt = do_kern_mount(mount_fs, 0, mount_dev, NULL);
+	if (IS_ERR(mnt)) {
+		printk(PRINT_PREF "can't mount %s, %ld\n", mount_dev,
+		       PTR_ERR(mnt));
+		return PTR_ERR(mnt);
+	}
+
+	filp = fsbench_open(mnt);
+	if (IS_ERR(filp)) {
+		err = PTR_ERR(filp);
+		printk(PRINT_PREF "can't create a file on %s, %d\n",
+		       mount_dev, err);
+		goto out_mnt;
+	}
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	err = fsbench_random_writes(filp);
+	set_fs(fs);
+	if (err)
+		printk(PRINT_PREF "writes on %s failed, %d\n", mount_dev, err);
+
+	fsbench_unlink(mnt, filp->f_path.dentry);
+	fput(filp);
+out_mnt:
+	mntput(mnt);
+	return err;
+}
+
+static int __init mtd_fsbench_init(void)
+{
+	int err;
+
+	if (!mount_dev || mount_runs < 0 || nr_writes < 0 ||
+	    sync_every < 0 || file_kb < FSBENCH_IO_SIZE >> 10)
+		return -EINVAL;
+
+	printk(KERN_INFO "\n");
+	printk(KERN_INFO "=================================================\n");
+
+	if (dev >= 0) {
+		mtd = get_mtd_device(NULL, dev);
+		if (IS_ERR(mtd)) {
+			err = PTR_ERR(mtd);
+			printk(PRINT_PREF "error: cannot get MTD device\n");
+			return err;
+		}
+	} else
+		mtd = NULL;
+
+	iobuf = kmalloc(FSBENCH_IO_SIZE, GFP_KERNEL);
+	if (!iobuf) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (mount_runs)
+		fsbench_mount_time();
+	err = nr_writes ? fsbench_writes() : 0;
+
+	kfree(iobuf);
+out:
+	if (mtd)
+		put_mtd_device(mtd);
+	printk(KERN_INFO "=================================================\n");
+	return err;
+}
+module_init(mtd_fsbench_init);
+
+static void __exit mtd_fsbench_exit(void)
+{
+	return;
+}
+module_exit(mtd_fsbench_exit);
+
+MODULE_DESCRIPTION("Flash file system mount, write and wear benchmark");
+MODULE_LICENSE("GPL");
@@ -1284,6 +1284,22 @@ static int __init bytes_str_to_int(const char *str)
 	return result;
 }
 
+/**
+ * find_mtd_param - find the attach request for an MTD device.
+ * @name: MTD device name or number string
+ *
+ * Returns the @mtd_dev_param entry for @name, or %NULL if there is none.
+ */
+static struct mtd_dev_param __init *find_mtd_param(const char *name)
+{
+	int i;
+
+	for (i = 0; i < mtd_devs; i++)
+		if (!strcmp(mtd_dev_param[i].name, name))
+			return &mtd_dev_param[i];
+	return NULL;
+}
+
 /**
  * ubi_mtd_param_parse - parse the 'mtd=' UBI parameter.
  * @val: the parameter value to parse
@@ -1303,12 +1319,6 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (!val)
 		return -EINVAL;
 
-	if (mtd_devs == UBI_MAX_DEVICES) {
-		printk(KERN_ERR "UBI error: too many parameters, max. is %d\n",
-		       UBI_MAX_DEVICES);
-		return -EINVAL;
-	}
-
 	len = strnlen(val, MTD_PARAM_LEN_MAX);
 	if (len == MTD_PARAM_LEN_MAX) {
 		printk(KERN_ERR "UBI error: parameter \"%s\" is too long, "
@@ -1337,16 +1347,26 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 		return -EINVAL;
 	}
 
-	p = &mtd_dev_param[mtd_devs];
+	if (!find_mtd_param(tokens[0]) && mtd_devs == UBI_MAX_DEVICES) {
+		printk(KERN_ERR "UBI error: too many parameters, max. is %d\n",
+		       UBI_MAX_DEVICES);
+		return -EINVAL;
+	}
+
+	p = find_mtd_param(tokens[0]);
+	if (!p)
+		p = &mtd_dev_param[mtd_devs];
 	strcpy(&p->name[0], tokens[0]);
 
+	p->vid_hdr_offs = 0;
 	if (tokens[1])
 		p->vid_hdr_offs = bytes_str_to_int(tokens[1]);
 
 	if (p->vid_hdr_offs < 0)
 		return p->vid_hdr_offs;
 
-	mtd_devs += 1;
+	if (p == &mtd_dev_param[mtd_devs])
+		mtd_devs += 1;
 	return 0;
 }
 
@@ -1362,6 +1382,41 @@ MODULE_PARM_DESC(mtd, "MTD devices to attach. Parameter format: "
 		      "with name \"content\" using VID header offset 1984, and "
 		      "MTD device number 4 with default VID header offset.");
 
+#ifndef MODULE
+/**
+ * ubi_attach_at_boot - ask for an MTD device to be attached by 'ubi_init()'.
+ * @name: MTD device name or number string
+ * @vid_hdr_offs: VID header offset, zero for the default
+ *
+ * Lets board code attach its UBI partitions without an 'ubi.mtd=' command
+ * line argument. It must be called before 'ubi_init()' runs. A device that is
+ * already named on the command line is left as the command line asked.
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of error.
+ */
+int __init ubi_attach_at_boot(const char *name, int vid_hdr_offs)
+{
+	struct mtd_dev_param *p;
+
+	if (!name || !*name || strlen(name) >= MTD_PARAM_LEN_MAX ||
+	    vid_hdr_offs < 0)
+		return -EINVAL;
+	if (find_mtd_param(name))
+		return 0;
+	if (mtd_devs == UBI_MAX_DEVICES) {
+		printk(KERN_ERR "UBI error: too many MTD devices, max. is %d\n",
+		       UBI_MAX_DEVICES);
+		return -EINVAL;
+	}
+
+	p = &mtd_dev_param[mtd_devs++];
+	strcpy(p->name, name);
+	p->vid_hdr_offs = vid_hdr_offs;
+	return 0;
+}
+#endif
+
 MODULE_VERSION(__stringify(UBI_VERSION));
 MODULE_DESCRIPTION("UBI - Unsorted Block Images");
 MODULE_AUTHOR("Artem Bityutskiy");
@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -29,12 +30,49 @@
 #include <linux/proc_fs.h>
 #include <linux/rbtree.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * There is no global lock on the transaction path. Locks, in the order
+ * they nest:
+ *
+ * binder_procs_lock and binder_context_mgr_node_lock (mutexes) only cover
+ * the proc list and the context manager.
+ *
+ * proc->outer_lock (mutex) protects the proc's refs: both ref trees and
+ * each ref's counts and death notification.
+ *
+ * proc->alloc_lock (mutex) protects the buffer allocator, the mapping and
+ * proc->files. It is never held across the other locks.
+ *
+ * node->lock (spinlock) protects a node's reference counts, its list of
+ * refs and node->proc. The counts of a live node are also covered by
+ * node->proc->inner_lock, so binder_node_inner_lock() takes both.
+ *
+ * proc->inner_lock (spinlock) protects the proc's todo lists, its threads
+ * and their transaction stacks, looper state and errors, the nodes tree
+ * and node work, the buffer <-> transaction links of the proc's buffers,
+ * and the thread counters and tmp_refs.
+ *
+ * binder_dead_nodes_lock (spinlock) protects the dead node list and the
+ * tmp_refs of dead nodes.
+ *
+ * transaction->lock (spinlock) protects t->from, t->to_proc and
+ * t->to_thread. It is taken inside the inner lock of either proc.
+ *
+ * At most one proc's outer and one proc's inner lock is held at a time.
+ * Objects used after their lock is dropped are pinned: procs with
+ * proc->tmp_refs, threads with thread->tmp_refs and nodes with
+ * node->tmp_refs. Threads and procs are only freed when they are dead and
+ * the last such reference goes away.
+ */
+static DEFINE_MUTEX(binder_procs_lock);
+static DEFINE_MUTEX(binder_context_mgr_node_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
 static HLIST_HEAD(binder_procs);
@@ -45,7 +83,7 @@ static struct proc_dir_entry *binder_proc_dir_entry_root;
 static struct proc_dir_entry *binder_proc_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 static int binder_read_proc_proc(char *page, char **start, off_t off,
@@ -64,6 +102,13 @@ static int binder_read_proc_proc(char *page, char **start, off_t off,
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+/*
+ * Transactions up to this size (data + offsets) share one size class and
+ * are recycled through a small per-proc cache instead of the free tree.
+ */
+#define BINDER_SMALL_TRANSACTION_SIZE 256
+#define BINDER_SMALL_CACHE_SIZE 8
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -89,6 +134,36 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* free pages a proc keeps mapped for reuse instead of releasing them */
+static int binder_alloc_cache_pages = 16;
+module_param_named(alloc_cache_pages, binder_alloc_cache_pages,
+		   int, S_IWUSR | S_IRUGO);
+
+/* when fewer pages are cached, populate this many extra per allocation */
+static int binder_alloc_low_pages = 2;
+module_param_named(alloc_low_pages, binder_alloc_low_pages,
+		   int, S_IWUSR | S_IRUGO);
+static int binder_alloc_prefill_pages = 4;
+module_param_named(alloc_prefill_pages, binder_alloc_prefill_pages,
+		   int, S_IWUSR | S_IRUGO);
+
+/* let synchronous calls from SCHED_FIFO/SCHED_RR threads run at their class */
+static int binder_inherit_rt = 1;
+module_param_named(inherit_rt, binder_inherit_rt, bool, S_IWUSR | S_IRUGO);
+
+/*
+ * Synchronous calls from RT threads, or from threads at or below this nice
+ * value, go on a separate proc queue that idle threads service first. The
+ * last reserved_threads idle threads of a proc only take work from that
+ * queue, so high priority callers do not wait behind background work.
+ */
+static int binder_high_priority_nice = -8;
+module_param_named(high_priority_nice, binder_high_priority_nice,
+		   int, S_IWUSR | S_IRUGO);
+static int binder_reserved_threads;
+module_param_named(reserved_threads, binder_reserved_threads,
+		   int, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -130,22 +205,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -161,24 +236,47 @@ struct binder_transaction_log_entry {
 	int offsets_size;
 };
 struct binder_transaction_log {
-	int next;
+	atomic_t cur;
 	int full;
 	struct binder_transaction_log_entry entry[32];
 };
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
 
+/*
+ * Latency histograms in log2 buckets of microseconds: bucket 0 counts
+ * everything below 16us, bucket n counts [8 << n, 16 << n) us and the last
+ * bucket is open ended (from about 262ms up).
+ */
+#define BINDER_LATENCY_BUCKETS 16
+
+struct binder_latency_hist {
+	uint32_t count[BINDER_LATENCY_BUCKETS];
+};
+
+static void binder_latency_record(struct binder_latency_hist *hist, s64 us)
+{
+	int bucket;
+
+	if (us < 16)
+		bucket = 0;
+	else if (us >= 8LL << (BINDER_LATENCY_BUCKETS - 1))
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	else
+		bucket = fls((unsigned int)(us >> 4));
+	hist->count[bucket]++;
+}
+
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
-	e = &log->entry[log->next];
-	memset(e, 0, sizeof(*e));
-	log->next++;
-	if (log->next == ARRAY_SIZE(log->entry)) {
-		log->next = 0;
+	unsigned int cur = atomic_inc_return(&log->cur) - 1;
+
+	if (cur >= ARRAY_SIZE(log->entry))
 		log->full = 1;
-	}
+	e = &log->entry[cur % ARRAY_SIZE(log->entry)];
+	memset(e, 0, sizeof(*e));
 	return e;
 }
 
@@ -196,6 +294,7 @@ struct binder_work {
 
 struct binder_node {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	union {
 		struct rb_node rb_node;
@@ -203,6 +302,7 @@ struct binder_node {
 	};
 	struct binder_proc *proc;
 	struct hlist_head refs;
+	int tmp_refs;
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
@@ -216,6 +316,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency_hist wakeup_latency;
 };
 
 struct binder_ref_death {
@@ -247,7 +348,8 @@ struct binder_buffer {
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
-	unsigned debug_id:29;
+	unsigned cached:1;
+	unsigned debug_id:28;
 
 	struct binder_transaction *transaction;
 
@@ -257,12 +359,27 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+struct binder_alloc_stats {
+	int pages_populated;
+	int pages_reused;
+	int pages_deferred;
+	int pages_released;
+	int small_hits;
+	int small_misses;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+struct binder_priority {
+	int sched_policy;
+	int rt_priority;
+	long nice;
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
 	struct rb_root threads;
@@ -275,9 +392,14 @@ struct binder_proc {
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
+	int tmp_refs;
+	int is_dead;
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex outer_lock;
+	spinlock_t inner_lock;
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
@@ -286,7 +408,12 @@ struct binder_proc {
 	struct page **pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	int pages_cached;
+	struct binder_buffer *small_buffers[BINDER_SMALL_CACHE_SIZE];
+	int small_buffer_count;
+	struct binder_alloc_stats alloc_stats;
 	struct list_head todo;
+	struct list_head todo_high;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
 	struct list_head delivered_death;
@@ -294,7 +421,8 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_latency_hist wakeup_latency;
+	struct binder_latency_hist reply_latency;
 };
 
 enum {
@@ -319,10 +447,20 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	atomic_t tmp_refs;
+	int is_dead;
+	/*
+	 * Set while the thread runs at a priority binder gave it for a
+	 * transaction; idle_priority is what it had before the first one.
+	 */
+	int priority_inherited;
+	struct binder_priority inherited_priority;
+	struct binder_priority idle_priority;
 };
 
 struct binder_transaction {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	struct binder_thread *from;
 	struct binder_transaction *from_parent;
@@ -335,13 +473,19 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_proc_dec_tmpref(struct binder_proc *proc);
+static void binder_thread_dec_tmpref(struct binder_thread *thread);
 
 /*
  * copied from get_unused_fd_flags
@@ -498,6 +642,110 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_get_priority(struct task_struct *task,
+				struct binder_priority *prio)
+{
+	prio->sched_policy = task->policy;
+	prio->rt_priority = task->rt_priority;
+	prio->nice = task_nice(task);
+}
+
+static void binder_set_priority(struct binder_priority *prio)
+{
+	struct sched_param param;
+	int ret;
+
+	if (current->policy != prio->sched_policy ||
+	    current->rt_priority != prio->rt_priority) {
+		param.sched_priority = binder_rt_policy(prio->sched_policy) ?
+				       prio->rt_priority : 0;
+		ret = sched_setscheduler_nocheck(current, prio->sched_policy,
+						 &param);
+		if (ret)
+			binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+				     "binder: %d: failed to set policy %d "
+				     "prio %d, %d\n", current->pid,
+				     prio->sched_policy, prio->rt_priority,
+				     ret);
+	}
+	binder_set_nice(prio->nice);
+}
+
+static int binder_priority_equal(struct binder_priority *a,
+				 struct binder_priority *b)
+{
+	return a->sched_policy == b->sched_policy &&
+		a->rt_priority == b->rt_priority && a->nice == b->nice;
+}
+
+/*
+ * Go back to prio, but only if the thread still runs at the priority
+ * binder gave it. A policy or nice value the thread has set for itself
+ * since is left alone.
+ */
+static void binder_restore_priority(struct binder_thread *thread,
+				    struct binder_priority *prio)
+{
+	struct binder_priority cur;
+
+	if (!thread->priority_inherited)
+		return;
+	binder_get_priority(current, &cur);
+	if (!binder_priority_equal(&cur, &thread->inherited_priority)) {
+		thread->priority_inherited = 0;
+		return;
+	}
+	if (!binder_priority_equal(&cur, prio))
+		binder_set_priority(prio);
+	binder_get_priority(current, &thread->inherited_priority);
+}
+
+static int binder_priority_is_high(struct binder_priority *prio)
+{
+	return binder_rt_policy(prio->sched_policy) ||
+		prio->nice <= binder_high_priority_nice;
+}
+
+/*
+ * Called with t delivered to the current thread. Synchronous calls run at
+ * the caller's priority, or at the node's minimum if that is higher.
+ */
+static void binder_transaction_priority(struct binder_thread *thread,
+					struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority prio;
+	long min_nice = node->min_priority;
+
+	binder_get_priority(current, &t->saved_priority);
+	if (!thread->priority_inherited ||
+	    !binder_priority_equal(&t->saved_priority,
+				   &thread->inherited_priority)) {
+		thread->idle_priority = t->saved_priority;
+		thread->priority_inherited = 1;
+	}
+	if (t->flags & TF_ONE_WAY) {
+		if (t->saved_priority.nice > min_nice)
+			binder_set_nice(min_nice);
+	} else {
+		prio.sched_policy = SCHED_NORMAL;
+		prio.rt_priority = 0;
+		prio.nice = min(t->priority.nice, min_nice);
+		if (binder_inherit_rt &&
+		    binder_rt_policy(t->priority.sched_policy)) {
+			prio.sched_policy = t->priority.sched_policy;
+			prio.rt_priority = t->priority.rt_priority;
+		}
+		binder_set_priority(&prio);
+	}
+	binder_get_priority(current, &thread->inherited_priority);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -566,6 +814,7 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
+/* Called with proc->alloc_lock held */
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
@@ -631,7 +880,8 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
+		if (*page)
+			continue; /* kept mapped by binder_release_page_range */
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -688,6 +938,98 @@ err_no_vma:
 	return -ENOMEM;
 }
 
+static int binder_count_pages(struct binder_proc *proc, void *start, void *end)
+{
+	void *page_addr;
+	int count = 0;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+		if (proc->pages[(page_addr - proc->buffer) / PAGE_SIZE])
+			count++;
+	return count;
+}
+
+/*
+ * Populate the pages backing [start, end), and when the proc is low on
+ * mapped free pages, up to binder_alloc_prefill_pages more below limit,
+ * all under a single mmap_sem acquisition.
+ */
+static int binder_populate_page_range(struct binder_proc *proc,
+				      void *start, void *end, void *limit)
+{
+	void *prefill_end = end;
+	int present, mapped, ret;
+
+	if (end <= start)
+		return 0;
+
+	if (proc->pages_cached < binder_alloc_low_pages &&
+	    binder_alloc_prefill_pages > 0) {
+		prefill_end = end + binder_alloc_prefill_pages * PAGE_SIZE;
+		if (prefill_end > limit)
+			prefill_end = limit;
+		if (prefill_end < end)
+			prefill_end = end;
+	}
+
+	present = binder_count_pages(proc, start, end);
+	proc->alloc_stats.pages_reused += present;
+	if (present == (end - start) / PAGE_SIZE && prefill_end == end) {
+		proc->pages_cached -= present;
+		return 0;
+	}
+
+	mapped = binder_count_pages(proc, start, prefill_end);
+	ret = binder_update_page_range(proc, 1, start, prefill_end, NULL);
+	mapped = binder_count_pages(proc, start, prefill_end) - mapped;
+	proc->alloc_stats.pages_populated += mapped;
+	proc->pages_cached += mapped;
+	if (ret)
+		return ret;
+
+	proc->pages_cached -= (end - start) / PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Pages freed along with a buffer stay mapped while the proc has fewer
+ * than binder_alloc_cache_pages of them, so the next allocation touching
+ * them does not have to map them again.
+ */
+static void binder_release_page_range(struct binder_proc *proc,
+				      void *start, void *end)
+{
+	int count;
+
+	if (end <= start)
+		return;
+
+	count = (end - start) / PAGE_SIZE;
+	if (!proc->is_dead &&
+	    proc->pages_cached + count <= binder_alloc_cache_pages) {
+		proc->pages_cached += count;
+		proc->alloc_stats.pages_deferred += count;
+		return;
+	}
+	binder_update_page_range(proc, 0, start, end, NULL);
+	proc->alloc_stats.pages_released += count;
+}
+
+static size_t binder_buffer_alloc_size(size_t data_size, size_t offsets_size)
+{
+	size_t size = ALIGN(data_size, sizeof(void *)) +
+		ALIGN(offsets_size, sizeof(void *));
+
+	if (size < BINDER_SMALL_TRANSACTION_SIZE)
+		size = BINDER_SMALL_TRANSACTION_SIZE;
+	return size;
+}
+
+/*
+ * Called with proc->alloc_lock held. The returned buffer is not owned by a
+ * transaction yet and cannot be freed from userspace until the caller sets
+ * allow_user_free.
+ */
 static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 					      size_t data_size,
 					      size_t offsets_size, int is_async)
@@ -706,8 +1048,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	size = ALIGN(data_size, sizeof(void *)) +
-		ALIGN(offsets_size, sizeof(void *));
+	size = binder_buffer_alloc_size(data_size, offsets_size);
 
 	if (size < data_size || size < offsets_size) {
 		binder_user_error("binder: %d: got transaction with invalid "
@@ -723,6 +1064,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	if (size == BINDER_SMALL_TRANSACTION_SIZE) {
+		if (proc->small_buffer_count) {
+			buffer = proc->small_buffers[--proc->small_buffer_count];
+			buffer->cached = 0;
+			proc->alloc_stats.small_hits++;
+			binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+				     "binder: %d: binder_alloc_buf size %zd "
+				     "reused %p\n", proc->pid, size, buffer);
+			goto out;
+		}
+		proc->alloc_stats.small_misses++;
+	}
+
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -764,8 +1118,9 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
 		end_page_addr = has_page_addr;
-	if (binder_update_page_range(proc, 1,
-	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
+	if (binder_populate_page_range(proc,
+	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr,
+	    has_page_addr))
 		return NULL;
 
 	rb_erase(best_fit, &proc->free_buffers);
@@ -780,9 +1135,13 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got "
 		     "%p\n", proc->pid, size, buffer);
+out:
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
+	buffer->target_node = NULL;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -844,13 +1203,14 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 			     "not share page%s%s with with %p or %p\n",
 			     proc->pid, buffer, free_page_start ? "" : " end",
 			     free_page_end ? "" : " start", prev, next);
-		binder_update_page_range(proc, 0, free_page_start ?
+		binder_release_page_range(proc, free_page_start ?
 			buffer_start_page(buffer) : buffer_end_page(buffer),
 			(free_page_end ? buffer_end_page(buffer) :
-			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+			buffer_start_page(buffer)) + PAGE_SIZE);
 	}
 }
 
+/* Called with proc->alloc_lock held */
 static void binder_free_buf(struct binder_proc *proc,
 			    struct binder_buffer *buffer)
 {
@@ -858,8 +1218,8 @@ static void binder_free_buf(struct binder_proc *proc,
 
 	buffer_size = binder_buffer_size(proc, buffer);
 
-	size = ALIGN(buffer->data_size, sizeof(void *)) +
-		ALIGN(buffer->offsets_size, sizeof(void *));
+	size = binder_buffer_alloc_size(buffer->data_size,
+					buffer->offsets_size);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_free_buf %p size %zd buffer"
@@ -880,10 +1240,18 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
+	if (size == BINDER_SMALL_TRANSACTION_SIZE && !proc->is_dead &&
+	    proc->small_buffer_count < BINDER_SMALL_CACHE_SIZE) {
+		/* stays in allocated_buffers, so userspace cannot free it */
+		buffer->async_transaction = 0;
+		buffer->cached = 1;
+		proc->small_buffers[proc->small_buffer_count++] = buffer;
+		return;
+	}
+
+	binder_release_page_range(proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK));
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
@@ -906,12 +1274,38 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_node_inner_lock(struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	if (node->proc)
+		spin_lock(&node->proc->inner_lock);
+}
+
+static void binder_node_inner_unlock(struct binder_node *node)
+{
+	if (node->proc)
+		spin_unlock(&node->proc->inner_lock);
+	spin_unlock(&node->lock);
+}
+
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
+/*
+ * Returns the node with a temporary reference, which the caller drops with
+ * binder_put_node().
+ */
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
-	struct rb_node *n = proc->nodes.rb_node;
+	struct rb_node *n;
 	struct binder_node *node;
 
+	spin_lock(&proc->inner_lock);
+	n = proc->nodes.rb_node;
 	while (n) {
 		node = rb_entry(n, struct binder_node, rb_node);
 
@@ -919,20 +1313,33 @@ static struct binder_node *binder_get_node(struct binder_proc *proc,
 			n = n->rb_left;
 		else if (ptr > node->ptr)
 			n = n->rb_right;
-		else
+		else {
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
 			return node;
+		}
 	}
+	spin_unlock(&proc->inner_lock);
 	return NULL;
 }
 
+/*
+ * Like binder_get_node(), but creates the node for fp (the NULL object
+ * when fp is NULL) if it does not exist yet.
+ */
 static struct binder_node *binder_new_node(struct binder_proc *proc,
-					   void __user *ptr,
-					   void __user *cookie)
+					   struct flat_binder_object *fp)
 {
 	struct rb_node **p = &proc->nodes.rb_node;
 	struct rb_node *parent = NULL;
-	struct binder_node *node;
+	struct binder_node *node, *new_node;
+	void __user *ptr = fp ? fp->binder : NULL;
+
+	new_node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (new_node == NULL)
+		return NULL;
 
+	spin_lock(&proc->inner_lock);
 	while (*p) {
 		parent = *p;
 		node = rb_entry(parent, struct binder_node, rb_node);
@@ -941,23 +1348,33 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 			p = &(*p)->rb_left;
 		else if (ptr > node->ptr)
 			p = &(*p)->rb_right;
-		else
-			return NULL;
+		else {
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
+			kfree(new_node);
+			return node;
+		}
 	}
 
-	node = kzalloc(sizeof(*node), GFP_KERNEL);
-	if (node == NULL)
-		return NULL;
+	node = new_node;
 	binder_stats_created(BINDER_STAT_NODE);
-	rb_link_node(&node->rb_node, parent, p);
-	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
+	spin_lock_init(&node->lock);
+	node->tmp_refs = 1;
 	node->proc = proc;
 	node->ptr = ptr;
-	node->cookie = cookie;
+	if (fp) {
+		node->cookie = fp->cookie;
+		node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+		node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
+	}
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
+	rb_link_node(&node->rb_node, parent, p);
+	rb_insert_color(&node->rb_node, &proc->nodes);
+	spin_unlock(&proc->inner_lock);
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -965,8 +1382,9 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
-static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+/* Called with binder_node_inner_lock() held */
+static int binder_inc_node_nilocked(struct binder_node *node, int strong,
+				    int internal, struct list_head *target_list)
 {
 	if (strong) {
 		if (internal) {
@@ -1000,50 +1418,141 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 	return 0;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+static int binder_inc_node(struct binder_node *node, int strong, int internal,
+			   struct list_head *target_list)
+{
+	int ret;
+
+	binder_node_inner_lock(node);
+	ret = binder_inc_node_nilocked(node, strong, internal, target_list);
+	binder_node_inner_unlock(node);
+	return ret;
+}
+
+/*
+ * Called with binder_node_inner_lock() held. Returns 1 if the node is gone
+ * from its proc or the dead list, and the caller has to free it once the
+ * locks are dropped.
+ */
+static int binder_dec_node_nilocked(struct binder_node *node, int strong,
+				    int internal)
 {
+	struct binder_proc *proc = node->proc;
+
+	/* releasing a dead node's proc already dropped its local refs */
 	if (strong) {
 		if (internal)
 			node->internal_strong_refs--;
-		else
+		else if (proc)
 			node->local_strong_refs--;
 		if (node->local_strong_refs || node->internal_strong_refs)
 			return 0;
 	} else {
-		if (!internal)
+		if (!internal && proc)
 			node->local_weak_refs--;
-		if (node->local_weak_refs || !hlist_empty(&node->refs))
+		if (node->local_weak_refs || node->tmp_refs ||
+		    !hlist_empty(&node->refs))
 			return 0;
 	}
-	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
+	if (proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
-			list_add_tail(&node->work.entry, &node->proc->todo);
-			wake_up_interruptible(&node->proc->wait);
+			list_add_tail(&node->work.entry, &proc->todo);
+			wake_up_interruptible(&proc->wait);
 		}
+		return 0;
+	}
+	if (!hlist_empty(&node->refs) || node->local_strong_refs ||
+	    node->local_weak_refs || node->tmp_refs)
+		return 0;
+	if (proc) {
+		list_del_init(&node->work.entry);
+		rb_erase(&node->rb_node, &proc->nodes);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: refless node %d deleted\n",
+			     node->debug_id);
 	} else {
-		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
-			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
-			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+		spin_lock(&binder_dead_nodes_lock);
+		/* the dead list can hand out new temporary refs */
+		if (node->tmp_refs) {
+			spin_unlock(&binder_dead_nodes_lock);
+			return 0;
 		}
+		hlist_del(&node->dead_node);
+		spin_unlock(&binder_dead_nodes_lock);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: dead node %d deleted\n",
+			     node->debug_id);
 	}
+	return 1;
+}
 
-	return 0;
+static void binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	int free_node;
+
+	binder_node_inner_lock(node);
+	free_node = binder_dec_node_nilocked(node, strong, internal);
+	binder_node_inner_unlock(node);
+	if (free_node)
+		binder_free_node(node);
+}
+
+static void binder_inc_node_tmpref(struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	if (node->proc) {
+		spin_lock(&node->proc->inner_lock);
+		node->tmp_refs++;
+		spin_unlock(&node->proc->inner_lock);
+	} else {
+		spin_lock(&binder_dead_nodes_lock);
+		node->tmp_refs++;
+		spin_unlock(&binder_dead_nodes_lock);
+	}
+	spin_unlock(&node->lock);
+}
+
+static void binder_put_node(struct binder_node *node)
+{
+	int free_node;
+
+	binder_node_inner_lock(node);
+	if (!node->proc)
+		spin_lock(&binder_dead_nodes_lock);
+	node->tmp_refs--;
+	BUG_ON(node->tmp_refs < 0);
+	if (!node->proc)
+		spin_unlock(&binder_dead_nodes_lock);
+	free_node = binder_dec_node_nilocked(node, 0, 1);
+	binder_node_inner_unlock(node);
+	if (free_node)
+		binder_free_node(node);
 }
 
+/*
+ * Takes what a transaction to node needs: a local strong ref for the
+ * buffer, a temporary ref on the node and one on its proc. Fails with
+ * BR_DEAD_REPLY if the node's proc is gone.
+ */
+static struct binder_node *binder_get_node_refs_for_txn(
+	struct binder_node *node, struct binder_proc **procp, uint32_t *error)
+{
+	struct binder_node *target_node = NULL;
+
+	binder_node_inner_lock(node);
+	if (node->proc) {
+		binder_inc_node_nilocked(node, 1, 0, NULL);
+		node->tmp_refs++;
+		node->proc->tmp_refs++;
+		*procp = node->proc;
+		target_node = node;
+	} else
+		*error = BR_DEAD_REPLY;
+	binder_node_inner_unlock(node);
+	return target_node;
+}
 
+/* Called with proc->outer_lock held */
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
 {
@@ -1063,6 +1572,7 @@ static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 	return NULL;
 }
 
+/* Called with proc->outer_lock held */
 static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 						  struct binder_node *node)
 {
@@ -1086,7 +1596,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1115,7 +1625,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spin_lock(&node->lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(&node->lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1130,25 +1642,37 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	return new_ref;
 }
 
+/* Called with ref->proc->outer_lock held */
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct binder_node *node = ref->node;
+	int free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
-		     ref->desc, ref->node->debug_id);
+		     ref->desc, node->debug_id);
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+
+	binder_node_inner_lock(node);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		binder_dec_node_nilocked(node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	free_node = binder_dec_node_nilocked(node, 0, 1);
+	binder_node_inner_unlock(node);
+	if (free_node)
+		binder_free_node(node);
+
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1156,6 +1680,7 @@ static void binder_delete_ref(struct binder_ref *ref)
 	binder_stats_deleted(BINDER_STAT_REF);
 }
 
+/* Called with ref->proc->outer_lock held */
 static int binder_inc_ref(struct binder_ref *ref, int strong,
 			  struct list_head *target_list)
 {
@@ -1178,7 +1703,7 @@ static int binder_inc_ref(struct binder_ref *ref, int strong,
 	return 0;
 }
 
-
+/* Called with ref->proc->outer_lock held */
 static int binder_dec_ref(struct binder_ref *ref, int strong)
 {
 	if (strong) {
@@ -1190,12 +1715,8 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 			return -EINVAL;
 		}
 		ref->strong--;
-		if (ref->strong == 0) {
-			int ret;
-			ret = binder_dec_node(ref->node, strong, 1);
-			if (ret)
-				return ret;
-		}
+		if (ref->strong == 0)
+			binder_dec_node(ref->node, strong, 1);
 	} else {
 		if (ref->weak == 0) {
 			binder_user_error("binder: %d invalid dec weak, "
@@ -1211,30 +1732,78 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
-static void binder_pop_transaction(struct binder_thread *target_thread,
-				   struct binder_transaction *t)
+/* Called with target_thread->proc->inner_lock held */
+static void binder_pop_transaction_ilocked(struct binder_thread *target_thread,
+					   struct binder_transaction *t)
 {
-	if (target_thread) {
-		BUG_ON(target_thread->transaction_stack != t);
-		BUG_ON(target_thread->transaction_stack->from != target_thread);
-		target_thread->transaction_stack =
-			target_thread->transaction_stack->from_parent;
-		t->from = NULL;
-	}
+	BUG_ON(target_thread->transaction_stack != t);
+	BUG_ON(target_thread->transaction_stack->from != target_thread);
+	target_thread->transaction_stack =
+		target_thread->transaction_stack->from_parent;
+	spin_lock(&t->lock);
+	t->from = NULL;
+	spin_unlock(&t->lock);
 	t->need_reply = 0;
-	if (t->buffer)
-		t->buffer->transaction = NULL;
+}
+
+static void binder_free_transaction(struct binder_transaction *t)
+{
+	struct binder_proc *target_proc = t->to_proc;
+
+	if (target_proc) {
+		spin_lock(&target_proc->inner_lock);
+		if (t->buffer)
+			t->buffer->transaction = NULL;
+		spin_unlock(&target_proc->inner_lock);
+	}
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
+/* Returns t->from with a temporary reference, or NULL if it is gone */
+static struct binder_thread *binder_get_txn_from(struct binder_transaction *t)
+{
+	struct binder_thread *from;
+
+	spin_lock(&t->lock);
+	from = t->from;
+	if (from)
+		atomic_inc(&from->tmp_refs);
+	spin_unlock(&t->lock);
+	return from;
+}
+
+/*
+ * As binder_get_txn_from(), but returns with the sender's inner lock held,
+ * or NULL if the sender went away before it could be taken.
+ */
+static struct binder_thread *binder_get_txn_from_and_acq_inner(
+	struct binder_transaction *t)
+{
+	struct binder_thread *from;
+
+	from = binder_get_txn_from(t);
+	if (!from)
+		return NULL;
+	spin_lock(&from->proc->inner_lock);
+	if (t->from) {
+		BUG_ON(from != t->from);
+		return from;
+	}
+	spin_unlock(&from->proc->inner_lock);
+	binder_thread_dec_tmpref(from);
+	return NULL;
+}
+
 static void binder_send_failed_reply(struct binder_transaction *t,
 				     uint32_t error_code)
 {
 	struct binder_thread *target_thread;
+	struct binder_transaction *next;
+
 	BUG_ON(t->flags & TF_ONE_WAY);
 	while (1) {
-		target_thread = t->from;
+		target_thread = binder_get_txn_from_and_acq_inner(t);
 		if (target_thread) {
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
@@ -1249,37 +1818,40 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					      t->debug_id, target_thread->proc->pid,
 					      target_thread->pid);
 
-				binder_pop_transaction(target_thread, t);
+				binder_pop_transaction_ilocked(target_thread, t);
 				target_thread->return_error = error_code;
 				wake_up_interruptible(&target_thread->wait);
+				spin_unlock(&target_thread->proc->inner_lock);
+				binder_free_transaction(t);
 			} else {
 				printk(KERN_ERR "binder: reply failed, target "
 					"thread, %d:%d, has error code %d "
 					"already\n", target_thread->proc->pid,
 					target_thread->pid,
 					target_thread->return_error);
+				spin_unlock(&target_thread->proc->inner_lock);
 			}
+			binder_thread_dec_tmpref(target_thread);
 			return;
-		} else {
-			struct binder_transaction *next = t->from_parent;
-
-			binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
-				     "binder: send failed reply "
-				     "for transaction %d, target dead\n",
-				     t->debug_id);
-
-			binder_pop_transaction(target_thread, t);
-			if (next == NULL) {
-				binder_debug(BINDER_DEBUG_DEAD_BINDER,
-					     "binder: reply failed,"
-					     " no target thread at root\n");
-				return;
-			}
-			t = next;
+		}
+		next = t->from_parent;
+
+		binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+			     "binder: send failed reply "
+			     "for transaction %d, target dead\n",
+			     t->debug_id);
+
+		binder_free_transaction(t);
+		if (next == NULL) {
 			binder_debug(BINDER_DEBUG_DEAD_BINDER,
-				     "binder: reply failed, no target "
-				     "thread -- retry %d\n", t->debug_id);
+				     "binder: reply failed,"
+				     " no target thread at root\n");
+			return;
 		}
+		t = next;
+		binder_debug(BINDER_DEBUG_DEAD_BINDER,
+			     "binder: reply failed, no target "
+			     "thread -- retry %d\n", t->debug_id);
 	}
 }
 
@@ -1327,11 +1899,16 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        node %d u%p\n",
 				     node->debug_id, node->ptr);
 			binder_dec_node(node, fp->type == BINDER_TYPE_BINDER, 0);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+
+			mutex_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad handle %ld\n", debug_id,
 				       fp->handle);
@@ -1341,13 +1918,17 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 
 		case BINDER_TYPE_FD:
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld\n", fp->handle);
-			if (failed_at)
+			if (failed_at) {
+				mutex_lock(&proc->alloc_lock);
 				task_close_fd(proc, fp->handle);
+				mutex_unlock(&proc->alloc_lock);
+			}
 			break;
 
 		default:
@@ -1358,6 +1939,29 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Called with thread->proc->inner_lock held. Returns the thread of
+ * target_proc deepest in the call chain, with a temporary reference.
+ */
+static struct binder_thread *binder_stack_target_thread(
+	struct binder_thread *thread, struct binder_proc *target_proc)
+{
+	struct binder_transaction *tmp = thread->transaction_stack;
+	struct binder_transaction *match = NULL;
+	struct binder_thread *target_thread = NULL;
+
+	while (tmp) {
+		spin_lock(&tmp->lock);
+		if (tmp->from && tmp->from->proc == target_proc)
+			match = tmp;
+		spin_unlock(&tmp->lock);
+		tmp = tmp->from_parent;
+	}
+	if (match)
+		target_thread = binder_get_txn_from(match);
+	return target_thread;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1365,7 +1969,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
 	size_t *offp, *off_end;
-	struct binder_proc *target_proc;
+	struct binder_proc *target_proc = NULL;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
 	struct list_head *target_list;
@@ -1383,16 +1987,18 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		spin_lock(&proc->inner_lock);
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
+			spin_unlock(&proc->inner_lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
 					  proc->pid, thread->pid);
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
+			spin_lock(&in_reply_to->lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
 				" transaction %d has target %d:%d\n",
@@ -1401,12 +2007,23 @@ static void binder_transaction(struct binder_proc *proc,
 				in_reply_to->to_proc->pid : 0,
 				in_reply_to->to_thread ?
 				in_reply_to->to_thread->pid : 0);
+			spin_unlock(&in_reply_to->lock);
+			spin_unlock(&proc->inner_lock);
+			binder_restore_priority(thread,
+						&in_reply_to->saved_priority);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
 		thread->transaction_stack = in_reply_to->to_parent;
-		target_thread = in_reply_to->from;
+		/* the buffer stays with userspace, not with the transaction */
+		if (in_reply_to->buffer) {
+			in_reply_to->buffer->transaction = NULL;
+			in_reply_to->buffer = NULL;
+		}
+		spin_unlock(&proc->inner_lock);
+		binder_restore_priority(thread, &in_reply_to->saved_priority);
+		target_thread = binder_get_txn_from_and_acq_inner(in_reply_to);
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
@@ -1419,16 +2036,27 @@ static void binder_transaction(struct binder_proc *proc,
 				target_thread->transaction_stack ?
 				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
+			spin_unlock(&target_thread->proc->inner_lock);
+			binder_thread_dec_tmpref(target_thread);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			target_thread = NULL;
 			goto err_dead_binder;
 		}
 		target_proc = target_thread->proc;
+		target_proc->tmp_refs++;
+		spin_unlock(&target_proc->inner_lock);
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
+
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, tr->target.handle);
+			if (ref)
+				target_node = binder_get_node_refs_for_txn(
+					ref->node, &target_proc,
+					&return_error);
+			mutex_unlock(&proc->outer_lock);
 			if (ref == NULL) {
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
@@ -1436,24 +2064,25 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_invalid_target_handle;
 			}
-			target_node = ref->node;
 		} else {
-			target_node = binder_context_mgr_node;
-			if (target_node == NULL) {
+			mutex_lock(&binder_context_mgr_node_lock);
+			if (binder_context_mgr_node)
+				target_node = binder_get_node_refs_for_txn(
+					binder_context_mgr_node, &target_proc,
+					&return_error);
+			else
 				return_error = BR_DEAD_REPLY;
-				goto err_no_context_mgr_node;
-			}
+			mutex_unlock(&binder_context_mgr_node_lock);
 		}
-		e->to_node = target_node->debug_id;
-		target_proc = target_node->proc;
-		if (target_proc == NULL) {
-			return_error = BR_DEAD_REPLY;
+		if (target_node == NULL)
 			goto err_dead_binder;
-		}
+		e->to_node = target_node->debug_id;
+		spin_lock(&proc->inner_lock);
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
 			tmp = thread->transaction_stack;
 			if (tmp->to_thread != thread) {
+				spin_lock(&tmp->lock);
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1461,24 +2090,18 @@ static void binder_transaction(struct binder_proc *proc,
 					tmp->to_proc ? tmp->to_proc->pid : 0,
 					tmp->to_thread ?
 					tmp->to_thread->pid : 0);
+				spin_unlock(&tmp->lock);
+				spin_unlock(&proc->inner_lock);
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
+			target_thread = binder_stack_target_thread(thread,
+								   target_proc);
 		}
+		spin_unlock(&proc->inner_lock);
 	}
-	if (target_thread) {
+	if (target_thread)
 		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1488,6 +2111,7 @@ static void binder_transaction(struct binder_proc *proc,
 		goto err_alloc_t_failed;
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION);
+	spin_lock_init(&t->lock);
 
 	tcomplete = kzalloc(sizeof(*tcomplete), GFP_KERNEL);
 	if (tcomplete == NULL) {
@@ -1496,7 +2120,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1525,19 +2149,19 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	binder_get_priority(current, &t->priority);
+
+	mutex_lock(&target_proc->alloc_lock);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	mutex_unlock(&target_proc->alloc_lock);
 	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1579,13 +2203,11 @@ static void binder_transaction(struct binder_proc *proc,
 			struct binder_ref *ref;
 			struct binder_node *node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
-				node = binder_new_node(proc, fp->binder, fp->cookie);
+				node = binder_new_node(proc, fp);
 				if (node == NULL) {
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
-				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
 				binder_user_error("binder: %d:%d sending u%p "
@@ -1593,10 +2215,14 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				binder_put_node(node);
 				goto err_binder_get_ref_for_node_failed;
 			}
+			mutex_lock(&target_proc->outer_lock);
 			ref = binder_get_ref_for_node(target_proc, node);
 			if (ref == NULL) {
+				mutex_unlock(&target_proc->outer_lock);
+				binder_put_node(node);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
@@ -1612,11 +2238,20 @@ static void binder_transaction(struct binder_proc *proc,
 				     "        node %d u%p -> ref %d desc %d\n",
 				     node->debug_id, node->ptr, ref->debug_id,
 				     ref->desc);
+			mutex_unlock(&target_proc->outer_lock);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+			struct binder_node *node;
+			int ref_debug_id;
+			uint32_t ref_desc;
+
+			mutex_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction with invalid "
 					"handle, %ld\n", proc->pid,
@@ -1624,22 +2259,36 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_failed;
 			}
-			if (ref->node->proc == target_proc) {
+			node = ref->node;
+			binder_inc_node_tmpref(node);
+			ref_debug_id = ref->debug_id;
+			ref_desc = ref->desc;
+			mutex_unlock(&proc->outer_lock);
+
+			binder_node_inner_lock(node);
+			if (node->proc == target_proc) {
 				if (fp->type == BINDER_TYPE_HANDLE)
 					fp->type = BINDER_TYPE_BINDER;
 				else
 					fp->type = BINDER_TYPE_WEAK_BINDER;
-				fp->binder = ref->node->ptr;
-				fp->cookie = ref->node->cookie;
-				binder_inc_node(ref->node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
+				fp->binder = node->ptr;
+				fp->cookie = node->cookie;
+				binder_inc_node_nilocked(node,
+					fp->type == BINDER_TYPE_BINDER, 0, NULL);
+				binder_node_inner_unlock(node);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
 					     "        ref %d desc %d -> node %d u%p\n",
-					     ref->debug_id, ref->desc, ref->node->debug_id,
-					     ref->node->ptr);
+					     ref_debug_id, ref_desc, node->debug_id,
+					     node->ptr);
 			} else {
 				struct binder_ref *new_ref;
-				new_ref = binder_get_ref_for_node(target_proc, ref->node);
+
+				binder_node_inner_unlock(node);
+				mutex_lock(&target_proc->outer_lock);
+				new_ref = binder_get_ref_for_node(target_proc, node);
 				if (new_ref == NULL) {
+					mutex_unlock(&target_proc->outer_lock);
+					binder_put_node(node);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_get_ref_for_node_failed;
 				}
@@ -1647,9 +2296,11 @@ static void binder_transaction(struct binder_proc *proc,
 				binder_inc_ref(new_ref, fp->type == BINDER_TYPE_HANDLE, NULL);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
 					     "        ref %d desc %d -> ref %d desc %d (node %d)\n",
-					     ref->debug_id, ref->desc, new_ref->debug_id,
-					     new_ref->desc, ref->node->debug_id);
+					     ref_debug_id, ref_desc, new_ref->debug_id,
+					     new_ref->desc, node->debug_id);
+				mutex_unlock(&target_proc->outer_lock);
 			}
+			binder_put_node(node);
 		} break;
 
 		case BINDER_TYPE_FD: {
@@ -1677,13 +2328,16 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_fget_failed;
 			}
+			mutex_lock(&target_proc->alloc_lock);
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
+			if (target_fd >= 0)
+				task_fd_install(target_proc, target_fd, file);
+			mutex_unlock(&target_proc->alloc_lock);
 			if (target_fd < 0) {
 				fput(file);
 				return_error = BR_FAILED_REPLY;
 				goto err_get_unused_fd_failed;
 			}
-			task_fd_install(target_proc, target_fd, file);
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld -> %d\n", fp->handle, target_fd);
 			/* TODO: fput? */
@@ -1698,16 +2352,65 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	if (target_thread) {
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		if (!(t->flags & TF_ONE_WAY) &&
+		    binder_priority_is_high(&t->priority))
+			target_list = &target_proc->todo_high;
+		else
+			target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+	t->work.type = BINDER_WORK_TRANSACTION;
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+
+	/*
+	 * Queue the completion and push a synchronous call on our stack
+	 * before the target can see t, so its reply cannot overtake them.
+	 */
+	spin_lock(&proc->inner_lock);
 	if (reply) {
+		s64 latency_us;
+
 		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
+		latency_us = ktime_us_delta(ktime_get(),
+					    in_reply_to->start_time);
+		binder_latency_record(&proc->reply_latency, latency_us);
+		trace_binder_transaction_reply(in_reply_to, latency_us);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
 		t->need_reply = 1;
 		t->from_parent = thread->transaction_stack;
 		thread->transaction_stack = t;
-	} else {
-		BUG_ON(target_node == NULL);
+	}
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&proc->inner_lock);
+
+	spin_lock(&target_proc->inner_lock);
+	if (target_proc->is_dead ||
+	    (target_thread && target_thread->is_dead)) {
+		spin_unlock(&target_proc->inner_lock);
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
+	if (reply) {
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			spin_unlock(&target_proc->inner_lock);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_target;
+		}
+		binder_pop_transaction_ilocked(target_thread, in_reply_to);
+	} else if (t->flags & TF_ONE_WAY) {
 		BUG_ON(t->buffer->async_transaction != 1);
 		if (target_node->has_async_transaction) {
 			target_list = &target_node->async_todo;
@@ -1715,14 +2418,28 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
+	t->start_time = ktime_get();
+	trace_binder_transaction(reply, t, target_node);
 	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	spin_unlock(&target_proc->inner_lock);
+
+	if (in_reply_to)
+		binder_free_transaction(in_reply_to);
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
+	if (target_node)
+		binder_put_node(target_node);
 	return;
 
+err_dead_target:
+	spin_lock(&proc->inner_lock);
+	list_del(&tcomplete->entry);
+	if (t->need_reply)
+		binder_pop_transaction_ilocked(thread, t);
+	spin_unlock(&proc->inner_lock);
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1733,8 +2450,15 @@ err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
+	if (target_node) {
+		/* the buffer owned the local strong ref */
+		binder_put_node(target_node);
+		target_node = NULL;
+	}
 	t->buffer->transaction = NULL;
+	mutex_lock(&target_proc->alloc_lock);
 	binder_free_buf(target_proc, t->buffer);
+	mutex_unlock(&target_proc->alloc_lock);
 err_binder_alloc_buf_failed:
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
@@ -1746,7 +2470,14 @@ err_bad_call_stack:
 err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
-err_no_context_mgr_node:
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	if (target_proc)
+		binder_proc_dec_tmpref(target_proc);
+	if (target_node) {
+		binder_dec_node(target_node, 1, 0);
+		binder_put_node(target_node);
+	}
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1758,12 +2489,16 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
-	if (in_reply_to) {
-		thread->return_error = BR_TRANSACTION_COMPLETE;
+	spin_lock(&proc->inner_lock);
+	/* a failed reply to one of our calls may have got here first */
+	if (thread->return_error != BR_OK &&
+	    thread->return_error2 == BR_OK)
+		thread->return_error2 = thread->return_error;
+	thread->return_error = in_reply_to ? BR_TRANSACTION_COMPLETE :
+					     return_error;
+	spin_unlock(&proc->inner_lock);
+	if (in_reply_to)
 		binder_send_failed_reply(in_reply_to, return_error);
-	} else
-		thread->return_error = return_error;
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1778,9 +2513,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1788,17 +2523,26 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_RELEASE:
 		case BC_DECREFS: {
 			uint32_t target;
-			struct binder_ref *ref;
+			struct binder_ref *ref = NULL;
+			struct binder_node *ctx_mgr_node = NULL;
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (target == 0 && binder_context_mgr_node &&
+			if (target == 0 &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
+				mutex_lock(&binder_context_mgr_node_lock);
+				ctx_mgr_node = binder_context_mgr_node;
+				if (ctx_mgr_node)
+					binder_inc_node_tmpref(ctx_mgr_node);
+				mutex_unlock(&binder_context_mgr_node_lock);
+			}
+			mutex_lock(&proc->outer_lock);
+			if (ctx_mgr_node) {
 				ref = binder_get_ref_for_node(proc,
-					       binder_context_mgr_node);
-				if (ref->desc != target) {
+					       ctx_mgr_node);
+				if (ref && ref->desc != target) {
 					binder_user_error("binder: %d:"
 						"%d tried to acquire "
 						"reference to desc 0, "
@@ -1809,6 +2553,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				mutex_unlock(&proc->outer_lock);
+				if (ctx_mgr_node)
+					binder_put_node(ctx_mgr_node);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1837,6 +2584,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			mutex_unlock(&proc->outer_lock);
+			if (ctx_mgr_node)
+				binder_put_node(ctx_mgr_node);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1870,8 +2620,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 					node_ptr, node->debug_id,
 					cookie, node->cookie);
+				binder_put_node(node);
 				break;
 			}
+			binder_node_inner_lock(node);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
 					binder_user_error("binder: %d:%d "
@@ -1879,6 +2631,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending acquire request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_node_inner_unlock(node);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_strong_ref = 0;
@@ -1889,16 +2643,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending increfs request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					binder_node_inner_unlock(node);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			/* our temporary ref keeps the node from being freed here */
+			binder_dec_node_nilocked(node, cmd == BC_ACQUIRE_DONE, 0);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+			binder_node_inner_unlock(node);
+			binder_put_node(node);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1916,20 +2675,32 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			/*
+			 * Clearing allow_user_free under alloc_lock makes this
+			 * looper the only one that frees the buffer; another
+			 * one freeing the same data_ptr fails below.
+			 */
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->alloc_lock);
+
+			spin_lock(&proc->inner_lock);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1946,8 +2717,11 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
+			spin_unlock(&proc->inner_lock);
 			binder_transaction_buffer_release(proc, buffer, NULL);
+			mutex_lock(&proc->alloc_lock);
 			binder_free_buf(proc, buffer);
+			mutex_unlock(&proc->alloc_lock);
 			break;
 		}
 
@@ -1966,6 +2740,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -1983,11 +2758,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_ENTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_REGISTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -1996,12 +2773,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_EXIT_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			thread->looper |= BINDER_LOOPER_STATE_EXITED;
+			spin_unlock(&proc->inner_lock);
 			break;
 
 		case BC_REQUEST_DEATH_NOTIFICATION:
@@ -2009,7 +2789,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			uint32_t target;
 			void __user *cookie;
 			struct binder_ref *ref;
-			struct binder_ref_death *death;
+			struct binder_ref_death *death = NULL;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2017,6 +2797,20 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
+				death = kzalloc(sizeof(*death), GFP_KERNEL);
+				if (death == NULL) {
+					spin_lock(&proc->inner_lock);
+					thread->return_error = BR_ERROR;
+					spin_unlock(&proc->inner_lock);
+					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+						     "binder: %d:%d "
+						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
+						     proc->pid, thread->pid);
+					break;
+				}
+			}
+			mutex_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
 				binder_user_error("binder: %d:%d %s "
@@ -2026,6 +2820,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_REQUEST_DEATH_NOTIFICATION" :
 					"BC_CLEAR_DEATH_NOTIFICATION",
 					target);
+				mutex_unlock(&proc->outer_lock);
+				kfree(death);
 				break;
 			}
 
@@ -2038,6 +2834,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     cookie, ref->debug_id, ref->desc,
 				     ref->strong, ref->weak, ref->node->debug_id);
 
+			/* node->lock orders this against the node's release */
+			spin_lock(&ref->node->lock);
 			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
 				if (ref->death) {
 					binder_user_error("binder: %d:%"
@@ -2045,15 +2843,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"FICATION death notific"
 						"ation already set\n",
 						proc->pid, thread->pid);
-					break;
-				}
-				death = kzalloc(sizeof(*death), GFP_KERNEL);
-				if (death == NULL) {
-					thread->return_error = BR_ERROR;
-					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
-						     "binder: %d:%d "
-						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
-						     proc->pid, thread->pid);
+					spin_unlock(&ref->node->lock);
+					mutex_unlock(&proc->outer_lock);
+					kfree(death);
 					break;
 				}
 				binder_stats_created(BINDER_STAT_DEATH);
@@ -2062,12 +2854,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->inner_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->inner_lock);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2076,6 +2870,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"CATION death notificat"
 						"ion not active\n",
 						proc->pid, thread->pid);
+					spin_unlock(&ref->node->lock);
+					mutex_unlock(&proc->outer_lock);
 					break;
 				}
 				death = ref->death;
@@ -2087,9 +2883,12 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"%p != %p\n",
 						proc->pid, thread->pid,
 						death->cookie, cookie);
+					spin_unlock(&ref->node->lock);
+					mutex_unlock(&proc->outer_lock);
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2102,7 +2901,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
+			spin_unlock(&ref->node->lock);
+			mutex_unlock(&proc->outer_lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2112,6 +2914,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->inner_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2126,6 +2929,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
+				spin_unlock(&proc->inner_lock);
 				break;
 			}
 
@@ -2139,6 +2943,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2155,16 +2960,40 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
+/*
+ * Number of idle threads held back for proc->todo_high. Only applies once
+ * the proc has spawned enough threads that the rest can still make progress.
+ */
+static int binder_proc_reserved_threads(struct binder_proc *proc)
+{
+	if (binder_reserved_threads <= 0 ||
+	    proc->requested_threads_started < binder_reserved_threads)
+		return 0;
+	return binder_reserved_threads;
+}
+
+/*
+ * Whether the current thread may take work from proc->todo. others_idle is
+ * the number of other threads left waiting for proc work.
+ */
+static int binder_can_take_proc_work(struct binder_proc *proc,
+				     int others_idle)
+{
+	return !list_empty(&proc->todo) &&
+		others_idle >= binder_proc_reserved_threads(proc);
+}
+
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
-	return !list_empty(&proc->todo) ||
+	return !list_empty(&proc->todo_high) ||
+		binder_can_take_proc_work(proc, proc->ready_threads - 1) ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
@@ -2192,22 +3021,32 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+		/* both only go out if there is room for both */
+		int room = return_error2 == BR_OK ||
+			   ptr + sizeof(uint32_t) != end;
+
+		if (room) {
+			thread->return_error2 = BR_OK;
+			thread->return_error = BR_OK;
+		}
+		spin_unlock(&proc->inner_lock);
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (ptr == end)
+			if (!room)
 				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
+		if (put_user(return_error, (uint32_t __user *)ptr))
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2215,7 +3054,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2226,7 +3065,8 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_restore_priority(thread, &thread->idle_priority);
+		thread->priority_inherited = 0;
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2239,10 +3079,11 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	spin_lock(&proc->inner_lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	spin_unlock(&proc->inner_lock);
 
 	if (ret)
 		return ret;
@@ -2251,26 +3092,44 @@ retry:
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
+		struct list_head *list;
 		struct binder_transaction *t = NULL;
+		struct binder_thread *t_from;
+		s64 latency_us;
 
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
-		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
+			list = &thread->todo;
+		else if (!list_empty(&proc->todo_high) && wait_for_proc_work)
+			list = &proc->todo_high;
+		else if (wait_for_proc_work &&
+			 binder_can_take_proc_work(proc, proc->ready_threads))
+			list = &proc->todo;
 		else {
+			spin_unlock(&proc->inner_lock);
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
 		}
 
-		if (end - ptr < sizeof(tr) + 4)
+		if (end - ptr < sizeof(tr) + 4) {
+			spin_unlock(&proc->inner_lock);
 			break;
+		}
+		w = list_first_entry(list, struct binder_work, entry);
 
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
+			list_del_init(&w->entry);
+			spin_unlock(&proc->inner_lock);
 			t = container_of(w, struct binder_transaction, work);
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
+			list_del(&w->entry);
+			spin_unlock(&proc->inner_lock);
+			kfree(w);
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
+
 			cmd = BR_TRANSACTION_COMPLETE;
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2280,17 +3139,17 @@ retry:
 			binder_debug(BINDER_DEBUG_TRANSACTION_COMPLETE,
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
-
-			list_del(&w->entry);
-			kfree(w);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		case BINDER_WORK_NODE: {
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
+			void __user *node_ptr = node->ptr;
+			void __user *node_cookie = node->cookie;
+			int node_debug_id = node->debug_id;
 			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int weak = !hlist_empty(&node->refs) || node->local_weak_refs ||
+				   node->tmp_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2313,35 +3172,44 @@ retry:
 				node->has_weak_ref = 0;
 			}
 			if (cmd != BR_NOOP) {
+				/* the work stays queued until the node is settled */
+				spin_unlock(&proc->inner_lock);
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(uint32_t);
-				if (put_user(node->ptr, (void * __user *)ptr))
+				if (put_user(node_ptr, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
-				if (put_user(node->cookie, (void * __user *)ptr))
+				if (put_user(node_cookie, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
 				binder_debug(BINDER_DEBUG_USER_REFS,
 					     "binder: %d:%d %s %d u%p c%p\n",
-					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
+					     proc->pid, thread->pid, cmd_name, node_debug_id, node_ptr, node_cookie);
 			} else {
 				list_del_init(&w->entry);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
-						     proc->pid, thread->pid, node->debug_id,
-						     node->ptr, node->cookie);
+						     proc->pid, thread->pid, node_debug_id,
+						     node_ptr, node_cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
+					spin_unlock(&proc->inner_lock);
+					/*
+					 * Whoever dropped the last reference
+					 * may still be unlocking the node.
+					 */
+					spin_lock(&node->lock);
+					spin_unlock(&node->lock);
+					binder_free_node(node);
 				} else {
+					spin_unlock(&proc->inner_lock);
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p state unchanged\n",
-						     proc->pid, thread->pid, node->debug_id, node->ptr,
-						     node->cookie);
+						     proc->pid, thread->pid, node_debug_id, node_ptr,
+						     node_cookie);
 				}
 			}
 		} break;
@@ -2349,17 +3217,26 @@ retry:
 		case BINDER_WORK_DEAD_BINDER_AND_CLEAR:
 		case BINDER_WORK_CLEAR_DEATH_NOTIFICATION: {
 			struct binder_ref_death *death;
+			void __user *cookie;
 			uint32_t cmd;
 
 			death = container_of(w, struct binder_ref_death, work);
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
+			cookie = death->cookie;
+			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
-			else
+				list_del(&w->entry);
+				spin_unlock(&proc->inner_lock);
+				kfree(death);
+				binder_stats_deleted(BINDER_STAT_DEATH);
+			} else {
 				cmd = BR_DEAD_BINDER;
+				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->inner_lock);
+			}
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (put_user(death->cookie, (void * __user *)ptr))
+			if (put_user(cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
@@ -2368,34 +3245,32 @@ retry:
 				      cmd == BR_DEAD_BINDER ?
 				      "BR_DEAD_BINDER" :
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-				      death->cookie);
+				      cookie);
 
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
-				kfree(death);
-				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
-				list_move(&w->entry, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
+		default:
+			spin_unlock(&proc->inner_lock);
+			break;
 		}
 
 		if (!t)
 			continue;
 
 		BUG_ON(t->buffer == NULL);
+		latency_us = ktime_us_delta(ktime_get(), t->start_time);
+		trace_binder_transaction_received(t, latency_us);
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
+			spin_lock(&proc->inner_lock);
+			binder_latency_record(&proc->wakeup_latency, latency_us);
+			binder_latency_record(&target_node->wakeup_latency,
+					      latency_us);
+			spin_unlock(&proc->inner_lock);
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(thread, t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2406,8 +3281,9 @@ retry:
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
 
-		if (t->from) {
-			struct task_struct *sender = t->from->proc->tsk;
+		t_from = binder_get_txn_from(t);
+		if (t_from) {
+			struct task_struct *sender = t_from->proc->tsk;
 			tr.sender_pid = task_tgid_nr_ns(sender,
 							current->nsproxy->pid_ns);
 		} else {
@@ -2422,12 +3298,17 @@ retry:
 					ALIGN(t->buffer->data_size,
 					    sizeof(void *));
 
-		if (put_user(cmd, (uint32_t __user *)ptr))
+		if (put_user(cmd, (uint32_t __user *)ptr) ||
+		    copy_to_user(ptr + sizeof(uint32_t), &tr, sizeof(tr))) {
+			/* leave it for the next read */
+			if (t_from)
+				binder_thread_dec_tmpref(t_from);
+			spin_lock(&proc->inner_lock);
+			list_add(&t->work.entry, list);
+			spin_unlock(&proc->inner_lock);
 			return -EFAULT;
-		ptr += sizeof(uint32_t);
-		if (copy_to_user(ptr, &tr, sizeof(tr)))
-			return -EFAULT;
-		ptr += sizeof(tr);
+		}
+		ptr += sizeof(uint32_t) + sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
@@ -2436,19 +3317,25 @@ retry:
 			     proc->pid, thread->pid,
 			     (cmd == BR_TRANSACTION) ? "BR_TRANSACTION" :
 			     "BR_REPLY",
-			     t->debug_id, t->from ? t->from->proc->pid : 0,
-			     t->from ? t->from->pid : 0, cmd,
+			     t->debug_id, t_from ? t_from->proc->pid : 0,
+			     t_from ? t_from->pid : 0, cmd,
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
+		if (t_from)
+			binder_thread_dec_tmpref(t_from);
 
-		list_del(&t->work.entry);
+		spin_lock(&proc->inner_lock);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
+			spin_lock(&t->lock);
 			t->to_thread = thread;
+			spin_unlock(&t->lock);
 			thread->transaction_stack = t;
+			spin_unlock(&proc->inner_lock);
 		} else {
 			t->buffer->transaction = NULL;
+			spin_unlock(&proc->inner_lock);
 			kfree(t);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION);
 		}
@@ -2458,27 +3345,39 @@ retry:
 done:
 
 	*consumed = ptr - buffer;
-	if (proc->requested_threads + proc->ready_threads == 0 &&
+	spin_lock(&proc->inner_lock);
+	if (proc->requested_threads + proc->ready_threads <=
+	    binder_proc_reserved_threads(proc) &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
 	     /*spawn a new thread if we leave this out */) {
 		proc->requested_threads++;
+		spin_unlock(&proc->inner_lock);
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
 		if (put_user(BR_SPAWN_LOOPER, (uint32_t __user *)buffer))
 			return -EFAULT;
-	}
+	} else
+		spin_unlock(&proc->inner_lock);
 	return 0;
 }
 
-static void binder_release_work(struct list_head *list)
+static void binder_release_work(struct binder_proc *proc,
+				struct list_head *list)
 {
 	struct binder_work *w;
-	while (!list_empty(list)) {
+
+	while (1) {
+		spin_lock(&proc->inner_lock);
+		if (list_empty(list)) {
+			spin_unlock(&proc->inner_lock);
+			break;
+		}
 		w = list_first_entry(list, struct binder_work, entry);
 		list_del_init(&w->entry);
+		spin_unlock(&proc->inner_lock);
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			struct binder_transaction *t;
@@ -2498,7 +3397,9 @@ static void binder_release_work(struct list_head *list)
 
 }
 
-static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+/* Called with proc->inner_lock held; inserts new_thread if none is found */
+static struct binder_thread *binder_get_thread_ilocked(
+	struct binder_proc *proc, struct binder_thread *new_thread)
 {
 	struct binder_thread *thread = NULL;
 	struct rb_node *parent = NULL;
@@ -2513,38 +3414,93 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		else if (current->pid > thread->pid)
 			p = &(*p)->rb_right;
 		else
-			break;
-	}
-	if (*p == NULL) {
-		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
-			return NULL;
-		binder_stats_created(BINDER_STAT_THREAD);
-		thread->proc = proc;
-		thread->pid = current->pid;
-		init_waitqueue_head(&thread->wait);
-		INIT_LIST_HEAD(&thread->todo);
-		rb_link_node(&thread->rb_node, parent, p);
-		rb_insert_color(&thread->rb_node, &proc->threads);
-		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
-		thread->return_error = BR_OK;
-		thread->return_error2 = BR_OK;
+			return thread;
 	}
+	if (!new_thread)
+		return NULL;
+	thread = new_thread;
+	binder_stats_created(BINDER_STAT_THREAD);
+	thread->proc = proc;
+	thread->pid = current->pid;
+	atomic_set(&thread->tmp_refs, 0);
+	init_waitqueue_head(&thread->wait);
+	INIT_LIST_HEAD(&thread->todo);
+	rb_link_node(&thread->rb_node, parent, p);
+	rb_insert_color(&thread->rb_node, &proc->threads);
+	thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
+	thread->return_error = BR_OK;
+	thread->return_error2 = BR_OK;
 	return thread;
 }
 
-static int binder_free_thread(struct binder_proc *proc,
-			      struct binder_thread *thread)
+static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+{
+	struct binder_thread *thread;
+	struct binder_thread *new_thread;
+
+	spin_lock(&proc->inner_lock);
+	thread = binder_get_thread_ilocked(proc, NULL);
+	spin_unlock(&proc->inner_lock);
+	if (thread)
+		return thread;
+
+	new_thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+	if (new_thread == NULL)
+		return NULL;
+	spin_lock(&proc->inner_lock);
+	thread = binder_get_thread_ilocked(proc, new_thread);
+	spin_unlock(&proc->inner_lock);
+	if (thread != new_thread)
+		kfree(new_thread);
+	return thread;
+}
+
+static void binder_free_thread(struct binder_thread *thread)
+{
+	BUG_ON(!list_empty(&thread->todo));
+	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_proc_dec_tmpref(thread->proc);
+	kfree(thread);
+}
+
+static void binder_thread_dec_tmpref(struct binder_thread *thread)
+{
+	/* is_dead is set under the inner lock, so check both under it */
+	spin_lock(&thread->proc->inner_lock);
+	if (atomic_dec_and_test(&thread->tmp_refs) && thread->is_dead) {
+		spin_unlock(&thread->proc->inner_lock);
+		binder_free_thread(thread);
+		return;
+	}
+	spin_unlock(&thread->proc->inner_lock);
+}
+
+/*
+ * Takes the thread out of the proc and fails what is still on its stack.
+ * The thread is freed once the last temporary reference to it is gone.
+ */
+static int binder_thread_release(struct binder_proc *proc,
+				 struct binder_thread *thread)
 {
 	struct binder_transaction *t;
+	struct binder_transaction *last_t;
 	struct binder_transaction *send_reply = NULL;
 	int active_transactions = 0;
 
+	spin_lock(&proc->inner_lock);
+	/* dropped by binder_free_thread() and at the end of this function */
+	proc->tmp_refs++;
+	atomic_inc(&thread->tmp_refs);
 	rb_erase(&thread->rb_node, &proc->threads);
+	thread->is_dead = 1;
 	t = thread->transaction_stack;
-	if (t && t->to_thread == thread)
-		send_reply = t;
+	if (t) {
+		spin_lock(&t->lock);
+		if (t->to_thread == thread)
+			send_reply = t;
+	}
 	while (t) {
+		last_t = t;
 		active_transactions++;
 		binder_debug(BINDER_DEBUG_DEAD_TRANSACTION,
 			     "binder: release %d:%d transaction %d "
@@ -2565,12 +3521,16 @@ static int binder_free_thread(struct binder_proc *proc,
 			t = t->from_parent;
 		} else
 			BUG();
+		spin_unlock(&last_t->lock);
+		if (t)
+			spin_lock(&t->lock);
 	}
+	spin_unlock(&proc->inner_lock);
+
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
-	binder_release_work(&thread->todo);
-	kfree(thread);
-	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_release_work(proc, &thread->todo);
+	binder_thread_dec_tmpref(thread);
 	return active_transactions;
 }
 
@@ -2581,12 +3541,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
+	if (thread == NULL)
+		return POLLERR;
 
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2618,7 +3580,6 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2652,7 +3613,8 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		if (bwr.read_size > 0) {
 			ret = binder_thread_read(proc, thread, (void __user *)bwr.read_buffer, bwr.read_size, &bwr.read_consumed, filp->f_flags & O_NONBLOCK);
-			if (!list_empty(&proc->todo))
+			if (!list_empty(&proc->todo) ||
+			    !list_empty(&proc->todo_high))
 				wake_up_interruptible(&proc->wait);
 			if (ret < 0) {
 				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
@@ -2670,17 +3632,26 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		spin_lock(&proc->inner_lock);
+		proc->max_threads = max_threads;
+		spin_unlock(&proc->inner_lock);
 		break;
-	case BINDER_SET_CONTEXT_MGR:
+	}
+	case BINDER_SET_CONTEXT_MGR: {
+		struct binder_node *node;
+
+		mutex_lock(&binder_context_mgr_node_lock);
 		if (binder_context_mgr_node != NULL) {
 			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
 			ret = -EBUSY;
-			goto err;
+			goto err_context_mgr;
 		}
 		if (binder_context_mgr_uid != -1) {
 			if (binder_context_mgr_uid != current->cred->euid) {
@@ -2689,24 +3660,33 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				       current->cred->euid,
 				       binder_context_mgr_uid);
 				ret = -EPERM;
-				goto err;
+				goto err_context_mgr;
 			}
 		} else
 			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
+		node = binder_new_node(proc, NULL);
+		if (node == NULL) {
 			ret = -ENOMEM;
-			goto err;
+			goto err_context_mgr;
 		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
+		binder_node_inner_lock(node);
+		node->local_weak_refs++;
+		node->local_strong_refs++;
+		node->has_strong_ref = 1;
+		node->has_weak_ref = 1;
+		binder_node_inner_unlock(node);
+		binder_context_mgr_node = node;
+		binder_put_node(node);
+err_context_mgr:
+		mutex_unlock(&binder_context_mgr_node_lock);
+		if (ret)
+			goto err;
 		break;
+	}
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
-		binder_free_thread(proc, thread);
+		binder_thread_release(proc, thread);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2725,9 +3705,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	}
 	ret = 0;
 err:
-	if (thread)
+	if (thread) {
+		spin_lock(&proc->inner_lock);
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+		spin_unlock(&proc->inner_lock);
+	}
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2786,6 +3768,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	}
 	vma->vm_flags = (vma->vm_flags | VM_DONTCOPY) & ~VM_MAYWRITE;
 
+	mutex_lock(&proc->alloc_lock);
 	if (proc->buffer) {
 		ret = -EBUSY;
 		failure_string = "already mapped";
@@ -2834,6 +3817,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	barrier();
 	proc->files = get_files_struct(current);
 	proc->vma = vma;
+	mutex_unlock(&proc->alloc_lock);
 
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
 		 proc->pid, vma->vm_start, vma->vm_end, proc->buffer);*/
@@ -2847,6 +3831,7 @@ err_alloc_pages_failed:
 	proc->buffer = NULL;
 err_get_vm_area_failed:
 err_already_mapped:
+	mutex_unlock(&proc->alloc_lock);
 err_bad_arg:
 	printk(KERN_ERR "binder_mmap: %d %lx-%lx %s failed %d\n",
 	       proc->pid, vma->vm_start, vma->vm_end, failure_string, ret);
@@ -2866,15 +3851,19 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	get_task_struct(current);
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
+	INIT_LIST_HEAD(&proc->todo_high);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	mutex_init(&proc->outer_lock);
+	spin_lock_init(&proc->inner_lock);
+	mutex_init(&proc->alloc_lock);
 	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_proc_dir_entry_proc) {
 		char strbuf[11];
@@ -2901,6 +3890,8 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2909,6 +3900,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 			wake_count++;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	wake_up_interruptible_all(&proc->wait);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -2930,79 +3922,16 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
-static void binder_deferred_release(struct binder_proc *proc)
+static void binder_free_proc(struct binder_proc *proc)
 {
-	struct hlist_node *pos;
 	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
-
-	BUG_ON(proc->vma);
-	BUG_ON(proc->files);
-
-	hlist_del(&proc->proc_node);
-	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
-		binder_debug(BINDER_DEBUG_DEAD_BINDER,
-			     "binder_release: %d context_mgr_node gone\n",
-			     proc->pid);
-		binder_context_mgr_node = NULL;
-	}
-
-	threads = 0;
-	active_transactions = 0;
-	while ((n = rb_first(&proc->threads))) {
-		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
-		threads++;
-		active_transactions += binder_free_thread(proc, thread);
-	}
-	nodes = 0;
-	incoming_refs = 0;
-	while ((n = rb_first(&proc->nodes))) {
-		struct binder_node *node = rb_entry(n, struct binder_node, rb_node);
-
-		nodes++;
-		rb_erase(&node->rb_node, &proc->nodes);
-		list_del_init(&node->work.entry);
-		if (hlist_empty(&node->refs)) {
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
-		} else {
-			struct binder_ref *ref;
-			int death = 0;
+	int buffers, page_count;
 
-			node->proc = NULL;
-			node->local_strong_refs = 0;
-			node->local_weak_refs = 0;
-			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+	BUG_ON(proc->tmp_refs);
 
-			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
-				incoming_refs++;
-				if (ref->death) {
-					death++;
-					if (list_empty(&ref->death->work.entry)) {
-						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
-						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
-						wake_up_interruptible(&ref->proc->wait);
-					} else
-						BUG();
-				}
-			}
-			binder_debug(BINDER_DEBUG_DEAD_BINDER,
-				     "binder: node %d now dead, "
-				     "refs %d, death %d\n", node->debug_id,
-				     incoming_refs, death);
-		}
-	}
-	outgoing_refs = 0;
-	while ((n = rb_first(&proc->refs_by_desc))) {
-		struct binder_ref *ref = rb_entry(n, struct binder_ref,
-						  rb_node_desc);
-		outgoing_refs++;
-		binder_delete_ref(ref);
-	}
-	binder_release_work(&proc->todo);
 	buffers = 0;
-
+	mutex_lock(&proc->alloc_lock);
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3018,6 +3947,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_free_buf(proc, buffer);
 		buffers++;
 	}
+	mutex_unlock(&proc->alloc_lock);
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
@@ -3044,14 +3974,147 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	put_task_struct(proc->tsk);
 
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
+/*
+ * Called with a temporary reference on node, which is no longer in its
+ * proc's tree. Nodes that are still referenced move to the dead list.
+ */
+static int binder_node_release(struct binder_node *node, int refs)
+{
+	struct binder_proc *proc = node->proc;
+	struct binder_ref *ref;
+	struct hlist_node *pos;
+	int death = 0;
+
+	spin_lock(&node->lock);
+	spin_lock(&proc->inner_lock);
+	list_del_init(&node->work.entry);
+	if (hlist_empty(&node->refs) && node->tmp_refs == 1) {
+		spin_unlock(&proc->inner_lock);
+		spin_unlock(&node->lock);
+		binder_free_node(node);
+		return refs;
+	}
+	node->proc = NULL;
+	node->local_strong_refs = 0;
+	node->local_weak_refs = 0;
+	spin_unlock(&proc->inner_lock);
+
+	spin_lock(&binder_dead_nodes_lock);
+	hlist_add_head(&node->dead_node, &binder_dead_nodes);
+	spin_unlock(&binder_dead_nodes_lock);
+
+	hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
+		refs++;
+		if (!ref->death)
+			continue;
+		death++;
+		spin_lock(&ref->proc->inner_lock);
+		if (list_empty(&ref->death->work.entry)) {
+			ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+			list_add_tail(&ref->death->work.entry, &ref->proc->todo);
+			wake_up_interruptible(&ref->proc->wait);
+		} else
+			BUG();
+		spin_unlock(&ref->proc->inner_lock);
+	}
+	binder_debug(BINDER_DEBUG_DEAD_BINDER,
+		     "binder: node %d now dead, "
+		     "refs %d, death %d\n", node->debug_id,
+		     refs, death);
+	spin_unlock(&node->lock);
+	binder_put_node(node);
+	return refs;
+}
+
+static void binder_deferred_release(struct binder_proc *proc)
+{
+	struct rb_node *n;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
+
+	BUG_ON(proc->vma);
+	BUG_ON(proc->files);
+
+	mutex_lock(&binder_procs_lock);
+	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
+
+	mutex_lock(&binder_context_mgr_node_lock);
+	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
+		binder_debug(BINDER_DEBUG_DEAD_BINDER,
+			     "binder_release: %d context_mgr_node gone\n",
+			     proc->pid);
+		binder_context_mgr_node = NULL;
+	}
+	mutex_unlock(&binder_context_mgr_node_lock);
+
+	spin_lock(&proc->inner_lock);
+	/*
+	 * Senders still copying into our buffers hold their own reference,
+	 * the last one to go frees the proc.
+	 */
+	proc->tmp_refs++;
+	proc->is_dead = 1;
+	threads = 0;
+	active_transactions = 0;
+	while ((n = rb_first(&proc->threads))) {
+		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
+		spin_unlock(&proc->inner_lock);
+		threads++;
+		active_transactions += binder_thread_release(proc, thread);
+		spin_lock(&proc->inner_lock);
+	}
+	nodes = 0;
+	incoming_refs = 0;
+	while ((n = rb_first(&proc->nodes))) {
+		struct binder_node *node = rb_entry(n, struct binder_node, rb_node);
+
+		nodes++;
+		node->tmp_refs++;
+		rb_erase(&node->rb_node, &proc->nodes);
+		spin_unlock(&proc->inner_lock);
+		incoming_refs = binder_node_release(node, incoming_refs);
+		spin_lock(&proc->inner_lock);
+	}
+	spin_unlock(&proc->inner_lock);
+
+	outgoing_refs = 0;
+	mutex_lock(&proc->outer_lock);
+	while ((n = rb_first(&proc->refs_by_desc))) {
+		struct binder_ref *ref = rb_entry(n, struct binder_ref,
+						  rb_node_desc);
+		outgoing_refs++;
+		binder_delete_ref(ref);
+	}
+	mutex_unlock(&proc->outer_lock);
+	binder_release_work(proc, &proc->todo);
+	binder_release_work(proc, &proc->todo_high);
+
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions);
 
-	kfree(proc);
+	binder_proc_dec_tmpref(proc);
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	spin_lock(&proc->inner_lock);
+	proc->tmp_refs--;
+	if (proc->is_dead && !proc->tmp_refs) {
+		spin_unlock(&proc->inner_lock);
+		binder_free_proc(proc);
+		return;
+	}
+	spin_unlock(&proc->inner_lock);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3061,7 +4124,6 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3077,18 +4139,19 @@ static void binder_deferred_func(struct work_struct *work)
 
 		files = NULL;
 		if (defer & BINDER_DEFERRED_PUT_FILES) {
+			mutex_lock(&proc->alloc_lock);
 			files = proc->files;
 			if (files)
 				proc->files = NULL;
+			mutex_unlock(&proc->alloc_lock);
 		}
 
 		if (defer & BINDER_DEFERRED_FLUSH)
 			binder_deferred_flush(proc);
 
 		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+			binder_deferred_release(proc); /* may free proc */
 
-		mutex_unlock(&binder_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3108,20 +4171,36 @@ binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer)
 	mutex_unlock(&binder_deferred_lock);
 }
 
+/*
+ * Called with proc->inner_lock held.  The buffer belongs to t->to_proc and
+ * is only stable under that proc's inner lock, so it is only printed for
+ * transactions addressed to proc.
+ */
 static char *print_binder_transaction(char *buf, char *end, const char *prefix,
+				      struct binder_proc *proc,
 				      struct binder_transaction *t)
 {
+	struct binder_proc *to_proc;
+
+	spin_lock(&t->lock);
+	to_proc = t->to_proc;
 	buf += snprintf(buf, end - buf,
 			"%s %d: %p from %d:%d to %d:%d code %x "
-			"flags %x pri %ld r%d",
+			"flags %x pri %d:%d:%ld r%d",
 			prefix, t->debug_id, t,
 			t->from ? t->from->proc->pid : 0,
 			t->from ? t->from->pid : 0,
-			t->to_proc ? t->to_proc->pid : 0,
+			to_proc ? to_proc->pid : 0,
 			t->to_thread ? t->to_thread->pid : 0,
-			t->code, t->flags, t->priority, t->need_reply);
+			t->code, t->flags, t->priority.sched_policy,
+			t->priority.rt_priority, t->priority.nice, t->need_reply);
+	spin_unlock(&t->lock);
 	if (buf >= end)
 		return buf;
+	if (proc != to_proc) {
+		buf += snprintf(buf, end - buf, "\n");
+		return buf;
+	}
 	if (t->buffer == NULL) {
 		buf += snprintf(buf, end - buf, " buffer free\n");
 		return buf;
@@ -3150,7 +4229,7 @@ static char *print_binder_buffer(char *buf, char *end, const char *prefix,
 
 static char *print_binder_work(char *buf, char *end, const char *prefix,
 			       const char *transaction_prefix,
-			       struct binder_work *w)
+			       struct binder_proc *proc, struct binder_work *w)
 {
 	struct binder_node *node;
 	struct binder_transaction *t;
@@ -3158,7 +4237,8 @@ static char *print_binder_work(char *buf, char *end, const char *prefix,
 	switch (w->type) {
 	case BINDER_WORK_TRANSACTION:
 		t = container_of(w, struct binder_transaction, work);
-		buf = print_binder_transaction(buf, end, transaction_prefix, t);
+		buf = print_binder_transaction(buf, end, transaction_prefix,
+					       proc, t);
 		break;
 	case BINDER_WORK_TRANSACTION_COMPLETE:
 		buf += snprintf(buf, end - buf,
@@ -3189,10 +4269,12 @@ static char *print_binder_work(char *buf, char *end, const char *prefix,
 	return buf;
 }
 
+/* Called with thread->proc->inner_lock held */
 static char *print_binder_thread(char *buf, char *end,
 				 struct binder_thread *thread,
 				 int print_always)
 {
+	struct binder_proc *proc = thread->proc;
 	struct binder_transaction *t;
 	struct binder_work *w;
 	char *start_buf = buf;
@@ -3207,15 +4289,15 @@ static char *print_binder_thread(char *buf, char *end,
 			break;
 		if (t->from == thread) {
 			buf = print_binder_transaction(buf, end,
-						"    outgoing transaction", t);
+						"    outgoing transaction", proc, t);
 			t = t->from_parent;
 		} else if (t->to_thread == thread) {
 			buf = print_binder_transaction(buf, end,
-						"    incoming transaction", t);
+						"    incoming transaction", proc, t);
 			t = t->to_parent;
 		} else {
 			buf = print_binder_transaction(buf, end,
-						"    bad transaction", t);
+						"    bad transaction", proc, t);
 			t = NULL;
 		}
 	}
@@ -3223,14 +4305,16 @@ static char *print_binder_thread(char *buf, char *end,
 		if (buf >= end)
 			break;
 		buf = print_binder_work(buf, end, "    ",
-					"    pending transaction", w);
+					"    pending transaction", proc, w);
 	}
 	if (!print_always && buf == header_buf)
 		buf = start_buf;
 	return buf;
 }
 
-static char *print_binder_node(char *buf, char *end, struct binder_node *node)
+/* Called with the node's lock and, for a live node, its proc's inner_lock */
+static char *print_binder_node_nilocked(char *buf, char *end,
+					struct binder_node *node)
 {
 	struct binder_ref *ref;
 	struct hlist_node *pos;
@@ -3243,11 +4327,11 @@ static char *print_binder_node(char *buf, char *end, struct binder_node *node)
 
 	buf += snprintf(buf, end - buf,
 			"  node %d: u%p c%p hs %d hw %d ls %d lw %d "
-			"is %d iw %d",
+			"is %d iw %d tr %d",
 			node->debug_id, node->ptr, node->cookie,
 			node->has_strong_ref, node->has_weak_ref,
 			node->local_strong_refs, node->local_weak_refs,
-			node->internal_strong_refs, count);
+			node->internal_strong_refs, count, node->tmp_refs);
 	if (buf >= end)
 		return buf;
 	if (count) {
@@ -3265,11 +4349,13 @@ static char *print_binder_node(char *buf, char *end, struct binder_node *node)
 		if (buf >= end)
 			break;
 		buf = print_binder_work(buf, end, "    ",
-					"    pending async transaction", w);
+					"    pending async transaction",
+					node->proc, w);
 	}
 	return buf;
 }
 
+/* Called with ref->proc->outer_lock held */
 static char *print_binder_ref(char *buf, char *end, struct binder_ref *ref)
 {
 	buf += snprintf(buf, end - buf,
@@ -3284,6 +4370,7 @@ static char *print_binder_proc(char *buf, char *end,
 			       struct binder_proc *proc, int print_all)
 {
 	struct binder_work *w;
+	struct binder_node *last_node = NULL;
 	struct rb_node *n;
 	char *start_buf = buf;
 	char *header_buf;
@@ -3291,6 +4378,7 @@ static char *print_binder_proc(char *buf, char *end,
 	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
 	header_buf = buf;
 
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads);
 	     n != NULL && buf < end;
 	     n = rb_next(n))
@@ -3302,28 +4390,58 @@ static char *print_binder_proc(char *buf, char *end,
 	     n = rb_next(n)) {
 		struct binder_node *node = rb_entry(n, struct binder_node,
 						    rb_node);
-		if (print_all || node->has_async_transaction)
-			buf = print_binder_node(buf, end, node);
+		if (!print_all && !node->has_async_transaction)
+			continue;
+		/*
+		 * Pin the node so it stays in the tree while the inner lock
+		 * is dropped to take node->lock ahead of it.
+		 */
+		node->tmp_refs++;
+		spin_unlock(&proc->inner_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		binder_node_inner_lock(node);
+		buf = print_binder_node_nilocked(buf, end, node);
+		binder_node_inner_unlock(node);
+		last_node = node;
+		spin_lock(&proc->inner_lock);
 	}
+	spin_unlock(&proc->inner_lock);
+	if (last_node)
+		binder_put_node(last_node);
+
 	if (print_all) {
+		mutex_lock(&proc->outer_lock);
 		for (n = rb_first(&proc->refs_by_desc);
 		     n != NULL && buf < end;
 		     n = rb_next(n))
 			buf = print_binder_ref(buf, end,
 					       rb_entry(n, struct binder_ref,
 							rb_node_desc));
+		mutex_unlock(&proc->outer_lock);
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers);
 	     n != NULL && buf < end;
-	     n = rb_next(n))
-		buf = print_binder_buffer(buf, end, "  buffer",
-					  rb_entry(n, struct binder_buffer,
-						   rb_node));
+	     n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		if (!buffer->cached)
+			buf = print_binder_buffer(buf, end, "  buffer", buffer);
+	}
+	mutex_unlock(&proc->alloc_lock);
+	spin_lock(&proc->inner_lock);
+	list_for_each_entry(w, &proc->todo_high, entry) {
+		if (buf >= end)
+			break;
+		buf = print_binder_work(buf, end, "  ",
+					"  pending transaction", proc, w);
+	}
 	list_for_each_entry(w, &proc->todo, entry) {
 		if (buf >= end)
 			break;
 		buf = print_binder_work(buf, end, "  ",
-					"  pending transaction", w);
+					"  pending transaction", proc, w);
 	}
 	list_for_each_entry(w, &proc->delivered_death, entry) {
 		if (buf >= end)
@@ -3332,6 +4450,7 @@ static char *print_binder_proc(char *buf, char *end,
 				"  has delivered dead binder\n");
 		break;
 	}
+	spin_unlock(&proc->inner_lock);
 	if (!print_all && buf == header_buf)
 		buf = start_buf;
 	return buf;
@@ -3396,10 +4515,11 @@ static char *print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 			ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int count = atomic_read(&stats->bc[i]);
+
+		if (count)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_command_strings[i],
-					stats->bc[i]);
+					binder_command_strings[i], count);
 		if (buf >= end)
 			return buf;
 	}
@@ -3407,9 +4527,11 @@ static char *print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 			ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int count = atomic_read(&stats->br[i]);
+
+		if (count)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_return_strings[i], stats->br[i]);
+					binder_return_strings[i], count);
 		if (buf >= end)
 			return buf;
 	}
@@ -3419,51 +4541,112 @@ static char *print_binder_stats(char *buf, char *end, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 			ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			buf += snprintf(buf, end - buf,
 					"%s%s: active %d total %d\n", prefix,
 					binder_objstat_strings[i],
-					stats->obj_created[i] -
-						stats->obj_deleted[i],
-					stats->obj_created[i]);
+					created - deleted, created);
 		if (buf >= end)
 			return buf;
 	}
 	return buf;
 }
 
+static char *print_binder_alloc_stats(char *buf, char *end,
+				      struct binder_proc *proc)
+{
+	struct binder_alloc_stats *stats = &proc->alloc_stats;
+	struct rb_node *n;
+	size_t free_size = 0;
+	size_t largest = 0;
+	int count = 0;
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size_t size = binder_buffer_size(proc,
+				rb_entry(n, struct binder_buffer, rb_node));
+		count++;
+		free_size += size;
+		if (size > largest)
+			largest = size;
+	}
+	buf += snprintf(buf, end - buf,
+			"  free buffers: %d size %zd largest %zd "
+			"fragmentation %zd%%\n", count, free_size, largest,
+			free_size ? 100 - largest * 100 / free_size : 0);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf,
+			"  pages: cached %d populated %d reused %d "
+			"deferred %d released %d\n", proc->pages_cached,
+			stats->pages_populated, stats->pages_reused,
+			stats->pages_deferred, stats->pages_released);
+	if (buf >= end)
+		return buf;
+	buf += snprintf(buf, end - buf,
+			"  small buffers: cached %d hits %d misses %d\n",
+			proc->small_buffer_count, stats->small_hits,
+			stats->small_misses);
+	return buf;
+}
+
 static char *print_binder_proc_stats(char *buf, char *end,
 				     struct binder_proc *proc)
 {
 	struct binder_work *w;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, ready_threads, requested_threads;
+	int requested_threads_started, max_threads, nodes, pending;
 
 	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
 	if (buf >= end)
 		return buf;
+
+	/* take one snapshot of the inner state, then print outside the lock */
+	spin_lock(&proc->inner_lock);
 	count = 0;
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		count++;
+	nodes = 0;
+	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
+		nodes++;
+	pending = 0;
+	list_for_each_entry(w, &proc->todo_high, entry)
+		pending++;
+	list_for_each_entry(w, &proc->todo, entry) {
+		switch (w->type) {
+		case BINDER_WORK_TRANSACTION:
+			pending++;
+			break;
+		default:
+			break;
+		}
+	}
+	ready_threads = proc->ready_threads;
+	requested_threads = proc->requested_threads;
+	requested_threads_started = proc->requested_threads_started;
+	max_threads = proc->max_threads;
+	spin_unlock(&proc->inner_lock);
+
 	buf += snprintf(buf, end - buf, "  threads: %d\n", count);
 	if (buf >= end)
 		return buf;
 	buf += snprintf(buf, end - buf, "  requested threads: %d+%d/%d\n"
 			"  ready threads %d\n"
-			"  free async space %zd\n", proc->requested_threads,
-			proc->requested_threads_started, proc->max_threads,
-			proc->ready_threads, proc->free_async_space);
+			"  free async space %zd\n", requested_threads,
+			requested_threads_started, max_threads,
+			ready_threads, proc->free_async_space);
 	if (buf >= end)
 		return buf;
-	count = 0;
-	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
-		count++;
-	buf += snprintf(buf, end - buf, "  nodes: %d\n", count);
+	buf += snprintf(buf, end - buf, "  nodes: %d\n", nodes);
 	if (buf >= end)
 		return buf;
 	count = 0;
 	strong = 0;
 	weak = 0;
+	mutex_lock(&proc->outer_lock);
 	for (n = rb_first(&proc->refs_by_desc); n != NULL; n = rb_next(n)) {
 		struct binder_ref *ref = rb_entry(n, struct binder_ref,
 						  rb_node_desc);
@@ -3471,29 +4654,26 @@ static char *print_binder_proc_stats(char *buf, char *end,
 		strong += ref->strong;
 		weak += ref->weak;
 	}
+	mutex_unlock(&proc->outer_lock);
 	buf += snprintf(buf, end - buf, "  refs: %d s %d w %d\n",
 			count, strong, weak);
 	if (buf >= end)
 		return buf;
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
-	buf += snprintf(buf, end - buf, "  buffers: %d\n", count);
+	buf += snprintf(buf, end - buf, "  buffers: %d\n",
+			count - proc->small_buffer_count);
+	if (buf < end)
+		buf = print_binder_alloc_stats(buf, end, proc);
+	mutex_unlock(&proc->alloc_lock);
 	if (buf >= end)
 		return buf;
 
-	count = 0;
-	list_for_each_entry(w, &proc->todo, entry) {
-		switch (w->type) {
-		case BINDER_WORK_TRANSACTION:
-			count++;
-			break;
-		default:
-			break;
-		}
-	}
-	buf += snprintf(buf, end - buf, "  pending transactions: %d\n", count);
+	buf += snprintf(buf, end - buf, "  pending transactions: %d\n",
+			pending);
 	if (buf >= end)
 		return buf;
 
@@ -3509,6 +4689,7 @@ static int binder_read_proc_state(char *page, char **start, off_t off,
 	struct binder_proc *proc;
 	struct hlist_node *pos;
 	struct binder_node *node;
+	struct binder_node *last_node = NULL;
 	int len = 0;
 	char *buf = page;
 	char *end = page + PAGE_SIZE;
@@ -3518,17 +4699,30 @@ static int binder_read_proc_state(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		mutex_lock(&binder_procs_lock);
 
 	buf += snprintf(buf, end - buf, "binder state:\n");
 
+	spin_lock(&binder_dead_nodes_lock);
 	if (!hlist_empty(&binder_dead_nodes))
 		buf += snprintf(buf, end - buf, "dead nodes:\n");
 	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node) {
 		if (buf >= end)
 			break;
-		buf = print_binder_node(buf, end, node);
+		/* a pinned dead node stays on the list across the unlock */
+		node->tmp_refs++;
+		spin_unlock(&binder_dead_nodes_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		binder_node_inner_lock(node);
+		buf = print_binder_node_nilocked(buf, end, node);
+		binder_node_inner_unlock(node);
+		last_node = node;
+		spin_lock(&binder_dead_nodes_lock);
 	}
+	spin_unlock(&binder_dead_nodes_lock);
+	if (last_node)
+		binder_put_node(last_node);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
 		if (buf >= end)
@@ -3536,7 +4730,7 @@ static int binder_read_proc_state(char *page, char **start, off_t off,
 		buf = print_binder_proc(buf, end, proc, 1);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		mutex_unlock(&binder_procs_lock);
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -3564,7 +4758,7 @@ static int binder_read_proc_stats(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		mutex_lock(&binder_procs_lock);
 
 	p += snprintf(p, PAGE_SIZE, "binder stats:\n");
 
@@ -3576,7 +4770,7 @@ static int binder_read_proc_stats(char *page, char **start, off_t off,
 		p = print_binder_proc_stats(p, page + PAGE_SIZE, proc);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		mutex_unlock(&binder_procs_lock);
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
 
@@ -3605,7 +4799,7 @@ static int binder_read_proc_transactions(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		mutex_lock(&binder_procs_lock);
 
 	buf += snprintf(buf, end - buf, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
@@ -3614,7 +4808,7 @@ static int binder_read_proc_transactions(char *page, char **start, off_t off,
 		buf = print_binder_proc(buf, end, proc, 0);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		mutex_unlock(&binder_procs_lock);
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -3641,11 +4835,11 @@ static int binder_read_proc_proc(char *page, char **start, off_t off,
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		mutex_lock(&binder_procs_lock);
 	p += snprintf(p, PAGE_SIZE, "binder proc state:\n");
 	p = print_binder_proc(p, page + PAGE_SIZE, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		mutex_unlock(&binder_procs_lock);
 
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
@@ -3660,6 +4854,98 @@ static int binder_read_proc_proc(char *page, char **start, off_t off,
 	return len < count ? len  : count;
 }
 
+static char *print_binder_latency_hist(char *buf, char *end,
+				       const char *prefix,
+				       struct binder_latency_hist *hist)
+{
+	int i;
+	uint32_t total = 0;
+
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		total += hist->count[i];
+	if (!total)
+		return buf;
+
+	buf += snprintf(buf, end - buf, "%s:", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS && buf < end; i++)
+		buf += snprintf(buf, end - buf, " %u", hist->count[i]);
+	if (buf < end)
+		buf += snprintf(buf, end - buf, "\n");
+	return buf;
+}
+
+static char *print_binder_proc_latency(char *buf, char *end,
+				       struct binder_proc *proc)
+{
+	struct rb_node *n;
+	char *start_buf = buf;
+	char *header_buf;
+	char prefix[24];
+
+	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
+	header_buf = buf;
+	spin_lock(&proc->inner_lock);
+	if (buf < end)
+		buf = print_binder_latency_hist(buf, end, "  wakeup",
+						&proc->wakeup_latency);
+	if (buf < end)
+		buf = print_binder_latency_hist(buf, end, "  reply",
+						&proc->reply_latency);
+	for (n = rb_first(&proc->nodes); n != NULL && buf < end;
+	     n = rb_next(n)) {
+		struct binder_node *node = rb_entry(n, struct binder_node,
+						    rb_node);
+		snprintf(prefix, sizeof(prefix), "  node %d wakeup",
+			 node->debug_id);
+		buf = print_binder_latency_hist(buf, end, prefix,
+						&node->wakeup_latency);
+	}
+	spin_unlock(&proc->inner_lock);
+	if (buf == header_buf)
+		buf = start_buf;
+	return buf;
+}
+
+static int binder_read_proc_latency(char *page, char **start, off_t off,
+				    int count, int *eof, void *data)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int len = 0;
+	char *buf = page;
+	char *end = page + PAGE_SIZE;
+	int do_lock = !binder_debug_no_lock;
+
+	if (off)
+		return 0;
+
+	if (do_lock)
+		mutex_lock(&binder_procs_lock);
+
+	buf += snprintf(buf, end - buf, "binder latency (us, log2 buckets "
+			"from <16 to >=%d):\n",
+			8 << (BINDER_LATENCY_BUCKETS - 1));
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (buf >= end)
+			break;
+		buf = print_binder_proc_latency(buf, end, proc);
+	}
+	if (do_lock)
+		mutex_unlock(&binder_procs_lock);
+	if (buf > page + PAGE_SIZE)
+		buf = page + PAGE_SIZE;
+
+	*start = page + off;
+
+	len = buf - page;
+	if (len > off)
+		len -= off;
+	else
+		len = 0;
+
+	return len < count ? len  : count;
+}
+
 static char *print_binder_transaction_log_entry(char *buf, char *end,
 					struct binder_transaction_log_entry *e)
 {
@@ -3679,21 +4965,23 @@ static int binder_read_proc_transaction_log(
 	struct binder_transaction_log *log = data;
 	int len = 0;
 	int i;
+	int next;
 	char *buf = page;
 	char *end = page + PAGE_SIZE;
 
 	if (off)
 		return 0;
 
+	next = (unsigned int)atomic_read(&log->cur) % ARRAY_SIZE(log->entry);
 	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++) {
+		for (i = next; i < ARRAY_SIZE(log->entry); i++) {
 			if (buf >= end)
 				break;
 			buf = print_binder_transaction_log_entry(buf, end,
 								&log->entry[i]);
 		}
 	}
-	for (i = 0; i < log->next; i++) {
+	for (i = 0; i < next; i++) {
 		if (buf >= end)
 			break;
 		buf = print_binder_transaction_log_entry(buf, end,
@@ -3756,6 +5044,11 @@ static int __init binder_init(void)
 				       binder_proc_dir_entry_root,
 				       binder_read_proc_transactions,
 				       NULL);
+		create_proc_read_entry("latency",
+				       S_IRUGO,
+				       binder_proc_dir_entry_root,
+				       binder_read_proc_latency,
+				       NULL);
 		create_proc_read_entry("transaction_log",
 				       S_IRUGO,
 				       binder_proc_dir_entry_root,
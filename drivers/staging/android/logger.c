@@ -24,6 +24,9 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -32,35 +35,98 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Positions in the log are free-running byte sequence numbers; the offset
+ * into the buffer is the low bits (see logger_offset). A writer reserves
+ * [w_seq, w_seq + len) and writes the entry header under 'lock', then copies
+ * the payload without any lock held and commits the entry. 'c_seq' only
+ * moves over entries that are committed, so readers never see a partially
+ * written entry. 'head' is the oldest entry that has not been overwritten;
+ * a reader whose position has fallen behind it was lapped by the writers.
+ * 'lock' protects the sequence numbers and the entry headers.
+ *
+ * If the log has an archive, entries are compressed into it in batches
+ * before they are overwritten; 'a_seq' is where the next batch starts and
+ * 'a_head' the oldest entry still held by the archive.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	wait_queue_head_t	wwq;	/* writers waiting for a commit */
+	spinlock_t		lock;	/* lock protecting sequence numbers */
+	size_t			w_seq;	/* reserved up to here */
+	size_t			c_seq;	/* committed up to here */
+	size_t			head;	/* oldest entry in the buffer */
 	size_t			size;	/* size of the log */
+	struct logger_archive	*archive; /* compressed history, or NULL */
+	size_t			a_seq;	/* archived up to here */
+	size_t			a_head;	/* oldest archived entry */
+	int			a_valid; /* archive holds entries */
+};
+
+/*
+ * struct logger_archive - compressed history of a log
+ *
+ * Each chunk holds one LZO-compressed batch of consecutive entries. Chunks
+ * are appended by 'work' and the oldest are freed once the archive exceeds
+ * 'size' bytes. Everything here is protected by 'mutex'.
+ */
+struct logger_archive {
+	struct logger_log	*log;	/* associated log */
+	struct mutex		mutex;	/* mutex protecting the archive */
+	struct list_head	chunks;	/* chunks, oldest first */
+	size_t			bytes;	/* bytes used by chunks */
+	size_t			size;	/* maximum bytes used by chunks */
+	struct work_struct	work;	/* compresses the next batches */
+	unsigned char		*ubuf;	/* batch being compressed */
+	unsigned char		*cbuf;	/* compressed batch */
+	void			*wrkmem; /* LZO work memory */
+};
+
+struct logger_chunk {
+	struct list_head	list;	/* entry in logger_archive's list */
+	size_t			seq;	/* sequence number of the first entry */
+	size_t			len;	/* uncompressed length */
+	size_t			clen;	/* compressed length */
+	unsigned char		data[0]; /* the compressed entries */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by its mutex, which only
+ * serializes readers sharing one file.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* mutex protecting r_seq */
+	size_t			r_seq;	/* current read position */
+	unsigned char		*abuf;	/* last archive chunk, decompressed */
+	size_t			abuf_seq; /* sequence number of abuf */
+	size_t			abuf_len; /* bytes in abuf, or 0 */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* seq_after - is sequence number 'a' after 'b'? */
+#define seq_after(a, b)		((long)((a) - (b)) > 0)
+
+/* __pad of a written entry that c_seq has not moved over yet */
+#define LOGGER_ENTRY_COMMITTED	1
+
+/* entries are archived in batches of up to this many bytes */
+#define LOGGER_ARCHIVE_BATCH	(16*1024)
+
+/* bytes of compressed history kept per log; 0 disables the archive */
+static int logger_archive_size;
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+module_param_named(archive_size, logger_archive_size, int, S_IRUGO);
+#endif
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -84,39 +150,299 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * do_read_log - reads 'count' bytes at offset 'off' of 'log' into 'buf'
+ */
+static void do_read_log(struct logger_log *log, size_t off, void *buf,
+			size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
+
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' at offset 'off' of 'log'
+ */
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
+
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+}
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
-	switch (log->size - off) {
-	case 1:
-		memcpy(&val, log->buffer + off, 1);
-		memcpy(((char *) &val) + 1, log->buffer, 1);
-		break;
-	default:
-		memcpy(&val, log->buffer + off, 2);
-	}
+	do_read_log(log, off, &val, sizeof(val));
 
 	return sizeof(struct logger_entry) + val;
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * logger_first_seq - the oldest entry a reader can still get, from the
+ * archive if there is one.
  *
- * Caller must hold log->mutex.
+ * Caller needs to hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static inline size_t logger_first_seq(struct logger_log *log)
 {
+	if (log->a_valid && seq_after(log->head, log->a_head))
+		return log->a_head;
+	return log->head;
+}
+
+/*
+ * logger_sync_reader - pulls a reader that was lapped by the writers forward
+ * to the oldest entry still in the log.
+ *
+ * Caller needs to hold log->lock.
+ */
+static inline void logger_sync_reader(struct logger_log *log,
+				      struct logger_reader *reader)
+{
+	size_t first = logger_first_seq(log);
+
+	if (seq_after(first, reader->r_seq))
+		reader->r_seq = first;
+}
+
+/*
+ * logger_readable - is there a committed entry at the reader's position?
+ *
+ * Caller needs to hold log->lock.
+ */
+static inline int logger_readable(struct logger_log *log,
+				  struct logger_reader *reader)
+{
+	logger_sync_reader(log, reader);
+	return seq_after(log->c_seq, reader->r_seq);
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/*
+ * logger_archive_entry - returns the entry at the reader's position if it
+ * has to come from the archive, decompressing its chunk into the reader's
+ * buffer as needed. Returns NULL if the entry is in the ring buffer.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static struct logger_entry *logger_archive_entry(struct logger_log *log,
+						 struct logger_reader *reader)
+{
+	struct logger_archive *archive = log->archive;
+	struct logger_entry *entry = NULL;
+	struct logger_chunk *chunk;
+	size_t seq, len;
+	int ret;
+
+	if (!archive)
+		return NULL;
+
+again:
+	spin_lock(&log->lock);
+	logger_sync_reader(log, reader);
+	seq = reader->r_seq;
+	ret = seq_after(log->head, seq);
+	spin_unlock(&log->lock);
+	if (!ret)
+		return NULL;
+
+	if (reader->abuf_len && !seq_after(reader->abuf_seq, seq) &&
+	    seq_after(reader->abuf_seq + reader->abuf_len, seq))
+		return (struct logger_entry *)
+			(reader->abuf + (seq - reader->abuf_seq));
+
+	mutex_lock(&archive->mutex);
+	list_for_each_entry(chunk, &archive->chunks, list)
+		if (seq_after(chunk->seq + chunk->len, seq))
+			break;
+
+	if (&chunk->list == &archive->chunks ||
+	    seq_after(chunk->seq, seq)) {
+		/*
+		 * Entries were lost before they could be archived; skip to
+		 * the next chunk, or to the ring buffer if there is none.
+		 */
+		spin_lock(&log->lock);
+		if (&chunk->list == &archive->chunks)
+			reader->r_seq = log->head;
+		else
+			reader->r_seq = chunk->seq;
+		spin_unlock(&log->lock);
+		mutex_unlock(&archive->mutex);
+		goto again;
+	}
+
+	if (!reader->abuf) {
+		reader->abuf = kmalloc(LOGGER_ARCHIVE_BATCH, GFP_KERNEL);
+		if (!reader->abuf) {
+			entry = ERR_PTR(-ENOMEM);
+			goto out;
+		}
+	}
+
+	len = LOGGER_ARCHIVE_BATCH;
+	ret = lzo1x_decompress_safe(chunk->data, chunk->clen, reader->abuf,
+				    &len);
+	if (unlikely(ret != LZO_E_OK || len != chunk->len)) {
+		printk(KERN_ERR "logger: bad archive chunk in '%s', %d\n",
+		       log->misc.name, ret);
+		reader->abuf_len = 0;
+		entry = ERR_PTR(-EIO);
+		goto out;
+	}
+	reader->abuf_seq = chunk->seq;
+	reader->abuf_len = len;
+	entry = (struct logger_entry *)(reader->abuf + (seq - chunk->seq));
+
+out:
+	mutex_unlock(&archive->mutex);
+	return entry;
+}
+
+/*
+ * logger_archive_work - compresses batches of entries into the archive
+ * before the writers overwrite them.
+ *
+ * A batch that was lapped while it was being copied out is dropped.
+ */
+static void logger_archive_work(struct work_struct *work)
+{
+	struct logger_archive *archive =
+		container_of(work, struct logger_archive, work);
+	struct logger_log *log = archive->log;
+	struct logger_chunk *chunk;
+	size_t start, len, clen;
+	int lapped, ret;
+
+	mutex_lock(&archive->mutex);
+	while (1) {
+		spin_lock(&log->lock);
+		if (seq_after(log->head, log->a_seq))
+			log->a_seq = log->head;
+		start = log->a_seq;
+		if (log->c_seq - start < LOGGER_ARCHIVE_BATCH) {
+			spin_unlock(&log->lock);
+			break;
+		}
+		len = 0;
+		while (1) {
+			size_t nr = get_entry_len(log, logger_offset(start + len));
+
+			if (len + nr > LOGGER_ARCHIVE_BATCH)
+				break;
+			len += nr;
+		}
+		spin_unlock(&log->lock);
+
+		do_read_log(log, logger_offset(start), archive->ubuf, len);
+
+		smp_rmb();
+		spin_lock(&log->lock);
+		lapped = seq_after(log->head, start);
+		if (!lapped)
+			log->a_seq = start + len;
+		spin_unlock(&log->lock);
+		if (lapped)
+			continue;
+
+		ret = lzo1x_1_compress(archive->ubuf, len, archive->cbuf,
+				       &clen, archive->wrkmem);
+		if (unlikely(ret != LZO_E_OK))
+			continue;
+
+		chunk = kmalloc(sizeof(*chunk) + clen, GFP_KERNEL);
+		if (!chunk)
+			continue;
+		chunk->seq = start;
+		chunk->len = len;
+		chunk->clen = clen;
+		memcpy(chunk->data, archive->cbuf, clen);
+		list_add_tail(&chunk->list, &archive->chunks);
+		archive->bytes += sizeof(*chunk) + clen;
+
+		while (archive->bytes > archive->size) {
+			chunk = list_first_entry(&archive->chunks,
+						 struct logger_chunk, list);
+			list_del(&chunk->list);
+			archive->bytes -= sizeof(*chunk) + chunk->clen;
+			kfree(chunk);
+		}
+
+		spin_lock(&log->lock);
+		log->a_valid = !list_empty(&archive->chunks);
+		if (log->a_valid)
+			log->a_head = list_first_entry(&archive->chunks,
+					struct logger_chunk, list)->seq;
+		spin_unlock(&log->lock);
+	}
+	mutex_unlock(&archive->mutex);
+}
+#else
+static inline struct logger_entry *
+logger_archive_entry(struct logger_log *log, struct logger_reader *reader)
+{
+	return NULL;
+}
+#endif
+
+/*
+ * logger_flush - drops all entries, including any archived ones
+ */
+static void logger_flush(struct logger_log *log)
+{
+	struct logger_archive *archive = log->archive;
+	struct logger_chunk *chunk, *tmp;
+
+	if (archive)
+		mutex_lock(&archive->mutex);
+
+	/* readers notice they are behind the head and catch up */
+	spin_lock(&log->lock);
+	log->head = log->w_seq;
+	log->a_seq = log->w_seq;
+	log->a_valid = 0;
+	spin_unlock(&log->lock);
+
+	if (!archive)
+		return;
+
+	list_for_each_entry_safe(chunk, tmp, &archive->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	archive->bytes = 0;
+	mutex_unlock(&archive->mutex);
+}
+
+/*
+ * do_read_log_to_user - reads exactly 'count' bytes from position 'seq' of
+ * 'log' into the user-space buffer 'buf'. Returns 'count' on success.
+ *
+ * No lock is held; the caller checks afterwards that the entry was not
+ * overwritten while it was being copied.
+ */
+static ssize_t do_read_log_to_user(struct logger_log *log, size_t seq,
+				   char __user *buf, size_t count)
+{
+	size_t off = logger_offset(seq);
 	size_t len;
 
 	/*
@@ -124,8 +450,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -136,8 +462,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -158,16 +482,20 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry *entry;
 	ssize_t ret;
+	size_t seq;
 	DEFINE_WAIT(wait);
 
+	if (mutex_lock_interruptible(&reader->mutex))
+		return -EINTR;
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		ret = !logger_readable(log, reader);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -186,132 +514,198 @@ start:
 
 	finish_wait(&log->wq, &wait);
 	if (ret)
-		return ret;
+		goto out;
 
-	mutex_lock(&log->mutex);
+	entry = logger_archive_entry(log, reader);
+	if (IS_ERR(entry)) {
+		ret = PTR_ERR(entry);
+		goto out;
+	}
+	if (entry) {
+		seq = reader->abuf_seq + ((unsigned char *)entry - reader->abuf);
+		ret = sizeof(struct logger_entry) + entry->len;
+		if (count < ret) {
+			ret = -EINVAL;
+			goto out;
+		}
+		if (copy_to_user(buf, entry, ret)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		spin_lock(&log->lock);
+		reader->r_seq = seq + ret;
+		spin_unlock(&log->lock);
+		goto out;
+	}
+
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(!logger_readable(log, reader))) {
+		spin_unlock(&log->lock);
 		goto start;
 	}
 
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
+	seq = reader->r_seq;
+	ret = get_entry_len(log, logger_offset(seq));
+	spin_unlock(&log->lock);
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, seq, buf, ret);
+	if (ret < 0)
+		goto out;
+
+	/*
+	 * Writers move 'head' past an entry before they start overwriting it.
+	 * If that happened while we were copying, drop what we copied and
+	 * retry from the new head.
+	 */
+	smp_rmb();
+	spin_lock(&log->lock);
+	if (unlikely(seq_after(log->head, seq))) {
+		spin_unlock(&log->lock);
+		goto start;
+	}
+	reader->r_seq = seq + ret;
+	spin_unlock(&log->lock);
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_reserve - reserves room for an entry of 'len' bytes, including the
+ * header, writes the header and returns the sequence number of the entry.
+ * Entries that the reservation overwrites are dropped by moving log->head.
  *
- * Caller must hold log->mutex.
+ * A writer never overwrites an entry that is still being filled in; if the
+ * log is that far behind it waits for the oldest writer to commit.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static size_t logger_reserve(struct logger_log *log,
+			     struct logger_entry *header, size_t len)
 {
-	size_t count = 0;
+	size_t seq;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
+	spin_lock(&log->lock);
+	while (unlikely(log->w_seq + len - log->c_seq > log->size)) {
+		size_t c_seq = log->c_seq;
 
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+		spin_unlock(&log->lock);
+		wait_event(log->wwq, ACCESS_ONCE(log->c_seq) != c_seq);
+		spin_lock(&log->lock);
 	}
 
-	return 0;
+	seq = log->w_seq;
+	log->w_seq += len;
+	while (log->w_seq - log->head > log->size)
+		log->head += get_entry_len(log, logger_offset(log->head));
+
+	/* archive the oldest half before the writers get to it */
+	if (log->archive && log->w_seq - log->a_seq > log->size / 2)
+		schedule_work(&log->archive->work);
+
+	header->__pad = 0;
+	do_write_log(log, logger_offset(seq), header,
+		     sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
+
+	/* readers must see the new head before any payload we overwrite */
+	smp_wmb();
+
+	return seq;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - marks the entry at 'seq' as written and moves c_seq over
+ * all committed entries. Entries are committed in any order, but only
+ * become visible to readers in the order they were reserved.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, size_t seq)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	const size_t pad_off = offsetof(struct logger_entry, __pad);
+	__u16 pad = LOGGER_ENTRY_COMMITTED;
+	size_t old;
+	int wake;
+
+	spin_lock(&log->lock);
+	do_write_log(log, logger_offset(seq + pad_off), &pad, sizeof(pad));
+	old = log->c_seq;
+	while (log->c_seq != log->w_seq) {
+		size_t off = logger_offset(log->c_seq);
+
+		do_read_log(log, logger_offset(off + pad_off), &pad, sizeof(pad));
+		if (pad != LOGGER_ENTRY_COMMITTED)
+			break;
+		pad = 0;
+		do_write_log(log, logger_offset(off + pad_off), &pad,
+			     sizeof(pad));
+		log->c_seq += get_entry_len(log, off);
+	}
+	wake = log->c_seq != old;
+	spin_unlock(&log->lock);
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	if (!wake)
+		return;
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	/* wake up any blocked readers and writers */
+	wake_up_interruptible(&log->wq);
+	if (waitqueue_active(&log->wwq))
+		wake_up(&log->wwq);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_cancel - undoes a reservation whose payload could not be copied.
  *
- * The caller needs to hold log->mutex.
+ * If another writer reserved space after it, the entry can no longer be
+ * removed; its payload is zeroed and it is committed as is.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_cancel(struct logger_log *log, size_t seq, size_t len)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
+	static const char zeroes[LOGGER_ENTRY_MAX_PAYLOAD];
+	const size_t hdr = sizeof(struct logger_entry);
+
+	spin_lock(&log->lock);
+	if (log->w_seq == seq + len) {
+		log->w_seq = seq;
+		if (seq_after(log->head, seq))
+			log->head = seq;
+		spin_unlock(&log->lock);
+		return;
+	}
+	spin_unlock(&log->lock);
 
+	do_write_log(log, logger_offset(seq + hdr), zeroes, len - hdr);
+	logger_commit(log, seq);
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * offset 'off' of the log 'log'
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to own a reservation covering the bytes.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
@@ -319,14 +713,18 @@ static ssize_t do_write_log_from_user(struct logger_log *log,
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The header and all segments of the payload go into one reservation, so a
+ * writev() from liblog costs a single trip through log->lock to reserve and
+ * one to commit, and the user copies run without any lock held.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t seq, off, len;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -341,41 +739,30 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	len = sizeof(struct logger_entry) + header.len;
+	seq = logger_reserve(log, &header, len);
+	off = logger_offset(seq + sizeof(struct logger_entry));
 
-	while (nr_segs-- > 0) {
-		size_t len;
+	while (nr_segs-- > 0 && ret < header.len) {
+		size_t seg_len;
 		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		seg_len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, seg_len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			logger_cancel(log, seq, len);
 			return nr;
 		}
 
+		off = logger_offset(off + nr);
 		iov++;
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, seq);
 
 	return ret;
 }
@@ -408,12 +795,13 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->mutex);
+		reader->abuf = NULL;
+		reader->abuf_len = 0;
 
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_lock(&log->lock);
+		reader->r_seq = logger_first_seq(log);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -431,7 +819,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+		kfree(reader->abuf);
 		kfree(reader);
 	}
 
@@ -461,10 +849,36 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	spin_lock(&log->lock);
+	if (logger_readable(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
+
+	return ret;
+}
+
+/*
+ * logger_next_entry_len - length of the next entry the reader would get
+ */
+static long logger_next_entry_len(struct logger_log *log,
+				  struct logger_reader *reader)
+{
+	struct logger_entry *entry;
+	long ret = 0;
+
+	mutex_lock(&reader->mutex);
+	entry = logger_archive_entry(log, reader);
+	if (IS_ERR(entry)) {
+		ret = PTR_ERR(entry);
+	} else if (entry) {
+		ret = sizeof(struct logger_entry) + entry->len;
+	} else {
+		spin_lock(&log->lock);
+		if (logger_readable(log, reader))
+			ret = get_entry_len(log, logger_offset(reader->r_seq));
+		spin_unlock(&log->lock);
+	}
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -475,8 +889,6 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -487,36 +899,36 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
+		spin_lock(&log->lock);
+		/*
+		 * A reader that is still in the archive has more than a ring
+		 * buffer's worth to read, but callers size their buffer from
+		 * this, so it never exceeds the ring.
+		 */
+		if (logger_readable(log, reader))
+			ret = min_t(size_t, log->c_seq - reader->r_seq,
+				    log->size);
 		else
-			ret = (log->size - reader->r_off) + log->w_off;
+			ret = 0;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		ret = logger_next_entry_len(log, file->private_data);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		logger_flush(log);
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -547,9 +959,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.wwq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wwq), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
+	.w_seq = 0, \
+	.c_seq = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -572,10 +985,56 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+/*
+ * init_archive - sets up the compressed archive of a log. The log works
+ * without one, so failing here is not fatal.
+ */
+static void __init init_archive(struct logger_log *log)
+{
+	struct logger_archive *archive;
+
+	archive = kzalloc(sizeof(*archive), GFP_KERNEL);
+	if (!archive)
+		goto err;
+
+	archive->ubuf = kmalloc(LOGGER_ARCHIVE_BATCH, GFP_KERNEL);
+	archive->cbuf = kmalloc(lzo1x_worst_compress(LOGGER_ARCHIVE_BATCH),
+				GFP_KERNEL);
+	archive->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!archive->ubuf || !archive->cbuf || !archive->wrkmem)
+		goto err_free;
+
+	archive->log = log;
+	archive->size = logger_archive_size;
+	mutex_init(&archive->mutex);
+	INIT_LIST_HEAD(&archive->chunks);
+	INIT_WORK(&archive->work, logger_archive_work);
+	log->archive = archive;
+	return;
+
+err_free:
+	vfree(archive->wrkmem);
+	kfree(archive->cbuf);
+	kfree(archive->ubuf);
+	kfree(archive);
+err:
+	printk(KERN_ERR "logger: failed to allocate archive for log '%s'\n",
+	       log->misc.name);
+}
+#else
+static inline void init_archive(struct logger_log *log)
+{
+}
+#endif
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	if (logger_archive_size > 0)
+		init_archive(log);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -585,6 +1044,10 @@ static int __init init_log(struct logger_log *log)
 
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
+	if (log->archive)
+		printk(KERN_INFO "logger: keeping %dK compressed history "
+		       "for '%s'\n", logger_archive_size >> 10,
+		       log->misc.name);
 
 	return 0;
 }
@@ -0,0 +1,212 @@
+/*
+ * drivers/staging/android/logger_bench.c
+ *
+ * Writer throughput benchmark for the Android logger
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/uio.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+static char *log_path = "/dev/log/main";
+module_param(log_path, charp, S_IRUGO);
+MODULE_PARM_DESC(log_path, "log device to write to");
+
+static int nr_writers = 4;
+module_param(nr_writers, int, S_IRUGO);
+MODULE_PARM_DESC(nr_writers, "number of concurrent writer threads");
+
+static int run_time = 5;
+module_param(run_time, int, S_IRUGO);
+MODULE_PARM_DESC(run_time, "seconds each writer runs");
+
+static int msg_len = 64;
+module_param(msg_len, int, S_IRUGO);
+MODULE_PARM_DESC(msg_len, "length of the message part of each entry");
+
+struct logger_bench_writer {
+	struct task_struct	*task;
+	struct file		*filp;
+	unsigned long		entries;
+	unsigned long		bytes;
+	int			error;
+};
+
+static struct logger_bench_writer *writers;
+static atomic_t writers_running;
+static DECLARE_COMPLETION(writers_done);
+static DECLARE_COMPLETION(writers_start);
+
+/*
+ * Each entry is written the way liblog does it: priority, tag and message
+ * as three segments of one writev().
+ */
+static int logger_bench_thread(void *data)
+{
+	struct logger_bench_writer *w = data;
+	static const char tag[] = "logger_bench";
+	unsigned char prio = 4;	/* ANDROID_LOG_INFO */
+	struct iovec vec[3];
+	unsigned long end;
+	mm_segment_t fs;
+	char *msg;
+	ssize_t ret;
+
+	msg = kmalloc(msg_len, GFP_KERNEL);
+	if (!msg) {
+		w->error = -ENOMEM;
+		goto done;
+	}
+	memset(msg, 'x', msg_len - 1);
+	msg[msg_len - 1] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = (void *)tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_len;
+
+	wait_for_completion(&writers_start);
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	end = jiffies + run_time * HZ;
+	while (time_before(jiffies, end)) {
+		loff_t pos = 0;
+
+		ret = vfs_writev(w->filp, (const struct iovec __user *)vec,
+				 ARRAY_SIZE(vec), &pos);
+		if (ret < 0) {
+			w->error = ret;
+			break;
+		}
+		w->entries++;
+		w->bytes += ret;
+		cond_resched();
+	}
+	set_fs(fs);
+	kfree(msg);
+
+done:
+	if (atomic_dec_and_test(&writers_running))
+		complete(&writers_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void logger_bench_report(s64 elapsed_us)
+{
+	unsigned long entries = 0, bytes = 0;
+	int i;
+
+	for (i = 0; i < nr_writers; i++) {
+		struct logger_bench_writer *w = &writers[i];
+
+		if (w->error)
+			printk(KERN_INFO "logger_bench: writer %d failed, %d\n",
+			       i, w->error);
+		printk(KERN_INFO "logger_bench: writer %d: %lu entries\n",
+		       i, w->entries);
+		entries += w->entries;
+		bytes += w->bytes;
+	}
+
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+	printk(KERN_INFO "logger_bench: %d writers, %lu entries, %lu bytes "
+	       "in %lld us: %llu entries/s, %llu KiB/s\n", nr_writers,
+	       entries, bytes, elapsed_us,
+	       div64_u64((u64)entries * USEC_PER_SEC, elapsed_us),
+	       div64_u64((u64)bytes * USEC_PER_SEC, elapsed_us) >> 10);
+}
+
+static int __init logger_bench_init(void)
+{
+	ktime_t start;
+	int ret = 0;
+	int i;
+
+	if (nr_writers <= 0 || run_time <= 0 || msg_len <= 0)
+		return -EINVAL;
+
+	writers = kzalloc(nr_writers * sizeof(*writers), GFP_KERNEL);
+	if (!writers)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_writers; i++) {
+		struct file *filp = filp_open(log_path, O_WRONLY, 0);
+
+		if (IS_ERR(filp)) {
+			ret = PTR_ERR(filp);
+			printk(KERN_ERR "logger_bench: can't open %s, %d\n",
+			       log_path, ret);
+			goto err_open;
+		}
+		writers[i].filp = filp;
+	}
+
+	for (i = 0; i < nr_writers; i++) {
+		struct task_struct *task;
+
+		task = kthread_create(logger_bench_thread, &writers[i],
+				      "logger_bench/%d", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			goto err_create;
+		}
+		writers[i].task = task;
+	}
+
+	atomic_set(&writers_running, nr_writers);
+	for (i = 0; i < nr_writers; i++)
+		wake_up_process(writers[i].task);
+
+	start = ktime_get();
+	complete_all(&writers_start);
+	wait_for_completion(&writers_done);
+	logger_bench_report(ktime_us_delta(ktime_get(), start));
+
+	i = nr_writers;
+err_create:
+	/* threads that were never woken exit without running */
+	while (i-- > 0)
+		kthread_stop(writers[i].task);
+	i = nr_writers;
+err_open:
+	while (i-- > 0)
+		if (writers[i].filp)
+			filp_close(writers[i].filp, NULL);
+	kfree(writers);
+	return ret;
+}
+
+static void __exit logger_bench_exit(void)
+{
+}
+
+module_init(logger_bench_init);
+module_exit(logger_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Android logger writer benchmark");
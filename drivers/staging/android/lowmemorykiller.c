@@ -12,6 +12,19 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Victims are picked from the highest non-empty oom_adj bucket at or above
+ * the threshold (see for_each_process_oom_adj), so only the candidates are
+ * looked at. After a kill, the shrinker does not look for another victim
+ * until the previous one has been freed or a second has passed.
+ *
+ * /dev/lowmemorykiller lets user-space watch the same levels without
+ * waiting for the shrinker: poll() returns POLLIN when free and file pages
+ * cross one of the minfree values, and read() returns the current level
+ * (0 when above all of them, n when below the n-th largest), the adj value
+ * that level kills at and the time since the crossing. The crossings are
+ * noticed by the page allocator, so they are reported before reclaim runs.
+ * The notify_latency parameter shows how long readers took to pick them up.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -34,6 +47,14 @@
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/notifier.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -51,12 +72,61 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+static struct task_struct *lowmem_deathpending;
+static unsigned long lowmem_deathpending_timeout;
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
 			printk(x);			\
 	} while (0)
 
+static int
+task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+
+static struct notifier_block task_nb = {
+	.notifier_call	= task_notify_func,
+};
+
+static int
+task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	if (task == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+
+	return NOTIFY_OK;
+}
+
+static int lowmem_array_size(void)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	return array_size;
+}
+
+/*
+ * lowmem_threshold - index of the smallest minfree value that both free and
+ * file pages are below, or -1 if they are above all of them.
+ */
+static int lowmem_threshold(int other_free, int other_file)
+{
+	int array_size = lowmem_array_size();
+	int i;
+
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i])
+			return i;
+	}
+	return -1;
+}
+
 static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
@@ -67,21 +137,13 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int oom_adj;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES);
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	i = lowmem_threshold(other_free, other_file);
+	if (i >= 0)
+		min_adj = lowmem_adj[i];
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -95,42 +157,43 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
+
+	/*
+	 * The last victim is still exiting; its memory has not been freed
+	 * yet, so killing another task now would likely be one too many.
+	 */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		lowmem_print(4, "lowmem_shrink %d, %x, death pending, "
+			     "return %d\n", nr_to_scan, gfp_mask, rem);
+		return rem;
+	}
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		for_each_process_oom_adj(p, oom_adj) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
 		if (fatal_signal_pending(selected)) {
@@ -142,6 +205,8 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
 	}
@@ -156,15 +221,245 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+struct lowmem_notify_reader {
+	unsigned int seq;	/* lowmem_notify_seq when last read */
+};
+
+static DEFINE_MUTEX(lowmem_notify_mutex);	/* protects readers count */
+static int lowmem_notify_readers;
+static DEFINE_SPINLOCK(lowmem_notify_lock);	/* protects the rest */
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+static int lowmem_notify_level;
+static unsigned int lowmem_notify_seq;
+static ktime_t lowmem_notify_time;
+static unsigned int lowmem_notify_reads;
+static u64 lowmem_notify_latency_total;
+static u64 lowmem_notify_latency_max;
+
+static void lowmem_notify_recheck(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_notify_work, lowmem_notify_recheck);
+
+static int lowmem_level(int other_free, int other_file)
+{
+	int i = lowmem_threshold(other_free, other_file);
+
+	return i < 0 ? 0 : lowmem_array_size() - i;
+}
+
+/*
+ * lowmem_notify_update - wakes up readers if the level has changed. May be
+ * called from any context that can allocate pages.
+ */
+static void lowmem_notify_update(void)
+{
+	unsigned long flags;
+	int level;
+	int changed = 0;
+
+	level = lowmem_level(global_page_state(NR_FREE_PAGES),
+			     global_page_state(NR_FILE_PAGES));
+	if (level == lowmem_notify_level)
+		return;
+
+	spin_lock_irqsave(&lowmem_notify_lock, flags);
+	if (level != lowmem_notify_level) {
+		lowmem_notify_level = level;
+		lowmem_notify_time = ktime_get();
+		lowmem_notify_seq++;
+		changed = 1;
+	}
+	spin_unlock_irqrestore(&lowmem_notify_lock, flags);
+	if (!changed)
+		return;
+
+	lowmem_print(3, "lowmem_notify level %d\n", level);
+	wake_up_interruptible(&lowmem_notify_wait);
+
+	/*
+	 * The allocator only calls us while free memory is low, so look
+	 * again later to report when it has recovered.
+	 */
+	if (level)
+		schedule_delayed_work(&lowmem_notify_work, HZ);
+}
+
+static void lowmem_notify_set_pages(void);
+
+static void lowmem_notify_recheck(struct work_struct *work)
+{
+	/* pick up changes to minfree */
+	mutex_lock(&lowmem_notify_mutex);
+	lowmem_notify_set_pages();
+	mutex_unlock(&lowmem_notify_mutex);
+
+	lowmem_notify_update();
+	if (lowmem_notify_level)
+		schedule_delayed_work(&lowmem_notify_work, HZ);
+}
+
+static int lowmem_notify_func(struct notifier_block *self, unsigned long val,
+			      void *data)
+{
+	lowmem_notify_update();
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_notify_nb = {
+	.notifier_call	= lowmem_notify_func,
+};
+
+/* the allocator notifies below the largest minfree value, if anyone cares */
+static void lowmem_notify_set_pages(void)
+{
+	int array_size = lowmem_array_size();
+
+	if (lowmem_notify_readers && array_size > 0)
+		lowmem_notify_pages = lowmem_minfree[array_size - 1];
+	else
+		lowmem_notify_pages = 0;
+}
+
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_notify_reader *reader;
+
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	mutex_lock(&lowmem_notify_mutex);
+	lowmem_notify_readers++;
+	lowmem_notify_set_pages();
+	mutex_unlock(&lowmem_notify_mutex);
+
+	lowmem_notify_update();
+	spin_lock_irq(&lowmem_notify_lock);
+	reader->seq = lowmem_notify_seq;
+	spin_unlock_irq(&lowmem_notify_lock);
+	file->private_data = reader;
+
+	return 0;
+}
+
+static int lowmem_notify_release(struct inode *inode, struct file *file)
+{
+	mutex_lock(&lowmem_notify_mutex);
+	lowmem_notify_readers--;
+	lowmem_notify_set_pages();
+	mutex_unlock(&lowmem_notify_mutex);
+
+	kfree(file->private_data);
+	return 0;
+}
+
+static unsigned int lowmem_notify_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_notify_reader *reader = file->private_data;
+
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (reader->seq != lowmem_notify_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct lowmem_notify_reader *reader = file->private_data;
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES);
+	char text[96];
+	loff_t pos = 0;
+	s64 elapsed_us;
+	int level;
+	int adj;
+	int len;
+
+	spin_lock_irq(&lowmem_notify_lock);
+	level = lowmem_notify_level;
+	elapsed_us = ktime_us_delta(ktime_get(), lowmem_notify_time);
+	if (reader->seq != lowmem_notify_seq) {
+		reader->seq = lowmem_notify_seq;
+		lowmem_notify_reads++;
+		lowmem_notify_latency_total += elapsed_us;
+		if (elapsed_us > lowmem_notify_latency_max)
+			lowmem_notify_latency_max = elapsed_us;
+	}
+	spin_unlock_irq(&lowmem_notify_lock);
+
+	adj = OOM_ADJUST_MAX + 1;
+	if (level && level <= lowmem_array_size())
+		adj = lowmem_adj[lowmem_array_size() - level];
+
+	len = snprintf(text, sizeof(text), "level %d adj %d free %d file %d "
+		       "elapsed_us %lld\n", level, adj, other_free, other_file,
+		       elapsed_us);
+	return simple_read_from_buffer(buf, count, &pos, text, len);
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_notify_open,
+	.release = lowmem_notify_release,
+	.poll = lowmem_notify_poll,
+	.read = lowmem_notify_read,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmemorykiller",
+	.fops = &lowmem_notify_fops,
+};
+
+static int lowmem_notify_latency_set(const char *val, struct kernel_param *kp)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_notify_lock, flags);
+	lowmem_notify_reads = 0;
+	lowmem_notify_latency_total = 0;
+	lowmem_notify_latency_max = 0;
+	spin_unlock_irqrestore(&lowmem_notify_lock, flags);
+	return 0;
+}
+
+static int lowmem_notify_latency_get(char *buffer, struct kernel_param *kp)
+{
+	unsigned int reads;
+	u64 total, max;
+
+	spin_lock_irq(&lowmem_notify_lock);
+	reads = lowmem_notify_reads;
+	total = lowmem_notify_latency_total;
+	max = lowmem_notify_latency_max;
+	spin_unlock_irq(&lowmem_notify_lock);
+
+	return sprintf(buffer, "reads %u avg_us %llu max_us %llu", reads,
+		       reads ? div_u64(total, reads) : 0ULL, max);
+}
+
 static int __init lowmem_init(void)
 {
+	int ret;
+
+	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_notify_time = ktime_get();
+	register_lowmem_notifier(&lowmem_notify_nb);
+	ret = misc_register(&lowmem_notify_misc);
+	if (ret)
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "misc device, %d\n", ret);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_notify_misc);
+	unregister_lowmem_notifier(&lowmem_notify_nb);
+	cancel_delayed_work_sync(&lowmem_notify_work);
 	unregister_shrinker(&lowmem_shrinker);
+	task_free_unregister(&task_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -173,6 +468,8 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_call(notify_latency, lowmem_notify_latency_set,
+		  lowmem_notify_latency_get, NULL, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
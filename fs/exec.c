@@ -845,6 +845,7 @@ static int de_thread(struct task_struct *tsk)
 		transfer_pid(leader, tsk, PIDTYPE_PGID);
 		transfer_pid(leader, tsk, PIDTYPE_SID);
 		list_replace_rcu(&leader->tasks, &tsk->tasks);
+		list_replace_init(&leader->oom_adj_node, &tsk->oom_adj_node);
 
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
@@ -1063,6 +1063,7 @@ static ssize_t oom_adjust_write(struct file *file, const char __user *buf,
 	task->signal->oom_adj = oom_adjust;
 
 	unlock_task_sighand(task, &flags);
+	oom_adj_bucket_update(task);
 	put_task_struct(task);
 
 	return count;
@@ -0,0 +1,526 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * Concurrent read, lookup and write benchmark.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Point bench_dir at a directory on a yaffs mount, e.g. one backed by
+ * nandsim, and load the module. It creates one file per reader, then runs
+ * nr_readers threads that stream their file and nr_lookups threads that
+ * stat() names that are not in the dcache, so every one of them reaches
+ * yaffs_lookup(). nr_writers threads keep overwriting a file of their own
+ * in write_size pieces and time each write; the spread of those times shows
+ * how often a write had to wait for garbage collection, so compare runs with
+ * yaffs_bg_gc on and off. All of them run together for run_time seconds;
+ * the results are printed when the module loads.
+ *
+ * Set mount_dev to an unmounted yaffs device, e.g. /dev/mtdblock0 on top
+ * of nandsim, to time mounting it mount_runs times from the checkpoint and
+ * then as many times again with the checkpoint ignored, which is what a
+ * mount after an unclean shutdown costs. Each of those mounts is dropped
+ * straight away, saving a fresh checkpoint for the next one. The mounts
+ * are timed before any threads are started; leave all the nr_ parameters
+ * at 0 to do nothing else.
+ */
+
+#include <linux/module.h>
+#include <linux/mount.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/stat.h>
+#include <linux/hrtimer.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+static char *bench_dir = "/data";
+module_param(bench_dir, charp, S_IRUGO);
+MODULE_PARM_DESC(bench_dir, "directory on a yaffs mount to work in");
+
+static int nr_readers = 2;
+module_param(nr_readers, int, S_IRUGO);
+MODULE_PARM_DESC(nr_readers, "number of threads streaming file data");
+
+static int nr_lookups = 2;
+module_param(nr_lookups, int, S_IRUGO);
+MODULE_PARM_DESC(nr_lookups, "number of threads looking up names");
+
+static int nr_writers;
+module_param(nr_writers, int, S_IRUGO);
+MODULE_PARM_DESC(nr_writers, "number of threads overwriting a file");
+
+static int write_size = 4096;
+module_param(write_size, int, S_IRUGO);
+MODULE_PARM_DESC(write_size, "bytes per timed write");
+
+static int file_kb = 4096;
+module_param(file_kb, int, S_IRUGO);
+MODULE_PARM_DESC(file_kb, "size of each reader's file in KiB");
+
+static char *mount_dev;
+module_param(mount_dev, charp, S_IRUGO);
+MODULE_PARM_DESC(mount_dev, "unmounted yaffs device to time mounting");
+
+static char *mount_fs = "yaffs2";
+module_param(mount_fs, charp, S_IRUGO);
+MODULE_PARM_DESC(mount_fs, "file system type to mount mount_dev as");
+
+static int mount_runs = 5;
+module_param(mount_runs, int, S_IRUGO);
+MODULE_PARM_DESC(mount_runs, "mounts to time each way");
+
+static int run_time = 10;
+module_param(run_time, int, S_IRUGO);
+MODULE_PARM_DESC(run_time, "seconds the threads run");
+
+#define YAFFS_BENCH_BUF_SIZE	(64 * 1024)
+
+/* Write latencies by power of two microseconds; the last bucket is open */
+#define YAFFS_BENCH_LAT_BUCKETS	24
+
+struct yaffs_bench_thread {
+	struct task_struct	*task;
+	int			id;
+	unsigned long		ops;
+	unsigned long long	bytes;
+	s64			max_us;
+	unsigned long		lat[YAFFS_BENCH_LAT_BUCKETS];
+	int			error;
+};
+
+static struct yaffs_bench_thread *threads;
+static atomic_t threads_running;
+static DECLARE_COMPLETION(threads_done);
+static DECLARE_COMPLETION(threads_start);
+
+/* Readers and writers each have a file, named after the thread */
+static char *yaffs_bench_name(int id)
+{
+	return kasprintf(GFP_KERNEL, "%s/yaffs_bench.%d", bench_dir, id);
+}
+
+static int yaffs_bench_has_file(int id)
+{
+	return id < nr_readers || id >= nr_readers + nr_lookups;
+}
+
+/* Fill a thread's file; the caller runs with KERNEL_DS */
+static int yaffs_bench_create(int id, char *buf)
+{
+	struct file *filp;
+	loff_t pos = 0;
+	char *name;
+	int ret = 0;
+
+	name = yaffs_bench_name(id);
+	if (!name)
+		return -ENOMEM;
+
+	filp = filp_open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	kfree(name);
+	if (IS_ERR(filp))
+		return PTR_ERR(filp);
+
+	memset(buf, 0x5a, YAFFS_BENCH_BUF_SIZE);
+	while (pos < (loff_t)file_kb << 10) {
+		ssize_t n = vfs_write(filp, (const char __user *)buf,
+				      YAFFS_BENCH_BUF_SIZE, &pos);
+		if (n <= 0) {
+			ret = n ? n : -ENOSPC;
+			break;
+		}
+	}
+
+	filp_close(filp, NULL);
+	return ret;
+}
+
+static void yaffs_bench_remove(int id)
+{
+	struct dentry *dentry, *parent;
+	struct file *filp;
+	char *name;
+
+	name = yaffs_bench_name(id);
+	if (!name)
+		return;
+	filp = filp_open(name, O_RDONLY, 0);
+	kfree(name);
+	if (IS_ERR(filp))
+		return;
+	dentry = dget(filp->f_path.dentry);
+	filp_close(filp, NULL);
+
+	parent = dget_parent(dentry);
+	mutex_lock_nested(&parent->d_inode->i_mutex, I_MUTEX_PARENT);
+	vfs_unlink(parent->d_inode, dentry);
+	mutex_unlock(&parent->d_inode->i_mutex);
+	dput(parent);
+	dput(dentry);
+}
+
+/*
+ * Readers drop their file's page cache before every pass so that each
+ * pass goes through yaffs_readpage().
+ */
+static void yaffs_bench_read(struct yaffs_bench_thread *t, char *buf)
+{
+	unsigned long end = jiffies + run_time * HZ;
+	struct file *filp;
+	char *name;
+
+	name = yaffs_bench_name(t->id);
+	if (!name) {
+		t->error = -ENOMEM;
+		return;
+	}
+	filp = filp_open(name, O_RDONLY, 0);
+	kfree(name);
+	if (IS_ERR(filp)) {
+		t->error = PTR_ERR(filp);
+		return;
+	}
+
+	while (time_before(jiffies, end)) {
+		loff_t pos = 0;
+		ssize_t n;
+
+		invalidate_mapping_pages(filp->f_mapping, 0, -1);
+		do {
+			n = vfs_read(filp, (char __user *)buf,
+				     YAFFS_BENCH_BUF_SIZE, &pos);
+			if (n > 0)
+				t->bytes += n;
+			cond_resched();
+		} while (n > 0 && time_before(jiffies, end));
+
+		if (n < 0) {
+			t->error = n;
+			break;
+		}
+		t->ops++;
+	}
+
+	filp_close(filp, NULL);
+}
+
+/*
+ * Names that have never been looked up miss the dcache, so each stat()
+ * ends in yaffs_lookup() and fails with -ENOENT.
+ */
+static void yaffs_bench_lookup(struct yaffs_bench_thread *t, char *buf)
+{
+	unsigned long end = jiffies + run_time * HZ;
+	struct kstat stat;
+	int ret;
+
+	while (time_before(jiffies, end)) {
+		snprintf(buf, YAFFS_BENCH_BUF_SIZE, "%s/yaffs_bench.%d.%lu",
+			 bench_dir, t->id, t->ops);
+		ret = vfs_stat((char __user *)buf, &stat);
+		if (ret && ret != -ENOENT) {
+			t->error = ret;
+			break;
+		}
+		t->ops++;
+		cond_resched();
+	}
+}
+
+/*
+ * Writers go round their file overwriting it, so it keeps leaving dirty
+ * blocks behind for garbage collection to clean up.
+ */
+static void yaffs_bench_write(struct yaffs_bench_thread *t, char *buf)
+{
+	unsigned long end = jiffies + run_time * HZ;
+	loff_t size = (loff_t)file_kb << 10;
+	struct file *filp;
+	loff_t pos = 0;
+	char *name;
+
+	name = yaffs_bench_name(t->id);
+	if (!name) {
+		t->error = -ENOMEM;
+		return;
+	}
+	filp = filp_open(name, O_WRONLY, 0);
+	kfree(name);
+	if (IS_ERR(filp)) {
+		t->error = PTR_ERR(filp);
+		return;
+	}
+
+	memset(buf, 0xa5, write_size);
+	while (time_before(jiffies, end)) {
+		ktime_t start;
+		ssize_t n;
+		s64 us;
+		int b;
+
+		if (pos + write_size > size)
+			pos = 0;
+
+		start = ktime_get();
+		n = vfs_write(filp, (const char __user *)buf, write_size,
+			      &pos);
+		us = ktime_us_delta(ktime_get(), start);
+		if (n < 0) {
+			t->error = n;
+			break;
+		}
+
+		b = us > 0 ? fls64(us) : 0;
+		if (b >= YAFFS_BENCH_LAT_BUCKETS)
+			b = YAFFS_BENCH_LAT_BUCKETS - 1;
+		t->lat[b]++;
+		if (us > t->max_us)
+			t->max_us = us;
+		t->bytes += n;
+		t->ops++;
+		cond_resched();
+	}
+
+	filp_close(filp, NULL);
+}
+
+static int yaffs_bench_thread_fn(void *data)
+{
+	struct yaffs_bench_thread *t = data;
+	mm_segment_t fs;
+	char *buf;
+
+	buf = kmalloc(YAFFS_BENCH_BUF_SIZE, GFP_KERNEL);
+	if (!buf) {
+		t->error = -ENOMEM;
+		goto done;
+	}
+
+	wait_for_completion(&threads_start);
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	if (t->id < nr_readers)
+		yaffs_bench_read(t, buf);
+	else if (t->id < nr_readers + nr_lookups)
+		yaffs_bench_lookup(t, buf);
+	else
+		yaffs_bench_write(t, buf);
+	set_fs(fs);
+	kfree(buf);
+
+done:
+	if (atomic_dec_and_test(&threads_running))
+		complete(&threads_done);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+/* Upper bound in microseconds of the latency of permille/1000 of the writes */
+static s64 yaffs_bench_write_percentile(unsigned long *lat,
+					unsigned long writes, int permille)
+{
+	unsigned long want = writes - div64_u64((u64)writes *
+						(1000 - permille), 1000);
+	unsigned long seen = 0;
+	int b;
+
+	for (b = 0; b < YAFFS_BENCH_LAT_BUCKETS - 1; b++) {
+		seen += lat[b];
+		if (seen >= want)
+			break;
+	}
+	return 1LL << b;
+}
+
+static void yaffs_bench_report_writes(s64 elapsed_us)
+{
+	unsigned long lat[YAFFS_BENCH_LAT_BUCKETS] = { 0 };
+	unsigned long long bytes = 0;
+	unsigned long writes = 0;
+	s64 max_us = 0;
+	int i, b;
+
+	for (i = nr_readers + nr_lookups; i < nr_readers + nr_lookups +
+						nr_writers; i++) {
+		struct yaffs_bench_thread *t = &threads[i];
+
+		for (b = 0; b < YAFFS_BENCH_LAT_BUCKETS; b++)
+			lat[b] += t->lat[b];
+		if (t->max_us > max_us)
+			max_us = t->max_us;
+		writes += t->ops;
+		bytes += t->bytes;
+	}
+	if (!writes)
+		return;
+
+	printk(KERN_INFO "yaffs_bench: %d writers: %lu writes, %llu KiB/s, "
+	       "p50 < %lld us, p99 < %lld us, p99.9 < %lld us, max %lld us\n",
+	       nr_writers, writes,
+	       div64_u64(bytes * USEC_PER_SEC, elapsed_us) >> 10,
+	       yaffs_bench_write_percentile(lat, writes, 500),
+	       yaffs_bench_write_percentile(lat, writes, 990),
+	       yaffs_bench_write_percentile(lat, writes, 999), max_us);
+}
+
+static void yaffs_bench_report(s64 elapsed_us)
+{
+	unsigned long long bytes = 0;
+	unsigned long lookups = 0;
+	int i;
+
+	for (i = 0; i < nr_readers + nr_lookups + nr_writers; i++) {
+		struct yaffs_bench_thread *t = &threads[i];
+
+		if (t->error)
+			printk(KERN_INFO "yaffs_bench: thread %d failed, %d\n",
+			       i, t->error);
+		if (i < nr_readers)
+			bytes += t->bytes;
+		else if (i < nr_readers + nr_lookups)
+			lookups += t->ops;
+	}
+
+	if (elapsed_us <= 0)
+		elapsed_us = 1;
+	printk(KERN_INFO "yaffs_bench: %d readers: %llu bytes in %lld us, "
+	       "%llu KiB/s\n", nr_readers, bytes, elapsed_us,
+	       div64_u64(bytes * USEC_PER_SEC, elapsed_us) >> 10);
+	printk(KERN_INFO "yaffs_bench: %d lookup threads: %lu lookups, "
+	       "%llu lookups/s\n", nr_lookups, lookups,
+	       div64_u64((u64)lookups * USEC_PER_SEC, elapsed_us));
+	yaffs_bench_report_writes(elapsed_us);
+}
+
+static void yaffs_bench_mount(void)
+{
+	static const char * const how[] = { "checkpoint", "scan" };
+	static char opts[][20] = { "", "no-checkpoint-read" };
+	int i, run;
+
+	for (i = 0; i < ARRAY_SIZE(opts); i++) {
+		s64 total_us = 0, max_us = 0;
+
+		for (run = 0; run < mount_runs; run++) {
+			struct vfsmount *mnt;
+			ktime_t start;
+			s64 us;
+
+			start = ktime_get();
+			mnt = do_kern_mount(mount_fs, 0, mount_dev, opts[i]);
+			us = ktime_us_delta(ktime_get(), start);
+			if (IS_ERR(mnt)) {
+				printk(KERN_ERR "yaffs_bench: can't mount %s, "
+				       "%ld\n", mount_dev, PTR_ERR(mnt));
+				return;
+			}
+			mntput(mnt);
+
+			total_us += us;
+			if (us > max_us)
+				max_us = us;
+		}
+
+		if (run)
+			printk(KERN_INFO "yaffs_bench: mount from %s: %d mounts, "
+			       "avg %lld us, max %lld us\n", how[i], run,
+			       div64_u64(total_us, run), max_us);
+	}
+}
+
+static int __init yaffs_bench_init(void)
+{
+	int nr_threads = nr_readers + nr_lookups + nr_writers;
+	mm_segment_t fs;
+	ktime_t start;
+	char *buf;
+	int ret = 0;
+	int i;
+
+	if (nr_readers < 0 || nr_lookups < 0 || nr_writers < 0 ||
+	    (nr_threads <= 0 && !mount_dev) || run_time <= 0 ||
+	    file_kb <= 0 || write_size <= 0 ||
+	    write_size > YAFFS_BENCH_BUF_SIZE || write_size > file_kb << 10 ||
+	    mount_runs <= 0)
+		return -EINVAL;
+
+	if (mount_dev)
+		yaffs_bench_mount();
+	if (!nr_threads)
+		return 0;
+
+	threads = kzalloc(nr_threads * sizeof(*threads), GFP_KERNEL);
+	buf = kmalloc(YAFFS_BENCH_BUF_SIZE, GFP_KERNEL);
+	if (!threads || !buf) {
+		ret = -ENOMEM;
+		goto err_alloc;
+	}
+
+	fs = get_fs();
+	set_fs(KERNEL_DS);
+	for (i = 0; i < nr_threads && !ret; i++)
+		if (yaffs_bench_has_file(i))
+			ret = yaffs_bench_create(i, buf);
+	set_fs(fs);
+	if (ret) {
+		printk(KERN_ERR "yaffs_bench: can't create files in %s, %d\n",
+		       bench_dir, ret);
+		goto err_create;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct task_struct *task;
+
+		threads[i].id = i;
+		task = kthread_create(yaffs_bench_thread_fn, &threads[i],
+				      "yaffs_bench/%d", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			goto err_thread;
+		}
+		threads[i].task = task;
+	}
+
+	atomic_set(&threads_running, nr_threads);
+	for (i = 0; i < nr_threads; i++)
+		wake_up_process(threads[i].task);
+
+	start = ktime_get();
+	complete_all(&threads_start);
+	wait_for_completion(&threads_done);
+	yaffs_bench_report(ktime_us_delta(ktime_get(), start));
+
+	i = nr_threads;
+err_thread:
+	/* threads that were never woken exit without running */
+	while (i-- > 0)
+		kthread_stop(threads[i].task);
+err_create:
+	for (i = 0; i < nr_threads; i++)
+		if (yaffs_bench_has_file(i))
+			yaffs_bench_remove(i);
+err_alloc:
+	kfree(buf);
+	kfree(threads);
+	return ret;
+}
+
+static void __exit yaffs_bench_exit(void)
+{
+}
+
+module_init(yaffs_bench_init);
+module_exit(yaffs_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("YAFFS concurrent read, lookup and write benchmark");
@@ -49,6 +49,8 @@ extern const char *yaffs_guts_c_version;
 #include <linux/pagemap.h>
 #include <linux/mtd/mtd.h>
 #include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
 
@@ -121,16 +123,34 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+unsigned int yaffs_bg_gc = 1;
+unsigned int yaffs_bg_gc_idle_ms = 500;
+unsigned int yaffs_bg_gc_interval_ms = 100;
+unsigned int yaffs_bg_gc_margin = 6;
+unsigned int yaffs_checkpoint_interval_s = 60;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
+static int yaffs_set_bg_gc(const char *val, struct kernel_param *kp);
+
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param_call(yaffs_bg_gc, yaffs_set_bg_gc, param_get_uint,
+		  &yaffs_bg_gc, 0644);
+module_param(yaffs_bg_gc_idle_ms, uint, 0644);
+module_param(yaffs_bg_gc_interval_ms, uint, 0644);
+module_param(yaffs_bg_gc_margin, uint, 0644);
+module_param(yaffs_checkpoint_interval_s, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_bg_gc, "i");
+MODULE_PARM(yaffs_bg_gc_idle_ms, "i");
+MODULE_PARM(yaffs_bg_gc_interval_ms, "i");
+MODULE_PARM(yaffs_bg_gc_margin, "i");
+MODULE_PARM(yaffs_checkpoint_interval_s, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -237,6 +257,10 @@ static void yaffs_delete_inode(struct inode *);
 static void yaffs_clear_inode(struct inode *);
 
 static int yaffs_readpage(struct file *file, struct page *page);
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+static int yaffs_readpages(struct file *file, struct address_space *mapping,
+			struct list_head *pages, unsigned nr_pages);
+#endif
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 static int yaffs_writepage(struct page *page, struct writeback_control *wbc);
 #else
@@ -269,6 +293,9 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd);
 
 static struct address_space_operations yaffs_file_address_operations = {
 	.readpage = yaffs_readpage,
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	.readpages = yaffs_readpages,
+#endif
 	.writepage = yaffs_writepage,
 #if (YAFFS_USE_WRITE_BEGIN_END > 0)
 	.write_begin = yaffs_write_begin,
@@ -365,17 +392,43 @@ static const struct super_operations yaffs_super_ops = {
 	.write_super = yaffs_write_super,
 };
 
+/*
+ * The gross lock is held exclusively by anything that can change the
+ * device: writes, allocation, GC, checkpointing and directory changes.
+ * Lookups, inode reads, symlink reads and page reads only hold it shared.
+ * What they still share (NAND reads, temp buffers and lazy loading) is
+ * protected by the smaller locks in yaffs_Device; see yportenv.h.
+ */
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs locking %p\n", current));
-	down(&dev->grossLock);
+	down_write(&dev->grossLock);
 	T(YAFFS_TRACE_OS, ("yaffs locked %p\n", current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs unlocking %p\n", current));
-	up(&dev->grossLock);
+	/* Wake the resting background GC thread once there is work */
+	if (dev->gcResting && (dev->nPageWrites != dev->gcRestWrites ||
+			       dev->isCheckpointed != dev->gcRestCheckpointed)) {
+		dev->gcResting = 0;
+		wake_up_process(dev->gcThread);
+	}
+	up_write(&dev->grossLock);
+}
+
+static void yaffs_GrossReadLock(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs read locking %p\n", current));
+	down_read(&dev->grossLock);
+	T(YAFFS_TRACE_OS, ("yaffs read locked %p\n", current));
+}
+
+static void yaffs_GrossReadUnlock(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_OS, ("yaffs read unlocking %p\n", current));
+	up_read(&dev->grossLock);
 }
 
 
@@ -502,11 +555,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user *buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -526,11 +579,11 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (!alias) {
 		ret = -ENOMEM;
@@ -566,7 +619,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_lookup for %d:%s\n",
@@ -578,7 +631,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -740,13 +793,24 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
-	ret = yaffs_ReadDataFromFile(obj, pg_buf,
+	ret = yaffs_ReadDataFromFileDirect(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
+
+	if (ret < 0) {
+		/* Partly cached, or not whole chunks: go through the cache */
+		yaffs_GrossLock(dev);
+
+		ret = yaffs_ReadDataFromFile(obj, pg_buf,
+					pg->index << PAGE_CACHE_SHIFT,
+					PAGE_CACHE_SIZE);
+
+		yaffs_GrossUnlock(dev);
+	}
 
 	if (ret >= 0)
 		ret = 0;
@@ -778,6 +842,103 @@ static int yaffs_readpage(struct file *f, struct page *pg)
 	return yaffs_readpage_unlock(f, pg);
 }
 
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+
+/* Most pages read ahead in one go */
+#define YAFFS_READPAGES_BATCH	8
+/* Chunks per page the batched read handles, smaller chunks go page by page */
+#define YAFFS_READPAGES_CHUNKS	4
+
+/*
+ * Fill a run of locked pages with consecutive indexes from one read of the
+ * file, then unlock and release them. The chunks are read straight into the
+ * pages; if that can't be done the pages are read one at a time.
+ */
+static void yaffs_readpages_batch(struct file *f, struct page **pages,
+				int nr)
+{
+	yaffs_Object *obj = yaffs_DentryToObject(f->f_dentry);
+	yaffs_Device *dev = obj->myDev;
+	__u8 *data[YAFFS_READPAGES_BATCH * YAFFS_READPAGES_CHUNKS];
+	loff_t offset = (loff_t)pages[0]->index << PAGE_CACHE_SHIFT;
+	int chunksPerPage = PAGE_CACHE_SIZE / dev->nDataBytesPerChunk;
+	int ret = -1;
+	int i, j;
+
+	if (nr > 1 && chunksPerPage > 0 &&
+	    chunksPerPage <= YAFFS_READPAGES_CHUNKS &&
+	    chunksPerPage * dev->nDataBytesPerChunk == PAGE_CACHE_SIZE) {
+		for (i = 0; i < nr; i++) {
+			__u8 *pg_buf = kmap(pages[i]);
+
+			for (j = 0; j < chunksPerPage; j++)
+				data[i * chunksPerPage + j] =
+					pg_buf + j * dev->nDataBytesPerChunk;
+		}
+
+		yaffs_GrossReadLock(dev);
+		ret = yaffs_ReadChunksFromFile(obj, data, offset,
+					nr * chunksPerPage);
+		yaffs_GrossReadUnlock(dev);
+
+		for (i = 0; i < nr; i++) {
+			if (ret >= 0)
+				flush_dcache_page(pages[i]);
+			kunmap(pages[i]);
+		}
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct page *pg = pages[i];
+
+		if (ret < 0) {
+			yaffs_readpage_unlock(f, pg);
+		} else {
+			SetPageUptodate(pg);
+			ClearPageError(pg);
+			unlock_page(pg);
+		}
+		page_cache_release(pg);
+	}
+}
+
+/*
+ * Readahead. Pages with consecutive indexes are read together, so that
+ * chunks lying next to each other in NAND reach the driver as one request.
+ */
+static int yaffs_readpages(struct file *f, struct address_space *mapping,
+			struct list_head *pages, unsigned nr_pages)
+{
+	struct page *batch[YAFFS_READPAGES_BATCH];
+	int nr = 0;
+	unsigned i;
+
+	T(YAFFS_TRACE_OS, ("yaffs_readpages %u pages\n", nr_pages));
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *pg = list_entry(pages->prev, struct page, lru);
+
+		list_del(&pg->lru);
+		if (add_to_page_cache_lru(pg, mapping, pg->index,
+					GFP_KERNEL)) {
+			page_cache_release(pg);
+			continue;
+		}
+
+		if (nr && (nr == YAFFS_READPAGES_BATCH ||
+			   pg->index != batch[nr - 1]->index + 1)) {
+			yaffs_readpages_batch(f, batch, nr);
+			nr = 0;
+		}
+		batch[nr++] = pg;
+	}
+	if (nr)
+		yaffs_readpages_batch(f, batch, nr);
+
+	return 0;
+}
+#endif
+
 /* writepage inspired by/stolen from smbfs */
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -1805,13 +1966,13 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 	 * need to lock again.
 	 */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	unlock_new_inode(inode);
 	return inode;
@@ -1832,19 +1993,169 @@ static void yaffs_read_inode(struct inode *inode)
 	T(YAFFS_TRACE_OS,
 		("yaffs_read_inode for %d\n", (int)inode->i_ino));
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 }
 
 #endif
 
 static YLIST_HEAD(yaffs_dev_list);
 
+/*
+ * Background garbage collection, one thread per writable mount.
+ * Whenever erased blocks come within yaffs_bg_gc_margin of the reserve,
+ * whole blocks are collected straight away so that writers seldom have to.
+ * Once a mount has seen no writes for yaffs_bg_gc_idle_ms, passive GC is
+ * done a step at a time until there is nothing left worth collecting.
+ * While the thread is enabled, writers leave passive GC to it.
+ * The same thread saves the checkpoint of an idle mount at most every
+ * yaffs_checkpoint_interval_s, so that an unclean shutdown seldom leaves
+ * the next mount to scan.
+ * Once an idle mount has nothing left to collect or save, the thread
+ * stops polling and sleeps until yaffs_GrossUnlock() sees a page write
+ * or the checkpoint invalidated.
+ */
+static int yaffs_BackgroundGC(void *data)
+{
+	yaffs_Device *dev = data;
+	unsigned long lastActive = jiffies;
+	unsigned long lastCheckpoint = jiffies;
+	int lastWrites = -1;
+	int idleWork = 0;
+
+	while (!kthread_should_stop()) {
+		long timeout = msecs_to_jiffies(yaffs_bg_gc_interval_ms);
+		int checkpoint;
+		int resting = 0;
+		int idle;
+		int more = 0;
+
+		yaffs_GrossLock(dev);
+
+		dev->gcResting = 0;
+		dev->backgroundGC = yaffs_bg_gc ? 1 : 0;
+
+		if (dev->nPageWrites != lastWrites) {
+			lastWrites = dev->nPageWrites;
+			lastActive = jiffies;
+			idleWork = 1;
+		}
+		idle = time_after_eq(jiffies, lastActive +
+				msecs_to_jiffies(yaffs_bg_gc_idle_ms));
+
+		if (dev->backgroundGC) {
+			more = yaffs_BackgroundGarbageCollect(dev,
+						idle && idleWork,
+						yaffs_bg_gc_margin);
+			if (idle && !more)
+				idleWork = 0;
+		}
+
+		checkpoint = !dev->isCheckpointed && yaffs_auto_checkpoint &&
+			yaffs_checkpoint_interval_s;
+		if (!more && idle && checkpoint &&
+		    time_after_eq(jiffies, lastCheckpoint +
+					yaffs_checkpoint_interval_s * HZ)) {
+			yaffs_FlushEntireDeviceCache(dev);
+			yaffs_CheckpointSave(dev);
+			lastCheckpoint = jiffies;
+			checkpoint = !dev->isCheckpointed;
+		}
+
+		/* Our own copies are not activity */
+		lastWrites = dev->nPageWrites;
+
+		if (!more && idle && (!idleWork || !dev->backgroundGC)) {
+			if (!checkpoint)
+				timeout = MAX_SCHEDULE_TIMEOUT;
+			else if (time_before(jiffies, lastCheckpoint +
+					     yaffs_checkpoint_interval_s * HZ))
+				timeout = lastCheckpoint - jiffies +
+					yaffs_checkpoint_interval_s * HZ;
+			/* Set before unlocking, so a write can't be missed */
+			set_current_state(TASK_INTERRUPTIBLE);
+			dev->gcRestWrites = lastWrites;
+			dev->gcRestCheckpointed = dev->isCheckpointed;
+			dev->gcResting = 1;
+			resting = 1;
+		}
+
+		yaffs_GrossUnlock(dev);
+
+		if (more)
+			cond_resched();
+		else if (resting)
+			schedule_timeout(timeout);
+		else
+			schedule_timeout_interruptible(timeout);
+	}
+
+	return 0;
+}
+
+static void yaffs_StartBackgroundGC(yaffs_Device *dev)
+{
+	struct task_struct *task;
+
+	task = kthread_run(yaffs_BackgroundGC, dev, "yaffs-gc/%s", dev->name);
+	if (IS_ERR(task)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: no background GC for %s\n", dev->name));
+		return;
+	}
+	dev->gcThread = task;
+}
+
+static void yaffs_StopBackgroundGC(yaffs_Device *dev)
+{
+	if (!dev->gcThread)
+		return;
+
+	kthread_stop(dev->gcThread);
+
+	yaffs_GrossLock(dev);
+	dev->gcThread = NULL;
+	dev->gcResting = 0;
+	dev->backgroundGC = 0;
+	yaffs_GrossUnlock(dev);
+}
+
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
+/*
+ * Setting yaffs_bg_gc wakes the threads resting on idle mounts, so that
+ * the new setting is taken up straight away rather than on the next write.
+ */
+static int yaffs_set_bg_gc(const char *val, struct kernel_param *kp)
+{
+	struct ylist_head *item;
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (ret)
+		return ret;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+	ylist_for_each(item, &yaffs_dev_list) {
+		yaffs_Device *dev = ylist_entry(item, yaffs_Device, devList);
+
+		yaffs_GrossLock(dev);
+		if (dev->gcResting) {
+			dev->gcResting = 0;
+			wake_up_process(dev->gcThread);
+		}
+		yaffs_GrossUnlock(dev);
+	}
+	unlock_kernel();
+	return 0;
+}
+#endif
+
 #if 0 /* not used */
 static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 {
@@ -1881,6 +2192,8 @@ static void yaffs_put_super(struct super_block *sb)
 
 	T(YAFFS_TRACE_OS, ("yaffs_put_super\n"));
 
+	yaffs_StopBackgroundGC(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1931,6 +2244,7 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_size;		/* Short op cache chunks, -1 for the default */
 	int empty_lost_and_found_overridden;
 	int empty_lost_and_found;
 } yaffs_options;
@@ -1963,6 +2277,19 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->inband_tags = 1;
 		else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
+		else if (!strncmp(cur_opt, "cache-size=", 11)) {
+			unsigned long n;
+			char *end;
+
+			n = simple_strtoul(cur_opt + 11, &end, 0);
+			if (end == cur_opt + 11 || *end ||
+			    n > YAFFS_MAX_SHORT_OP_CACHES) {
+				printk(KERN_INFO "yaffs: Bad cache size \"%s\"\n",
+						cur_opt + 11);
+				error = 1;
+			} else
+				options->cache_size = n;
+		}
 		else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
@@ -1998,6 +2325,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	struct mtd_info *mtd;
 	int err;
 	char *data_str = (char *)data;
+	ktime_t start;
 
 	yaffs_options options;
 
@@ -2022,6 +2350,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	printk(KERN_INFO "yaffs: passed flags \"%s\"\n", data_str);
 
 	memset(&options, 0, sizeof(options));
+	options.cache_size = -1;
 
 	if (yaffs_parse_options(&options, data_str)) {
 		/* Option parsing failed */
@@ -2187,7 +2516,12 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	if (options.no_cache)
+		dev->nShortOpCaches = 0;
+	else if (options.cache_size >= 0)
+		dev->nShortOpCaches = options.cache_size;
+	else
+		dev->nShortOpCaches = YAFFS_DEFAULT_SHORT_OP_CACHES;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2196,6 +2530,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_WriteChunkWithTagsToNAND;
 		dev->readChunkWithTagsFromNAND =
 		    nandmtd2_ReadChunkWithTagsFromNAND;
+		dev->readChunksFromNAND = nandmtd2_ReadChunksFromNAND;
+		dev->readTagsFromNAND = nandmtd2_ReadTagsFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
@@ -2254,11 +2590,17 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&dev->searchContexts);
         dev->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&dev->grossLock);
+	init_rwsem(&dev->grossLock);
+	mutex_init(&dev->readLock);
+	mutex_init(&dev->lazyLock);
+	spin_lock_init(&dev->tempLock);
 
 	yaffs_GrossLock(dev);
 
+	start = ktime_get();
 	err = yaffs_GutsInitialise(dev);
+	dev->mountTimeUs = ktime_us_delta(ktime_get(), start);
+	dev->mountFromCheckpoint = dev->isCheckpointed;
 
 	T(YAFFS_TRACE_OS,
 	  ("yaffs_read_super: guts initialised %s\n",
@@ -2293,6 +2635,9 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
+	if (!(sb->s_flags & MS_RDONLY))
+		yaffs_StartBackgroundGC(dev);
+
 	T(YAFFS_TRACE_OS, ("yaffs_read_super: done\n"));
 	return sb;
 }
@@ -2405,6 +2750,8 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nErasedBlocks...... %d\n", dev->nErasedBlocks);
 	buf += sprintf(buf, "nReservedBlocks.... %d\n", dev->nReservedBlocks);
 	buf += sprintf(buf, "blocksInCheckpoint. %d\n", dev->blocksInCheckpoint);
+	buf += sprintf(buf, "mountTimeUs........ %u\n", dev->mountTimeUs);
+	buf += sprintf(buf, "mountFromCheckpoint %d\n", dev->mountFromCheckpoint);
 	buf += sprintf(buf, "nTnodesCreated..... %d\n", dev->nTnodesCreated);
 	buf += sprintf(buf, "nFreeTnodes........ %d\n", dev->nFreeTnodes);
 	buf += sprintf(buf, "nObjectsCreated.... %d\n", dev->nObjectsCreated);
@@ -2417,6 +2764,15 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "garbageCollections. %d\n", dev->garbageCollections);
 	buf += sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
+	buf += sprintf(buf, "foregroundGCStalls. %d\n",
+		    dev->foregroundGCStalls);
+	buf += sprintf(buf, "backgroundGC....... %d\n", dev->backgroundGC);
+	buf += sprintf(buf, "bgGCBlocks......... %d\n",
+		    dev->backgroundGCBlocks);
+	buf += sprintf(buf, "bgGCCopies......... %d\n",
+		    dev->backgroundGCCopies);
+	buf += sprintf(buf, "bgGCStallsAvoided.. %d\n",
+		    dev->backgroundGCStallsAvoided);
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nShortOpCaches..... %d\n", dev->nShortOpCaches);
 	buf += sprintf(buf, "nRetireBlocks...... %d\n", dev->nRetiredBlocks);
@@ -2425,6 +2781,11 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheCoalesced..... %d\n",
+		    dev->cacheCoalescedWrites);
+	buf += sprintf(buf, "cacheFlushes....... %d\n", dev->cacheFlushes);
+	buf += sprintf(buf, "cacheEvictions..... %d\n", dev->cacheEvictions);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -2458,6 +2819,11 @@ static int yaffs_proc_read(char *page,
 		buf += sprintf(buf, "YAFFS built:" __DATE__ " " __TIME__
 			       "\n%s\n%s\n", yaffs_fs_c_version,
 			       yaffs_guts_c_version);
+		buf += sprintf(buf, "bg_gc %u idle_ms %u interval_ms %u "
+			       "margin %u\n", yaffs_bg_gc, yaffs_bg_gc_idle_ms,
+			       yaffs_bg_gc_interval_ms, yaffs_bg_gc_margin);
+		buf += sprintf(buf, "checkpoint_interval_s %u\n",
+			       yaffs_checkpoint_interval_s);
 	}
 
 	/* hold lock_kernel while traversing yaffs_dev_list */
@@ -213,6 +213,8 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 {
 	int i, j;
 
+	YLOCK_TEMP(dev);
+
 	dev->tempInUse++;
 	if (dev->tempInUse > dev->maxTemp)
 		dev->maxTemp = dev->tempInUse;
@@ -227,10 +229,14 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 					    dev->tempBuffer[j].line;
 			}
 
+			YUNLOCK_TEMP(dev);
 			return dev->tempBuffer[i].buffer;
 		}
 	}
 
+	dev->unmanagedTempAllocations++;
+	YUNLOCK_TEMP(dev);
+
 	T(YAFFS_TRACE_BUFFERS,
 	  (TSTR("Out of temp buffers at line %d, other held by lines:"),
 	   lineNo));
@@ -244,7 +250,6 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 	 * This is not good.
 	 */
 
-	dev->unmanagedTempAllocations++;
 	return YMALLOC(dev->nDataBytesPerChunk);
 
 }
@@ -254,22 +259,29 @@ void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
 {
 	int i;
 
+	YLOCK_TEMP(dev);
+
 	dev->tempInUse--;
 
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->tempBuffer[i].buffer == buffer) {
 			dev->tempBuffer[i].line = 0;
+			YUNLOCK_TEMP(dev);
 			return;
 		}
 	}
 
+	if (buffer)
+		dev->unmanagedTempDeallocations++;
+
+	YUNLOCK_TEMP(dev);
+
 	if (buffer) {
 		/* assume it is an unmanaged one. */
 		T(YAFFS_TRACE_BUFFERS,
 		  (TSTR("Releasing unmanaged temp buffer in line %d" TENDSTR),
 		   lineNo));
 		YFREE(buffer);
-		dev->unmanagedTempDeallocations++;
 	}
 
 }
@@ -3222,6 +3234,22 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
  * The idea is to help clear out space in a more spread-out manner.
  * Dunno if it really does anything useful.
  */
+
+/*
+ * Are erased blocks within margin of the reserve (plus what the checkpoint
+ * still needs)? The foreground goes aggressive at a margin of 2.
+ */
+static int yaffs_ErasedBlocksLow(yaffs_Device *dev, int margin)
+{
+	int checkpointBlockAdjust;
+
+	checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
+	if (checkpointBlockAdjust < 0)
+		checkpointBlockAdjust = 0;
+
+	return dev->nErasedBlocks < (dev->nReservedBlocks + checkpointBlockAdjust + margin);
+}
+
 static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 {
 	int block;
@@ -3229,8 +3257,6 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	int gcOk = YAFFS_OK;
 	int maxTries = 0;
 
-	int checkpointBlockAdjust;
-
 	if (dev->isDoingGC) {
 		/* Bail out so we don't get recursive gc */
 		return YAFFS_OK;
@@ -3243,13 +3269,12 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	do {
 		maxTries++;
 
-		checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
-		if (checkpointBlockAdjust < 0)
-			checkpointBlockAdjust = 0;
-
-		if (dev->nErasedBlocks < (dev->nReservedBlocks + checkpointBlockAdjust + 2)) {
+		if (yaffs_ErasedBlocksLow(dev, 2)) {
 			/* We need a block soon...*/
 			aggressive = 1;
+		} else if (dev->backgroundGC) {
+			/* We're in no hurry, and someone else will do it */
+			return YAFFS_OK;
 		} else {
 			/* We're in no hurry */
 			aggressive = 0;
@@ -3266,6 +3291,8 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 			dev->garbageCollections++;
 			if (!aggressive)
 				dev->passiveGarbageCollections++;
+			else if (maxTries == 1)
+				dev->foregroundGCStalls++;
 
 			T(YAFFS_TRACE_GC,
 			  (TSTR
@@ -3288,6 +3315,52 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+/*
+ * One step of garbage collection on behalf of a background thread, which
+ * must hold the device lock as for any other operation.
+ * Once erased blocks are within margin of the reserve a whole block is
+ * collected, so that writers seldom reach the foreground's aggressive
+ * threshold. Otherwise, if idle is set, a passive step is taken just as a
+ * writer would. Returns 1 if it did something and should be called again.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int idle, int margin)
+{
+	int urgent = yaffs_ErasedBlocksLow(dev, margin);
+	int copies = dev->nGCCopies;
+	int block;
+
+	if (dev->isDoingGC || (!urgent && !idle))
+		return 0;
+
+	if (dev->gcBlock <= 0) {
+		dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, urgent);
+		dev->gcChunk = 0;
+	}
+
+	block = dev->gcBlock;
+	if (block <= 0)
+		return 0;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC erasedBlocks %d urgent %d" TENDSTR),
+	   dev->nErasedBlocks, urgent));
+
+	dev->garbageCollections++;
+	if (!urgent)
+		dev->passiveGarbageCollections++;
+	else if (!yaffs_ErasedBlocksLow(dev, 2))
+		/* A writer would have had to do this soon */
+		dev->backgroundGCStallsAvoided++;
+
+	yaffs_GarbageCollectBlock(dev, block, urgent);
+
+	dev->backgroundGCCopies += dev->nGCCopies - copies;
+	if (dev->gcBlock != block)
+		dev->backgroundGCBlocks++;
+
+	return 1;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
@@ -3855,10 +3928,60 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The number of cache chunks per device is set at mount time. Lookups go
+ *   through a hash on (object, chunkId); the LRU search only happens when a
+ *   chunk has to be grabbed and nothing is free.
  */
 
+static int yaffs_ChunkCacheHash(yaffs_Device *dev, const yaffs_Object *obj,
+				int chunkId)
+{
+	return (obj->objectId * 31 + chunkId) & (dev->srCacheBuckets - 1);
+}
+
+/* Hand a cache chunk to (obj, chunkId), or free it if obj is NULL,
+ * keeping the hash chains in step.
+ */
+static void yaffs_SetChunkCacheOwner(yaffs_Device *dev, yaffs_ChunkCache *cache,
+				yaffs_Object *obj, int chunkId)
+{
+	yaffs_ChunkCache **p;
+
+	if (cache->object) {
+		p = &dev->srCacheHash[yaffs_ChunkCacheHash(dev, cache->object,
+							   cache->chunkId)];
+		while (*p != cache)
+			p = &(*p)->hashNext;
+		*p = cache->hashNext;
+		cache->hashNext = NULL;
+	}
+
+	cache->object = obj;
+	cache->chunkId = chunkId;
+
+	if (obj) {
+		p = &dev->srCacheHash[yaffs_ChunkCacheHash(dev, obj, chunkId)];
+		cache->hashNext = *p;
+		*p = cache;
+	}
+}
+
+/* Write out a dirty cache chunk and free it up */
+static int yaffs_FlushChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	int chunkWritten;
+
+	chunkWritten = yaffs_WriteChunkDataToObject(cache->object,
+						    cache->chunkId,
+						    cache->data,
+						    cache->nBytes, 1);
+	dev->cacheFlushes++;
+	cache->dirty = 0;
+	yaffs_SetChunkCacheOwner(dev, cache, NULL, 0);
+
+	return chunkWritten;
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -3905,15 +4028,7 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 
 			if (cache && !cache->locked) {
 				/* Write it out and free it up */
-
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
+				chunkWritten = yaffs_FlushChunkCache(dev, cache);
 			}
 
 		} while (cache && chunkWritten > 0);
@@ -3961,7 +4076,9 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 /* Grab us a cache chunk for use.
  * First look for an empty one.
  * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then write out the least recently used dirty one and take that. Only that
+ * chunk is written, so a chunk still being appended to stays in the cache
+ * and its later writes are coalesced.
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 {
@@ -3980,47 +4097,43 @@ static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 {
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
+	yaffs_ChunkCache *clean;
+	yaffs_ChunkCache *dirty;
 	int i;
-	int pushout;
 
 	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
+		/* Try find an empty one... */
 
 		cache = yaffs_GrabChunkCacheWorker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
-
 			/* With locking we can't assume we can use entry zero */
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+			clean = NULL;
+			dirty = NULL;
 
 			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
+				cache = &dev->srCache[i];
+				if (!cache->object || cache->locked)
+					continue;
+				if (!cache->dirty) {
+					if (!clean || cache->lastUse < clean->lastUse)
+						clean = cache;
+				} else if (!dirty || cache->lastUse < dirty->lastUse)
+					dirty = cache;
 			}
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
+			cache = NULL;
+			if (clean) {
+				yaffs_SetChunkCacheOwner(dev, clean, NULL, 0);
+				cache = clean;
+			} else if (dirty) {
+				yaffs_FlushChunkCache(dev, dirty);
 				cache = yaffs_GrabChunkCacheWorker(dev);
 			}
 
+			if (cache)
+				dev->cacheEvictions++;
 		}
 		return cache;
 	} else
@@ -4028,23 +4141,35 @@ static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 
 }
 
+/* Look up a cached chunk without touching the statistics */
+static yaffs_ChunkCache *yaffs_LookupChunkCache(const yaffs_Object *obj,
+						int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *cache = NULL;
+
+	if (dev->nShortOpCaches > 0) {
+		cache = dev->srCacheHash[yaffs_ChunkCacheHash(dev, obj, chunkId)];
+		while (cache &&
+		       (cache->object != obj || cache->chunkId != chunkId))
+			cache = cache->hashNext;
+	}
+	return cache;
+}
+
 /* Find a cached chunk */
 static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache = yaffs_LookupChunkCache(obj, chunkId);
 
-				return &dev->srCache[i];
-			}
-		}
-	}
-	return NULL;
+	if (cache)
+		dev->cacheHits++;
+	else if (dev->nShortOpCaches > 0)
+		dev->cacheMisses++;
+
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -4078,10 +4203,10 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 {
 	if (object->myDev->nShortOpCaches > 0) {
-		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
+		yaffs_ChunkCache *cache = yaffs_LookupChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_SetChunkCacheOwner(object->myDev, cache, NULL, 0);
 	}
 }
 
@@ -4097,7 +4222,8 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_SetChunkCacheOwner(dev, &dev->srCache[i],
+							 NULL, 0);
 		}
 	}
 }
@@ -4333,9 +4459,24 @@ static int yaffs_CheckpointTnodeWorker(yaffs_Object *in, yaffs_Tnode *tn,
 			}
 		} else if (level == 0) {
 			__u32 baseOffset = chunkOffset <<  YAFFS_TNODES_LEVEL0_BITS;
-			ok = (yaffs_CheckpointWrite(dev, &baseOffset, sizeof(baseOffset)) == sizeof(baseOffset));
-			if (ok)
-				ok = (yaffs_CheckpointWrite(dev, tn, tnodeSize) == tnodeSize);
+			__u32 first = yaffs_GetChunkGroupBase(dev, tn, 0) >> dev->chunkGroupBits;
+
+			/* Sequentially written files have runs of consecutive chunks */
+			for (i = 1; first && i < YAFFS_NTNODES_LEVEL0; i++) {
+				if ((yaffs_GetChunkGroupBase(dev, tn, i) >> dev->chunkGroupBits) != first + i)
+					break;
+			}
+
+			if (first && i == YAFFS_NTNODES_LEVEL0) {
+				baseOffset |= YAFFS_CHECKPOINT_TNODE_RUN;
+				ok = (yaffs_CheckpointWrite(dev, &baseOffset, sizeof(baseOffset)) == sizeof(baseOffset));
+				if (ok)
+					ok = (yaffs_CheckpointWrite(dev, &first, sizeof(first)) == sizeof(first));
+			} else {
+				ok = (yaffs_CheckpointWrite(dev, &baseOffset, sizeof(baseOffset)) == sizeof(baseOffset));
+				if (ok)
+					ok = (yaffs_CheckpointWrite(dev, tn, tnodeSize) == tnodeSize);
+			}
 		}
 	}
 
@@ -4370,6 +4511,8 @@ static int yaffs_ReadCheckpointTnodes(yaffs_Object *obj)
 	yaffs_Tnode *tn;
 	int nread = 0;
 	int tnodeSize = (dev->tnodeWidth * YAFFS_NTNODES_LEVEL0)/8;
+	__u32 first;
+	int i;
 
 	if (tnodeSize < sizeof(yaffs_Tnode))
 		tnodeSize = sizeof(yaffs_Tnode);
@@ -4380,12 +4523,24 @@ static int yaffs_ReadCheckpointTnodes(yaffs_Object *obj)
 		nread++;
 		/* Read level 0 tnode */
 
+		if (baseChunk & YAFFS_CHECKPOINT_TNODE_RUN) {
+			/* Just the first chunk of a consecutive run */
+			baseChunk &= ~YAFFS_CHECKPOINT_TNODE_RUN;
+			tn = yaffs_GetTnode(dev);
+			if (tn)
+				ok = (yaffs_CheckpointRead(dev, &first, sizeof(first)) == sizeof(first));
+			else
+				ok = 0;
 
-		tn = yaffs_GetTnodeRaw(dev);
-		if (tn)
-			ok = (yaffs_CheckpointRead(dev, tn, tnodeSize) == tnodeSize);
-		else
-			ok = 0;
+			for (i = 0; ok && i < YAFFS_NTNODES_LEVEL0; i++)
+				yaffs_PutLevel0Tnode(dev, tn, i, (first + i) << dev->chunkGroupBits);
+		} else {
+			tn = yaffs_GetTnodeRaw(dev);
+			if (tn)
+				ok = (yaffs_CheckpointRead(dev, tn, tnodeSize) == tnodeSize);
+			else
+				ok = 0;
+		}
 
 		if (tn && ok)
 			ok = yaffs_AddOrFindLevel0Tnode(dev,
@@ -4720,8 +4875,7 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 
 				if (!cache) {
 					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					yaffs_SetChunkCacheOwner(dev, cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -4770,6 +4924,105 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 	return nDone;
 }
 
+/*
+ * yaffs_ReadChunksFromFile reads nChunks whole chunks starting at offset,
+ * chunk i into data[i], so the caller can point each chunk straight at its
+ * final page. Chunks held in the short-op cache are copied from it without
+ * touching the LRU, holes read as zeros and runs of chunks that sit next to
+ * each other in NAND go to the driver as one read. Only exclusive grossLock
+ * holders change the cache, so this is safe against other readers while it
+ * is held shared. Returns -1, having read nothing, if offset is not on a
+ * chunk boundary; the caller then falls back to yaffs_ReadDataFromFile.
+ */
+int yaffs_ReadChunksFromFile(yaffs_Object *in, __u8 **data, loff_t offset,
+			int nChunks)
+{
+	yaffs_Device *dev = in->myDev;
+	int runStart = -1;
+	int runLength = 0;
+	yaffs_ChunkCache *cache;
+	int chunkInNAND;
+	int chunk;
+	__u32 start;
+	int i;
+
+	if (dev->inbandTags)
+		return -1;
+
+	yaffs_AddrToChunk(dev, offset, &chunk, &start);
+	chunk++;
+	if (start)
+		return -1;
+
+	for (i = 0; i < nChunks; i++) {
+		cache = yaffs_LookupChunkCache(in, chunk + i);
+
+		if (cache) {
+			memcpy(data[i], cache->data, dev->nDataBytesPerChunk);
+			chunkInNAND = -1;
+		} else {
+			chunkInNAND = yaffs_FindChunkInFile(in, chunk + i,
+							    NULL);
+			if (chunkInNAND < 0)
+				memset(data[i], 0, dev->nDataBytesPerChunk);
+		}
+
+		if (runLength && chunkInNAND == runStart + runLength) {
+			runLength++;
+			continue;
+		}
+
+		if (runLength)
+			yaffs_ReadChunksFromNAND(dev, runStart, runLength,
+						 &data[i - runLength]);
+
+		runStart = chunkInNAND;
+		runLength = (chunkInNAND >= 0) ? 1 : 0;
+	}
+
+	if (runLength)
+		yaffs_ReadChunksFromNAND(dev, runStart, runLength,
+					 &data[nChunks - runLength]);
+
+	return nChunks * dev->nDataBytesPerChunk;
+}
+
+/* Chunk pointers yaffs_ReadDataFromFileDirect keeps on the stack */
+#define YAFFS_DIRECT_CHUNKS	16
+
+/*
+ * yaffs_ReadDataFromFileDirect is yaffs_ReadChunksFromFile for one linear
+ * buffer. Returns -1, having read nothing, if the range is not whole chunks.
+ */
+int yaffs_ReadDataFromFileDirect(yaffs_Object *in, __u8 *buffer, loff_t offset,
+			int nBytes)
+{
+	yaffs_Device *dev = in->myDev;
+	int nChunks = nBytes / dev->nDataBytesPerChunk;
+	__u8 *data[YAFFS_DIRECT_CHUNKS];
+	int done;
+	int n;
+	int i;
+
+	if (nBytes % dev->nDataBytesPerChunk)
+		return -1;
+
+	for (done = 0; done < nChunks; done += n) {
+		n = nChunks - done;
+		if (n > YAFFS_DIRECT_CHUNKS)
+			n = YAFFS_DIRECT_CHUNKS;
+		for (i = 0; i < n; i++)
+			data[i] = buffer + (done + i) * dev->nDataBytesPerChunk;
+
+		if (yaffs_ReadChunksFromFile(in, data,
+				offset + done * dev->nDataBytesPerChunk,
+				n) < 0)
+			return -1;
+	}
+
+	return nBytes;
+}
+
 int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 			int nBytes, int writeThrough)
 {
@@ -4850,8 +5103,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
 					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
+					yaffs_SetChunkCacheOwner(dev, cache, in, chunk);
 					cache->dirty = 0;
 					cache->locked = 0;
 					yaffs_ReadChunkDataFromObject(in, chunk,
@@ -4867,6 +5119,8 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				}
 
 				if (cache) {
+					if (cache->dirty)
+						dev->cacheCoalescedWrites++;
 					yaffs_UseChunkCache(dev, cache, 1);
 					cache->locked = 1;
 
@@ -4885,6 +5139,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 						     cache->chunkId,
 						     cache->data, cache->nBytes,
 						     1);
+						dev->cacheFlushes++;
 						cache->dirty = 0;
 					}
 
@@ -6048,8 +6303,16 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		in->lazyLoaded ? "not yet" : "already"));
 #endif
 
-	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
+	if (!in->lazyLoaded || in->hdrChunk <= 0) {
+		/* Pairs with YWMB() below when another reader loaded it */
+		YRMB();
+		return;
+	}
+
+	/* Readers holding grossLock shared may race to load the same object */
+	YLOCK_LAZY(dev);
+
+	if (in->lazyLoaded) {
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
@@ -6082,7 +6345,13 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		}
 
 		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+		/* Publish the details before the flag that says they are there */
+		YWMB();
+		in->lazyLoaded = 0;
 	}
+
+	YUNLOCK_LAZY(dev);
 }
 
 static int yaffs_ScanBackwards(yaffs_Device *dev)
@@ -6118,6 +6387,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
+	yaffs_ExtendedTags *blockTags;
 
 	if (!dev->isYaffs2) {
 		T(YAFFS_TRACE_SCAN,
@@ -6148,6 +6418,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	dev->blocksInCheckpoint = 0;
 
+	/* Tags for a whole block, read in one go. Without it we read chunk by chunk. */
+	blockTags = YMALLOC(dev->nChunksPerBlock * sizeof(yaffs_ExtendedTags));
+
 	chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 	/* Scan all the blocks to determine their state */
@@ -6265,6 +6538,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		if (blockTags &&
+		    (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING ||
+		     state == YAFFS_BLOCK_STATE_ALLOCATING))
+			yaffs_ReadTagsFromNAND(dev, blk * dev->nChunksPerBlock,
+					       dev->nChunksPerBlock, blockTags);
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->nChunksPerBlock - 1;
@@ -6277,8 +6556,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (blockTags)
+				tags = blockTags[c];
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6732,6 +7014,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	else
 		YFREE(blockIndex);
 
+	if (blockTags)
+		YFREE(blockTags);
+
 	/* Ok, we've done all the scanning.
 	 * Fix up the hard link chains.
 	 * We should now have scanned all the objects, now it's time to add these
@@ -7438,6 +7723,10 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
+	dev->foregroundGCStalls = 0;
+	dev->backgroundGCBlocks = 0;
+	dev->backgroundGCCopies = 0;
+	dev->backgroundGCStallsAvoided = 0;
 	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -7458,6 +7747,7 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srCacheHash = NULL;
 	dev->gcCleanupList = NULL;
 
 
@@ -7465,11 +7755,13 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
 		dev->srCache =  YMALLOC(srCacheBytes);
 
 		buf = (__u8 *) dev->srCache;
@@ -7477,6 +7769,19 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
 
+		/* About one chunk per bucket */
+		for (dev->srCacheBuckets = 1;
+		     dev->srCacheBuckets < dev->nShortOpCaches;
+		     dev->srCacheBuckets <<= 1)
+			;
+		dev->srCacheHash = YMALLOC(dev->srCacheBuckets *
+					   sizeof(yaffs_ChunkCache *));
+		if (dev->srCacheHash)
+			memset(dev->srCacheHash, 0, dev->srCacheBuckets *
+			       sizeof(yaffs_ChunkCache *));
+		else
+			buf = NULL;
+
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
 			dev->srCache[i].lastUse = 0;
@@ -7490,6 +7795,10 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheCoalescedWrites = 0;
+	dev->cacheFlushes = 0;
+	dev->cacheEvictions = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7609,6 +7918,11 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			dev->srCache = NULL;
 		}
 
+		if (dev->srCacheHash) {
+			YFREE(dev->srCacheHash);
+			dev->srCacheHash = NULL;
+		}
+
 		YFREE(dev->gcCleanupList);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
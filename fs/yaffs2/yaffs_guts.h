@@ -63,7 +63,10 @@
 
 #define YAFFS_OBJECT_SPACE		0x40000
 
-#define YAFFS_CHECKPOINT_VERSION 	3
+#define YAFFS_CHECKPOINT_VERSION 	4
+
+/* Marks a level 0 tnode stored in the checkpoint as a run of consecutive chunks */
+#define YAFFS_CHECKPOINT_TNODE_RUN	0x80000000
 
 #ifdef CONFIG_YAFFS_UNICODE
 #define YAFFS_MAX_NAME_LENGTH		127
@@ -88,7 +91,8 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
+#define YAFFS_DEFAULT_SHORT_OP_CACHES	32
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -112,9 +116,10 @@
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
 /* ChunkCache is used for short read/write operations.*/
-typedef struct {
+typedef struct yaffs_ChunkCacheStruct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
+	struct yaffs_ChunkCacheStruct *hashNext; /* Chain for (object, chunkId) */
 	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
@@ -587,6 +592,14 @@ struct yaffs_DeviceStruct {
 	int (*readChunkWithTagsFromNAND) (struct yaffs_DeviceStruct *dev,
 					  int chunkInNAND, __u8 *data,
 					  yaffs_ExtendedTags *tags);
+	/* Optional: data only, for physically consecutive chunks,
+	 * chunk i going to data[i] */
+	int (*readChunksFromNAND) (struct yaffs_DeviceStruct *dev,
+				   int chunkInNAND, int nChunks, __u8 **data);
+	/* Optional: tags only, for physically consecutive chunks */
+	int (*readTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				 int chunkInNAND, int nChunks,
+				 yaffs_ExtendedTags *tags);
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
@@ -636,7 +649,11 @@ struct yaffs_DeviceStruct {
 #ifdef __KERNEL__
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
-	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct rw_semaphore grossLock;	/* Shared by lookups and reads,
+					 * exclusive for everything else */
+	struct mutex readLock;	/* Serialises NAND reads under a shared lock */
+	struct mutex lazyLock;	/* Serialises lazy loading of object headers */
+	spinlock_t tempLock;	/* Protects the temp buffers */
 	struct rw_semaphore dirLock; /* Lock the directory structure */
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -644,6 +661,12 @@ struct yaffs_DeviceStruct {
 				 */
 	void (*putSuperFunc) (struct super_block *sb);
         struct ylist_head searchContexts;
+	struct task_struct *gcThread;	/* Background garbage collection */
+	int gcResting;			/* gcThread sleeps until a write */
+	int gcRestWrites;		/* nPageWrites when it went to sleep */
+	int gcRestCheckpointed;		/* and isCheckpointed */
+	unsigned mountTimeUs;		/* Time yaffs_GutsInitialise took */
+	int mountFromCheckpoint;	/* It restored the checkpoint, no scan */
 
 #endif
 
@@ -699,6 +722,7 @@ struct yaffs_DeviceStruct {
 	int isDoingGC;
 	int gcBlock;
 	int gcChunk;
+	int backgroundGC;	/* Passive GC is left to a background thread */
 
 	int nObjectsCreated;
 	yaffs_Object *freeObjects;
@@ -725,6 +749,10 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int foregroundGCStalls;		/* Writes that had to collect a whole block */
+	int backgroundGCBlocks;		/* Blocks finished by background GC */
+	int backgroundGCCopies;
+	int backgroundGCStallsAvoided;	/* Blocks collected before writers had to */
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -749,9 +777,15 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
+	yaffs_ChunkCache **srCacheHash;	/* Buckets, a power of two of them */
+	int srCacheBuckets;
 	int srLastUse;
 
 	int cacheHits;
+	int cacheMisses;
+	int cacheCoalescedWrites;	/* Writes into an already dirty chunk */
+	int cacheFlushes;		/* Dirty chunks written out */
+	int cacheEvictions;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -842,6 +876,10 @@ int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr);
 /* File operations */
 int yaffs_ReadDataFromFile(yaffs_Object *obj, __u8 *buffer, loff_t offset,
 				int nBytes);
+int yaffs_ReadDataFromFileDirect(yaffs_Object *obj, __u8 *buffer,
+				loff_t offset, int nBytes);
+int yaffs_ReadChunksFromFile(yaffs_Object *obj, __u8 **data, loff_t offset,
+				int nChunks);
 int yaffs_WriteDataToFile(yaffs_Object *obj, const __u8 *buffer, loff_t offset,
 				int nBytes, int writeThrough);
 int yaffs_ResizeFile(yaffs_Object *obj, loff_t newSize);
@@ -856,6 +894,9 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev);
 int yaffs_CheckpointSave(yaffs_Device *dev);
 int yaffs_CheckpointRestore(yaffs_Device *dev);
 
+/* Garbage collection */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int idle, int margin);
+
 /* Directory operations */
 yaffs_Object *yaffs_MknodDirectory(yaffs_Object *parent, const YCHAR *name,
 				__u32 mode, __u32 uid, __u32 gid);
@@ -22,6 +22,7 @@ const char *yaffs_mtdif2_c_version =
 #include "yaffs_mtdif2.h"
 
 #include "linux/mtd/mtd.h"
+#include "linux/scatterlist.h"
 #include "linux/types.h"
 #include "linux/time.h"
 
@@ -187,6 +188,178 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/*
+ * Read the tags of nChunks physically consecutive chunks with one oob-only
+ * read_oob call, which the driver can stream without stopping for each
+ * page. Each page's free oob bytes land oobavail apart in the buffer. Any
+ * error, including a corrected one, is reported as YAFFS_FAIL and the caller
+ * reads the tags chunk by chunk so that ECC results are recorded per chunk.
+ */
+int nandmtd2_ReadTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, yaffs_ExtendedTags *tags)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	yaffs_PackedTags2 pt;
+	__u8 *oob;
+	int retval;
+	int i;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->totalBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadTagsFromNAND chunk %d count %d" TENDSTR),
+	   chunkInNAND, nChunks));
+
+	if (dev->inbandTags || mtd->oobavail < sizeof(pt.t))
+		return YAFFS_FAIL;
+
+	oob = kmalloc(nChunks * mtd->oobavail, GFP_NOFS);
+	if (!oob)
+		return YAFFS_FAIL;
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.len = 0;
+	ops.retlen = 0;
+	ops.ooblen = nChunks * mtd->oobavail;
+	ops.oobretlen = 0;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+	retval = mtd->read_oob(mtd, addr, &ops);
+
+	if (retval == 0 && ops.oobretlen == ops.ooblen) {
+		for (i = 0; i < nChunks; i++) {
+			memset(&pt, 0xff, sizeof(pt));
+			memcpy(&pt, &oob[i * mtd->oobavail],
+			       min_t(size_t, sizeof(pt), mtd->oobavail));
+			yaffs_UnpackTags2(&tags[i], &pt);
+		}
+	}
+
+	kfree(oob);
+
+	if (retval == 0 && ops.oobretlen == ops.ooblen)
+		return YAFFS_OK;
+#endif
+	return YAFFS_FAIL;
+}
+
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+/* Scatterlist entries handed to mtd->read_sg() in one call */
+#define YAFFS_MTD_SG_MAX	16
+
+/*
+ * Chunk buffers that follow each other in memory are merged into one
+ * entry. Only the directly mapped kernel buffers can go in a scatterlist.
+ */
+static int nandmtd2_ReadChunksSG(yaffs_Device *dev, struct mtd_info *mtd,
+				loff_t addr, int nChunks, __u8 **data)
+{
+	struct scatterlist sg[YAFFS_MTD_SG_MAX];
+	int chunkBytes = dev->totalBytesPerChunk;
+	int first = 0;
+	int nents = 0;
+	size_t len = 0;
+	size_t retlen;
+	int retval;
+	int i;
+
+	for (i = 0; i < nChunks; i++) {
+		if (!virt_addr_valid(data[i]))
+			return YAFFS_FAIL;
+	}
+
+	sg_init_table(sg, YAFFS_MTD_SG_MAX);
+	for (i = 0; i <= nChunks; i++) {
+		if (i < nChunks && nents &&
+		    data[i] == data[i - 1] + chunkBytes) {
+			sg[nents - 1].length += chunkBytes;
+			len += chunkBytes;
+			continue;
+		}
+		if (nents && (i == nChunks || nents == YAFFS_MTD_SG_MAX)) {
+			sg_mark_end(&sg[nents - 1]);
+			retval = mtd->read_sg(mtd,
+					addr + (loff_t)first * chunkBytes,
+					sg, nents, &retlen);
+			if (retval != 0 || retlen != len)
+				return YAFFS_FAIL;
+			sg_init_table(sg, YAFFS_MTD_SG_MAX);
+			first = i;
+			nents = 0;
+			len = 0;
+		}
+		if (i < nChunks) {
+			sg_set_buf(&sg[nents++], data[i], chunkBytes);
+			len += chunkBytes;
+		}
+	}
+
+	return YAFFS_OK;
+}
+#endif
+
+/*
+ * Read the data of nChunks physically consecutive chunks, chunk i into
+ * data[i], so the driver can stream all of them in a single operation. With
+ * mtd->read_sg the chunks go straight to their buffers; otherwise buffers
+ * that follow each other in memory are read with one read_oob call. Tags
+ * are not returned. Anything short of a clean read of every byte is
+ * reported as YAFFS_FAIL and the caller re-reads chunk by chunk to get the
+ * ECC results.
+ */
+int nandmtd2_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	int retval;
+	int n;
+	int i;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->totalBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunksFromNAND chunk %d count %d data %p"
+	    TENDSTR), chunkInNAND, nChunks, data[0]));
+
+	if (dev->inbandTags)
+		return YAFFS_FAIL;
+
+	if (mtd->read_sg &&
+	    nandmtd2_ReadChunksSG(dev, mtd, addr, nChunks, data) == YAFFS_OK)
+		return YAFFS_OK;
+
+	for (i = 0; i < nChunks; i += n) {
+		for (n = 1; i + n < nChunks; n++) {
+			if (data[i + n] != data[i] + n * dev->totalBytesPerChunk)
+				break;
+		}
+
+		ops.mode = MTD_OOB_AUTO;
+		ops.len = n * dev->totalBytesPerChunk;
+		ops.retlen = 0;
+		ops.ooblen = 0;
+		ops.ooboffs = 0;
+		ops.datbuf = data[i];
+		ops.oobbuf = NULL;
+		retval = mtd->read_oob(mtd,
+				addr + (loff_t)i * dev->totalBytesPerChunk,
+				&ops);
+
+		if (retval != 0 || ops.retlen != ops.len)
+			return YAFFS_FAIL;
+	}
+
+	return YAFFS_OK;
+#else
+	return YAFFS_FAIL;
+#endif
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
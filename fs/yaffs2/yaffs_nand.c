@@ -29,6 +29,8 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 
 	int realignedChunkInNAND = chunkInNAND - dev->chunkOffset;
 
+	YLOCK_READ(dev);
+
 	dev->nPageReads++;
 
 	/* If there are no tags provided, use local tags to get prioritised gc working */
@@ -50,6 +52,77 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		yaffs_HandleChunkError(dev, bi);
 	}
 
+	YUNLOCK_READ(dev);
+
+	return result;
+}
+
+/*
+ * Read the data of nChunks physically consecutive chunks, chunk i into
+ * data[i], which is nDataBytesPerChunk long. Uses the device's multi-chunk
+ * read where there is one. If that is missing or does not come back clean,
+ * the chunks are read one at a time so that ECC errors are handled exactly
+ * as for a single chunk read.
+ */
+int yaffs_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data)
+{
+	int result = YAFFS_FAIL;
+	int i;
+
+	if (nChunks > 1 && dev->readChunksFromNAND &&
+	    dev->totalBytesPerChunk == dev->nDataBytesPerChunk) {
+		YLOCK_READ(dev);
+		dev->nPageReads += nChunks;
+		result = dev->readChunksFromNAND(dev,
+						 chunkInNAND - dev->chunkOffset,
+						 nChunks, data);
+		YUNLOCK_READ(dev);
+	}
+
+	if (result == YAFFS_OK)
+		return YAFFS_OK;
+
+	result = YAFFS_OK;
+	for (i = 0; i < nChunks; i++) {
+		if (yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + i,
+				data[i], NULL) != YAFFS_OK)
+			result = YAFFS_FAIL;
+	}
+
+	return result;
+}
+
+/*
+ * Read the tags of nChunks physically consecutive chunks, as the scan does
+ * for each block. As with yaffs_ReadChunksFromNAND, anything but a clean
+ * multi-chunk read falls back to reading the chunks one at a time.
+ */
+int yaffs_ReadTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, yaffs_ExtendedTags *tags)
+{
+	int result = YAFFS_FAIL;
+	int i;
+
+	if (nChunks > 1 && dev->readTagsFromNAND) {
+		YLOCK_READ(dev);
+		dev->nPageReads += nChunks;
+		result = dev->readTagsFromNAND(dev,
+					       chunkInNAND - dev->chunkOffset,
+					       nChunks, tags);
+		YUNLOCK_READ(dev);
+	}
+
+	if (result == YAFFS_OK)
+		return YAFFS_OK;
+
+	result = YAFFS_OK;
+	for (i = 0; i < nChunks; i++) {
+		if (yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + i,
+				NULL, &tags[i]) != YAFFS_OK)
+			result = YAFFS_FAIL;
+	}
+
 	return result;
 }
 
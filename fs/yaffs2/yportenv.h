@@ -101,6 +101,18 @@
 #define compile_time_assertion(assertion) \
 	({ int x = __builtin_choose_expr(assertion, 0, (void)0); (void) x; })
 
+/* Locks for the state that readers share while grossLock is only held for
+ * reading: temp buffers, NAND reads and lazy loading of object headers.
+ */
+#define YLOCK_TEMP(dev)		spin_lock(&(dev)->tempLock)
+#define YUNLOCK_TEMP(dev)	spin_unlock(&(dev)->tempLock)
+#define YLOCK_READ(dev)		mutex_lock(&(dev)->readLock)
+#define YUNLOCK_READ(dev)	mutex_unlock(&(dev)->readLock)
+#define YLOCK_LAZY(dev)		mutex_lock(&(dev)->lazyLock)
+#define YUNLOCK_LAZY(dev)	mutex_unlock(&(dev)->lazyLock)
+#define YWMB()			smp_wmb()
+#define YRMB()			smp_rmb()
+
 #elif defined CONFIG_YAFFS_DIRECT
 
 #define MTD_VERSION_CODE MTD_VERSION(2, 6, 22)
@@ -158,6 +170,18 @@
 
 #endif
 
+/* Without a shared read lock there is nothing to protect */
+#ifndef YLOCK_TEMP
+#define YLOCK_TEMP(dev)		do { } while (0)
+#define YUNLOCK_TEMP(dev)	do { } while (0)
+#define YLOCK_READ(dev)		do { } while (0)
+#define YUNLOCK_READ(dev)	do { } while (0)
+#define YLOCK_LAZY(dev)		do { } while (0)
+#define YUNLOCK_LAZY(dev)	do { } while (0)
+#define YWMB()			do { } while (0)
+#define YRMB()			do { } while (0)
+#endif
+
 /* see yaffs_fs.c */
 extern unsigned int yaffs_traceMask;
 extern unsigned int yaffs_wr_attempts;
@@ -30,6 +30,20 @@
 	_IO(PMEM_KERNEL_TEST_MAGIC, 4)
 #define PMEM_KERNEL_TEST_LARGE_REGION_NUMBER_TEST_IOCTL \
 	_IO(PMEM_KERNEL_TEST_MAGIC, 5)
+#define PMEM_KERNEL_TEST_TRACE_REPLAY_TEST_IOCTL \
+	_IO(PMEM_KERNEL_TEST_MAGIC, 6)
+
+/* allocation trace records, written to the pmem_kernel_test device */
+#define PMEM_KERNEL_TEST_TRACE_ALLOC	1
+#define PMEM_KERNEL_TEST_TRACE_FREE	2
+#define PMEM_KERNEL_TEST_TRACE_SLOTS	64
+
+struct pmem_kernel_test_trace_op {
+	unsigned int op;	/* PMEM_KERNEL_TEST_TRACE_ALLOC or _FREE */
+	unsigned int slot;	/* buffer the op applies to */
+	unsigned int size;	/* bytes to allocate, for _ALLOC */
+	unsigned int flags;	/* pmem_kalloc() flags, for _ALLOC */
+};
 
 #define PMEM_IOCTL_MAGIC 'p'
 #define PMEM_GET_PHYS		_IOW(PMEM_IOCTL_MAGIC, 1, unsigned int)
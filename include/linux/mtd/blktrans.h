@@ -11,6 +11,7 @@
 #include <linux/mutex.h>
 
 struct hd_geometry;
+struct scatterlist;
 struct mtd_info;
 struct mtd_blktrans_ops;
 struct file;
@@ -44,6 +45,11 @@ struct mtd_blktrans_ops {
 	int (*discard)(struct mtd_blktrans_dev *dev,
 		       unsigned long block, unsigned nr_blocks);
 
+	/* Optional: read a whole request straight into its pages.
+	   -EOPNOTSUPP falls back to readsect for that request. */
+	int (*readsg)(struct mtd_blktrans_dev *dev, unsigned long block,
+		      size_t len, struct scatterlist *sg, int nents);
+
 	/* Block layer ioctls */
 	int (*getgeo)(struct mtd_blktrans_dev *dev, struct hd_geometry *geo);
 	int (*flush)(struct mtd_blktrans_dev *dev);
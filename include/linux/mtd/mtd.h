@@ -18,6 +18,8 @@
 
 #include <asm/div64.h>
 
+struct scatterlist;
+
 #define MTD_CHAR_MAJOR 90
 #define MTD_BLOCK_MAJOR 31
 #define MAX_MTD_DEVICES 32
@@ -101,6 +103,36 @@ struct mtd_oob_ops {
 	uint8_t		*oobbuf;
 };
 
+/*
+ * I/O statistics of one MTD, see mtd_stats_account().  Latencies are
+ * counted in log2 microsecond buckets: bucket n holds the operations
+ * that took [2^n, 2^(n+1)) us, bucket 0 also the faster ones and the
+ * last bucket everything slower.
+ */
+#define MTD_STATS_BUCKETS	16
+
+enum mtd_stats_op {
+	MTD_STATS_READ,
+	MTD_STATS_WRITE,
+	MTD_STATS_ERASE,
+	MTD_STATS_NR_OPS,
+};
+
+struct mtd_op_stats {
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t hist[MTD_STATS_BUCKETS];
+};
+
+struct mtd_stats {
+	struct mtd_op_stats op[MTD_STATS_NR_OPS];
+	uint64_t ecc_corrected;		/* bitflips the ECC fixed */
+	uint64_t ecc_failed;		/* reads it could not fix */
+};
+
 struct mtd_info {
 	u_char type;
 	uint32_t flags;
@@ -213,6 +245,14 @@ struct mtd_info {
 	*/
 	int (*writev) (struct mtd_info *mtd, const struct kvec *vecs, unsigned long count, loff_t to, size_t *retlen);
 
+	/* Scatterlist-based data transfers, optional.  The data goes to and
+	   from the scatterlist's pages directly, without a bounce buffer.
+	   Every entry must start and end on a page (writesize) boundary,
+	   anything else fails with -EINVAL before the flash is touched.
+	*/
+	int (*read_sg) (struct mtd_info *mtd, loff_t from, struct scatterlist *sg, unsigned int nents, size_t *retlen);
+	int (*write_sg) (struct mtd_info *mtd, loff_t to, struct scatterlist *sg, unsigned int nents, size_t *retlen);
+
 	/* Sync */
 	void (*sync) (struct mtd_info *mtd);
 
@@ -232,6 +272,10 @@ struct mtd_info {
 
 	/* ECC status information */
 	struct mtd_ecc_stats ecc_stats;
+	/* I/O statistics, exported in sysfs */
+	struct mtd_stats stats;
+	/* Erases of each eraseblock since it was registered */
+	uint32_t *erase_count;
 	/* Subpage shift (NAND) */
 	int subpage_sft;
 
@@ -305,6 +349,13 @@ struct mtd_notifier {
 extern void register_mtd_user (struct mtd_notifier *new);
 extern int unregister_mtd_user (struct mtd_notifier *old);
 
+extern void mtd_stats_account(struct mtd_info *mtd, enum mtd_stats_op op,
+			      size_t bytes, int err, s64 us);
+extern void mtd_stats_ecc(struct mtd_info *mtd, unsigned int corrected,
+			  unsigned int failed);
+extern void mtd_stats_erase(struct mtd_info *mtd, uint64_t addr,
+			    uint64_t len);
+
 int default_mtd_writev(struct mtd_info *mtd, const struct kvec *vecs,
 		       unsigned long count, loff_t to, size_t *retlen);
 
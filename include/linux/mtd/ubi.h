@@ -22,6 +22,7 @@
 #define __LINUX_UBI_H__
 
 #include <asm/ioctl.h>
+#include <linux/errno.h>
 #include <linux/types.h>
 #include <mtd/ubi-user.h>
 
@@ -191,6 +192,15 @@ int ubi_leb_map(struct ubi_volume_desc *desc, int lnum, int dtype);
 int ubi_is_mapped(struct ubi_volume_desc *desc, int lnum);
 int ubi_sync(int ubi_num);
 
+#if defined(CONFIG_MTD_UBI) && !defined(MODULE)
+int ubi_attach_at_boot(const char *name, int vid_hdr_offs);
+#else
+static inline int ubi_attach_at_boot(const char *name, int vid_hdr_offs)
+{
+	return -ENODEV;
+}
+#endif
+
 /*
  * This function is the same as the 'ubi_leb_read()' function, but it does not
  * provide the checking capability.
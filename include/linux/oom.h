@@ -10,9 +10,31 @@
 #ifdef __KERNEL__
 
 #include <linux/types.h>
+#include <linux/list.h>
 
 struct zonelist;
 struct notifier_block;
+struct task_struct;
+
+/*
+ * Thread group leaders are kept on one list per oom_adj value, so that a
+ * killer can find the tasks with the highest oom_adj without walking every
+ * process. The lists are protected by tasklist_lock.
+ */
+#define OOM_ADJ_BUCKETS (OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+extern struct list_head oom_adj_buckets[OOM_ADJ_BUCKETS];
+
+static inline struct list_head *oom_adj_bucket(int oom_adj)
+{
+	return &oom_adj_buckets[oom_adj - OOM_DISABLE];
+}
+
+#define for_each_process_oom_adj(p, oom_adj) \
+	list_for_each_entry(p, oom_adj_bucket(oom_adj), oom_adj_node)
+
+extern void oom_adj_buckets_init(void);
+extern void oom_adj_bucket_update(struct task_struct *p);
 
 /*
  * Types of limitations to the nodes from which allocations may occur
@@ -30,6 +52,10 @@ extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask, int order);
 extern int register_oom_notifier(struct notifier_block *nb);
 extern int unregister_oom_notifier(struct notifier_block *nb);
 
+extern unsigned long lowmem_notify_pages;
+extern int register_lowmem_notifier(struct notifier_block *nb);
+extern int unregister_lowmem_notifier(struct notifier_block *nb);
+
 extern bool oom_killer_disabled;
 
 static inline void oom_killer_disable(void)
@@ -1266,6 +1266,7 @@ struct task_struct {
 #endif
 
 	struct list_head tasks;
+	struct list_head oom_adj_node;	/* oom_adj bucket, leaders only */
 	struct plist_node pushable_tasks;
 
 	struct mm_struct *mm, *active_mm;
@@ -27,17 +27,33 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/ashmem.h>
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/*
+ * ashmem_stats - purge and pin statistics, shared by all areas of one name
+ * Lifecycle: From the first mmap() of an area with this name, forever
+ * Locking: Protected by `ashmem_stats_lock'
+ */
+struct ashmem_stats {
+	struct list_head list;		/* entry in ashmem_stats_list */
+	unsigned long long purged;	/* bytes purged by the shrinker */
+	atomic_long_t pin_hits;		/* pins that found the pages intact */
+	atomic_long_t pin_misses;	/* pins that found them purged */
+	char name[ASHMEM_NAME_LEN];	/* area name, without the prefix */
+};
+
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
@@ -46,12 +62,17 @@ struct ashmem_area {
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	struct mutex mutex;		/* protects this area and its ranges */
+	struct ashmem_stats *stats;	/* statistics for this area's name */
+	struct task_struct *purger;	/* shrinker holding `mutex', if any */
+	struct list_head purge_list;	/* entry in the shrinker's batch */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'; the LRU entry and lru_count are
+ * protected by `ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
@@ -62,18 +83,34 @@ struct ashmem_range {
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and lru_count
+ *
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock, and
+ *		  asma->mutex -> i_mutex -> i_alloc_sem
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * The shrinker takes the area mutexes with mutex_trylock() while holding
+ * ashmem_lru_lock, skipping areas that are busy.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/* Statistics per area name, protected by ashmem_stats_lock */
+static LIST_HEAD(ashmem_stats_list);
+static DEFINE_SPINLOCK(ashmem_stats_lock);
+static int ashmem_stats_count;
+
+/* areas with names beyond this many share the "other" entry */
+#define ASHMEM_STATS_MAX	256
+static struct ashmem_stats ashmem_stats_other = {
+	.list = LIST_HEAD_INIT(ashmem_stats_other.list),
+	.name = "(other)",
+};
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -104,37 +141,36 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 static inline void lru_del(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_del(&range->lru);
 	lru_count -= range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /*
- * range_alloc - allocate and initialize a new ashmem_range structure
+ * range_alloc - initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
+ * 'range' - the new range, allocated by the caller before taking any lock
  * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
-		       size_t start, size_t end)
+static void range_alloc(struct ashmem_area *asma, struct ashmem_range *range,
+			struct ashmem_range *prev_range, unsigned int purged,
+			size_t start, size_t end)
 {
-	struct ashmem_range *range;
-
-	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
-	if (unlikely(!range))
-		return -ENOMEM;
-
 	range->asma = asma;
 	range->pgstart = start;
 	range->pgend = end;
@@ -144,8 +180,6 @@ static int range_alloc(struct ashmem_area *asma,
 
 	if (range_on_lru(range))
 		lru_add(range);
-
-	return 0;
 }
 
 static void range_del(struct ashmem_range *range)
@@ -159,7 +193,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +203,43 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
+}
+
+/*
+ * ashmem_get_stats - find or create the statistics for an area's name
+ */
+static struct ashmem_stats *ashmem_get_stats(struct ashmem_area *asma)
+{
+	const char *name = asma->name + ASHMEM_NAME_PREFIX_LEN;
+	struct ashmem_stats *stats, *new;
+
+	if (*name == '\0')
+		name = ASHMEM_NAME_DEF;
+
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock(&ashmem_stats_lock);
+	list_for_each_entry(stats, &ashmem_stats_list, list)
+		if (!strcmp(stats->name, name))
+			goto out;
+
+	stats = &ashmem_stats_other;
+	if (new && ashmem_stats_count < ASHMEM_STATS_MAX) {
+		strlcpy(new->name, name, sizeof(new->name));
+		list_add_tail(&new->list, &ashmem_stats_list);
+		ashmem_stats_count++;
+		stats = new;
+		new = NULL;
+	}
+out:
+	spin_unlock(&ashmem_stats_lock);
+	kfree(new);
+	return stats;
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -187,6 +256,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	INIT_LIST_HEAD(&asma->purge_list);
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -199,10 +270,10 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -216,7 +287,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -244,6 +315,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 			goto out;
 		}
 		asma->file = vmfile;
+		asma->stats = ashmem_get_stats(asma);
 	}
 	get_file(asma->file);
 
@@ -257,7 +329,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -272,13 +344,17 @@ out:
  * Return value is the number of objects (pages) remaining, or -1 if we cannot
  * proceed without risk of deadlock (due to gfp_mask).
  *
- * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
- * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * We approximate LRU via least-recently-unpinned. Ranges are taken off the
+ * LRU list in one pass until 'nr_to_scan' pages are collected, locking each
+ * area once, and are then purged together with only their areas locked.
+ * Areas whose lock is contended are skipped rather than waited on.
  */
 static int ashmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 {
 	struct ashmem_range *range, *next;
+	struct ashmem_area *asma, *asma_next;
+	LIST_HEAD(ranges);
+	LIST_HEAD(areas);
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (nr_to_scan && !(gfp_mask & __GFP_FS))
@@ -286,21 +362,45 @@ static int ashmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 	if (!nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
+	spin_lock(&ashmem_lru_lock);
 	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+		asma = range->asma;
+		if (asma->purger != current) {
+			if (!mutex_trylock(&asma->mutex))
+				continue;
+			asma->purger = current;
+			list_add_tail(&asma->purge_list, &areas);
+		}
 
-		vmtruncate_range(inode, start, end);
 		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		list_move_tail(&range->lru, &ranges);
+		lru_count -= range_size(range);
 
 		nr_to_scan -= range_size(range);
 		if (nr_to_scan <= 0)
 			break;
 	}
-	mutex_unlock(&ashmem_mutex);
+	spin_unlock(&ashmem_lru_lock);
+
+	list_for_each_entry_safe(range, next, &ranges, lru) {
+		struct inode *inode = range->asma->file->f_dentry->d_inode;
+		loff_t start = range->pgstart * PAGE_SIZE;
+		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+		vmtruncate_range(inode, start, end);
+
+		list_del_init(&range->lru);
+
+		spin_lock(&ashmem_stats_lock);
+		range->asma->stats->purged += range_size(range) * PAGE_SIZE;
+		spin_unlock(&ashmem_stats_lock);
+	}
+
+	list_for_each_entry_safe(asma, asma_next, &areas, purge_list) {
+		list_del_init(&asma->purge_list);
+		asma->purger = NULL;
+		mutex_unlock(&asma->mutex);
+	}
 
 	return lru_count;
 }
@@ -314,7 +414,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -329,7 +429,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -337,7 +437,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -351,7 +451,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -360,7 +460,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -377,18 +477,43 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
 
+/*
+ * ashmem_pin_splits - returns nonzero if pinning the given interval would
+ * punch a hole in an unpinned range, which is the only case in which
+ * ashmem_pin() needs a new range.
+ *
+ * Caller must hold asma->mutex.
+ */
+static int ashmem_pin_splits(struct ashmem_area *asma, size_t pgstart,
+			     size_t pgend)
+{
+	struct ashmem_range *range;
+
+	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+		if (range_before_page(range, pgstart))
+			break;
+		if (range->pgstart < pgstart && range->pgend > pgend)
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * If a range has to be split, '*new' is consumed and set to NULL.
+ *
+ * Caller must hold asma->mutex.
  */
-static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
+static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend,
+		      struct ashmem_range **new)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
@@ -439,8 +564,9 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			 * more complicated, we allocate a new range for the
 			 * second half and adjust the first chunk's endpoint.
 			 */
-			range_alloc(asma, range, range->purged,
+			range_alloc(asma, *new, range, range->purged,
 				    pgend + 1, range->pgend);
+			*new = NULL;
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -452,9 +578,12 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Unless the pages are already unpinned, '*new' is consumed and set to NULL.
+ *
+ * Caller must hold asma->mutex.
  */
-static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
+static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend,
+			struct ashmem_range **new)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
@@ -480,14 +609,17 @@ restart:
 		}
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	range_alloc(asma, *new, range, purged, pgstart, pgend);
+	*new = NULL;
+
+	return 0;
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -510,6 +642,7 @@ static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 			    void __user *p)
 {
+	struct ashmem_range *new = NULL;
 	struct ashmem_pin pin;
 	size_t pgstart, pgend;
 	int ret = -EINVAL;
@@ -536,21 +669,48 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	/*
+	 * Ranges are allocated before taking the area lock, so that reclaim
+	 * from the allocation can purge this area too. Unpinning almost
+	 * always needs one; pinning only when it splits an unpinned range,
+	 * so the common case of pinning pinned pages allocates nothing.
+	 */
+	if (cmd == ASHMEM_UNPIN) {
+		new = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
+		if (unlikely(!new))
+			return -ENOMEM;
+	}
+
+retry:
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
-		ret = ashmem_pin(asma, pgstart, pgend);
+		if (!new && ashmem_pin_splits(asma, pgstart, pgend)) {
+			mutex_unlock(&asma->mutex);
+			new = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
+			if (unlikely(!new))
+				return -ENOMEM;
+			goto retry;
+		}
+		ret = ashmem_pin(asma, pgstart, pgend, &new);
+		if (ret == ASHMEM_NOT_PURGED)
+			atomic_long_inc(&asma->stats->pin_hits);
+		else
+			atomic_long_inc(&asma->stats->pin_misses);
 		break;
 	case ASHMEM_UNPIN:
-		ret = ashmem_unpin(asma, pgstart, pgend);
+		ret = ashmem_unpin(asma, pgstart, pgend, &new);
 		break;
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_get_pin_status(asma, pgstart, pgend);
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+
+	if (new)
+		kmem_cache_free(ashmem_range_cachep, new);
 
 	return ret;
 }
@@ -609,6 +769,43 @@ static struct file_operations ashmem_fops = {
 	.compat_ioctl = ashmem_ioctl,
 };
 
+static void ashmem_stats_show_one(struct seq_file *m, struct ashmem_stats *st)
+{
+	seq_printf(m, "%-32s %12llu %10lu %10lu\n", st->name, st->purged,
+		   atomic_long_read(&st->pin_hits),
+		   atomic_long_read(&st->pin_misses));
+}
+
+static int ashmem_stats_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_stats *stats;
+
+	seq_printf(m, "%-32s %12s %10s %10s\n", "name", "purged",
+		   "pin_hits", "pin_misses");
+
+	spin_lock(&ashmem_stats_lock);
+	list_for_each_entry(stats, &ashmem_stats_list, list)
+		ashmem_stats_show_one(m, stats);
+	ashmem_stats_show_one(m, &ashmem_stats_other);
+	spin_unlock(&ashmem_stats_lock);
+
+	return 0;
+}
+
+static int ashmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_stats_show, NULL);
+}
+
+static const struct file_operations ashmem_stats_fops = {
+	.open = ashmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *ashmem_debugfs;
+
 static struct miscdevice ashmem_misc = {
 	.minor = MISC_DYNAMIC_MINOR,
 	.name = "ashmem",
@@ -643,6 +840,9 @@ static int __init ashmem_init(void)
 
 	register_shrinker(&ashmem_shrinker);
 
+	ashmem_debugfs = debugfs_create_file("ashmem_stats", S_IRUGO, NULL,
+					     NULL, &ashmem_stats_fops);
+
 	printk(KERN_INFO "ashmem: initialized\n");
 
 	return 0;
@@ -652,6 +852,7 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	debugfs_remove(ashmem_debugfs);
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);
@@ -661,6 +862,15 @@ static void __exit ashmem_exit(void)
 	kmem_cache_destroy(ashmem_range_cachep);
 	kmem_cache_destroy(ashmem_area_cachep);
 
+	while (!list_empty(&ashmem_stats_list)) {
+		struct ashmem_stats *stats;
+
+		stats = list_first_entry(&ashmem_stats_list,
+					 struct ashmem_stats, list);
+		list_del(&stats->list);
+		kfree(stats);
+	}
+
 	printk(KERN_INFO "ashmem: unloaded\n");
 }
 
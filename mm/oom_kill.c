@@ -34,6 +34,35 @@ int sysctl_oom_dump_tasks;
 static DEFINE_SPINLOCK(zone_scan_lock);
 /* #define DEBUG */
 
+struct list_head oom_adj_buckets[OOM_ADJ_BUCKETS];
+EXPORT_SYMBOL_GPL(oom_adj_buckets);
+
+void __init oom_adj_buckets_init(void)
+{
+	int i;
+
+	for (i = 0; i < OOM_ADJ_BUCKETS; i++)
+		INIT_LIST_HEAD(&oom_adj_buckets[i]);
+}
+
+/**
+ * oom_adj_bucket_update() - refile a thread group after an oom_adj change
+ * @p: any thread of the group
+ *
+ * Must be called without siglock held, after signal->oom_adj was written.
+ */
+void oom_adj_bucket_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	write_lock_irq(&tasklist_lock);
+	leader = p->group_leader;
+	if (!list_empty(&leader->oom_adj_node))
+		list_move_tail(&leader->oom_adj_node,
+			       oom_adj_bucket(leader->signal->oom_adj));
+	write_unlock_irq(&tasklist_lock);
+}
+
 /*
  * Is all threads of the target process nodes overlap ours?
  */
@@ -75,6 +75,26 @@ unsigned long totalreserve_pages __read_mostly;
 int percpu_pagelist_fraction;
 gfp_t gfp_allowed_mask __read_mostly = GFP_BOOT_MASK;
 
+/*
+ * Allocations that leave fewer than lowmem_notify_pages free pages call
+ * the lowmem notifiers, so memory pressure can be reported before reclaim
+ * has to step in. Zero disables the check.
+ */
+unsigned long lowmem_notify_pages __read_mostly;
+static ATOMIC_NOTIFIER_HEAD(lowmem_notify_chain);
+
+int register_lowmem_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&lowmem_notify_chain, nb);
+}
+EXPORT_SYMBOL_GPL(register_lowmem_notifier);
+
+int unregister_lowmem_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&lowmem_notify_chain, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_lowmem_notifier);
+
 #ifdef CONFIG_HUGETLB_PAGE_SIZE_VARIABLE
 int pageblock_order __read_mostly;
 #endif
@@ -1595,6 +1615,9 @@ try_next_zone:
 		zlc_active = 0;
 		goto zonelist_scan;
 	}
+	if (page && unlikely(lowmem_notify_pages) &&
+	    global_page_state(NR_FREE_PAGES) < lowmem_notify_pages)
+		atomic_notifier_call_chain(&lowmem_notify_chain, order, NULL);
 	return page;
 }
 
@@ -0,0 +1,482 @@
+/*
+ * tools/binder/binder_pingpong.c
+ *
+ * Round trip throughput of /dev/binder with several independent process
+ * pairs. Each pair is a client process calling a server process in a loop.
+ * The test first runs one pair alone, then all pairs at once, and reports
+ * the rate per pair against the single pair baseline. If the driver
+ * serializes unrelated processes, that rate drops as pairs are added.
+ *
+ * The test becomes the context manager, so servicemanager must not be
+ * running:
+ *
+ *	stop; stop servicemanager
+ *	binder_pingpong -p 4 -n 100000
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_SIZE	4096
+
+enum {
+	CODE_REGISTER = 1,	/* server -> manager: here is pair i's node */
+	CODE_LOOKUP,		/* client -> manager: give me pair i's node */
+	CODE_PING,		/* client -> server */
+	CODE_QUIT,		/* client -> server */
+};
+
+struct register_msg {
+	struct flat_binder_object obj;
+	uint32_t index;
+};
+
+struct result {
+	unsigned long calls;
+	unsigned long errors;
+	uint64_t ns;
+};
+
+struct bs {
+	int fd;
+	void *map;
+	uint32_t out[64];
+	size_t out_len;
+	uint32_t in[256];
+	size_t in_pos;
+	size_t in_end;
+};
+
+static int pairs = 4;
+static unsigned long iterations = 100000;
+static size_t size = 32;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bs_open(struct bs *bs)
+{
+	memset(bs, 0, sizeof(*bs));
+	bs->fd = open("/dev/binder", O_RDWR);
+	if (bs->fd < 0) {
+		perror("binder_pingpong: open /dev/binder");
+		return -1;
+	}
+	bs->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bs->fd, 0);
+	if (bs->map == MAP_FAILED) {
+		perror("binder_pingpong: mmap /dev/binder");
+		close(bs->fd);
+		return -1;
+	}
+	return 0;
+}
+
+static void bs_close(struct bs *bs)
+{
+	munmap(bs->map, MAP_SIZE);
+	close(bs->fd);
+}
+
+static void put_cmd(struct bs *bs, uint32_t cmd, const void *arg, size_t len)
+{
+	char *p = (char *)bs->out + bs->out_len;
+
+	memcpy(p, &cmd, sizeof(cmd));
+	if (len)
+		memcpy(p + sizeof(cmd), arg, len);
+	bs->out_len += sizeof(cmd) + len;
+}
+
+static void put_u32(struct bs *bs, uint32_t cmd, uint32_t arg)
+{
+	put_cmd(bs, cmd, &arg, sizeof(arg));
+}
+
+static void put_ptr(struct bs *bs, uint32_t cmd, const void *arg)
+{
+	put_cmd(bs, cmd, &arg, sizeof(arg));
+}
+
+static void put_txn(struct bs *bs, uint32_t cmd, size_t handle, uint32_t code,
+		    const void *data, size_t data_size,
+		    const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = data_size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put_cmd(bs, cmd, &tr, sizeof(tr));
+}
+
+/* Sends what is queued, then reads until there are returns to parse */
+static int bs_flush(struct bs *bs, int read)
+{
+	struct binder_write_read bwr;
+
+	for (;;) {
+		bwr.write_size = bs->out_len;
+		bwr.write_consumed = 0;
+		bwr.write_buffer = (unsigned long)bs->out;
+		bwr.read_size = read ? sizeof(bs->in) : 0;
+		bwr.read_consumed = 0;
+		bwr.read_buffer = (unsigned long)bs->in;
+		if (ioctl(bs->fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("binder_pingpong: BINDER_WRITE_READ");
+			return -1;
+		}
+		bs->out_len = 0;
+		if (!read || bwr.read_consumed)
+			break;
+	}
+	bs->in_pos = 0;
+	bs->in_end = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Returns the next BR_TRANSACTION or BR_REPLY in *tr, answering the
+ * refcount requests on the way. Any other failure returns -1.
+ */
+static int bs_next(struct bs *bs, struct binder_transaction_data *tr)
+{
+	for (;;) {
+		char *p = (char *)bs->in + bs->in_pos;
+		uint32_t cmd;
+
+		if (bs->in_pos >= bs->in_end) {
+			if (bs_flush(bs, 1))
+				return -1;
+			continue;
+		}
+		memcpy(&cmd, p, sizeof(cmd));
+		p += sizeof(cmd);
+		bs->in_pos += sizeof(cmd) + _IOC_SIZE(cmd);
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+		case BR_RELEASE:
+		case BR_DECREFS:
+			break;
+		case BR_INCREFS:
+		case BR_ACQUIRE:
+			put_cmd(bs, cmd == BR_INCREFS ? BC_INCREFS_DONE :
+				BC_ACQUIRE_DONE, p, sizeof(struct binder_ptr_cookie));
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			memcpy(tr, p, sizeof(*tr));
+			return cmd;
+		default:
+			fprintf(stderr, "binder_pingpong: %d: unexpected "
+				"return 0x%x\n", getpid(), cmd);
+			return -1;
+		}
+	}
+}
+
+/* Sends a call and waits for its reply */
+static int bs_call(struct bs *bs, size_t handle, uint32_t code,
+		   const void *data, size_t data_size,
+		   const size_t *offsets, size_t offsets_size,
+		   struct binder_transaction_data *reply)
+{
+	put_txn(bs, BC_TRANSACTION, handle, code, data, data_size,
+		offsets, offsets_size);
+	if (bs_flush(bs, 1))
+		return -1;
+	return bs_next(bs, reply) == BR_REPLY ? 0 : -1;
+}
+
+static void bs_reply(struct bs *bs, const struct binder_transaction_data *tr,
+		     const void *data, size_t data_size,
+		     const size_t *offsets, size_t offsets_size)
+{
+	put_txn(bs, BC_REPLY, 0, 0, data, data_size, offsets, offsets_size);
+	put_ptr(bs, BC_FREE_BUFFER, tr->data.ptr.buffer);
+}
+
+static void server(int index)
+{
+	struct register_msg msg;
+	struct binder_transaction_data tr;
+	size_t offset = 0;
+	struct bs bs;
+
+	if (bs_open(&bs))
+		exit(1);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.obj.type = BINDER_TYPE_BINDER;
+	msg.obj.binder = (void *)(unsigned long)(index + 1);
+	msg.index = index;
+	if (bs_call(&bs, 0, CODE_REGISTER, &msg, sizeof(msg), &offset,
+		    sizeof(offset), &tr))
+		exit(1);
+	put_ptr(&bs, BC_FREE_BUFFER, tr.data.ptr.buffer);
+
+	put_cmd(&bs, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (bs_next(&bs, &tr) != BR_TRANSACTION)
+			exit(1);
+		/* the reply echoes the call's payload back */
+		bs_reply(&bs, &tr, tr.data.ptr.buffer, tr.data_size, NULL, 0);
+		if (tr.code == CODE_QUIT)
+			break;
+	}
+	bs_flush(&bs, 0);
+	bs_close(&bs);
+	exit(0);
+}
+
+static void client(int index, int go_fd, int result_fd)
+{
+	struct binder_transaction_data tr;
+	struct flat_binder_object obj;
+	struct result res;
+	uint32_t handle, idx = index;
+	char buf[MAX_SIZE];
+	unsigned long i;
+	struct bs bs;
+	uint64_t start;
+
+	if (bs_open(&bs))
+		exit(1);
+
+	/* the server may not have registered yet */
+	for (;;) {
+		if (bs_call(&bs, 0, CODE_LOOKUP, &idx, sizeof(idx), NULL, 0,
+			    &tr))
+			exit(1);
+		if (tr.offsets_size)
+			break;
+		put_ptr(&bs, BC_FREE_BUFFER, tr.data.ptr.buffer);
+		usleep(1000);
+	}
+	memcpy(&obj, tr.data.ptr.buffer, sizeof(obj));
+	handle = obj.handle;
+	put_u32(&bs, BC_ACQUIRE, handle);
+	put_ptr(&bs, BC_FREE_BUFFER, tr.data.ptr.buffer);
+	if (bs_flush(&bs, 0))
+		exit(1);
+
+	/* all clients start together once the manager closes the pipe */
+	if (read(go_fd, buf, 1) < 0)
+		exit(1);
+
+	memset(buf, index, size);
+	memset(&res, 0, sizeof(res));
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memcpy(buf, &i, sizeof(i) < size ? sizeof(i) : size);
+		if (bs_call(&bs, handle, CODE_PING, buf, size, NULL, 0, &tr))
+			exit(1);
+		if (tr.data_size != size ||
+		    memcmp(tr.data.ptr.buffer, buf, size))
+			res.errors++;
+		put_ptr(&bs, BC_FREE_BUFFER, tr.data.ptr.buffer);
+		res.calls++;
+	}
+	res.ns = now_ns() - start;
+
+	if (bs_call(&bs, handle, CODE_QUIT, buf, size, NULL, 0, &tr))
+		exit(1);
+	put_ptr(&bs, BC_FREE_BUFFER, tr.data.ptr.buffer);
+	bs_flush(&bs, 0);
+	bs_close(&bs);
+	exit(write(result_fd, &res, sizeof(res)) != sizeof(res));
+}
+
+/*
+ * Hands the servers' nodes to their clients, then starts the clients and
+ * collects their results. Returns the total round trips per second.
+ */
+static double run(struct bs *mgr, int n)
+{
+	uint32_t handles[MAX_PAIRS];
+	struct binder_transaction_data tr;
+	int go[2], results[2];
+	int looked_up = 0;
+	double rate = 0;
+	unsigned long errors = 0;
+	uint64_t ns = 0;
+	int i, status, failed = 0;
+
+	if (pipe(go) || pipe(results)) {
+		perror("binder_pingpong: pipe");
+		exit(1);
+	}
+	memset(handles, 0, sizeof(handles));
+
+	for (i = 0; i < 2 * n; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("binder_pingpong: fork");
+			exit(1);
+		}
+		if (pid)
+			continue;
+		/* the child needs a binder proc of its own */
+		close(mgr->fd);
+		close(go[1]);
+		close(results[0]);
+		if (i < n)
+			server(i);
+		client(i - n, go[0], results[1]);
+	}
+	close(go[0]);
+	close(results[1]);
+
+	while (looked_up < n) {
+		struct register_msg msg;
+		size_t offset = 0;
+		uint32_t index;
+		int32_t status;
+
+		if (bs_next(mgr, &tr) != BR_TRANSACTION)
+			exit(1);
+		memcpy(&index, (char *)tr.data.ptr.buffer +
+		       (tr.code == CODE_REGISTER ?
+			offsetof(struct register_msg, index) : 0),
+		       sizeof(index));
+		if (index >= n)
+			exit(1);
+		if (tr.code == CODE_REGISTER) {
+			memcpy(&msg, tr.data.ptr.buffer, sizeof(msg));
+			handles[index] = msg.obj.handle;
+			/* keep the node once the buffer holding it is freed */
+			put_u32(mgr, BC_ACQUIRE, handles[index]);
+			status = 0;
+			bs_reply(mgr, &tr, &status, sizeof(status), NULL, 0);
+		} else if (handles[index]) {
+			memset(&msg, 0, sizeof(msg));
+			msg.obj.type = BINDER_TYPE_HANDLE;
+			msg.obj.handle = handles[index];
+			bs_reply(mgr, &tr, &msg.obj, sizeof(msg.obj), &offset,
+				 sizeof(offset));
+			looked_up++;
+		} else {
+			/* not registered yet, the client asks again */
+			status = -1;
+			bs_reply(mgr, &tr, &status, sizeof(status), NULL, 0);
+		}
+		if (bs_flush(mgr, 0))
+			exit(1);
+	}
+	close(go[1]);
+
+	for (i = 0; i < n; i++) {
+		struct result res;
+
+		if (read(results[0], &res, sizeof(res)) != sizeof(res))
+			break;
+		if (res.ns)
+			rate += res.calls * 1e9 / res.ns;
+		errors += res.errors;
+		ns += res.ns;
+	}
+	close(results[0]);
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+
+	if (i < n || failed) {
+		fprintf(stderr, "binder_pingpong: %d of %d processes failed\n",
+			failed, 2 * n);
+		exit(1);
+	}
+	if (errors)
+		fprintf(stderr, "binder_pingpong: %lu replies did not match\n",
+			errors);
+	printf("binder_pingpong: %d pair%s: %.0f round trips/s, "
+	       "%.0f per pair, %.1f us per round trip\n", n, n > 1 ? "s" : "",
+	       rate, rate / n, ns / 1000.0 / n / iterations);
+	return rate;
+}
+
+int main(int argc, char **argv)
+{
+	double base, rate;
+	struct bs mgr;
+	int c;
+
+	while ((c = getopt(argc, argv, "p:n:s:")) != -1) {
+		switch (c) {
+		case 'p':
+			pairs = atoi(optarg);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: binder_pingpong [-p pairs] "
+				"[-n iterations] [-s size]\n");
+			return 2;
+		}
+	}
+	if (pairs < 1 || pairs > MAX_PAIRS || !iterations ||
+	    size < sizeof(uint32_t) || size > MAX_SIZE) {
+		fprintf(stderr, "binder_pingpong: pairs 1..%d, size %zu..%d\n",
+			MAX_PAIRS, sizeof(uint32_t), MAX_SIZE);
+		return 2;
+	}
+
+	if (bs_open(&mgr))
+		return 1;
+	if (ioctl(mgr.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("binder_pingpong: BINDER_SET_CONTEXT_MGR "
+		       "(is servicemanager running?)");
+		return 1;
+	}
+	put_cmd(&mgr, BC_ENTER_LOOPER, NULL, 0);
+
+	base = run(&mgr, 1);
+	if (pairs > 1) {
+		rate = run(&mgr, pairs);
+		printf("binder_pingpong: %d pairs run at %.0f%% of the "
+		       "1 pair rate each\n", pairs, rate / pairs * 100 / base);
+	}
+	bs_close(&mgr);
+	return 0;
+}
@@ -0,0 +1 @@
+#include "xdr_shim.h"
@@ -0,0 +1,246 @@
+/*
+ * tools/msm_rpc_xdr/xdr_desc_test.c
+ *
+ * Checks xdr_send_desc() and xdr_recv_desc() from
+ * arch/arm/mach-msm/smd_rpcrouter_xdr.c against the cpu_to_be32() hand
+ * encodings that the descriptor-driven clients used before.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "xdr_shim.h"
+#include <mach/msm_rpcrouter.h>
+
+/* smd_rpcrouter_xdr.c calls these from code the tests don't run */
+void msm_rpc_setup_req(struct rpc_request_hdr *hdr, uint32_t prog,
+		       uint32_t vers, uint32_t proc)
+{
+	memset(hdr, 0, sizeof(*hdr));
+}
+
+int msm_rpc_write(struct msm_rpc_endpoint *ept, void *data, int len)
+{
+	return len;
+}
+
+int xdr_shim_verbose;
+static int failures;
+
+#define CHECK(cond, fmt, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL %s:%d: " fmt "\n",	\
+				__func__, __LINE__, ##__VA_ARGS__);	\
+			failures++;					\
+		}							\
+	} while (0)
+
+static void xdr_out(struct msm_rpc_xdr *xdr, void *buf, uint32_t size)
+{
+	memset(xdr, 0, sizeof(*xdr));
+	xdr->out_buf = buf;
+	xdr->out_size = size;
+}
+
+static void xdr_in(struct msm_rpc_xdr *xdr, void *buf, uint32_t size)
+{
+	memset(xdr, 0, sizeof(*xdr));
+	xdr->in_buf = buf;
+	xdr->in_size = size;
+}
+
+/* rpc_hsusb.c: the calls that take or return one word */
+struct hsusb_rpc_word {
+	uint32_t value;
+};
+
+MSM_RPC_XDR_DESC(hsusb_rpc_word_desc,
+	MSM_RPC_XDR_UINT_FIELD(struct hsusb_rpc_word, value));
+
+static const uint32_t words[] = {
+	0, 1, 0x7f, 0x80, 0xff, 0x1234, 0x12345678, 0x80000000, 0xffffffff,
+};
+
+static void test_hsusb_word(void)
+{
+	struct hsusb_rpc_word arg, rep;
+	struct msm_rpc_xdr xdr;
+	uint32_t by_hand, by_desc;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(words); i++) {
+		/* was: req.product_id = cpu_to_be32(product_id); */
+		by_hand = cpu_to_be32(words[i]);
+
+		arg.value = words[i];
+		xdr_out(&xdr, &by_desc, sizeof(by_desc));
+		CHECK(!xdr_send_desc(&xdr, &hsusb_rpc_word_desc, &arg) &&
+		      xdr.out_index == sizeof(by_hand) &&
+		      by_desc == by_hand, "send 0x%08x", words[i]);
+
+		/* was: return be32_to_cpu(rep.rework); */
+		rep.value = ~words[i];
+		xdr_in(&xdr, &by_hand, sizeof(by_hand));
+		CHECK(!xdr_recv_desc(&xdr, &hsusb_rpc_word_desc, &rep) &&
+		      xdr.in_index == sizeof(by_hand) &&
+		      rep.value == be32_to_cpu(by_hand),
+		      "recv 0x%08x", words[i]);
+	}
+}
+
+/* every field type, as rpcrouter_loopback_bench uses them */
+struct mixed_args {
+	uint32_t seq;
+	int16_t level;
+	int8_t delta;
+	uint8_t flags;
+	unsigned char tag[6];
+	void *name;
+	uint32_t name_len;
+};
+
+MSM_RPC_XDR_DESC(mixed_args_desc,
+	MSM_RPC_XDR_UINT_FIELD(struct mixed_args, seq),
+	MSM_RPC_XDR_INT_FIELD(struct mixed_args, level),
+	MSM_RPC_XDR_INT_FIELD(struct mixed_args, delta),
+	MSM_RPC_XDR_UINT_FIELD(struct mixed_args, flags),
+	MSM_RPC_XDR_OPAQUE_FIELD(struct mixed_args, tag),
+	MSM_RPC_XDR_BYTES_FIELD(struct mixed_args, name, name_len));
+
+static char name[] = "xdr_desc_test";
+
+static int encode_by_hand(const struct mixed_args *a, void *buf)
+{
+	uint32_t *p = buf;
+
+	*p++ = cpu_to_be32(a->seq);
+	*p++ = cpu_to_be32((int32_t)a->level);
+	*p++ = cpu_to_be32((int32_t)a->delta);
+	*p++ = cpu_to_be32(a->flags);
+	memset(p, 0, 8);
+	memcpy(p, a->tag, sizeof(a->tag));
+	p += 2;
+	*p++ = cpu_to_be32(a->name_len);
+	memset(p, 0, ALIGN(a->name_len, 4));
+	memcpy(p, a->name, a->name_len);
+	return (void *)p + ALIGN(a->name_len, 4) - buf;
+}
+
+static void fill_args(struct mixed_args *a, uint32_t seq)
+{
+	a->seq = seq * 0x01010101;
+	a->level = seq & 1 ? -(int16_t)seq : 0x7fff - seq;
+	a->delta = seq & 2 ? -128 + seq : 127 - seq;
+	a->flags = 0xff - seq;
+	memset(a->tag, 0xa0 + seq, sizeof(a->tag));
+	a->name = name;
+	a->name_len = seq % sizeof(name);
+}
+
+static void test_mixed_send(void)
+{
+	unsigned char by_hand[64], by_desc[64];
+	struct mixed_args a;
+	struct msm_rpc_xdr xdr;
+	uint32_t seq;
+	int len;
+
+	for (seq = 0; seq < 2 * sizeof(name); seq++) {
+		fill_args(&a, seq);
+		len = encode_by_hand(&a, by_hand);
+		memset(by_desc, 0x5a, sizeof(by_desc));
+		xdr_out(&xdr, by_desc, sizeof(by_desc));
+		CHECK(!xdr_send_desc(&xdr, &mixed_args_desc, &a) &&
+		      xdr.out_index == len && !memcmp(by_hand, by_desc, len),
+		      "seq %u, name_len %u", seq, a.name_len);
+	}
+}
+
+static void test_mixed_recv(void)
+{
+	unsigned char by_hand[64], room[sizeof(name)];
+	struct mixed_args a, b;
+	struct msm_rpc_xdr xdr;
+	uint32_t seq;
+	int len;
+
+	for (seq = 0; seq < 2 * sizeof(name); seq++) {
+		fill_args(&a, seq);
+		len = encode_by_hand(&a, by_hand);
+
+		memset(&b, 0, sizeof(b));
+		memset(room, 0, sizeof(room));
+		b.name = room;
+		b.name_len = sizeof(room);
+		xdr_in(&xdr, by_hand, len);
+		CHECK(!xdr_recv_desc(&xdr, &mixed_args_desc, &b) &&
+		      xdr.in_index == len &&
+		      b.seq == a.seq && b.level == a.level &&
+		      b.delta == a.delta && b.flags == a.flags &&
+		      !memcmp(b.tag, a.tag, sizeof(a.tag)) &&
+		      b.name_len == a.name_len &&
+		      !memcmp(room, a.name, a.name_len),
+		      "seq %u, name_len %u", seq, a.name_len);
+
+		/* a name that doesn't fit the room given is refused */
+		if (!a.name_len)
+			continue;
+		b.name = room;
+		b.name_len = a.name_len - 1;
+		xdr_in(&xdr, by_hand, len);
+		CHECK(xdr_recv_desc(&xdr, &mixed_args_desc, &b),
+		      "seq %u, %u bytes into %u", seq, a.name_len,
+		      a.name_len - 1);
+	}
+}
+
+/* short buffers fail without writing or reading past their end */
+static void test_short_buffers(void)
+{
+	unsigned char by_hand[64], by_desc[64 + 4], room[sizeof(name)];
+	struct mixed_args a, b;
+	struct msm_rpc_xdr xdr;
+	int len, size;
+
+	fill_args(&a, 5);
+	len = encode_by_hand(&a, by_hand);
+	for (size = 0; size < len; size += 4) {
+		memset(by_desc, 0x5a, sizeof(by_desc));
+		xdr_out(&xdr, by_desc, size);
+		CHECK(xdr_send_desc(&xdr, &mixed_args_desc, &a) &&
+		      xdr.out_index <= size && by_desc[size] == 0x5a,
+		      "send into %d of %d bytes", size, len);
+
+		b.name = room;
+		b.name_len = sizeof(room);
+		xdr_in(&xdr, by_hand, size);
+		CHECK(xdr_recv_desc(&xdr, &mixed_args_desc, &b) &&
+		      xdr.in_index <= size,
+		      "recv from %d of %d bytes", size, len);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "-v"))
+		xdr_shim_verbose = 1;
+
+	test_hsusb_word();
+	test_mixed_send();
+	test_mixed_recv();
+	test_short_buffers();
+
+	if (failures) {
+		printf("xdr_desc_test: %d checks failed\n", failures);
+		return 1;
+	}
+	printf("xdr_desc_test: descriptor and hand encodings match\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * tools/msm_rpc_xdr/xdr_shim.h
+ *
+ * Just enough of the kernel API for smd_rpcrouter_xdr.c and
+ * <mach/msm_rpcrouter.h> to build as a host program.  The linux/
+ * headers they include are all redirected here.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _MSM_RPC_XDR_SHIM_H
+#define _MSM_RPC_XDR_SHIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define cpu_to_be32(x)	((uint32_t)(x))
+#else
+#define cpu_to_be32(x)	__builtin_bswap32((uint32_t)(x))
+#endif
+#define be32_to_cpu(x)	cpu_to_be32(x)
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+#define BUILD_BUG_ON_ZERO(e)	(sizeof(struct { int:-!!(e); }))
+
+/* the walker's own complaints are expected by the failure cases */
+extern int xdr_shim_verbose;
+#define pr_err(fmt, ...) \
+	do { \
+		if (xdr_shim_verbose) \
+			fprintf(stderr, fmt, ##__VA_ARGS__); \
+	} while (0)
+#define pr_info(fmt, ...)	pr_err(fmt, ##__VA_ARGS__)
+#define EXPORT_SYMBOL(sym)
+
+#define GFP_KERNEL	0
+#define kmalloc(size, flags)	malloc(size)
+#define kfree(p)		free(p)
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct mutex {
+	int locked;
+};
+
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_lock(m)		((m)->locked = 1)
+#define mutex_unlock(m)		((m)->locked = 0)
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(q)	do { } while (0)
+#define wait_event(q, cond)	do { } while (!(cond))
+#define wake_up(q)		do { } while (0)
+
+typedef struct {
+	int counter;
+} atomic_t;
+
+struct completion {
+	unsigned int done;
+};
+
+struct device {
+	void *platform_data;
+};
+
+struct platform_device {
+	const char *name;
+	int id;
+	struct device dev;
+};
+
+#endif